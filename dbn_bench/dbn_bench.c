@@ -0,0 +1,579 @@
+/**
+ * @file dbn_bench.c
+ * @brief Benchmark decode and dispatch offline, with synthetic DBN streams
+ * @author Nathan Blythe
+ * @copyright Copyright 2025 Nathan Blythe
+ * @copyright Released under the Apache-2.0 license, see LICENSE
+ *
+ * See README.md for details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <pthread.h>
+
+#include <dbn.h>
+
+
+/**
+ * @brief Show usage and exit.
+ *
+ * @param exit_code Exit code with which to call exit().
+ *
+ * Does not return.
+ */
+static void usage(int exit_code)
+{
+  printf("Usage: dbn_bench [-n <count>] [-i <passes>] [-p <percent>] [-v <percent>] [-x <percent>] [-w <bytes>] [-m <mode>] [-b <bytes>] [-s <seed>] [-B] [-h]\n");
+  printf("\n");
+  printf("Options:\n");
+  printf("   -n <count>     Messages per pass of the synthetic stream (default 1000000)\n");
+  printf("   -i <passes>    Number of times the stream is sent (default 20)\n");
+  printf("   -p <percent>   Percentage of quote messages that are BBO rather than CMBP-1 (default 50)\n");
+  printf("   -v <percent>   Percentage of messages that are variable-length system messages (default 1)\n");
+  printf("   -x <percent>   Percentage of writes that end partway through a message (default 10)\n");
+  printf("   -w <bytes>     Mean write size (default 65536)\n");
+  printf("   -m <mode>      Receive mode: double, multishot or mirror (default double)\n");
+  printf("   -b <bytes>     Local receive buffer size (default 4194304)\n");
+  printf("   -s <seed>      Random seed (default 1)\n");
+  printf("   -B             Dispatch with a batch handler instead of per-rtype message handlers\n");
+  printf("   -h             Show this usage information and exit\n");
+  printf("\n");
+  printf("Example: dbn_bench -n 1000000 -i 50 -x 25 -m mirror\n");
+  exit(exit_code);
+}
+
+
+/**
+ * @brief Synthetic stream writer thread argument.
+ */
+typedef struct
+{
+  int fd;             ///< @brief Socket to write to
+  uint8_t *stream;    ///< @brief Synthetic stream, one pass
+  size_t *writes;     ///< @brief End offset of each write within one pass
+  int num_writes;     ///< @brief Number of writes per pass
+  int num_passes;     ///< @brief Number of passes
+} writer_arg_t;
+
+
+/*
+ * Statistics collected while running.
+ */
+static uint64_t num_cmbp1 = 0;
+static uint64_t num_bbo = 0;
+static uint64_t num_smsg = 0;
+static uint64_t num_msgs = 0;
+static uint64_t checksum = 0;
+
+
+/**
+ * @brief Random number state.
+ */
+static uint64_t rng = 1;
+
+
+/**
+ * @brief Get a pseudorandom number (xorshift64), reproducible for a given seed.
+ */
+static inline uint64_t rand64()
+{
+  rng ^= rng << 13;
+  rng ^= rng >> 7;
+  rng ^= rng << 17;
+  return rng;
+}
+
+
+/**
+ * @brief Get current time in Unix nanoseconds.
+ */
+static inline uint64_t nanotime()
+{
+  struct timespec ts;
+  if (clock_gettime(CLOCK_REALTIME, &ts) == -1)
+  {
+    perror("clock_gettime");
+    abort();
+  }
+  return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+
+/**
+ * @brief Get nanoseconds in a friendly string, with units.
+ *
+ * @param ns Nanoseconds
+ *
+ * @return Pointer to friendly string. Do not free.
+ */
+static const char *pptime(uint64_t ns)
+{
+  static char text[256];
+  const int n = sizeof(text) - 1;
+
+  if (ns < 1000) snprintf(text, n, "%lu ns", ns);
+  else if (ns < 1000000)
+  {
+    double us = ns / 1000.0;
+    snprintf(text, n, "%.3f us", us);
+  }
+  else if (ns < 1000000000)
+  {
+    double ms = ns / 1000000.0;
+    snprintf(text, n, "%.3f ms", ms);
+  }
+  else if (ns < 60000000000)
+  {
+    double s = ns / 1000000000.0;
+    snprintf(text, n, "%.3f s", s);
+  }
+  else
+  {
+    double m = ns / 60000000000.0;
+    snprintf(text, n, "%.3f m", m);
+  }
+
+  return text;
+}
+
+
+/**
+ * @brief Get messages-per-second in a friendly string, with units.
+ *
+ * @param count Total number of messages
+ * @param ns Total nanoseconds elapsed
+ *
+ * @return Pointer to friendly string. Do not free.
+ */
+static const char *pprate(uint64_t count, uint64_t ns)
+{
+  static char text[256];
+  const int n = sizeof(text) - 1;
+
+  double ps = count * 1000000000.0 / ns;
+  double kps = count * 1000000.0 / ns;
+  double mps = count * 1000.0 / ns;
+
+  if (mps > 1) snprintf(text, n, "%.3f million messages per second", mps);
+  else if (kps > 1) snprintf(text, n, "%.3f thousand messages per second", kps);
+  else snprintf(text, n, "%.3f messages per second", ps);
+
+  return text;
+}
+
+
+/**
+ * @brief Handle client errors and warnings by printing to stdout.
+ */
+static void on_error(dbn_t *dbn, bool fatal, char *msg)
+{
+  if (fatal)
+  {
+    fprintf(stderr, "Client error: %s\n", msg);
+    exit(EXIT_FAILURE);
+  }
+  else
+    fprintf(stderr, "Client warning: %s\n", msg);
+}
+
+
+/**
+ * @brief CMBP-1 message handler. Counts messages and touches the quote, as
+ * a real handler would.
+ */
+static void on_cmbp1(dbn_t *dbn, dbn_hdr_t *msg)
+{
+  dbn_cmbp1_t *cmbp1 = (void *)msg;
+  num_cmbp1++;
+  checksum += cmbp1->bid_px ^ cmbp1->ask_px ^ cmbp1->ts_recv;
+}
+
+
+/**
+ * @brief BBO message handler. Counts messages and touches the quote, as a
+ * real handler would.
+ */
+static void on_bbo(dbn_t *dbn, dbn_hdr_t *msg)
+{
+  dbn_bbo_t *bbo = (void *)msg;
+  num_bbo++;
+  checksum += bbo->bid_px ^ bbo->ask_px ^ bbo->ts_recv;
+}
+
+
+/**
+ * @brief System message handler. Counts messages.
+ */
+static void on_smsg(dbn_t *dbn, dbn_hdr_t *msg)
+{
+  num_smsg++;
+}
+
+
+/**
+ * @brief Batch handler. Counts messages and touches each header.
+ */
+static void on_batch(dbn_t *dbn, dbn_batch_t *batch)
+{
+  dbn_batch_foreach(batch, msg)
+    checksum += msg->ts_event;
+  num_msgs += batch->count;
+}
+
+
+/**
+ * @brief Build one pass of a synthetic stream, and the write boundaries
+ * with which it is sent.
+ *
+ * @param num_messages Number of messages.
+ * @param pct_bbo Percentage of quote messages that are BBO.
+ * @param pct_var Percentage of messages that are variable-length system messages.
+ * @param pct_split Percentage of writes that end partway through a message.
+ * @param write_size Mean write size, in bytes.
+ * @param arg Pointer to writer argument to populate.
+ *
+ * @return Size of the stream, in bytes.
+ */
+static size_t build_stream(
+  int num_messages,
+  int pct_bbo,
+  int pct_var,
+  int pct_split,
+  int write_size,
+  writer_arg_t *arg)
+{
+  size_t capacity = (size_t)num_messages * sizeof(dbn_bbo_t);
+  arg->stream = malloc(capacity);
+  arg->writes = malloc(sizeof(size_t));
+  arg->num_writes = 0;
+  if (!arg->stream || !arg->writes)
+  {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+
+  size_t n = 0;
+  size_t target = write_size / 2 + rand64() % write_size;
+  uint64_t ts = 1748869200000000000ul;
+
+  for (int i = 0; i < num_messages; i++)
+  {
+    /*
+     * Pick a message type and length.
+     */
+    int length, rtype;
+    if ((int)(rand64() % 100) < pct_var)
+    {
+      length = 4 * (4 + rand64() % 252);
+      rtype = DBN_RTYPE_SMSG;
+    }
+    else if ((int)(rand64() % 100) < pct_bbo)
+    {
+      length = sizeof(dbn_bbo_t);
+      rtype = DBN_RTYPE_BBO1S;
+    }
+    else
+    {
+      length = sizeof(dbn_cmbp1_t);
+      rtype = DBN_RTYPE_CMBP1;
+    }
+
+    if (n + length > capacity)
+    {
+      capacity *= 2;
+      arg->stream = realloc(arg->stream, capacity);
+      if (!arg->stream)
+      {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+      }
+    }
+
+
+    /*
+     * Fill it with plausible content.
+     */
+    uint8_t *msg = arg->stream + n;
+    for (int j = 0; j < length; j += 8)
+    {
+      uint64_t r = rand64();
+      memcpy(msg + j, &r, length - j < 8 ? length - j : 8);
+    }
+
+    ts += rand64() % 2000;
+
+    dbn_hdr_t *hdr = (void *)msg;
+    hdr->rlength = length / 4;
+    hdr->rtype = rtype;
+    hdr->publisher_id = 1 + rand64() % 20;
+    hdr->instrument_id = rand64() % 1500000;
+    hdr->ts_event = ts;
+
+    if (rtype == DBN_RTYPE_BBO1S) ((dbn_bbo_t *)msg)->ts_recv = ts + 200000;
+    else if (rtype == DBN_RTYPE_CMBP1) ((dbn_cmbp1_t *)msg)->ts_recv = ts + 200000;
+
+    n += length;
+
+
+    /*
+     * End a write once it reaches its target size, either on this message
+     * boundary or partway through the next message.
+     */
+    if (n >= target)
+    {
+      size_t end = n;
+      if ((int)(rand64() % 100) < pct_split && i + 1 < num_messages)
+        end += 1 + rand64() % (sizeof(dbn_cmbp1_t) - 1);
+
+      arg->writes = realloc(arg->writes, (arg->num_writes + 1) * sizeof(size_t));
+      arg->writes[arg->num_writes++] = end;
+      target = end + write_size / 2 + rand64() % write_size;
+    }
+  }
+
+
+  /*
+   * Always end the pass on a message boundary, so passes can be repeated,
+   * and never let a split write run past the end of the stream.
+   */
+  while (arg->num_writes && arg->writes[arg->num_writes - 1] >= n)
+    arg->num_writes--;
+
+  arg->writes = realloc(arg->writes, (arg->num_writes + 1) * sizeof(size_t));
+  arg->writes[arg->num_writes++] = n;
+
+  return n;
+}
+
+
+/**
+ * @brief Write all of a buffer to a socket.
+ */
+static void write_all(int fd, const uint8_t *data, size_t n)
+{
+  while (n)
+  {
+    ssize_t m = write(fd, data, n);
+    if (m < 0)
+    {
+      if (errno == EINTR) continue;
+      perror("write");
+      exit(EXIT_FAILURE);
+    }
+    data += m;
+    n -= m;
+  }
+}
+
+
+/**
+ * @brief Synthetic stream writer thread entry point. Sends a DBN stream
+ * header, then every pass of the stream.
+ */
+static void *writer(void *arg)
+{
+  writer_arg_t *writer_arg = arg;
+
+  uint8_t header[8 + 100];
+  memset(header, 0, sizeof(header));
+  memcpy(header, "DBN", 3);
+  header[3] = 1;
+  *(uint32_t *)(header + 4) = sizeof(header) - 8;
+  write_all(writer_arg->fd, header, sizeof(header));
+
+  for (int i = 0; i < writer_arg->num_passes; i++)
+  {
+    size_t start = 0;
+    for (int j = 0; j < writer_arg->num_writes; j++)
+    {
+      write_all(writer_arg->fd, writer_arg->stream + start, writer_arg->writes[j] - start);
+      start = writer_arg->writes[j];
+    }
+  }
+
+  return NULL;
+}
+
+
+int main(int argc, char **argv)
+{
+  /*
+   * Parse args.
+   */
+  int num_messages = 1000000;
+  int num_passes = 20;
+  int pct_bbo = 50;
+  int pct_var = 1;
+  int pct_split = 10;
+  int write_size = 65536;
+  int capacity = 4 * 1024 * 1024;
+  dbn_recv_mode_t recv_mode = DBN_RECV_MODE_DOUBLE_BUFFER;
+  bool batch = false;
+  char c;
+  while ((c = getopt(argc, argv, "hn:i:p:v:x:w:m:b:s:B")) != -1)
+  {
+    switch(c)
+    {
+      case 'h':
+        usage(EXIT_SUCCESS);
+      case 'n':
+        num_messages = atoi(optarg);
+        break;
+      case 'i':
+        num_passes = atoi(optarg);
+        break;
+      case 'p':
+        pct_bbo = atoi(optarg);
+        break;
+      case 'v':
+        pct_var = atoi(optarg);
+        break;
+      case 'x':
+        pct_split = atoi(optarg);
+        break;
+      case 'w':
+        write_size = atoi(optarg);
+        break;
+      case 'm':
+        if (!strcmp(optarg, "double")) recv_mode = DBN_RECV_MODE_DOUBLE_BUFFER;
+        else if (!strcmp(optarg, "multishot")) recv_mode = DBN_RECV_MODE_MULTISHOT;
+        else if (!strcmp(optarg, "mirror")) recv_mode = DBN_RECV_MODE_MIRROR;
+        else usage(EXIT_FAILURE);
+        break;
+      case 'b':
+        capacity = atoi(optarg);
+        break;
+      case 's':
+        rng = strtoull(optarg, NULL, 0);
+        if (!rng) rng = 1;
+        break;
+      case 'B':
+        batch = true;
+        break;
+      case '?':
+      default:
+        usage(EXIT_FAILURE);
+    }
+  }
+
+  if (num_messages < 1 || num_passes < 1 || write_size < 1 || capacity < DBN_MAX_RECORD_SIZE)
+    usage(EXIT_FAILURE);
+
+
+  /*
+   * Generate the synthetic stream.
+   */
+  printf("Generating %d messages... ", num_messages);
+  fflush(stdout);
+
+  writer_arg_t arg;
+  size_t stream_length = build_stream(
+    num_messages,
+    pct_bbo,
+    pct_var,
+    pct_split,
+    write_size,
+    &arg);
+  arg.num_passes = num_passes;
+
+  printf("OK\n");
+
+
+  /*
+   * Attach a client to one end of a socketpair, and feed the other.
+   */
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+  {
+    perror("socketpair");
+    exit(EXIT_FAILURE);
+  }
+
+  arg.fd = fds[1];
+  setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &capacity, sizeof(int));
+
+  dbn_t dbn;
+  dbn_init(&dbn, on_error, NULL, NULL);
+  if (batch) dbn_set_batch_handler(&dbn, on_batch);
+  dbn_set_msg_handler(&dbn, DBN_RTYPE_CMBP1, on_cmbp1);
+  dbn_set_msg_handler(&dbn, DBN_RTYPE_BBO1S, on_bbo);
+  dbn_set_msg_handler(&dbn, DBN_RTYPE_SMSG, on_smsg);
+  dbn.opts.rcvbuf = 65536; // Within any rmem_max; the kernel buffer is not what limits a socketpair
+  dbn.opts.capacity = capacity;
+  dbn.opts.recv_mode = recv_mode;
+
+  pthread_t thread;
+  pthread_create(&thread, NULL, writer, &arg);
+
+  if (dbn_attach(&dbn, fds[0])) exit(EXIT_FAILURE);
+
+
+  /*
+   * Run until every message has been dispatched.
+   */
+  printf("Running... ");
+  fflush(stdout);
+
+  uint64_t total = (uint64_t)num_messages * num_passes;
+  uint64_t ts_start = nanotime();
+
+  while (num_msgs + num_cmbp1 + num_bbo + num_smsg < total)
+  {
+    if (dbn_get(&dbn) < 0) exit(EXIT_FAILURE);
+  }
+
+  uint64_t ts_end = nanotime();
+  printf("OK\n");
+
+  dbn_metrics_t metrics;
+  dbn_get_metrics(&dbn, &metrics);
+  uint64_t num_reads = metrics.num_reads;
+  uint64_t num_straddles = metrics.num_straddles;
+
+  pthread_join(thread, NULL);
+  close(fds[1]);
+  dbn_close(&dbn);
+
+
+  /*
+   * Report.
+   */
+  uint64_t elapsed = ts_end - ts_start;
+  uint64_t bytes = (uint64_t)stream_length * num_passes;
+
+  printf("Stream:\n");
+  printf("  Messages:       %lu\n", total);
+  printf("  Bytes:          %lu\n", bytes);
+  printf("  Writes:         %lu\n", (uint64_t)arg.num_writes * num_passes);
+  printf("Decode:\n");
+  printf("  Time:           %s\n", pptime(elapsed));
+  printf("  Rate:           %s\n", pprate(total, elapsed));
+  printf("  Per message:    %.3f ns\n", (double)elapsed / total);
+  printf("  Throughput:     %.3f MB/s\n", bytes * 1000.0 / elapsed);
+  printf("Reads:\n");
+  printf("  Reads:          %lu\n", num_reads);
+  printf("  Messages/read:  %.1f\n", num_reads ? (double)total / num_reads : 0.0);
+  printf("  Leftover path:  %lu (%.2f%% of reads)\n", num_straddles, num_reads ? 100.0 * num_straddles / num_reads : 0.0);
+  if (!batch)
+  {
+    printf("Message counts:\n");
+    printf("  cmbp1: %lu\n", num_cmbp1);
+    printf("  bbo:   %lu\n", num_bbo);
+    printf("  smsg:  %lu\n", num_smsg);
+  }
+  printf("Checksum: %016lx\n", checksum);
+
+  free(arg.stream);
+  free(arg.writes);
+
+  return EXIT_SUCCESS;
+}
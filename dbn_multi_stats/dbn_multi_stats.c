@@ -23,6 +23,7 @@
 #include <pthread.h>
 
 #include <dbn.h>
+#include <dbn_hist.h>
 #include <dbn_multi.h>
 
 
@@ -35,7 +36,7 @@
  */
 static void usage(int exit_code)
 {
-  printf("Usage: dbn_multi_stats -k <key> -d <dataset> -c <schema> -b <symbology> [-s <i>:<symbol>] [-f <path>] [-t <threads>] [-r] [-h]\n");
+  printf("Usage: dbn_multi_stats -k <key> -d <dataset> -c <schema> -b <symbology> [-s <i>:<symbol>] [-f <path>] [-t <threads>] [-n <sessions>] [-w <path>] [-W <path>] [-P <prefix>] [-B <bytes>] [-q] [-r] [-a] [-p <cpu>] [-h]\n");
   printf("\n");
   printf("Options:\n");
   printf("   -k <key>         Databento API key\n");
@@ -45,8 +46,18 @@ static void usage(int exit_code)
   printf("   -s <i>:<symbol>  Session index and symbol (may provide multiple)\n");
   printf("   -f <i>:<path>    Session index and path to file of symbols, one per line (may provide multiple)\n");
   printf("   -t <threads>     Set number of handler threads\n");
-  printf("                    Defaults to CPU count minus number of sesssions\n");
+  printf("                    Defaults to CPU count minus number of sesssions, 0 to handle on session threads\n");
+  printf("   -n <sessions>    Ignore session indices and balance all symbols across this many sessions\n");
+  printf("   -w <path>        With -n, weigh symbols by the tab-separated symbol and weight lines in file\n");
+  printf("   -W <path>        On exit, save each symbol's quote count to file, for use with -w\n");
+  printf("   -P <prefix>      Profile messages and bytes per instrument, symbol and session, and on exit write\n");
+  printf("                    <prefix>.instruments, <prefix>.timeline, <prefix>.weights (for -w) and a suggested\n");
+  printf("                    assignment of symbols to sessions in <prefix>.0, <prefix>.1, ... (for -f)\n");
+  printf("   -B <bytes>       Count reads after which a session's receive backlog is at least this many bytes\n");
+  printf("   -q               Count BBO messages whose sequence number repeats or goes backwards\n");
   printf("   -r               Intra-day replay\n");
+  printf("   -a               Connect and authenticate all sessions concurrently\n");
+  printf("   -p <cpu>         Pin session i's thread to CPU <cpu> + i\n");
   printf("   -h               Show this usage information and exit\n");
   printf("\n");
   printf("Example: dbn_multi_stats -k <key> -d OPRA.PILLAR -c cbbo-1s -b parent -s 0:MSFT.OPT -s 1:AAPL.OPT\n");
@@ -77,17 +88,315 @@ static atomic_uint_fast64_t num_smap = 0;
 static atomic_uint_fast64_t num_sdef = 0;
 static atomic_uint_fast64_t num_cmbp1 = 0;
 static atomic_uint_fast64_t num_bbo = 0;
-static uint64_t *tss_event = NULL;
-static uint64_t *tss_recv = NULL;
-static uint64_t *tss_out = NULL;
-static uint64_t *tss_local = NULL;
-static uint64_t tss_capacity = 0;
-static atomic_uint_fast64_t tss_count = 0;
-static pthread_rwlock_t rwlock = PTHREAD_RWLOCK_INITIALIZER;
 
 
 /**
- * @brief Record a ts_event / ts_recv / ts_out / ts_local quadruplet.
+ * @brief Latency histograms, in nanoseconds, of one handler thread.
+ */
+typedef struct latencies
+{
+  dbn_hist_t event_recv;
+  dbn_hist_t event_out;
+  dbn_hist_t recv_out;
+  dbn_hist_t out_local;
+  dbn_hist_t event_local;
+  dbn_hist_t recv_local;
+  struct latencies *next;
+} latencies_t;
+
+
+/*
+ * Each thread that handles quotes records into its own histograms, found
+ * through a thread-local pointer, so threads never contend. Every thread's
+ * histograms are also linked into a list, to be merged at exit.
+ */
+static _Thread_local latencies_t *thread_latencies = NULL;
+static latencies_t *all_latencies = NULL;
+static pthread_mutex_t latencies_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+ * Per-symbol quote counts, for -W. Symbols are indexed by hash, and
+ * instrument_ids are mapped to symbol indices as they are announced by SMAP
+ * messages. Both tables use open addressing.
+ */
+#define INSTRUMENTS_SIZE (1 << 22)
+static int all_num_symbols = 0;
+static const char **all_symbols = NULL;
+static int *symbol_table = NULL;
+static uint32_t symbol_table_size = 0;
+static _Atomic uint64_t *instruments = NULL;
+static atomic_uint_fast64_t *symbol_counts = NULL;
+
+
+/**
+ * @brief FNV-1a hash.
+ */
+static inline uint32_t hash(const char *str, size_t n)
+{
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < n && str[i]; i++)
+    h = (h ^ (uint8_t)str[i]) * 16777619u;
+  return h;
+}
+
+
+/**
+ * @brief Find a symbol's index, or -1 if it was not subscribed.
+ */
+static int find_symbol(const char *symbol, size_t n)
+{
+  size_t length = strnlen(symbol, n);
+  uint32_t k = hash(symbol, length) & (symbol_table_size - 1);
+  while (symbol_table[k] >= 0)
+  {
+    const char *s = all_symbols[symbol_table[k]];
+    if (strlen(s) == length && !memcmp(s, symbol, length)) return symbol_table[k];
+    k = (k + 1) & (symbol_table_size - 1);
+  }
+  return -1;
+}
+
+
+/**
+ * @brief Find the index of an instrument's symbol, or -1 if it hasn't been
+ * mapped.
+ */
+static inline int lookup_symbol(uint32_t instrument_id)
+{
+  uint32_t k = (instrument_id * 0x9E3779B1u) & (INSTRUMENTS_SIZE - 1);
+  for (int probes = 0; probes < INSTRUMENTS_SIZE; probes++)
+  {
+    uint64_t entry = atomic_load_explicit(&instruments[k], memory_order_relaxed);
+    if (!entry) return -1;
+    if ((uint32_t)(entry >> 32) == instrument_id) return (int)((uint32_t)entry - 1);
+    k = (k + 1) & (INSTRUMENTS_SIZE - 1);
+  }
+  return -1;
+}
+
+
+/**
+ * @brief Count a quote against its instrument's symbol.
+ */
+static inline void count_symbol(uint32_t instrument_id)
+{
+  if (!instruments) return;
+
+  int symbol = lookup_symbol(instrument_id);
+  if (symbol >= 0)
+    atomic_fetch_add_explicit(&symbol_counts[symbol], 1, memory_order_relaxed);
+}
+
+
+/**
+ * @brief Map an instrument to its symbol. Entries are instrument_id in the
+ * upper half and symbol index plus 1 in the lower.
+ */
+static void map_symbol(uint32_t instrument_id, int symbol)
+{
+  uint64_t entry = ((uint64_t)instrument_id << 32) | (uint32_t)(symbol + 1);
+  uint32_t k = (instrument_id * 0x9E3779B1u) & (INSTRUMENTS_SIZE - 1);
+  for (int probes = 0; probes < INSTRUMENTS_SIZE; probes++)
+  {
+    uint64_t expected = 0;
+    if (atomic_compare_exchange_strong(&instruments[k], &expected, entry)) return;
+    if ((uint32_t)(expected >> 32) == instrument_id) return;
+    k = (k + 1) & (INSTRUMENTS_SIZE - 1);
+  }
+}
+
+
+/**
+ * @brief profile_entry_t.id of an unused entry.
+ */
+#define PROFILE_EMPTY 0xFFFFFFFF
+
+
+/**
+ * @brief Initial number of entries in each thread's profile.
+ */
+#define PROFILE_INITIAL_SIZE (1 << 16)
+
+
+/**
+ * @brief Number of instruments and roots listed in the profile summary.
+ */
+#define PROFILE_TOP 20
+
+
+/**
+ * @brief Message and byte counts of one instrument, or of one symbol.
+ */
+typedef struct
+{
+  uint32_t id;                 // Instrument ID, or symbol index
+  uint64_t messages;
+  uint64_t bytes;
+} profile_entry_t;
+
+
+/**
+ * @brief Message and byte counts of one second of the timeline.
+ */
+typedef struct
+{
+  uint64_t messages;
+  uint64_t bytes;
+} rate_t;
+
+
+/**
+ * @brief Per-instrument message and byte counts of one handler thread, for -P.
+ */
+typedef struct profile
+{
+  uint32_t size;               // Number of entries, a power of 2
+  uint32_t used;               // Number of entries in use, at most half of size
+  profile_entry_t *entries;    // Open-addressed by instrument_id
+  uint64_t messages;           // Total messages, read by the main thread
+  uint64_t bytes;              // Total bytes, read by the main thread
+  struct profile *next;
+} profile_t;
+
+
+/*
+ * As with latencies, each thread counts into its own flat table, found
+ * through a thread-local pointer and linked into a list to be merged at exit.
+ * Only the running totals are shared while running, sampled once a second by
+ * the main thread into the rate timeline.
+ */
+static bool profiling = false;
+static _Thread_local profile_t *thread_profile = NULL;
+static profile_t *all_profiles = NULL;
+static pthread_mutex_t profiles_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * @brief Allocate a profile's entries, all unused.
+ */
+static void profile_alloc(profile_t *p, uint32_t size)
+{
+  p->size = size;
+  p->used = 0;
+  p->entries = malloc(size * sizeof(profile_entry_t));
+  if (!p->entries)
+  {
+    perror("malloc");
+    abort();
+  }
+
+  for (uint32_t i = 0; i < size; i++)
+    p->entries[i].id = PROFILE_EMPTY;
+}
+
+
+/**
+ * @brief Find an instrument's entry in a profile, adding it if absent and
+ * doubling the table if that makes it more than half full.
+ */
+static profile_entry_t *profile_entry(profile_t *p, uint32_t instrument_id)
+{
+  uint32_t mask = p->size - 1;
+  uint32_t k = (instrument_id * 0x9E3779B1u) & mask;
+  while (p->entries[k].id != instrument_id)
+  {
+    if (p->entries[k].id == PROFILE_EMPTY)
+    {
+      if (2 * (p->used + 1) > p->size)
+      {
+        profile_entry_t *old = p->entries;
+        uint32_t old_size = p->size;
+        uint32_t used = p->used;
+        profile_alloc(p, 2 * old_size);
+        for (uint32_t i = 0; i < old_size; i++)
+        {
+          if (old[i].id == PROFILE_EMPTY) continue;
+          *profile_entry(p, old[i].id) = old[i];
+        }
+        p->used = used;
+        free(old);
+        return profile_entry(p, instrument_id);
+      }
+
+      p->entries[k].id = instrument_id;
+      p->entries[k].messages = 0;
+      p->entries[k].bytes = 0;
+      p->used++;
+      break;
+    }
+    k = (k + 1) & mask;
+  }
+  return &p->entries[k];
+}
+
+
+/**
+ * @brief Count a message and its bytes against its instrument, if profiling.
+ */
+static inline void profile_count(const dbn_hdr_t *msg)
+{
+  if (!profiling) return;
+
+  profile_t *p = thread_profile;
+  if (!p)
+  {
+    p = calloc(1, sizeof(profile_t));
+    if (!p)
+    {
+      perror("calloc");
+      abort();
+    }
+    profile_alloc(p, PROFILE_INITIAL_SIZE);
+
+    pthread_mutex_lock(&profiles_lock);
+    p->next = all_profiles;
+    all_profiles = p;
+    pthread_mutex_unlock(&profiles_lock);
+
+    thread_profile = p;
+  }
+
+  uint64_t bytes = 4 * (uint64_t)msg->rlength;
+  profile_entry_t *e = profile_entry(p, msg->instrument_id);
+  e->messages++;
+  e->bytes += bytes;
+  __atomic_store_n(&p->messages, p->messages + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&p->bytes, p->bytes + bytes, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * @brief Sum the running totals of every thread's profile.
+ */
+static void profile_totals(uint64_t *messages, uint64_t *bytes)
+{
+  *messages = 0;
+  *bytes = 0;
+  pthread_mutex_lock(&profiles_lock);
+  for (profile_t *p = all_profiles; p; p = p->next)
+  {
+    *messages += __atomic_load_n(&p->messages, __ATOMIC_RELAXED);
+    *bytes += __atomic_load_n(&p->bytes, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&profiles_lock);
+}
+
+
+/**
+ * @brief Compare two profile entries by messages, most first, for qsort().
+ */
+static int compare_entries(const void *a, const void *b)
+{
+  uint64_t x = ((const profile_entry_t *)a)->messages;
+  uint64_t y = ((const profile_entry_t *)b)->messages;
+  return (x < y) - (x > y);
+}
+
+
+/**
+ * @brief Record the latencies between a ts_event / ts_recv / ts_out / ts_local
+ * quadruplet.
  *
  * @param ts_event ts_event from quote message (CMBP-1 or BBO)
  * @param ts_recv ts_recv from quote message (CMBP-1 or BBO)
@@ -100,51 +409,37 @@ static inline void record_timestamps(
   uint64_t ts_out,
   uint64_t ts_local)
 {
-  uint64_t offset = atomic_fetch_add(&tss_count, 1);
-
-  if (offset >= tss_capacity)
+  latencies_t *l = thread_latencies;
+  if (!l)
   {
-    pthread_rwlock_wrlock(&rwlock);
-
-    tss_capacity = tss_capacity ? 2 * tss_capacity : 1048576;
-
-    tss_event = realloc(tss_event, tss_capacity * sizeof(uint64_t));
-    if (!tss_event)
+    l = malloc(sizeof(latencies_t));
+    if (!l)
     {
-      perror("realloc");
+      perror("malloc");
       abort();
     }
 
-    tss_recv = realloc(tss_recv, tss_capacity * sizeof(uint64_t));
-    if (!tss_recv)
-    {
-      perror("realloc");
-      abort();
-    }
-
-    tss_out = realloc(tss_out, tss_capacity * sizeof(uint64_t));
-    if (!tss_out)
-    {
-      perror("realloc");
-      abort();
-    }
+    dbn_hist_init(&l->event_recv);
+    dbn_hist_init(&l->event_out);
+    dbn_hist_init(&l->recv_out);
+    dbn_hist_init(&l->out_local);
+    dbn_hist_init(&l->event_local);
+    dbn_hist_init(&l->recv_local);
 
-    tss_local = realloc(tss_local, tss_capacity * sizeof(uint64_t));
-    if (!tss_local)
-    {
-      perror("realloc");
-      abort();
-    }
+    pthread_mutex_lock(&latencies_lock);
+    l->next = all_latencies;
+    all_latencies = l;
+    pthread_mutex_unlock(&latencies_lock);
 
-    pthread_rwlock_unlock(&rwlock);
+    thread_latencies = l;
   }
 
-  pthread_rwlock_rdlock(&rwlock);
-  tss_event[offset] = ts_event;
-  tss_recv[offset] = ts_recv;
-  tss_out[offset] = ts_out;
-  tss_local[offset] = ts_local;
-  pthread_rwlock_unlock(&rwlock);
+  dbn_hist_record(&l->event_recv, (int64_t)(ts_recv - ts_event));
+  dbn_hist_record(&l->event_out, (int64_t)(ts_out - ts_event));
+  dbn_hist_record(&l->recv_out, (int64_t)(ts_out - ts_recv));
+  dbn_hist_record(&l->out_local, (int64_t)(ts_local - ts_out));
+  dbn_hist_record(&l->event_local, (int64_t)(ts_local - ts_event));
+  dbn_hist_record(&l->recv_local, (int64_t)(ts_local - ts_recv));
 }
 
 
@@ -246,91 +541,363 @@ static const char *pprate(uint64_t count, uint64_t ns)
 
 
 /**
- * @brief Handle client errors and warnings by printing to stdout.
+ * @brief Print percentiles, max and mean of a latency histogram on one line.
+ *
+ * @param name Label, padded to align the values.
+ * @param hist Pointer to histogram.
  */
-static void on_error(dbn_multi_t *dbn_multi, bool fatal, char *msg)
+static void print_latency(
+  const char *name,
+  const dbn_hist_t *hist)
 {
-  if (fatal)
+  printf("  %s ", name);
+  if (!hist->count)
   {
-    printf("Client error: %s\n", msg);
-    exit(EXIT_FAILURE);
+    printf("n/a (no quotes)\n");
+    return;
   }
-  else
-    printf("Client warning: %s\n", msg);
+
+  printf("p50 %s", pptime(dbn_hist_percentile(hist, 50)));
+  printf(", p99 %s", pptime(dbn_hist_percentile(hist, 99)));
+  printf(", p99.9 %s", pptime(dbn_hist_percentile(hist, 99.9)));
+  printf(", max %s", pptime(hist->max));
+  printf(", mean %s", pptime((uint64_t)dbn_hist_mean(hist)));
+  if (hist->num_negative) printf(" (%lu negative)", hist->num_negative);
+  printf("\n");
 }
 
 
 /**
- * @brief Databento message handler.
+ * @brief Open a profile output file, named by a prefix and a suffix.
+ *
+ * @return Pointer to file, or NULL on failure, after printing why.
+ */
+static FILE *open_profile_file(const char *prefix, const char *suffix)
+{
+  char path[4096];
+  snprintf(path, sizeof(path), "%s.%s", prefix, suffix);
+  FILE *file = fopen(path, "w");
+  if (!file) fprintf(stderr, "Failed to open %s : %s\n", path, strerror(errno));
+  return file;
+}
+
+
+/**
+ * @brief Merge every thread's profile and report it. Prints the hottest
+ * instruments and symbols, each session's share and the peak rate, and writes
+ * the instruments, timeline, weights and suggested assignment files. All
+ * threads must have exited.
+ *
+ * @param prefix Path prefix of the files to write.
+ * @param num_sessions Number of sessions.
+ * @param num_symbols Number of symbols subscribed by each session.
+ * @param symbols Symbols subscribed by each session.
+ * @param num_suggested Number of sessions to suggest an assignment across.
+ * @param wire_bytes Bytes received by each session.
+ * @param num_seconds Number of seconds in timeline.
+ * @param timeline Messages and bytes handled in each second of the run.
  */
-static void on_msg(dbn_multi_t *dbn, dbn_hdr_t *msg)
+static void report_profile(
+  const char *prefix,
+  int num_sessions,
+  const int *num_symbols,
+  char ***symbols,
+  int num_suggested,
+  const uint64_t *wire_bytes,
+  size_t num_seconds,
+  const rate_t *timeline)
 {
   /*
-   * Count CMBP-1 messages and record timestamps for calculating latencies.
+   * Merge every thread's counts, then sort instruments hottest first.
    */
-  if (msg->rtype == DBN_RTYPE_CMBP1)
+  profile_t merged;
+  profile_alloc(&merged, PROFILE_INITIAL_SIZE);
+  for (profile_t *p = all_profiles; p; p = p->next)
   {
-    dbn_cmbp1_t *cmbp1 = (void *)msg;
-    atomic_fetch_add(&num_cmbp1, 1);
-    record_timestamps(msg->ts_event, cmbp1->ts_recv, cmbp1->ts_out, nanotime());
+    for (uint32_t i = 0; i < p->size; i++)
+    {
+      if (p->entries[i].id == PROFILE_EMPTY) continue;
+      profile_entry_t *e = profile_entry(&merged, p->entries[i].id);
+      e->messages += p->entries[i].messages;
+      e->bytes += p->entries[i].bytes;
+    }
   }
 
+  size_t num_hot = 0;
+  profile_entry_t *hot = malloc((merged.used + 1) * sizeof(profile_entry_t));
+  if (!hot)
+  {
+    perror("malloc");
+    abort();
+  }
+  for (uint32_t i = 0; i < merged.size; i++)
+  {
+    if (merged.entries[i].id != PROFILE_EMPTY) hot[num_hot++] = merged.entries[i];
+  }
+  free(merged.entries);
+  qsort(hot, num_hot, sizeof(profile_entry_t), compare_entries);
+
 
   /*
-   * Count BBO messages and record timestamps for calculating latencies.
+   * Total instruments per symbol, as mapped by SMAP messages. Instruments
+   * never mapped (ex. system messages) are totalled after the last symbol.
    */
-  else if (
-       msg->rtype == DBN_RTYPE_BBO1S
-    || msg->rtype == DBN_RTYPE_BBO1M
-    || msg->rtype == DBN_RTYPE_CBBO1S
-    || msg->rtype == DBN_RTYPE_CBBO1M)
+  uint64_t total_messages = 0;
+  uint64_t total_bytes = 0;
+  profile_entry_t *per_symbol = calloc(all_num_symbols + 1, sizeof(profile_entry_t));
+  if (!per_symbol)
+  {
+    perror("calloc");
+    abort();
+  }
+  for (int i = 0; i <= all_num_symbols; i++)
+    per_symbol[i].id = i;
+  for (size_t i = 0; i < num_hot; i++)
   {
-    dbn_bbo_t *bbo = (void *)msg;
-    atomic_fetch_add(&num_bbo, 1);
-    record_timestamps(bbo->hdr.ts_event, bbo->ts_recv, bbo->ts_out, nanotime());
+    int s = lookup_symbol(hot[i].id);
+    if (s < 0) s = all_num_symbols;
+    per_symbol[s].messages += hot[i].messages;
+    per_symbol[s].bytes += hot[i].bytes;
+    total_messages += hot[i].messages;
+    total_bytes += hot[i].bytes;
   }
 
+  double *weights = malloc((all_num_symbols + 1) * sizeof(double));
+  if (!weights)
+  {
+    perror("malloc");
+    abort();
+  }
+  for (int i = 0; i < all_num_symbols; i++)
+    weights[i] = per_symbol[i].messages;
+
+  printf("Profile:\n");
+  printf("  Instruments: %zu\n", num_hot);
+  printf("  Messages:    %lu\n", total_messages);
+  printf("  Bytes:       %lu\n", total_bytes);
+
 
   /*
-   * Count symbol mapping messages and record first and last time received.
+   * Each session handles the symbols it subscribed to.
    */
-  else if (msg->rtype == DBN_RTYPE_SMAP)
+  printf("  Sessions:\n");
+  for (int i = 0; i < num_sessions; i++)
   {
-    atomic_fetch_add(&num_smap, 1);
-    uint64_t now = nanotime();
-    const uint64_t z = 0;
-    atomic_compare_exchange_strong(&ts_smap_first, &z, now);
-    atomic_store(&ts_smap_last, now);
+    uint64_t messages = 0;
+    uint64_t bytes = 0;
+    for (int j = 0; j < num_symbols[i]; j++)
+    {
+      int s = find_symbol(symbols[i][j], SIZE_MAX);
+      if (s < 0) continue;
+      messages += per_symbol[s].messages;
+      bytes += per_symbol[s].bytes;
+    }
+
+    printf("    %3d: %12lu messages (%6.2f%%), %14lu bytes handled, %14lu bytes received\n",
+      i,
+      messages,
+      total_messages ? 100.0 * messages / total_messages : 0,
+      bytes,
+      wire_bytes[i]);
   }
 
+  qsort(per_symbol, all_num_symbols + 1, sizeof(profile_entry_t), compare_entries);
 
-  /*
-   * Count symbol definition messages.
-   */
-  else if (msg->rtype == DBN_RTYPE_SDEF)
+  printf("  Hot symbols:\n");
+  for (int i = 0; i <= all_num_symbols && i < PROFILE_TOP && per_symbol[i].messages; i++)
   {
-    atomic_fetch_add(&num_sdef, 1);
+    printf("    %-24s %12lu messages (%6.2f%%), %14lu bytes\n",
+      (int)per_symbol[i].id < all_num_symbols ? all_symbols[per_symbol[i].id] : "(unmapped)",
+      per_symbol[i].messages,
+      100.0 * per_symbol[i].messages / total_messages,
+      per_symbol[i].bytes);
   }
 
+  printf("  Hot instruments:\n");
+  for (size_t i = 0; i < num_hot && i < PROFILE_TOP; i++)
+  {
+    int s = lookup_symbol(hot[i].id);
+    printf("    %10u %-24s %12lu messages (%6.2f%%), %14lu bytes\n",
+      hot[i].id,
+      s >= 0 ? all_symbols[s] : "(unmapped)",
+      hot[i].messages,
+      100.0 * hot[i].messages / total_messages,
+      hot[i].bytes);
+  }
+
+  size_t peak = 0;
+  for (size_t i = 1; i < num_seconds; i++)
+  {
+    if (timeline[i].messages > timeline[peak].messages) peak = i;
+  }
+  if (num_seconds)
+    printf("  Peak rate:   %s, in second %zu of %zu\n", pprate(timeline[peak].messages, 1000000000), peak + 1, num_seconds);
+  else
+    printf("  Peak rate:   n/a (ran for under a second)\n");
+
 
   /*
-   * Count system messages.
+   * Write every instrument, the timeline, and per-symbol weights.
    */
-  else if (msg->rtype == DBN_RTYPE_SMSG)
+  FILE *file = open_profile_file(prefix, "instruments");
+  if (file)
+  {
+    for (size_t i = 0; i < num_hot; i++)
+    {
+      int s = lookup_symbol(hot[i].id);
+      fprintf(file, "%u\t%s\t%lu\t%lu\n", hot[i].id, s >= 0 ? all_symbols[s] : "", hot[i].messages, hot[i].bytes);
+    }
+    fclose(file);
+  }
+
+  file = open_profile_file(prefix, "timeline");
+  if (file)
   {
-    atomic_fetch_add(&num_smsg, 1);
+    for (size_t i = 0; i < num_seconds; i++)
+      fprintf(file, "%zu\t%lu\t%lu\n", i, timeline[i].messages, timeline[i].bytes);
+    fclose(file);
   }
 
+  char path[4096];
+  snprintf(path, sizeof(path), "%s.weights", prefix);
+  if (dbn_multi_save_weights(path, all_num_symbols, all_symbols, weights))
+    fprintf(stderr, "Failed to save weights to %s : %s\n", path, strerror(errno));
+
 
   /*
-   * Count server errors and print to stdout.
+   * Suggest an assignment of symbols to sessions, balancing messages, as one
+   * file of symbols per session.
    */
-  else if (msg->rtype == DBN_RTYPE_EMSG)
+  int *assignment = malloc((all_num_symbols + 1) * sizeof(int));
+  if (!assignment)
   {
-    dbn_emsg_t *emsg = (void *)msg;
-    printf("Server error: %s\n", emsg->msg);
-    atomic_fetch_add(&num_emsg, 1);
+    perror("malloc");
+    abort();
   }
+
+  if (dbn_multi_partition(all_num_symbols, weights, num_suggested, assignment))
+    perror("dbn_multi_partition");
+  else
+  {
+    printf("  Suggested assignment:");
+    for (int i = 0; i < num_suggested; i++)
+    {
+      char suffix[16];
+      snprintf(suffix, sizeof(suffix), "%d", i);
+      file = open_profile_file(prefix, suffix);
+      if (!file) continue;
+
+      for (int j = 0; j < all_num_symbols; j++)
+      {
+        if (assignment[j] == i) fprintf(file, "%s\n", all_symbols[j]);
+      }
+      fclose(file);
+      printf(" -f %d:%s.%d", i, prefix, i);
+    }
+    printf("\n");
+  }
+
+  free(assignment);
+  free(weights);
+  free(per_symbol);
+  free(hot);
+}
+
+
+/**
+ * @brief Handle client errors and warnings by printing to stdout.
+ */
+static void on_error(dbn_multi_t *dbn_multi, bool fatal, char *msg)
+{
+  if (fatal)
+  {
+    printf("Client error: %s\n", msg);
+    exit(EXIT_FAILURE);
+  }
+  else
+    printf("Client warning: %s\n", msg);
+}
+
+
+/**
+ * @brief CMBP-1 message handler. Counts messages and records timestamps for
+ * calculating latencies.
+ */
+static void on_cmbp1(dbn_multi_t *dbn, dbn_hdr_t *msg)
+{
+  dbn_cmbp1_t *cmbp1 = (void *)msg;
+  atomic_fetch_add(&num_cmbp1, 1);
+  count_symbol(msg->instrument_id);
+  profile_count(msg);
+  record_timestamps(msg->ts_event, cmbp1->ts_recv, cmbp1->ts_out, nanotime());
+}
+
+
+/**
+ * @brief BBO message handler. Counts messages and records timestamps for
+ * calculating latencies.
+ */
+static void on_bbo(dbn_multi_t *dbn, dbn_hdr_t *msg)
+{
+  dbn_bbo_t *bbo = (void *)msg;
+  atomic_fetch_add(&num_bbo, 1);
+  count_symbol(msg->instrument_id);
+  profile_count(msg);
+  record_timestamps(bbo->hdr.ts_event, bbo->ts_recv, bbo->ts_out, nanotime());
+}
+
+
+/**
+ * @brief Symbol mapping message handler. Counts messages and records first
+ * and last time received.
+ */
+static void on_smap(dbn_multi_t *dbn, dbn_hdr_t *msg)
+{
+  atomic_fetch_add(&num_smap, 1);
+  profile_count(msg);
+  uint64_t now = nanotime();
+  const uint64_t z = 0;
+  atomic_compare_exchange_strong(&ts_smap_first, &z, now);
+  atomic_store(&ts_smap_last, now);
+
+  if (instruments)
+  {
+    dbn_smap_t *smap = (void *)msg;
+    int symbol = find_symbol(smap->stype_in_symbol, sizeof(smap->stype_in_symbol));
+    if (symbol >= 0) map_symbol(msg->instrument_id, symbol);
+  }
+}
+
+
+/**
+ * @brief Symbol definition message handler. Counts messages.
+ */
+static void on_sdef(dbn_multi_t *dbn, dbn_hdr_t *msg)
+{
+  atomic_fetch_add(&num_sdef, 1);
+  profile_count(msg);
+}
+
+
+/**
+ * @brief System message handler. Counts messages.
+ */
+static void on_smsg(dbn_multi_t *dbn, dbn_hdr_t *msg)
+{
+  atomic_fetch_add(&num_smsg, 1);
+  profile_count(msg);
+}
+
+
+/**
+ * @brief Server error message handler. Counts errors and prints them.
+ */
+static void on_emsg(dbn_multi_t *dbn, dbn_hdr_t *msg)
+{
+  dbn_emsg_t *emsg = (void *)msg;
+  printf("Server error: %s\n", emsg->msg);
+  atomic_fetch_add(&num_emsg, 1);
+  profile_count(msg);
 }
 
 
@@ -385,11 +952,20 @@ int main(int argc, char **argv)
   int total_num_symbols = 0;
   int num_sessions = 0;
   bool replay = false;
+  bool async_connect = false;
+  int first_cpu = -1;
+  int num_handler_threads = -1;
+  int num_balanced = 0;
+  const char *weights_path = NULL;
+  const char *counts_path = NULL;
+  const char *profile_prefix = NULL;
+  size_t backpressure_bytes = 0;
+  bool check_sequence = false;
   char c;
   char *d;
   char *endptr;
   int sid;
-  while ((c = getopt(argc, argv, "hk:d:c:b:s:f:r")) != -1)
+  while ((c = getopt(argc, argv, "hk:d:c:b:s:f:t:n:w:W:P:B:qrap:")) != -1)
   {
     switch(c)
     {
@@ -464,9 +1040,40 @@ int main(int argc, char **argv)
 
         close(fd);
         break;
+      case 't':
+        num_handler_threads = (int)strtol(optarg, &endptr, 10);
+        if (*endptr || num_handler_threads < 0) usage(EXIT_FAILURE);
+        break;
+      case 'n':
+        num_balanced = atoi(optarg);
+        if (num_balanced <= 0) usage(EXIT_FAILURE);
+        break;
+      case 'w':
+        weights_path = optarg;
+        break;
+      case 'W':
+        counts_path = optarg;
+        break;
+      case 'P':
+        profile_prefix = optarg;
+        profiling = true;
+        break;
+      case 'B':
+        backpressure_bytes = strtoull(optarg, &endptr, 10);
+        if (*endptr) usage(EXIT_FAILURE);
+        break;
+      case 'q':
+        check_sequence = true;
+        break;
       case 'r':
         replay = true;
         break;
+      case 'a':
+        async_connect = true;
+        break;
+      case 'p':
+        first_cpu = atoi(optarg);
+        break;
       case '?':
       default:
         usage(EXIT_FAILURE);
@@ -476,6 +1083,106 @@ int main(int argc, char **argv)
   if (!api_key || !dataset || !schema || !symbology || !num_sessions)
     usage(EXIT_FAILURE);
 
+  if (weights_path && !num_balanced)
+  {
+    fprintf(stderr, "-w requires -n\n");
+    usage(EXIT_FAILURE);
+  }
+
+  /*
+   * Pool all symbols, for balancing and for counting.
+   */
+  all_symbols = malloc(total_num_symbols * sizeof(char *));
+  if (!all_symbols)
+  {
+    perror("malloc");
+    abort();
+  }
+  for (int i = 0; i < num_sessions; i++)
+  {
+    for (int j = 0; j < num_symbols[i]; j++)
+      all_symbols[all_num_symbols++] = symbols[i][j];
+  }
+
+  double *weights = NULL;
+  if (weights_path)
+  {
+    weights = malloc(all_num_symbols * sizeof(double));
+    if (!weights)
+    {
+      perror("malloc");
+      abort();
+    }
+    if (dbn_multi_load_weights(weights_path, all_num_symbols, all_symbols, weights))
+    {
+      fprintf(stderr, "Failed to load weights from %s : %s\n", weights_path, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (counts_path || profiling)
+  {
+    symbol_table_size = 2;
+    while (symbol_table_size < 2 * (uint32_t)all_num_symbols) symbol_table_size <<= 1;
+    symbol_table = malloc(symbol_table_size * sizeof(int));
+    if (!symbol_table)
+    {
+      perror("malloc");
+      abort();
+    }
+    memset(symbol_table, 0xFF, symbol_table_size * sizeof(int));
+    for (int i = 0; i < all_num_symbols; i++)
+    {
+      uint32_t k = hash(all_symbols[i], SIZE_MAX) & (symbol_table_size - 1);
+      while (symbol_table[k] >= 0) k = (k + 1) & (symbol_table_size - 1);
+      symbol_table[k] = i;
+    }
+    symbol_counts = calloc(all_num_symbols, sizeof(atomic_uint_fast64_t));
+    instruments = calloc(INSTRUMENTS_SIZE, sizeof(uint64_t));
+    if (!symbol_counts || !instruments)
+    {
+      perror("calloc");
+      abort();
+    }
+  }
+
+
+
+  /*
+   * Rebalance symbols across sessions, if requested.
+   */
+  if (num_balanced)
+  {
+    int *assignment = malloc(all_num_symbols * sizeof(int));
+    if (!assignment)
+    {
+      perror("malloc");
+      abort();
+    }
+    if (dbn_multi_partition(all_num_symbols, weights, num_balanced, assignment))
+    {
+      perror("dbn_multi_partition");
+      exit(EXIT_FAILURE);
+    }
+
+    char ***balanced_symbols = NULL;
+    int *balanced_num_symbols = NULL;
+    int n = 0;
+    for (int i = 0; i < all_num_symbols; i++)
+      add_symbol(&balanced_symbols, &balanced_num_symbols, &n, assignment[i], (char *)all_symbols[i]);
+    free(assignment);
+
+    symbols = balanced_symbols;
+    num_symbols = balanced_num_symbols;
+    num_sessions = n;
+  }
+
+  if (num_handler_threads < 0)
+  {
+    num_handler_threads = (int)sysconf(_SC_NPROCESSORS_ONLN) - num_sessions;
+    if (num_handler_threads < 0) num_handler_threads = 0;
+  }
+
 
   /*
    * Register sigint handler.
@@ -487,7 +1194,20 @@ int main(int argc, char **argv)
    * Create a client and connect.
    */
   dbn_multi_t dbn_multi;
-  dbn_multi_init(&dbn_multi, on_error, on_msg, NULL);
+  dbn_multi_init(&dbn_multi, on_error, NULL, NULL);
+  dbn_multi_set_msg_handler(&dbn_multi, DBN_RTYPE_CMBP1, on_cmbp1);
+  dbn_multi_set_msg_handler(&dbn_multi, DBN_RTYPE_BBO1S, on_bbo);
+  dbn_multi_set_msg_handler(&dbn_multi, DBN_RTYPE_BBO1M, on_bbo);
+  dbn_multi_set_msg_handler(&dbn_multi, DBN_RTYPE_CBBO1S, on_bbo);
+  dbn_multi_set_msg_handler(&dbn_multi, DBN_RTYPE_CBBO1M, on_bbo);
+  dbn_multi_set_msg_handler(&dbn_multi, DBN_RTYPE_SMAP, on_smap);
+  dbn_multi_set_msg_handler(&dbn_multi, DBN_RTYPE_SDEF, on_sdef);
+  dbn_multi_set_msg_handler(&dbn_multi, DBN_RTYPE_SMSG, on_smsg);
+  dbn_multi_set_msg_handler(&dbn_multi, DBN_RTYPE_EMSG, on_emsg);
+  dbn_multi.async_connect = async_connect;
+  dbn_multi.num_handler_threads = num_handler_threads;
+  dbn_multi.opts.backpressure_bytes = backpressure_bytes;
+  if (check_sequence) dbn_multi.opts.sequence = DBN_SEQUENCE_MONOTONIC;
 
   printf("Connecting to Databento... ");
   fflush(stdout);
@@ -496,6 +1216,12 @@ int main(int argc, char **argv)
 
   for (int i = 0; i < num_sessions; i++)
   {
+    if (first_cpu >= 0)
+    {
+      dbn_multi.thread_opts.num_cpus = 1;
+      dbn_multi.thread_opts.cpus[0] = first_cpu + i;
+    }
+
     if (dbn_multi_connect_and_start(
       &dbn_multi,
       api_key,
@@ -525,9 +1251,9 @@ int main(int argc, char **argv)
 
   uint64_t ts_subscribe_start = nanotime();
 
-  while (!dbn_multi_is_fully_subscribed(&dbn_multi) && !siginted)
+  while (!dbn_multi_is_fully_subscribed(&dbn_multi) && !dbn_multi_get_num_failed(&dbn_multi) && !siginted)
   {
-    usleep(100000);
+    usleep(1000);
   }
 
   if (siginted)
@@ -536,6 +1262,14 @@ int main(int argc, char **argv)
     exit(EXIT_SUCCESS);
   }
 
+  uint64_t num_failed = dbn_multi_get_num_failed(&dbn_multi);
+  if (num_failed)
+  {
+    printf("FAILED (%lu session%s)\n", num_failed, num_failed == 1 ? "" : "s");
+    dbn_multi_close_all(&dbn_multi);
+    exit(EXIT_FAILURE);
+  }
+
   uint64_t ts_subscribe_end = nanotime();
   printf("OK\n");
 
@@ -546,9 +1280,46 @@ int main(int argc, char **argv)
   printf("Running... ");
   fflush(stdout);
 
+  /*
+   * When profiling, sample the message and byte totals once a second.
+   */
+  uint64_t ts_run_start = nanotime();
+  uint64_t ts_sample = ts_run_start;
+  uint64_t last_messages = 0;
+  uint64_t last_bytes = 0;
+  size_t num_seconds = 0;
+  size_t max_seconds = 0;
+  rate_t *timeline = NULL;
+  if (profiling)
+    profile_totals(&last_messages, &last_bytes);
+
   while (!siginted)
   {
     usleep(100000);
+
+    if (profiling && nanotime() - ts_sample >= 1000000000)
+    {
+      ts_sample += 1000000000;
+
+      if (num_seconds == max_seconds)
+      {
+        max_seconds = max_seconds ? 2 * max_seconds : 3600;
+        timeline = realloc(timeline, max_seconds * sizeof(rate_t));
+        if (!timeline)
+        {
+          perror("realloc");
+          abort();
+        }
+      }
+
+      uint64_t messages, bytes;
+      profile_totals(&messages, &bytes);
+      timeline[num_seconds].messages = messages - last_messages;
+      timeline[num_seconds].bytes = bytes - last_bytes;
+      num_seconds++;
+      last_messages = messages;
+      last_bytes = bytes;
+    }
   }
 
   uint64_t ts_run_end = nanotime();
@@ -558,9 +1329,34 @@ int main(int argc, char **argv)
   /*
    * Disconnect and free.
    */
+  dbn_metrics_t metrics;
+  dbn_multi_get_metrics(&dbn_multi, &metrics);
+
+  uint64_t *session_wire_bytes = calloc(num_sessions, sizeof(uint64_t));
+  for (int i = 0; i < dbn_multi.num_sessions && i < num_sessions; i++)
+  {
+    dbn_metrics_t session;
+    dbn_get_metrics(dbn_multi.clients[i], &session);
+    session_wire_bytes[i] = session.num_bytes;
+  }
+
   dbn_multi_close_all(&dbn_multi);
 
 
+  /*
+   * Save per-symbol counts, for use as weights next time.
+   */
+  if (counts_path)
+  {
+    double *counts = malloc(all_num_symbols * sizeof(double));
+    for (int i = 0; i < all_num_symbols; i++)
+      counts[i] = symbol_counts[i];
+    if (dbn_multi_save_weights(counts_path, all_num_symbols, all_symbols, counts))
+      fprintf(stderr, "Failed to save counts to %s : %s\n", counts_path, strerror(errno));
+    free(counts);
+  }
+
+
   /*
    * Summarize statistics.
    */
@@ -579,34 +1375,39 @@ int main(int argc, char **argv)
   printf("  cmbp1: %ld\n", num_cmbp1);
   printf("  bbo:   %ld\n", num_bbo);
 
+  printf("Receive path:\n");
+  printf("  Bytes:         %lu\n", metrics.num_bytes);
+  printf("  Reads:         %lu\n", metrics.num_reads);
+  printf("  Leftover path: %lu\n", metrics.num_straddles);
+  printf("  Time waiting:  %s\n", pptime(metrics.wait_ns));
+  printf("  Backpressured: %lu\n", metrics.num_backpressure);
+  printf("  Out of order:  %lu\n", metrics.num_sequence_duplicates);
+
   printf("Message rates:\n");
   printf("  smap:  %s\n", pprate(num_smap, ts_smap_last - ts_smap_first));
   printf("  sdef:  %s\n", pprate(num_sdef, ts_run_end - ts_smap_last));
   printf("  cmpb1: %s\n", pprate(num_cmbp1, ts_run_end - ts_smap_last));
   printf("  bbo:   %s\n", pprate(num_bbo, ts_run_end - ts_smap_last));
 
-  double ts_event_recv = 0;
-  double ts_event_out = 0;
-  double ts_recv_out = 0;
-  double ts_out_local = 0;
-  double ts_event_local = 0;
-  double ts_recv_local = 0;
-  for (size_t i = 0; i < tss_count; i++)
-  {
-    ts_event_recv += tss_recv[i] - tss_event[i];
-    ts_event_out += tss_out[i] - tss_event[i];
-    ts_recv_out += tss_out[i] - tss_recv[i];
-    ts_out_local += tss_local[i] - tss_out[i];
-    ts_event_local += tss_local[i] - tss_event[i];
-    ts_recv_local += tss_local[i] - tss_recv[i];
-  }
-  ts_event_recv /= tss_count;
-  ts_event_out /= tss_count;
-  ts_recv_out /= tss_count;
-  ts_out_local /= tss_count;
-  ts_event_local /= tss_count;
-  ts_recv_local /= tss_count;
-
+  /*
+   * Merge every thread's latency histograms. All threads have exited.
+   */
+  latencies_t latencies;
+  dbn_hist_init(&latencies.event_recv);
+  dbn_hist_init(&latencies.event_out);
+  dbn_hist_init(&latencies.recv_out);
+  dbn_hist_init(&latencies.out_local);
+  dbn_hist_init(&latencies.event_local);
+  dbn_hist_init(&latencies.recv_local);
+  for (latencies_t *l = all_latencies; l; l = l->next)
+  {
+    dbn_hist_merge(&latencies.event_recv, &l->event_recv);
+    dbn_hist_merge(&latencies.event_out, &l->event_out);
+    dbn_hist_merge(&latencies.recv_out, &l->recv_out);
+    dbn_hist_merge(&latencies.out_local, &l->out_local);
+    dbn_hist_merge(&latencies.event_local, &l->event_local);
+    dbn_hist_merge(&latencies.recv_local, &l->recv_local);
+  }
 
   printf("Latencies:\n");
 
@@ -618,12 +1419,12 @@ int main(int argc, char **argv)
   }
   else
   {
-    printf("  ts_event -> ts_recv:  %s\n", pptime((uint64_t)ts_event_recv));
-    printf("  ts_event -> ts_out:   %s\n", pptime((uint64_t)ts_event_out));
-    printf("  ts_recv  -> ts_out:   %s\n", pptime((uint64_t)ts_recv_out));
+    print_latency("ts_event -> ts_recv: ", &latencies.event_recv);
+    print_latency("ts_event -> ts_out:  ", &latencies.event_out);
+    print_latency("ts_recv  -> ts_out:  ", &latencies.recv_out);
   }
 
-  printf("  ts_out   -> ts_local: %s\n", pptime((uint64_t)ts_out_local));
+  print_latency("ts_out   -> ts_local:", &latencies.out_local);
 
   if (replay)
   {
@@ -632,9 +1433,20 @@ int main(int argc, char **argv)
   }
   else
   {
-    printf("  ts_event -> ts_local: %s\n", pptime((uint64_t)ts_event_local));
-    printf("  ts_recv  -> ts_local: %s\n", pptime((uint64_t)ts_recv_local));
+    print_latency("ts_event -> ts_local:", &latencies.event_local);
+    print_latency("ts_recv  -> ts_local:", &latencies.recv_local);
   }
 
+  if (profiling)
+    report_profile(
+      profile_prefix,
+      num_sessions,
+      num_symbols,
+      symbols,
+      num_balanced ? num_balanced : num_sessions,
+      session_wire_bytes,
+      num_seconds,
+      timeline);
+
   return EXIT_SUCCESS;
 }
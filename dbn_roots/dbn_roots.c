@@ -12,14 +12,17 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <signal.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 
 #include <dbn.h>
 #include <osi.h>
 #include <dbn_opra_discover.h>
+#include <dbn_opra_snapshot.h>
 
 
 /**
@@ -31,12 +34,15 @@
  */
 static void usage(int exit_code)
 {
-  printf("Usage: dbn_roots -k <key> [-h] [-c] [-o <path>]\n");
+  printf("Usage: dbn_roots -k <key> [-h] [-c] [-o <path>] [-s <path>] [-r <path> [-n <sessions>]]\n");
   printf("\n");
   printf("Options:\n");
   printf("   -k <key>       Databento API key\n");
   printf("   -c             Dump as C header instead of simple list\n");
   printf("   -o <path>      Dump to file instead of stdout\n");
+  printf("   -s <path>      Load today's discovery from a snapshot file if present, otherwise save it there\n");
+  printf("   -r <path>      Replay definitions only for the roots listed in a file (ex. a previous dump)\n");
+  printf("   -n <sessions>  With -r, number of parallel sessions to split the roots across (default 1)\n");
   printf("   -h             Show this usage information and exit\n");
   exit(exit_code);
 }
@@ -58,6 +64,51 @@ static void on_sigint(int signum)
 }
 
 
+/**
+ * @brief Read a list of roots, one per line, with or without the .OPT suffix.
+ *
+ * @param path Path to file.
+ * @param num_roots Pointer to populate with the number of roots.
+ *
+ * @return Array of roots, or NULL on failure with errno set.
+ */
+static char **read_roots(const char *path, size_t *num_roots)
+{
+  FILE *f = fopen(path, "r");
+  if (!f) return NULL;
+
+  char **roots = NULL;
+  size_t n = 0;
+  char line[64];
+  while (fgets(line, sizeof(line), f))
+  {
+    line[strcspn(line, "\r\n")] = 0;
+    char *suffix = strstr(line, ".OPT");
+    if (suffix) *suffix = 0;
+    if (!line[0]) continue;
+
+    char **r = realloc(roots, (n + 1) * sizeof(char *));
+    if (!r || !(r[n] = strdup(line)))
+    {
+      perror("realloc");
+      abort();
+    }
+    roots = r;
+    n++;
+  }
+
+  fclose(f);
+  if (!n)
+  {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  *num_roots = n;
+  return roots;
+}
+
+
 /**
  * @brief Write a null-terminated string to a file descriptor, looping as
  * needed to write the full string.
@@ -81,6 +132,64 @@ static int write_all(int fd, const char *string)
 }
 
 
+/**
+ * @brief Dump roots to a file or standard output, exiting on failure.
+ *
+ * @param path Pointer to null-terminated path of file, or NULL for stdout.
+ * @param as_header Dump as C header instead of simple list.
+ * @param num_roots Number of roots.
+ * @param roots Pointer to array of pointers to null-terminated roots, without .OPT suffix.
+ */
+static void dump_roots(
+  const char *path,
+  bool as_header,
+  size_t num_roots,
+  const char * const *roots)
+{
+  /*
+   * Open the target output file and dump roots.
+   */
+  int fd;
+  if (path != NULL)
+  {
+    printf("Writing roots to %s... ", path);
+    fflush(stdout);
+    fd = open(path, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd < 0)
+    {
+      printf("Failed to open or create %s : %s\n", path, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+  }
+  else
+  {
+    printf("Writing roots to stdout:\n");
+    fd = STDOUT_FILENO;
+  }
+
+  for (size_t i = 0; i < num_roots; i++)
+  {
+    if (as_header) write_all(fd, "  \"");
+
+    write_all(fd, roots[i]);
+    write_all(fd, ".OPT");
+
+    if (as_header)
+    {
+      if (i < num_roots - 1) write_all(fd, "\",\n");
+      else write_all(fd, "\"\n};\n");
+    }
+    else write_all(fd, "\n");
+  }
+
+  if (path)
+  {
+    close(fd);
+    printf("OK\n");
+  }
+}
+
+
 int main(int argc, char **argv)
 {
   /*
@@ -89,8 +198,11 @@ int main(int argc, char **argv)
   char *api_key = NULL;
   bool as_header = false;
   char *path = NULL;
+  char *roots_path = NULL;
+  char *snapshot_path = NULL;
+  int num_sessions = 1;
   char c;
-  while ((c = getopt(argc, argv, "hk:co:")) != -1)
+  while ((c = getopt(argc, argv, "hk:co:s:r:n:")) != -1)
   {
     switch(c)
     {
@@ -105,16 +217,79 @@ int main(int argc, char **argv)
       case 'o':
         path = optarg;
         break;
+      case 's':
+        snapshot_path = optarg;
+        break;
+      case 'r':
+        roots_path = optarg;
+        break;
+      case 'n':
+        num_sessions = atoi(optarg);
+        break;
       case '?':
       default:
         usage(EXIT_FAILURE);
     }
   }
 
-  if (!api_key)
+  if (!api_key || num_sessions < 1)
     usage(EXIT_FAILURE);
 
 
+  /*
+   * If there's a snapshot from today, use that instead of discovering.
+   */
+  time_t now = time(NULL);
+  struct tm tm;
+  localtime_r(&now, &tm);
+  uint32_t trading_date = 10000 * (tm.tm_year + 1900) + 100 * (tm.tm_mon + 1) + tm.tm_mday;
+
+  if (snapshot_path)
+  {
+    dbn_opra_snapshot_t snapshot;
+    if (!dbn_opra_snapshot_open(&snapshot, snapshot_path, trading_date))
+    {
+      printf("Loaded %" PRIu32 " roots and %" PRIu64 " options from snapshot %s\n",
+        snapshot.header->num_roots,
+        snapshot.header->num_options,
+        snapshot_path);
+
+      const char **names = malloc(snapshot.header->num_roots * sizeof(char *) + 1);
+      if (!names)
+      {
+        perror("malloc");
+        abort();
+      }
+      for (size_t i = 0; i < snapshot.header->num_roots; i++)
+        names[i] = snapshot.roots[i].root;
+      dump_roots(path, as_header, snapshot.header->num_roots, names);
+      free(names);
+
+      dbn_opra_snapshot_close(&snapshot);
+      return EXIT_SUCCESS;
+    }
+    else if (errno != ENOENT && errno != ESTALE)
+      printf("Ignoring snapshot %s : %s\n", snapshot_path, strerror(errno));
+  }
+
+
+  /*
+   * Load the roots to replay, if given.
+   */
+  char **roots = NULL;
+  size_t num_roots = 0;
+  if (roots_path)
+  {
+    roots = read_roots(roots_path, &num_roots);
+    if (!roots)
+    {
+      printf("Failed to read roots from %s : %s\n", roots_path, strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    if ((size_t)num_sessions > num_roots) num_sessions = num_roots;
+  }
+
+
   /*
    * Register sigint handler.
    */
@@ -130,7 +305,9 @@ int main(int argc, char **argv)
   printf("Connecting to Databento... ");
   fflush(stdout);
 
-  if (dbn_opra_discover_start(&discover, api_key))
+  if (roots
+    ? dbn_opra_discover_start_sharded(&discover, api_key, num_sessions, num_roots, (const char * const *)roots)
+    : dbn_opra_discover_start(&discover, api_key))
     exit(EXIT_FAILURE);
 
   printf("OK\n");
@@ -234,51 +411,39 @@ int main(int argc, char **argv)
 
 
   /*
-   * Open the target output file and dump roots.
+   * Save the snapshot, if requested.
    */
-  int fd;
-  if (path != NULL)
+  if (snapshot_path)
   {
-    printf("Writing roots to %s... ", path);
+    printf("Writing snapshot to %s... ", snapshot_path);
     fflush(stdout);
-    fd = open(path, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-    if (fd < 0)
-    {
-      printf("Failed to open or create %s : %s\n", path, strerror(errno));
-      exit(EXIT_FAILURE);
-    }
-  }
-  else
-  {
-    printf("Writing roots to stdout:\n");
-    fd = STDOUT_FILENO;
+    if (dbn_opra_snapshot_save(&discover, snapshot_path, trading_date))
+      printf("Failed, %s\n", strerror(errno));
+    else printf("OK\n");
   }
 
-  for (size_t i = 0; i < discover.num_roots; i++)
-  {
-    if (as_header) write_all(fd, "  \"");
 
-    write_all(fd, discover.roots[i].root);
-    write_all(fd, ".OPT");
-
-    if (as_header)
-    {
-      if (i < discover.num_roots - 1) write_all(fd, "\",\n");
-      else write_all(fd, "\"\n};\n");
-    }
-    else write_all(fd, "\n");
-  }
-
-  if (path)
+  /*
+   * Dump roots.
+   */
+  const char **names = malloc(discover.num_roots * sizeof(char *) + 1);
+  if (!names)
   {
-    close(fd);
-    printf("OK\n");
+    perror("malloc");
+    abort();
   }
+  for (size_t i = 0; i < discover.num_roots; i++)
+    names[i] = discover.roots[i].root;
+  dump_roots(path, as_header, discover.num_roots, names);
+  free(names);
 
 
   /*
    * Disconnect / clean up before we go.
    */
   dbn_opra_discover_destroy(&discover);
+  for (size_t i = 0; i < num_roots; i++)
+    free(roots[i]);
+  free(roots);
   return EXIT_SUCCESS;
 }
@@ -20,6 +20,7 @@
 #include <signal.h>
 
 #include <dbn.h>
+#include <dbn_hist.h>
 
 
 /**
@@ -31,7 +32,7 @@
  */
 static void usage(int exit_code)
 {
-  printf("Usage: dbn_stats -k <key> -d <dataset> -c <schema> -b <symbology> [-s <symbol>] [-f <path>] [-r] [-h]\n");
+  printf("Usage: dbn_stats -k <key> -d <dataset> -c <schema> -b <symbology> [-s <symbol>] [-f <path>] [-r] [-t] [-h]\n");
   printf("\n");
   printf("Options:\n");
   printf("   -k <key>       Databento API key\n");
@@ -41,6 +42,7 @@ static void usage(int exit_code)
   printf("   -s <symbol>    Symbol (may provide multiple)\n");
   printf("   -f <path>      Path to file of symbols, one per line (may provide multiple)\n");
   printf("   -r             Intra-day replay\n");
+  printf("   -t             Use kernel receive timestamps as local time\n");
   printf("   -h             Show this usage information and exit\n");
   printf("\n");
   printf("Example: dbn_stats -k <key> -d OPRA.PILLAR -c cbbo-1s -b parent -s MSFT.OPT -s AAPL.OPT\n");
@@ -71,16 +73,34 @@ static volatile uint64_t num_smap = 0;
 static volatile uint64_t num_sdef = 0;
 static volatile uint64_t num_cmbp1 = 0;
 static volatile uint64_t num_bbo = 0;
-static uint64_t *tss_event = NULL;
-static uint64_t *tss_recv = NULL;
-static uint64_t *tss_out = NULL;
-static uint64_t *tss_local = NULL;
-static volatile uint64_t tss_capacity = 0;
-static volatile uint64_t tss_count = 0;
 
 
 /**
- * @brief Record a ts_event / ts_recv / ts_out / ts_local quadruplet.
+ * @brief Latency histograms, in nanoseconds.
+ */
+typedef struct
+{
+  dbn_hist_t event_recv;
+  dbn_hist_t event_out;
+  dbn_hist_t recv_out;
+  dbn_hist_t out_local;
+  dbn_hist_t event_local;
+  dbn_hist_t recv_local;
+} latencies_t;
+
+static latencies_t latencies;
+
+
+/**
+ * @brief If true, use kernel receive timestamps rather than handler time as
+ * local time.
+ */
+static bool rx_timestamps = false;
+
+
+/**
+ * @brief Record the latencies between a ts_event / ts_recv / ts_out / ts_local
+ * quadruplet.
  *
  * @param ts_event ts_event from quote message (CMBP-1 or BBO)
  * @param ts_recv ts_recv from quote message (CMBP-1 or BBO)
@@ -93,44 +113,12 @@ static inline void record_timestamps(
   uint64_t ts_out,
   uint64_t ts_local)
 {
-  if (tss_count == tss_capacity)
-  {
-    tss_capacity = tss_capacity ? 2 * tss_capacity : 1048576;
-
-    tss_event = realloc(tss_event, tss_capacity * sizeof(uint64_t));
-    if (!tss_event)
-    {
-      perror("realloc");
-      abort();
-    }
-
-    tss_recv = realloc(tss_recv, tss_capacity * sizeof(uint64_t));
-    if (!tss_recv)
-    {
-      perror("realloc");
-      abort();
-    }
-
-    tss_out = realloc(tss_out, tss_capacity * sizeof(uint64_t));
-    if (!tss_out)
-    {
-      perror("realloc");
-      abort();
-    }
-
-    tss_local = realloc(tss_local, tss_capacity * sizeof(uint64_t));
-    if (!tss_local)
-    {
-      perror("realloc");
-      abort();
-    }
-  }
-
-  tss_event[tss_count] = ts_event;
-  tss_recv[tss_count] = ts_recv;
-  tss_out[tss_count] = ts_out;
-  tss_local[tss_count] = ts_local;
-  tss_count++;
+  dbn_hist_record(&latencies.event_recv, (int64_t)(ts_recv - ts_event));
+  dbn_hist_record(&latencies.event_out, (int64_t)(ts_out - ts_event));
+  dbn_hist_record(&latencies.recv_out, (int64_t)(ts_out - ts_recv));
+  dbn_hist_record(&latencies.out_local, (int64_t)(ts_local - ts_out));
+  dbn_hist_record(&latencies.event_local, (int64_t)(ts_local - ts_event));
+  dbn_hist_record(&latencies.recv_local, (int64_t)(ts_local - ts_recv));
 }
 
 
@@ -168,6 +156,16 @@ static inline uint64_t nanotime()
 }
 
 
+/**
+ * @brief Get the local time of the message being handled, in Unix
+ * nanoseconds.
+ */
+static inline uint64_t local_time(dbn_t *dbn)
+{
+  return rx_timestamps ? dbn_get_rx_timestamp(dbn) : nanotime();
+}
+
+
 /**
  * @brief Get nanoseconds in a friendly string, with units.
  *
@@ -231,6 +229,33 @@ static const char *pprate(uint64_t count, uint64_t ns)
 }
 
 
+/**
+ * @brief Print percentiles, max and mean of a latency histogram on one line.
+ *
+ * @param name Label, padded to align the values.
+ * @param hist Pointer to histogram.
+ */
+static void print_latency(
+  const char *name,
+  const dbn_hist_t *hist)
+{
+  printf("  %s ", name);
+  if (!hist->count)
+  {
+    printf("n/a (no quotes)\n");
+    return;
+  }
+
+  printf("p50 %s", pptime(dbn_hist_percentile(hist, 50)));
+  printf(", p99 %s", pptime(dbn_hist_percentile(hist, 99)));
+  printf(", p99.9 %s", pptime(dbn_hist_percentile(hist, 99.9)));
+  printf(", max %s", pptime(hist->max));
+  printf(", mean %s", pptime((uint64_t)dbn_hist_mean(hist)));
+  if (hist->num_negative) printf(" (%lu negative)", hist->num_negative);
+  printf("\n");
+}
+
+
 /**
  * @brief Handle client errors and warnings by printing to stdout.
  */
@@ -247,74 +272,67 @@ static void on_error(dbn_t *dbn, bool fatal, char *msg)
 
 
 /**
- * @brief Databento message handler.
+ * @brief CMBP-1 message handler. Counts messages and records timestamps for
+ * calculating latencies.
  */
-static void on_msg(dbn_t *dbn, dbn_hdr_t *msg)
+static void on_cmbp1(dbn_t *dbn, dbn_hdr_t *msg)
 {
-  /*
-   * Count CMBP-1 messages and record timestamps for calculating latencies.
-   */
-  if (msg->rtype == DBN_RTYPE_CMBP1)
-  {
-    dbn_cmbp1_t *cmbp1 = (void *)msg;
-    num_cmbp1++;
-    record_timestamps(msg->ts_event, cmbp1->ts_recv, cmbp1->ts_out, nanotime());
-  }
+  dbn_cmbp1_t *cmbp1 = (void *)msg;
+  num_cmbp1++;
+  record_timestamps(msg->ts_event, cmbp1->ts_recv, cmbp1->ts_out, local_time(dbn));
+}
 
 
-  /*
-   * Count BBO messages and record timestamps for calculating latencies.
-   */
-  else if (
-       msg->rtype == DBN_RTYPE_BBO1S
-    || msg->rtype == DBN_RTYPE_BBO1M
-    || msg->rtype == DBN_RTYPE_CBBO1S
-    || msg->rtype == DBN_RTYPE_CBBO1M)
-  {
-    dbn_bbo_t *bbo = (void *)msg;
-    num_bbo++;
-    record_timestamps(bbo->hdr.ts_event, bbo->ts_recv, bbo->ts_out, nanotime());
-  }
+/**
+ * @brief BBO message handler. Counts messages and records timestamps for
+ * calculating latencies.
+ */
+static void on_bbo(dbn_t *dbn, dbn_hdr_t *msg)
+{
+  dbn_bbo_t *bbo = (void *)msg;
+  num_bbo++;
+  record_timestamps(bbo->hdr.ts_event, bbo->ts_recv, bbo->ts_out, local_time(dbn));
+}
 
 
-  /*
-   * Count symbol mapping messages and record first and last time received.
-   */
-  else if (msg->rtype == DBN_RTYPE_SMAP)
-  {
-    num_smap++;
-    if (!ts_smap_first) ts_smap_first = nanotime();
-    else ts_smap_last = nanotime();
-  }
+/**
+ * @brief Symbol mapping message handler. Counts messages and records first
+ * and last time received.
+ */
+static void on_smap(dbn_t *dbn, dbn_hdr_t *msg)
+{
+  num_smap++;
+  if (!ts_smap_first) ts_smap_first = nanotime();
+  else ts_smap_last = nanotime();
+}
 
 
-  /*
-   * Count symbol definition messages.
-   */
-  else if (msg->rtype == DBN_RTYPE_SDEF)
-  {
-    num_sdef++;
-  }
+/**
+ * @brief Symbol definition message handler. Counts messages.
+ */
+static void on_sdef(dbn_t *dbn, dbn_hdr_t *msg)
+{
+  num_sdef++;
+}
 
 
-  /*
-   * Count system messages.
-   */
-  else if (msg->rtype == DBN_RTYPE_SMSG)
-  {
-    num_smsg++;
-  }
+/**
+ * @brief System message handler. Counts messages.
+ */
+static void on_smsg(dbn_t *dbn, dbn_hdr_t *msg)
+{
+  num_smsg++;
+}
 
 
-  /*
-   * Count server errors and print to stdout.
-   */
-  else if (msg->rtype == DBN_RTYPE_EMSG)
-  {
-    dbn_emsg_t *emsg = (void *)msg;
-    fprintf(stderr, "Server error: %s\n", emsg->msg);
-    num_emsg++;
-  }
+/**
+ * @brief Server error message handler. Counts errors and prints them.
+ */
+static void on_emsg(dbn_t *dbn, dbn_hdr_t *msg)
+{
+  dbn_emsg_t *emsg = (void *)msg;
+  fprintf(stderr, "Server error: %s\n", emsg->msg);
+  num_emsg++;
 }
 
 
@@ -331,7 +349,7 @@ int main(int argc, char **argv)
   int num_symbols = 0;
   bool replay = false;
   char c;
-  while ((c = getopt(argc, argv, "hk:d:c:b:s:f:r")) != -1)
+  while ((c = getopt(argc, argv, "hk:d:c:b:s:f:rt")) != -1)
   {
     switch(c)
     {
@@ -408,6 +426,9 @@ int main(int argc, char **argv)
       case 'r':
         replay = true;
         break;
+      case 't':
+        rx_timestamps = true;
+        break;
       case '?':
       default:
         usage(EXIT_FAILURE);
@@ -418,6 +439,17 @@ int main(int argc, char **argv)
     usage(EXIT_FAILURE);
 
 
+  /*
+   * Initialize latency histograms.
+   */
+  dbn_hist_init(&latencies.event_recv);
+  dbn_hist_init(&latencies.event_out);
+  dbn_hist_init(&latencies.recv_out);
+  dbn_hist_init(&latencies.out_local);
+  dbn_hist_init(&latencies.event_local);
+  dbn_hist_init(&latencies.recv_local);
+
+
   /*
    * Register sigint handler.
    */
@@ -428,7 +460,17 @@ int main(int argc, char **argv)
    * Create a client and connect.
    */
   dbn_t dbn;
-  dbn_init(&dbn, on_error, on_msg, NULL);
+  dbn_init(&dbn, on_error, NULL, NULL);
+  dbn_set_msg_handler(&dbn, DBN_RTYPE_CMBP1, on_cmbp1);
+  dbn_set_msg_handler(&dbn, DBN_RTYPE_BBO1S, on_bbo);
+  dbn_set_msg_handler(&dbn, DBN_RTYPE_BBO1M, on_bbo);
+  dbn_set_msg_handler(&dbn, DBN_RTYPE_CBBO1S, on_bbo);
+  dbn_set_msg_handler(&dbn, DBN_RTYPE_CBBO1M, on_bbo);
+  dbn_set_msg_handler(&dbn, DBN_RTYPE_SMAP, on_smap);
+  dbn_set_msg_handler(&dbn, DBN_RTYPE_SDEF, on_sdef);
+  dbn_set_msg_handler(&dbn, DBN_RTYPE_SMSG, on_smsg);
+  dbn_set_msg_handler(&dbn, DBN_RTYPE_EMSG, on_emsg);
+  dbn.opts.rx_timestamps = rx_timestamps;
 
   printf("Connecting to Databento... ");
   fflush(stdout);
@@ -515,29 +557,6 @@ int main(int argc, char **argv)
   printf("  cmpb1: %s\n", pprate(num_cmbp1, ts_run_end - ts_smap_last));
   printf("  bbo:   %s\n", pprate(num_bbo, ts_run_end - ts_smap_last));
 
-  double ts_event_recv = 0;
-  double ts_event_out = 0;
-  double ts_recv_out = 0;
-  double ts_out_local = 0;
-  double ts_event_local = 0;
-  double ts_recv_local = 0;
-  for (size_t i = 0; i < tss_count; i++)
-  {
-    ts_event_recv += tss_recv[i] - tss_event[i];
-    ts_event_out += tss_out[i] - tss_event[i];
-    ts_recv_out += tss_out[i] - tss_recv[i];
-    ts_out_local += tss_local[i] - tss_out[i];
-    ts_event_local += tss_local[i] - tss_event[i];
-    ts_recv_local += tss_local[i] - tss_recv[i];
-  }
-  ts_event_recv /= tss_count;
-  ts_event_out /= tss_count;
-  ts_recv_out /= tss_count;
-  ts_out_local /= tss_count;
-  ts_event_local /= tss_count;
-  ts_recv_local /= tss_count;
-
-
   printf("Latencies:\n");
 
   if (replay)
@@ -548,12 +567,12 @@ int main(int argc, char **argv)
   }
   else
   {
-    printf("  ts_event -> ts_recv:  %s\n", pptime((uint64_t)ts_event_recv));
-    printf("  ts_event -> ts_out:   %s\n", pptime((uint64_t)ts_event_out));
-    printf("  ts_recv  -> ts_out:   %s\n", pptime((uint64_t)ts_recv_out));
+    print_latency("ts_event -> ts_recv: ", &latencies.event_recv);
+    print_latency("ts_event -> ts_out:  ", &latencies.event_out);
+    print_latency("ts_recv  -> ts_out:  ", &latencies.recv_out);
   }
 
-  printf("  ts_out   -> ts_local: %s\n", pptime((uint64_t)ts_out_local));
+  print_latency("ts_out   -> ts_local:", &latencies.out_local);
 
   if (replay)
   {
@@ -562,8 +581,8 @@ int main(int argc, char **argv)
   }
   else
   {
-    printf("  ts_event -> ts_local: %s\n", pptime((uint64_t)ts_event_local));
-    printf("  ts_recv  -> ts_local: %s\n", pptime((uint64_t)ts_recv_local));
+    print_latency("ts_event -> ts_local:", &latencies.event_local);
+    print_latency("ts_recv  -> ts_local:", &latencies.recv_local);
   }
 
   return EXIT_SUCCESS;
@@ -11,16 +11,31 @@
 #include <unistd.h>
 #include <stdarg.h>
 #include <string.h>
+#include <inttypes.h>
 #include <errno.h>
 #include <sys/socket.h>
+#include <sys/ioctl.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/mempolicy.h>
+#include <linux/memfd.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+
+#include <pthread.h>
 
 #include <sodium.h>
 #include <liburing.h>
 
 #include "dbn.h"
+#include "dbn_quotes.h"
+#include "dbn_export.h"
 
 
 /**
@@ -30,38 +45,51 @@
  *
  * @return Pointer to ASCII string received from the socket, or NULL on error. Caller must free.
  *
- * Control messages are only received during the initial setup phase
- * of a Databento connection, so this code does not need to be performant.
+ * Peeks at whatever has arrived and consumes only up to the terminating
+ * newline, so a control message is read in one or two system calls without
+ * ever consuming bytes that belong to whatever follows it.
  */
 static char *receive_control_message(int sock)
 {
-  char *msg = malloc(64);
-  ssize_t c = 64;
+  ssize_t c = 256;
   ssize_t n = 0;
+  char *msg = malloc(c);
 
   while (true)
   {
-    if (n > c / 2)
+    if (c - n < 128)
     {
       c *= 2;
       msg = realloc(msg, c);
     }
 
-    ssize_t m = recv(sock, msg + n, 1, 0);
-    if (m > 0)
+    ssize_t m = recv(sock, msg + n, c - n - 1, MSG_PEEK);
+    if (m <= 0)
     {
-      n += m;
-      if (msg[n - 1] == '\n')
-      {
-        msg[n - 1] = 0;
-        return msg;
-      }
+      free(msg);
+      return NULL;
     }
-    else
+
+    char *end = memchr(msg + n, '\n', m);
+    if (end) m = end - (msg + n) + 1;
+
+
+    /*
+     * Consume what we peeked (up to and including the newline, if any). Data
+     * is already queued, so this does not block.
+     */
+    if (recv(sock, msg + n, m, 0) != m)
     {
       free(msg);
       return NULL;
     }
+
+    n += m;
+    if (end)
+    {
+      msg[n - 1] = 0;
+      return msg;
+    }
   }
 }
 
@@ -133,228 +161,2255 @@ static void invoke_error_handler(
 }
 
 
-void dbn_init(
+/**
+ * @brief Send an entire buffer to a socket.
+ *
+ * @param dbn Pointer to client object.
+ * @param data Pointer to data.
+ * @param n Size of data, in bytes.
+ *
+ * @return 0 on success, or -1 on failure with errno set and error handler
+ * invoked (if not NULL).
+ */
+static int send_all(
   dbn_t *dbn,
-  dbn_on_error_t on_error,
-  dbn_on_msg_t on_msg,
-  void *ctx)
+  const char *data,
+  size_t n)
 {
-  memset(dbn, 0, sizeof(dbn_t));
-  dbn->on_error = on_error;
-  dbn->on_msg = on_msg;
-  dbn->ctx = ctx;
+  while (n)
+  {
+    ssize_t m = send(dbn->sock, data, n, MSG_NOSIGNAL);
+    if (m < 0)
+    {
+      if (errno == EINTR) continue;
+
+      int e = errno;
+      invoke_error_handler(
+        dbn,
+        true,
+        "Error writing to socket (errno %d: %s)",
+        e,
+        strerror(e));
+      errno = e;
+      return -1;
+    }
+
+    data += m;
+    n -= m;
+  }
+
+  return 0;
 }
 
 
-int dbn_connect(
+/**
+ * @brief Maximum number of resolved gateway addresses cached.
+ */
+#define DBN_ADDR_CACHE_SIZE 16
+
+
+/**
+ * @brief Gateway addresses resolved so far, shared by all clients in the
+ * process so that sessions to the same dataset resolve it only once.
+ */
+static struct
+{
+  char fqdn[256];
+  struct in_addr addr;
+} addr_cache[DBN_ADDR_CACHE_SIZE];
+static int addr_cache_count = 0;
+static pthread_mutex_t addr_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * @brief Resolve a gateway FQDN, via the address cache.
+ *
+ * The cache lock is held across the lookup, so sessions connecting
+ * concurrently wait for the first one's lookup rather than repeating it.
+ *
+ * @param dbn Pointer to client object.
+ * @param fqdn Pointer to null-terminated FQDN.
+ * @param addr Pointer to address to populate.
+ *
+ * @return 0 on success, or -1 on failure with errno set and error handler
+ * invoked (if not NULL).
+ */
+static int resolve(
   dbn_t *dbn,
-  const char *api_key,
-  const char *dataset,
-  bool ts_out)
+  const char *fqdn,
+  struct in_addr *addr)
 {
-  /*
-   * Create socket.
-   */
-  if ((dbn->sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+  pthread_mutex_lock(&addr_cache_lock);
+
+  for (int i = 0; i < addr_cache_count; i++)
   {
-    int e = errno;
-    invoke_error_handler(
-      dbn,
-      true,
-      "Failed to create socket (errno %d: %s)",
-      e,
-      strerror(e));
-    errno = e;
-    return false;
+    if (!strcmp(addr_cache[i].fqdn, fqdn))
+    {
+      *addr = addr_cache[i].addr;
+      pthread_mutex_unlock(&addr_cache_lock);
+      return 0;
+    }
   }
 
-
-  /*
-   * Set a 64 MiB socket buffer.
-   */
-  int buffer_size = 1024 * 1024 * 64;
-  if (setsockopt(
-    dbn->sock,
-    SOL_SOCKET,
-    SO_RCVBUF,
-    &buffer_size,
-    sizeof(int)) < 0)
+  struct addrinfo hints, *res;
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = 0;
+  int r;
+  if ((r = getaddrinfo(fqdn, NULL, &hints, &res)))
   {
-    int e = errno;
+    pthread_mutex_unlock(&addr_cache_lock);
     invoke_error_handler(
       dbn,
       true,
-      "Failed to set socket buffer size (errno %d: %s)",
-      e,
-      strerror(e));
-    errno = e;
+      "Failed to resolve %s (%s)",
+      fqdn,
+      gai_strerror(r));
+    errno = ENXIO;
     return -1;
   }
 
+  *addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr;
+  freeaddrinfo(res);
 
-  /*
-   * Actual buffer size could end up bigger. Whatever it is,
-   * make our buffer size the same.
-   */
-  socklen_t optlen = sizeof(int);
-  getsockopt(
-    dbn->sock,
-    SOL_SOCKET,
-    SO_RCVBUF,
-    &buffer_size,
-    &optlen);
-
-  if (buffer_size < 1024 * 1024 * 64)
+  if (addr_cache_count < DBN_ADDR_CACHE_SIZE && strlen(fqdn) < sizeof(addr_cache[0].fqdn))
   {
-    invoke_error_handler(
-      dbn,
-      true,
-      "Failed to set socket buffer size (size is %d)",
-      buffer_size);
-    errno = ENOMEM;
-    return -1;
+    strcpy(addr_cache[addr_cache_count].fqdn, fqdn);
+    addr_cache[addr_cache_count].addr = *addr;
+    addr_cache_count++;
   }
 
-  dbn->capacity = buffer_size;
+  pthread_mutex_unlock(&addr_cache_lock);
+  return 0;
+}
+
+
+/**
+ * @brief Build the complete subscription request: one line per chunk of up
+ * to 1000 symbols (Databento limitation), followed by the session start.
+ *
+ * Lengths are computed up front so the request is written in a single pass
+ * into a single allocation, and can be sent with as few writes as possible.
+ *
+ * @param schema Pointer to null-terminated schema name.
+ * @param symbology Pointer to null-terminated symbology name.
+ * @param num_roots Number of symbols in roots, or 0 for all symbols.
+ * @param roots Pointer to array of pointers to null-terminated symbols.
+ * @param suffix Pointer to null-terminated suffix string to be applied to symbols.
+ * @param replay If true, request intra-day replay.
+ * @param start_session If true, end with the session start.
+ * @param length Pointer to populate with the length of the request, in bytes.
+ *
+ * @return Pointer to null-terminated request. Caller must free.
+ */
+static char *build_subscription(
+  const char *schema,
+  const char *symbology,
+  int num_roots,
+  const char * const *roots,
+  const char *suffix,
+  bool replay,
+  bool start_session,
+  size_t *length)
+{
+  const char *start = start_session ? "start_session=0\n" : "";
+  size_t start_length = strlen(start);
+  const char *start_field = replay ? "start=0|" : "";
 
 
   /*
-   * Allocate two buffers for liburing plus one buffer for "leftover" data
-   * that might happen when TCP read timing misaligns with internal kernel
-   * buffering of Databento TCP packets (which themselves always align with
-   * messages).
+   * Subscribing to all symbols means subscribing only to the special
+   * ALL_SYMBOLS symbol. Suffix is ignored.
    */
-  dbn->buffer0 = malloc(dbn->capacity);
-  dbn->buffer1 = malloc(dbn->capacity);
-  dbn->leftover = malloc(dbn->capacity);
-  if (!dbn->buffer0 || !dbn->buffer1 || !dbn->leftover)
+  if (num_roots == 0)
   {
-    int e = errno;
-    invoke_error_handler(
-      dbn,
-      true,
-      "Failed to allocate buffer (errno %d: %s)",
-      e,
-      strerror(e));
-    errno = e;
-    return -1;
+    int n = snprintf(NULL, 0, "schema=%s|stype_in=%s|%ssymbols=ALL_SYMBOLS\n%s", schema, symbology, start_field, start);
+    char *subscribe = malloc(n + 1);
+    snprintf(subscribe, n + 1, "schema=%s|stype_in=%s|%ssymbols=ALL_SYMBOLS\n%s", schema, symbology, start_field, start);
+    *length = n;
+    return subscribe;
   }
 
 
   /*
-   * Initialize the io_uring. Won't be used until we finish all early
-   * comms and are ready to receive dbn-encoded messages.
+   * Size the request. Every chunk's prefix is the same length (is_last is a
+   * single digit), and every symbol is followed by a single ',' or '\n'.
    */
-  io_uring_queue_init(2, &dbn->ring, 0);
+  int num_chunks = (num_roots + 999) / 1000;
+  int prefix_length = snprintf(NULL, 0, "schema=%s|stype_in=%s|%sis_last=0|symbols=", schema, symbology, start_field);
+  size_t suffix_length = strlen(suffix);
+
+  size_t n = (size_t)num_chunks * prefix_length + start_length;
+  for (int i = 0; i < num_roots; i++)
+    n += strlen(roots[i]) + suffix_length + 1;
+
+  char *subscribe = malloc(n + 1);
+  char *ptr = subscribe;
 
 
   /*
-   * Build the API FQDN.
+   * Write it.
    */
-  int dataset_length = 1 + strlen(dataset);
-  char *adjusted_dataset = malloc(dataset_length);
-  memcpy(adjusted_dataset, dataset, dataset_length);
-  for (int i = 0; i < dataset_length; i++)
+  for (int i = 0; i < num_roots; i += 1000)
   {
-    if (adjusted_dataset[i] == '.') adjusted_dataset[i] = '-';
-  }
-
-  int fqdn_length = 1 + snprintf(NULL, 0, "%s.lsg.databento.com", adjusted_dataset);
-  char *fqdn = malloc(fqdn_length);
-  snprintf(fqdn, fqdn_length, "%s.lsg.databento.com", adjusted_dataset);
-
-  free(adjusted_dataset);
+    int num_roots_i = num_roots - i;
+    if (num_roots_i > 1000) num_roots_i = 1000;
 
+    bool is_last = i + 1000 >= num_roots;
 
-  /*
-   * Resolve the API FQDN.
-   */
-  struct sockaddr_in addr;
-  addr.sin_family = AF_INET;
-  addr.sin_port = htons(13000);
+    ptr += snprintf(ptr, prefix_length + 1, "schema=%s|stype_in=%s|%sis_last=%s|symbols=", schema, symbology, start_field, is_last ? "1" : "0");
 
-  struct addrinfo hints, *res;
-  memset(&hints, 0, sizeof(struct addrinfo));
-  hints.ai_family = AF_INET;
-  hints.ai_socktype = 0;
-  int r;
-  if ((r = getaddrinfo(fqdn, NULL, &hints, &res)))
-  {
-    invoke_error_handler(
-      dbn,
-      true,
-      "Failed to resolve %s (%s)",
-      fqdn,
-      gai_strerror(r));
-    free(fqdn);
-    errno = ENXIO;
-    return -1;
+    for (int j = 0; j < num_roots_i; j++)
+    {
+      size_t m = strlen(roots[i + j]);
+      memcpy(ptr, roots[i + j], m);
+      ptr += m;
+      memcpy(ptr, suffix, suffix_length);
+      ptr += suffix_length;
+      *ptr++ = j == num_roots_i - 1 ? '\n' : ',';
+    }
   }
 
-  addr.sin_addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr;
+  memcpy(ptr, start, start_length + 1);
 
-  freeaddrinfo(res);
-  free(fqdn);
+  *length = n;
+  return subscribe;
+}
 
 
-  /*
-   * Connect.
-   */
-  char ipstr[INET_ADDRSTRLEN];
-  inet_ntop(addr.sin_family, &addr.sin_addr, ipstr, sizeof(ipstr));
+/**
+ * @brief Huge page size assumed when rounding huge page backed allocations.
+ */
+#define DBN_HUGEPAGE_SIZE (2 * 1024 * 1024)
 
-  if (connect(dbn->sock, (struct sockaddr *)&addr, sizeof(addr)))
-  {
-    int e = errno;
-    invoke_error_handler(
-      dbn,
-      true,
-      "Failed to connect (errno %d: %s)",
-      e,
-      strerror(e));
-    errno = e;
-    return -1;
-  }
 
+/**
+ * @brief Get the size actually mapped for a local buffer of a given size.
+ *
+ * @param dbn Pointer to client object.
+ * @param size Requested size, in bytes.
+ *
+ * @return Mapped size, in bytes.
+ */
+static size_t buffer_alloc_size(
+  dbn_t *dbn,
+  size_t size)
+{
+  size_t align = dbn->opts.hugepages == DBN_HUGEPAGES_NONE ? (size_t)sysconf(_SC_PAGESIZE) : DBN_HUGEPAGE_SIZE;
+  return (size + align - 1) / align * align;
+}
 
-  /*
-   * Receive lsg_version message.
-   */
-  char *msg0 = receive_control_message(dbn->sock);
 
-  if (!msg0)
+/**
+ * @brief Bind memory to the NUMA node selected by the numa_node option, if
+ * any. Must be called before the memory is first touched.
+ *
+ * @param dbn Pointer to client object.
+ * @param addr Pointer to page-aligned memory.
+ * @param n Number of bytes at addr.
+ *
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+static int bind_numa(
+  dbn_t *dbn,
+  void *addr,
+  size_t n)
+{
+  int node = dbn->opts.numa_node;
+  if (node == DBN_NUMA_NODE_CURRENT)
   {
-    invoke_error_handler(
-      dbn,
-      true,
-      "Error receiving first control message");
-    errno = EBADMSG;
-    return -1;
+    unsigned int cpu, current;
+    node = syscall(SYS_getcpu, &cpu, &current, NULL) ? DBN_NUMA_NODE_NONE : (int)current;
   }
 
-  char *lsg_version = get_control_message_field(msg0, "lsg_version");
-  free(msg0);
-  if (!lsg_version)
+  if (node < 0) return 0;
+
+  unsigned long mask[16];
+  if (node >= (int)(8 * sizeof(mask)))
   {
-    invoke_error_handler(
-      dbn,
-      true,
-      "First control message is missing lsg_version field");
-    errno = EBADMSG;
+    errno = EINVAL;
     return -1;
   }
 
-  free(lsg_version);
+  memset(mask, 0, sizeof(mask));
+  mask[node / (8 * sizeof(unsigned long))] |= 1ul << (node % (8 * sizeof(unsigned long)));
+  if (syscall(SYS_mbind, addr, n, MPOL_BIND, mask, 8 * sizeof(mask), 0)) return -1;
 
+  return 0;
+}
 
-  /*
-   * Receive cram message.
-   */
-  char *msg1 = receive_control_message(dbn->sock);
 
-  if (!msg1)
-  {
-    invoke_error_handler(
+/**
+ * @brief Allocate a local buffer, honoring the huge page and NUMA options.
+ *
+ * @param dbn Pointer to client object.
+ * @param size Requested size, in bytes.
+ *
+ * @return Pointer to buffer, or NULL on failure with errno set. Free with
+ * free_buffer().
+ *
+ * With a huge page or NUMA option set, the buffer is pre-faulted, after any
+ * NUMA policy is applied, so that page faults don't happen (and land on the
+ * wrong node) on the receive path. Otherwise pages are committed lazily, as
+ * they are first received into.
+ */
+static void *alloc_buffer(
+  dbn_t *dbn,
+  size_t size)
+{
+  size_t n = buffer_alloc_size(dbn, size);
+  void *buffer = MAP_FAILED;
+
+  if (dbn->opts.hugepages == DBN_HUGEPAGES_HUGETLB)
+  {
+    buffer = mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+    if (buffer == MAP_FAILED)
+    {
+      int e = errno;
+      invoke_error_handler(
+        dbn,
+        false,
+        "Failed to allocate explicit huge pages, falling back to transparent huge pages (errno %d: %s)",
+        e,
+        strerror(e));
+    }
+  }
+
+  if (buffer == MAP_FAILED)
+  {
+    buffer = mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (buffer == MAP_FAILED) return NULL;
+
+    if (dbn->opts.hugepages != DBN_HUGEPAGES_NONE)
+      madvise(buffer, n, MADV_HUGEPAGE);
+  }
+
+  if (bind_numa(dbn, buffer, n))
+  {
+    int e = errno;
+    munmap(buffer, n);
+    errno = e;
+    return NULL;
+  }
+
+  if (dbn->opts.hugepages != DBN_HUGEPAGES_NONE || dbn->opts.numa_node != DBN_NUMA_NODE_NONE)
+    memset(buffer, 0, n);
+  return buffer;
+}
+
+
+/**
+ * @brief Free a local buffer allocated with alloc_buffer().
+ *
+ * @param dbn Pointer to client object.
+ * @param buffer Pointer to buffer. May be NULL.
+ * @param size Size originally requested, in bytes.
+ */
+static void free_buffer(
+  dbn_t *dbn,
+  void *buffer,
+  size_t size)
+{
+  if (buffer) munmap(buffer, buffer_alloc_size(dbn, size));
+}
+
+
+/**
+ * @brief Add to a metric. Only the receiving thread writes metrics, so a
+ * relaxed load and store suffice (no locked read-modify-write), while
+ * readers on other threads still see whole values.
+ */
+static inline void metric_add(
+  uint64_t *metric,
+  uint64_t n)
+{
+  __atomic_store_n(metric, __atomic_load_n(metric, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * @brief Get the histogram bucket of a value.
+ */
+static inline int metric_bucket(uint64_t value)
+{
+  int bucket = value ? 64 - __builtin_clzll(value) : 0;
+  return bucket < DBN_METRICS_BUCKETS ? bucket : DBN_METRICS_BUCKETS - 1;
+}
+
+
+/**
+ * @brief Record metrics of a completed read.
+ *
+ * @param dbn Pointer to client object.
+ * @param num_bytes Number of bytes received by the read.
+ * @param num_messages Number of messages decoded as a result.
+ * @param straddled If the read ended partway through a message.
+ */
+static inline void count_read(
+  dbn_t *dbn,
+  size_t num_bytes,
+  int num_messages,
+  bool straddled)
+{
+  dbn_metrics_t *metrics = &dbn->metrics;
+  metric_add(&metrics->num_bytes, num_bytes);
+  metric_add(&metrics->num_messages, num_messages);
+  metric_add(&metrics->num_reads, 1);
+  if (straddled) metric_add(&metrics->num_straddles, 1);
+  metric_add(&metrics->read_messages[metric_bucket(num_messages)], 1);
+  metric_add(&metrics->read_bytes[metric_bucket(num_bytes / 64)], 1);
+}
+
+
+/**
+ * @brief Get the timestamp against which lag is measured for backpressure:
+ * ts_out if enabled, otherwise ts_recv.
+ *
+ * @param dbn Pointer to client object.
+ * @param msg Pointer to a complete message.
+ */
+static inline uint64_t lag_timestamp(
+  const dbn_t *dbn,
+  const uint8_t *msg)
+{
+  if (!dbn->ts_out) return dbn_ts_recv((const dbn_hdr_t *)msg);
+
+  uint64_t ts_out;
+  memcpy(&ts_out, msg + 4 * msg[0] - sizeof(ts_out), sizeof(ts_out));
+  return ts_out;
+}
+
+
+/**
+ * @brief After a socket read, compare the receive backlog against
+ * opts.backpressure_bytes, and invoke the backpressure handler if it is at
+ * or above it, or has just dropped back below it.
+ *
+ * @param dbn Pointer to client object.
+ * @param undecoded Number of bytes received but not yet decoded.
+ */
+static void check_backpressure(
+  dbn_t *dbn,
+  size_t undecoded)
+{
+  int queued;
+  if (ioctl(dbn->sock, SIOCINQ, &queued) < 0) return;
+
+  uint64_t backlog = (uint64_t)queued + undecoded;
+  bool backpressured = backlog >= dbn->opts.backpressure_bytes;
+  if (!backpressured && !dbn->backpressured) return;
+
+  dbn->backpressured = backpressured;
+  if (backpressured) metric_add(&dbn->metrics.num_backpressure, 1);
+  if (!dbn->on_backpressure) return;
+
+  int64_t lag = 0;
+  if (dbn->last_ts)
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    lag = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec - (int64_t)dbn->last_ts;
+  }
+
+  dbn->on_backpressure(dbn, backlog, lag);
+}
+
+
+/**
+ * @brief user_data tag bit marking a capture write completion. Receive
+ * requests are tagged with buffer pointers (aligned) or NULL, so never have
+ * it set.
+ */
+#define DBN_TAG_CAPTURE 1ull
+
+
+/**
+ * @brief user_data of the outstanding read of the wake eventfd. Even, so
+ * never a capture write, and too small to be a buffer pointer.
+ */
+#define DBN_TAG_WAKE 2ull
+
+
+/**
+ * @brief Position of the group member tag within user_data, above any user
+ * space pointer. See dbn_group_add().
+ */
+#define DBN_TAG_MEMBER_SHIFT 56
+
+
+/**
+ * @brief Bits of user_data below the group member tag.
+ */
+#define DBN_TAG_DATA_MASK ((1ull << DBN_TAG_MEMBER_SHIFT) - 1)
+
+
+/**
+ * @brief Set a request's user_data, tagged with the client's group member
+ * tag (if any) so that a shared io_uring's completion can find its client.
+ *
+ * @param dbn Pointer to client object.
+ * @param sqe Pointer to submission queue entry.
+ * @param data Untagged user_data.
+ */
+static inline void tag_sqe(
+  dbn_t *dbn,
+  struct io_uring_sqe *sqe,
+  uint64_t data)
+{
+  sqe->user_data = data | dbn->group_tag;
+}
+
+
+/**
+ * @brief Queue a read of the wake eventfd, which completes on dbn_wake().
+ * The caller submits it.
+ *
+ * @param dbn Pointer to client object.
+ */
+static void arm_wake(dbn_t *dbn)
+{
+  if (dbn->wake_fd < 0) return;
+
+  struct io_uring_sqe *sqe = io_uring_get_sqe(dbn->uring);
+  io_uring_prep_read(sqe, dbn->wake_fd, &dbn->wake_count, sizeof(dbn->wake_count), 0);
+  tag_sqe(dbn, sqe, DBN_TAG_WAKE);
+}
+
+
+/**
+ * @brief Handle completion of the read of the wake eventfd: queue the next
+ * one, so that later calls to dbn_wake() are seen too.
+ *
+ * @param dbn Pointer to client object.
+ * @param cqe Pointer to completion queue entry. Marked as seen by this function.
+ *
+ * @return 0, the number of messages received.
+ */
+static int handle_wake(
+  dbn_t *dbn,
+  struct io_uring_cqe *cqe)
+{
+  io_uring_cqe_seen(dbn->uring, cqe);
+  arm_wake(dbn);
+  io_uring_submit(dbn->uring);
+  return 0;
+}
+
+
+/**
+ * @brief Queue a write of the unwritten remainder of a capture write. The
+ * caller submits it.
+ *
+ * @param dbn Pointer to client object.
+ * @param tag Index of the write in captures, returned by its completion shifted past DBN_TAG_CAPTURE.
+ */
+static void submit_capture(
+  dbn_t *dbn,
+  uint64_t tag)
+{
+  dbn_capture_t *capture = &dbn->captures[tag];
+  struct io_uring_sqe *sqe = io_uring_get_sqe(dbn->uring);
+  io_uring_prep_write(sqe, dbn->capture_fd, capture->data, capture->length, capture->offset);
+  tag_sqe(dbn, sqe, tag << 1 | DBN_TAG_CAPTURE);
+}
+
+
+/**
+ * @brief Queue an asynchronous write of received data to the capture file.
+ * The caller submits it, and must not hand the data's buffer back for
+ * receiving until handle_capture() sees the write complete.
+ *
+ * @param dbn Pointer to client object.
+ * @param data Pointer to received data. Must not be modified until the write completes.
+ * @param n Number of bytes at data.
+ * @param tag Index of the write in captures: the receive buffer holding the data.
+ */
+static void prep_capture(
+  dbn_t *dbn,
+  const void *data,
+  size_t n,
+  uint64_t tag)
+{
+  dbn_capture_t *capture = &dbn->captures[tag];
+  capture->data = data;
+  capture->length = n;
+  capture->offset = dbn->capture_offset;
+  submit_capture(dbn, tag);
+
+  dbn->capture_offset += n;
+  dbn->capture_pending++;
+}
+
+
+/**
+ * @brief Prepare a recv request, as a recvmsg with ancillary data if receive
+ * timestamps are enabled.
+ *
+ * @param dbn Pointer to client object.
+ * @param sqe Pointer to submission queue entry.
+ * @param slot Index of the recvmsg header to use, one per outstanding request.
+ * @param buffer Pointer to receive buffer.
+ * @param n Size of receive buffer, in bytes.
+ */
+static void prep_recv(
+  dbn_t *dbn,
+  struct io_uring_sqe *sqe,
+  int slot,
+  void *buffer,
+  size_t n)
+{
+  if (!dbn->opts.rx_timestamps)
+  {
+    io_uring_prep_recv(sqe, dbn->sock, buffer, n, 0);
+    return;
+  }
+
+  struct msghdr *msg = &dbn->rx_msgs[slot];
+  memset(msg, 0, sizeof(struct msghdr));
+  dbn->rx_iovs[slot].iov_base = buffer;
+  dbn->rx_iovs[slot].iov_len = n;
+  msg->msg_iov = &dbn->rx_iovs[slot];
+  msg->msg_iovlen = 1;
+  msg->msg_control = dbn->rx_controls[slot];
+  msg->msg_controllen = DBN_RX_CONTROL_SIZE;
+
+  io_uring_prep_recvmsg(sqe, dbn->sock, msg, 0);
+}
+
+
+/**
+ * @brief Get the receive timestamp carried by a control message, if any.
+ *
+ * @param cmsg Pointer to control message.
+ *
+ * @return Hardware timestamp if present, otherwise software timestamp, in
+ * Unix nanoseconds, or 0 if cmsg is not a timestamping control message.
+ */
+static uint64_t cmsg_rx_timestamp(struct cmsghdr *cmsg)
+{
+  if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SO_TIMESTAMPING)
+    return 0;
+
+  struct timespec ts[3]; // Software, (deprecated), raw hardware
+  memcpy(ts, CMSG_DATA(cmsg), sizeof(ts));
+
+  struct timespec *t = (ts[2].tv_sec || ts[2].tv_nsec) ? &ts[2] : &ts[0];
+  return t->tv_sec * 1000000000ul + t->tv_nsec;
+}
+
+
+/**
+ * @brief Record the receive timestamp of a completed recvmsg, if any.
+ *
+ * @param dbn Pointer to client object.
+ * @param msg Pointer to completed recvmsg header.
+ */
+static void read_rx_timestamp(
+  dbn_t *dbn,
+  struct msghdr *msg)
+{
+  for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
+  {
+    uint64_t ts = cmsg_rx_timestamp(cmsg);
+    if (ts)
+    {
+      dbn->rx_timestamp = ts;
+      return;
+    }
+  }
+}
+
+
+/**
+ * @brief io_uring buffer group ID used for provided buffers. Members of a
+ * dbn_group_t add their member index.
+ */
+#define DBN_BUFFER_GROUP 0
+
+
+/**
+ * @brief Initialize the io_uring, applying SQPOLL options.
+ *
+ * @param dbn Pointer to client object.
+ * @param entries Number of submission queue entries.
+ * @param params Pointer to io_uring parameters, possibly with flags already set.
+ *
+ * @return 0 on success, or -1 on failure with errno set and error handler
+ * invoked (if not NULL).
+ */
+static int init_ring(
+  dbn_t *dbn,
+  unsigned int entries,
+  struct io_uring_params *params)
+{
+  /*
+   * Group members use the group's io_uring.
+   */
+  if (dbn->group) return 0;
+
+  if (dbn->opts.sqpoll)
+  {
+    params->flags |= IORING_SETUP_SQPOLL;
+    params->sq_thread_idle = dbn->opts.sqpoll_idle_ms;
+    if (dbn->opts.sqpoll_cpu >= 0)
+    {
+      params->flags |= IORING_SETUP_SQ_AFF;
+      params->sq_thread_cpu = dbn->opts.sqpoll_cpu;
+    }
+  }
+
+  int r = io_uring_queue_init_params(entries, dbn->uring, params);
+  if (r < 0)
+  {
+    invoke_error_handler(
+      dbn,
+      true,
+      "Failed to initialize io_uring (errno %d: %s)",
+      -r,
+      strerror(-r));
+    errno = -r;
+    return -1;
+  }
+
+  dbn->ring_initialized = true;
+  return 0;
+}
+
+
+/**
+ * @brief Set up the io_uring and a registered ring of provided buffers for
+ * DBN_RECV_MODE_MULTISHOT.
+ *
+ * @param dbn Pointer to client object.
+ *
+ * @return 0 on success, or -1 on failure with errno set and error handler
+ * invoked (if not NULL).
+ */
+static int setup_multishot(dbn_t *dbn)
+{
+  int num_buffers = dbn->opts.num_provided_buffers;
+  int buffer_size = dbn->opts.provided_buffer_size;
+
+  int overhead = dbn->opts.rx_timestamps ? sizeof(struct io_uring_recvmsg_out) + DBN_RX_CONTROL_SIZE : 0;
+
+  if (num_buffers < 1
+    || num_buffers > 32768
+    || (num_buffers & (num_buffers - 1))
+    || buffer_size < DBN_MAX_RECORD_SIZE + overhead)
+  {
+    invoke_error_handler(
+      dbn,
+      true,
+      "Invalid provided buffer configuration (%d buffers of %d bytes)",
+      num_buffers,
+      buffer_size);
+    errno = EINVAL;
+    return -1;
+  }
+
+
+  /*
+   * A message can straddle two provided buffers, but never by more than a
+   * single record, so the leftover buffer only needs to hold one record.
+   */
+  dbn->provided_buffers = alloc_buffer(dbn, (size_t)num_buffers * buffer_size);
+  dbn->leftover = malloc(DBN_MAX_RECORD_SIZE);
+  if (!dbn->provided_buffers || !dbn->leftover)
+  {
+    int e = errno;
+    invoke_error_handler(
+      dbn,
+      true,
+      "Failed to allocate buffer (errno %d: %s)",
+      e,
+      strerror(e));
+    errno = e;
+    return -1;
+  }
+
+
+  /*
+   * Size the completion queue so that the kernel can post a completion for
+   * every provided buffer (and its capture write, if any) without
+   * overflowing (which would terminate the multishot recv).
+   */
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = dbn->opts.capture_path ? 2 * num_buffers : num_buffers;
+
+  if (init_ring(dbn, 2, &params)) return -1;
+
+
+  /*
+   * Allocate, register, and populate the provided buffer ring.
+   */
+  dbn->buf_ring = mmap(
+    NULL,
+    num_buffers * sizeof(struct io_uring_buf),
+    PROT_READ | PROT_WRITE,
+    MAP_ANONYMOUS | MAP_PRIVATE,
+    -1,
+    0);
+  if (dbn->buf_ring == MAP_FAILED)
+  {
+    int e = errno;
+    dbn->buf_ring = NULL;
+    invoke_error_handler(
+      dbn,
+      true,
+      "Failed to allocate provided buffer ring (errno %d: %s)",
+      e,
+      strerror(e));
+    errno = e;
+    return -1;
+  }
+
+  io_uring_buf_ring_init(dbn->buf_ring);
+
+  struct io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (unsigned long)dbn->buf_ring;
+  reg.ring_entries = num_buffers;
+  reg.bgid = dbn->buffer_group;
+
+  int r = io_uring_register_buf_ring(dbn->uring, &reg, 0);
+  if (r < 0)
+  {
+    invoke_error_handler(
+      dbn,
+      true,
+      "Failed to register provided buffer ring (errno %d: %s)",
+      -r,
+      strerror(-r));
+    errno = -r;
+    return -1;
+  }
+
+  int mask = io_uring_buf_ring_mask(num_buffers);
+  for (int i = 0; i < num_buffers; i++)
+  {
+    io_uring_buf_ring_add(
+      dbn->buf_ring,
+      dbn->provided_buffers + (size_t)i * buffer_size,
+      buffer_size,
+      i,
+      mask,
+      i);
+  }
+  io_uring_buf_ring_advance(dbn->buf_ring, num_buffers);
+
+  return 0;
+}
+
+
+/**
+ * @brief Submit a multishot recv request that draws from the provided buffer
+ * ring. Remains armed until the kernel terminates it (no IORING_CQE_F_MORE).
+ *
+ * @param dbn Pointer to client object.
+ */
+static void arm_multishot(dbn_t *dbn)
+{
+  struct io_uring_sqe *sqe = io_uring_get_sqe(dbn->uring);
+
+  /*
+   * With receive timestamps, each provided buffer starts with a recvmsg
+   * header and ancillary data, followed by the payload.
+   */
+  if (dbn->opts.rx_timestamps)
+  {
+    struct msghdr *msg = &dbn->rx_msgs[0];
+    memset(msg, 0, sizeof(struct msghdr));
+    msg->msg_controllen = DBN_RX_CONTROL_SIZE;
+    io_uring_prep_recvmsg_multishot(sqe, dbn->sock, msg, 0);
+  }
+  else io_uring_prep_recv_multishot(sqe, dbn->sock, NULL, 0, 0);
+
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = dbn->buffer_group;
+  tag_sqe(dbn, sqe, 0);
+
+  io_uring_submit(dbn->uring);
+}
+
+
+/**
+ * @brief Determine if a character can be part of a symbol, for finding
+ * symbols in message text.
+ */
+static inline bool is_symbol_char(char c)
+{
+  return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '.' || c == '_';
+}
+
+
+/**
+ * @brief Determine if message text names a symbol, as a whole word.
+ *
+ * @param text Pointer to text, null-terminated or filling its buffer.
+ * @param n Size of the text buffer, in bytes.
+ * @param symbol Pointer to null-terminated, non-empty symbol.
+ */
+static bool mentions(
+  const char *text,
+  size_t n,
+  const char *symbol)
+{
+  size_t length = strlen(symbol);
+  size_t end = strnlen(text, n);
+  for (size_t i = 0; i + length <= end; i++)
+  {
+    if ((i == 0 || !is_symbol_char(text[i - 1]))
+      && !memcmp(text + i, symbol, length)
+      && (i + length == end || !is_symbol_char(text[i + length]))) return true;
+  }
+  return false;
+}
+
+
+/**
+ * @brief On receipt of an SMAP, SMSG or EMSG while dbn_subscribe() requests
+ * are pending, retire the pending symbols it settles: those an SMAP confirms,
+ * or that an SMSG or EMSG names (which the gateway sends in place of an SMAP
+ * for a symbol it rejects). An SMAP also completes every sent all-symbols
+ * request, and an EMSG fails them.
+ *
+ * @param dbn Pointer to client object.
+ * @param msg Pointer to message.
+ */
+static void retire_pending(
+  dbn_t *dbn,
+  const uint8_t *msg)
+{
+  const char *text = NULL;
+  if (msg[1] == DBN_RTYPE_SMSG) text = ((const dbn_smsg_t *)msg)->msg;
+  else if (msg[1] == DBN_RTYPE_EMSG) text = ((const dbn_emsg_t *)msg)->msg;
+  size_t text_size = sizeof(((dbn_smsg_t *)0)->msg);
+  int num_rejected = 0;
+  uint64_t rejected_id = 0;
+
+  pthread_mutex_lock(&dbn->pending_lock);
+  for (int i = 0; i < dbn->num_pending_symbols; )
+  {
+    dbn_pending_t *p = &dbn->pending[i];
+    bool retire;
+    if (!p->symbol[0])
+      retire = p->sent && msg[1] != DBN_RTYPE_SMSG;
+    else if (!text)
+      retire = !strncmp(p->symbol, ((const dbn_smap_t *)msg)->stype_in_symbol, sizeof(((dbn_smap_t *)0)->stype_in_symbol));
+    else
+      retire = mentions(text, text_size, p->symbol);
+
+    if (!retire)
+    {
+      i++;
+      continue;
+    }
+
+    if (text && !num_rejected++) rejected_id = p->id;
+    *p = dbn->pending[--dbn->num_pending_symbols];
+  }
+  atomic_store_explicit(&dbn->num_pending, dbn->num_pending_symbols, memory_order_relaxed);
+  pthread_mutex_unlock(&dbn->pending_lock);
+
+
+  /*
+   * Report outside the lock, so that the handler may check requests.
+   */
+  if (num_rejected)
+  {
+    invoke_error_handler(
+      dbn,
+      false,
+      "Retired %d pending symbol%s, first of subscription request %" PRIu64 ", on gateway message: %.*s",
+      num_rejected,
+      num_rejected == 1 ? "" : "s",
+      rejected_id,
+      (int)text_size,
+      text);
+  }
+}
+
+
+/**
+ * @brief Determine if a message may settle pending dbn_subscribe() symbols,
+ * see retire_pending().
+ */
+static inline bool settles_pending(uint8_t rtype)
+{
+  return rtype == DBN_RTYPE_SMAP || rtype == DBN_RTYPE_SMSG || rtype == DBN_RTYPE_EMSG;
+}
+
+
+/**
+ * @brief Initial number of entries of the sequence number table.
+ */
+#define DBN_SEQUENCE_INITIAL_ENTRIES 1024
+
+
+/**
+ * @brief Find the sequence number table entry of an instrument: either the
+ * entry holding it, or the unused entry at which to insert it. Linear
+ * probing from a multiplicative hash, which spreads runs of consecutive IDs
+ * over distinct entries.
+ */
+static inline dbn_sequence_entry_t *find_sequence(
+  dbn_sequence_entry_t *table,
+  uint32_t mask,
+  uint32_t instrument_id)
+{
+  uint32_t i = (instrument_id * 0x9E3779B1u) & mask;
+  while (table[i].instrument_id != instrument_id && table[i].instrument_id != DBN_SEQUENCE_EMPTY)
+    i = (i + 1) & mask;
+  return &table[i];
+}
+
+
+/**
+ * @brief Double the size of the sequence number table (or allocate it).
+ *
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+static int grow_sequences(dbn_t *dbn)
+{
+  uint32_t n = dbn->sequences ? 2 * (dbn->sequences_mask + 1) : DBN_SEQUENCE_INITIAL_ENTRIES;
+  dbn_sequence_entry_t *table = malloc(n * sizeof(dbn_sequence_entry_t));
+  if (!table) return -1;
+  memset(table, 0xFF, n * sizeof(dbn_sequence_entry_t));
+
+  if (dbn->sequences)
+  {
+    for (uint32_t i = 0; i <= dbn->sequences_mask; i++)
+    {
+      if (dbn->sequences[i].instrument_id != DBN_SEQUENCE_EMPTY)
+        *find_sequence(table, n - 1, dbn->sequences[i].instrument_id) = dbn->sequences[i];
+    }
+    free(dbn->sequences);
+  }
+
+  dbn->sequences = table;
+  dbn->sequences_mask = n - 1;
+  return 0;
+}
+
+
+/**
+ * @brief Check a message's sequence number against the last one received
+ * for its instrument, if its rtype carries one.
+ *
+ * @param dbn Pointer to client object.
+ * @param msg Pointer to a complete message.
+ */
+static inline void check_sequence(
+  dbn_t *dbn,
+  uint8_t *msg)
+{
+  if (msg[1] != DBN_RTYPE_BBO1S && msg[1] != DBN_RTYPE_BBO1M) return;
+
+
+  /*
+   * decode() tests opts.sequence once per read, so checking may have been
+   * disabled (below) since.
+   */
+  if (dbn->opts.sequence == DBN_SEQUENCE_NONE) return;
+
+  dbn_hdr_t *hdr = (dbn_hdr_t *)msg;
+  uint32_t sequence = ((dbn_bbo_t *)msg)->sequence;
+
+  if (dbn->num_sequences >= (dbn->sequences_mask + 1) / 2)
+  {
+    if (grow_sequences(dbn))
+    {
+      int e = errno;
+      invoke_error_handler(
+        dbn,
+        false,
+        "Failed to grow sequence number table, sequence checking disabled (errno %d: %s)",
+        e,
+        strerror(e));
+      dbn->opts.sequence = DBN_SEQUENCE_NONE;
+      return;
+    }
+  }
+
+  dbn_sequence_entry_t *entry = find_sequence(dbn->sequences, dbn->sequences_mask, hdr->instrument_id);
+  if (entry->instrument_id == DBN_SEQUENCE_EMPTY)
+  {
+    entry->instrument_id = hdr->instrument_id;
+    entry->sequence = sequence;
+    dbn->num_sequences++;
+    return;
+  }
+
+  /*
+   * Only move the tracker forwards, so that a duplicate or stale message
+   * doesn't make the next in-order one look like a gap, or hide a later one
+   * that is still behind.
+   */
+  uint32_t last = entry->sequence;
+  int32_t ahead = (int32_t)(sequence - last);
+  if (ahead > 0) entry->sequence = sequence;
+  if (ahead == 1) return;
+
+  if (ahead <= 0) metric_add(&dbn->metrics.num_sequence_duplicates, 1);
+  else if (dbn->opts.sequence == DBN_SEQUENCE_CONTIGUOUS) metric_add(&dbn->metrics.num_sequence_gaps, 1);
+  else return;
+
+  if (dbn->on_sequence) dbn->on_sequence(dbn, hdr, last, sequence);
+}
+
+
+/**
+ * @brief Decode as many complete messages as possible from received data,
+ * and dispatch them.
+ *
+ * @param dbn Pointer to client object.
+ * @param data Pointer to received data, starting at a message boundary.
+ * @param n Number of bytes at data.
+ * @param consumed Pointer where the number of bytes decoded will be stored.
+ * Any remaining bytes are the start of an incomplete message.
+ *
+ * @return Number of messages dispatched, or -1 on failure with errno set and
+ * error handler invoked (if not NULL).
+ */
+static inline int decode(
+  dbn_t *dbn,
+  uint8_t *data,
+  ssize_t n,
+  ssize_t *consumed)
+{
+  uint8_t *ptr = data;
+  uint8_t *last = NULL;
+  int num_messages;
+  bool pending = atomic_load_explicit(&dbn->num_pending, memory_order_acquire) > 0;
+  bool sequenced = dbn->opts.sequence != DBN_SEQUENCE_NONE;
+  dbn_export_producer_t *exporting = dbn->export_producer;
+
+
+  /*
+   * With a batch handler, just find the end of the last complete message and
+   * dispatch everything up to it in one call.
+   */
+  if (dbn->on_batch)
+  {
+    for (num_messages = 0; ; num_messages++)
+    {
+      if (n < 16) break; // Not enough data for a header
+
+      int rlength = 4 * ptr[0];
+      if (rlength < 16)
+      {
+        invoke_error_handler(
+          dbn,
+          true,
+          "Bad message length %d",
+          rlength);
+        errno = EBADMSG;
+        return -1;
+      }
+      if (n < rlength) break; // Not enough data for this message
+
+      if (pending && settles_pending(ptr[1])) retire_pending(dbn, ptr);
+      if (sequenced) check_sequence(dbn, ptr);
+      if (dbn->quotes) dbn_quotes_update(dbn->quotes, (dbn_hdr_t *)ptr);
+      if (exporting) dbn_export_push(exporting, (dbn_hdr_t *)ptr);
+
+      last = ptr;
+      ptr += rlength;
+      n -= rlength;
+    }
+
+    if (last && dbn->opts.backpressure_bytes) dbn->last_ts = lag_timestamp(dbn, last);
+    if (exporting) dbn_export_commit(exporting);
+
+    if (num_messages)
+    {
+      dbn_batch_t batch;
+      batch.data = data;
+      batch.length = ptr - data;
+      batch.count = num_messages;
+      batch.ts_rx = dbn->rx_timestamp;
+      dbn->on_batch(dbn, &batch);
+    }
+
+    *consumed = ptr - data;
+    return num_messages;
+  }
+
+
+  /*
+   * Otherwise dispatch messages one at a time.
+   */
+  for (num_messages = 0; ; num_messages++)
+  {
+    if (n < 16) break; // Not enough data for a header
+
+    int rlength = 4 * ptr[0];
+    if (rlength < 16)
+    {
+      invoke_error_handler(
+        dbn,
+        true,
+        "Bad message length %d",
+        rlength);
+      errno = EBADMSG;
+      return -1;
+    }
+    if (n < rlength) break; // Not enough data for this message
+
+    if (pending && settles_pending(ptr[1])) retire_pending(dbn, ptr);
+    if (sequenced) check_sequence(dbn, ptr);
+    if (dbn->quotes) dbn_quotes_update(dbn->quotes, (dbn_hdr_t *)ptr);
+    if (exporting) dbn_export_push(exporting, (dbn_hdr_t *)ptr);
+
+    dbn_on_msg_t handler = dbn->handlers[ptr[1]];
+    if (handler) handler(
+      dbn,
+      (dbn_hdr_t *)ptr);
+
+    last = ptr;
+    ptr += rlength;
+    n -= rlength;
+  }
+
+  if (last && dbn->opts.backpressure_bytes) dbn->last_ts = lag_timestamp(dbn, last);
+  if (exporting) dbn_export_commit(exporting);
+
+  *consumed = ptr - data;
+  return num_messages;
+}
+
+
+/**
+ * @brief Allocate the ring buffer for DBN_RECV_MODE_MIRROR: a memfd mapped
+ * twice, back to back, so that any span of up to capacity bytes starting
+ * anywhere in the first mapping is contiguous in virtual memory.
+ *
+ * @param dbn Pointer to client object. capacity is rounded up to a whole
+ * number of (huge) pages.
+ *
+ * @return 0 on success, or -1 on failure with errno set and error handler
+ * invoked (if not NULL).
+ */
+static int setup_mirror(dbn_t *dbn)
+{
+  size_t n = buffer_alloc_size(dbn, dbn->capacity);
+  if (n < 2 * DBN_MAX_RECORD_SIZE || n > INT32_MAX)
+  {
+    invoke_error_handler(
+      dbn,
+      true,
+      "Invalid mirror ring size %zu",
+      n);
+    errno = EINVAL;
+    return -1;
+  }
+
+  unsigned int flags = MFD_CLOEXEC;
+  if (dbn->opts.hugepages == DBN_HUGEPAGES_HUGETLB) flags |= MFD_HUGETLB;
+
+  int fd = syscall(SYS_memfd_create, "dbn", flags);
+  if (fd < 0 && (flags & MFD_HUGETLB))
+  {
+    invoke_error_handler(
+      dbn,
+      false,
+      "Failed to allocate explicit huge pages, falling back to regular pages (errno %d: %s)",
+      errno,
+      strerror(errno));
+    fd = syscall(SYS_memfd_create, "dbn", MFD_CLOEXEC);
+  }
+
+  uint8_t *base = MAP_FAILED;
+  if (fd >= 0 && !ftruncate(fd, n))
+  {
+    base = mmap(NULL, 2 * n, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base != MAP_FAILED
+      && (mmap(base, n, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+        || mmap(base + n, n, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED))
+    {
+      int e = errno;
+      munmap(base, 2 * n);
+      base = MAP_FAILED;
+      errno = e;
+    }
+  }
+
+  int e = errno;
+  if (fd >= 0) close(fd);
+
+  if (base == MAP_FAILED)
+  {
+    invoke_error_handler(
+      dbn,
+      true,
+      "Failed to map mirror ring (errno %d: %s)",
+      e,
+      strerror(e));
+    errno = e;
+    return -1;
+  }
+
+  if (dbn->opts.hugepages == DBN_HUGEPAGES_THP)
+    madvise(base, n, MADV_HUGEPAGE);
+
+  if (bind_numa(dbn, base, n))
+  {
+    e = errno;
+    munmap(base, 2 * n);
+    invoke_error_handler(
+      dbn,
+      true,
+      "Failed to bind mirror ring to NUMA node (errno %d: %s)",
+      e,
+      strerror(e));
+    errno = e;
+    return -1;
+  }
+
+  memset(base, 0, n);
+
+  dbn->capacity = n;
+  dbn->mirror = base;
+  dbn->mirror_head = 0;
+  dbn->mirror_tail = 0;
+  dbn->mirror_captured = 0;
+  dbn->mirror_armed = false;
+  return 0;
+}
+
+
+/**
+ * @brief Submit a recv request into all free space of the mirror ring, for
+ * DBN_RECV_MODE_MIRROR, unless one is outstanding, along with anything else
+ * queued.
+ *
+ * @param dbn Pointer to client object.
+ */
+static void arm_mirror(dbn_t *dbn)
+{
+  /*
+   * Data not yet in the capture file isn't free either. With nothing free
+   * the recv is armed once the capture write completes.
+   */
+  uint64_t head = dbn->mirror_head;
+  if (dbn->opts.capture_path && dbn->mirror_captured < head) head = dbn->mirror_captured;
+  size_t free_space = dbn->capacity - (dbn->mirror_tail - head);
+
+  if (!dbn->mirror_armed && free_space)
+  {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(dbn->uring);
+    prep_recv(
+      dbn,
+      sqe,
+      0,
+      dbn->mirror + dbn->mirror_tail % dbn->capacity,
+      free_space);
+    tag_sqe(dbn, sqe, 0);
+    dbn->mirror_armed = true;
+  }
+
+  io_uring_submit(dbn->uring);
+}
+
+
+/**
+ * @brief Queue a capture write of everything received but not yet written,
+ * for DBN_RECV_MODE_MIRROR, unless one is already in flight. The caller
+ * submits it.
+ *
+ * @param dbn Pointer to client object.
+ */
+static void capture_mirror(dbn_t *dbn)
+{
+  if (dbn->capture_pending || dbn->mirror_captured == dbn->mirror_tail) return;
+
+  prep_capture(
+    dbn,
+    dbn->mirror + dbn->mirror_captured % dbn->capacity,
+    dbn->mirror_tail - dbn->mirror_captured,
+    0);
+}
+
+
+/**
+ * @brief Handle a completion of the recv, for DBN_RECV_MODE_MIRROR.
+ *
+ * @param dbn Pointer to client object.
+ * @param cqe Pointer to completion queue entry. Marked as seen by this function.
+ *
+ * @return Number of messages received, or -1 on failure with errno set and
+ * error handler invoked (if not NULL).
+ */
+static int get_mirror(
+  dbn_t *dbn,
+  struct io_uring_cqe *cqe)
+{
+  ssize_t n = cqe->res;
+  io_uring_cqe_seen(dbn->uring, cqe);
+  dbn->mirror_armed = false;
+
+  if (n == 0)
+  {
+    invoke_error_handler(
+      dbn,
+      true,
+      "Connection closed unexpectedly");
+    errno = ECONNRESET;
+    return -1;
+  }
+  else if (n < 0)
+  {
+    invoke_error_handler(
+      dbn,
+      true,
+      "Error reading from socket (errno %d: %s)",
+      (int)-n,
+      strerror(-n));
+    errno = -n;
+    return -1;
+  }
+
+
+  if (dbn->opts.rx_timestamps) read_rx_timestamp(dbn, &dbn->rx_msgs[0]);
+
+
+  /*
+   * Everything received but not yet decoded is contiguous starting at the
+   * head, including any message that straddled the previous read, so it
+   * can be decoded in place with no copying.
+   */
+  dbn->mirror_tail += n;
+
+  ssize_t consumed;
+  int num_messages = decode(
+    dbn,
+    dbn->mirror + dbn->mirror_head % dbn->capacity,
+    dbn->mirror_tail - dbn->mirror_head,
+    &consumed);
+  if (num_messages < 0) return -1;
+
+  dbn->mirror_head += consumed;
+
+  count_read(dbn, n, num_messages, dbn->mirror_head != dbn->mirror_tail);
+  if (dbn->opts.backpressure_bytes) check_backpressure(dbn, dbn->mirror_tail - dbn->mirror_head);
+
+
+  /*
+   * The next recv won't land on data until it has been captured, see
+   * arm_mirror().
+   */
+  if (dbn->opts.capture_path) capture_mirror(dbn);
+
+  arm_mirror(dbn);
+
+  return num_messages;
+}
+
+
+/**
+ * @brief Handle a completion of the multishot recv, for
+ * DBN_RECV_MODE_MULTISHOT.
+ *
+ * @param dbn Pointer to client object.
+ * @param cqe Pointer to completion queue entry. Marked as seen by this function.
+ *
+ * @return Number of messages received, or -1 on failure with errno set and
+ * error handler invoked (if not NULL).
+ */
+static int get_multishot(
+  dbn_t *dbn,
+  struct io_uring_cqe *cqe)
+{
+  ssize_t n = cqe->res;
+  unsigned int flags = cqe->flags;
+  io_uring_cqe_seen(dbn->uring, cqe);
+
+
+  /*
+   * Running out of provided buffers just means we fell behind the kernel.
+   * The multishot recv terminates, and since every buffer is handed back as
+   * soon as it's decoded, we can re-arm right away.
+   */
+  if (n == -ENOBUFS)
+  {
+    invoke_error_handler(
+      dbn,
+      false,
+      "Provided buffers exhausted");
+    if (!(flags & IORING_CQE_F_MORE)) arm_multishot(dbn);
+    return 0;
+  }
+  else if (n == 0)
+  {
+    invoke_error_handler(
+      dbn,
+      true,
+      "Connection closed unexpectedly");
+    errno = ECONNRESET;
+    return -1;
+  }
+  else if (n < 0)
+  {
+    invoke_error_handler(
+      dbn,
+      true,
+      "Error reading from socket (errno %d: %s)",
+      (int)-n,
+      strerror(-n));
+    errno = -n;
+    return -1;
+  }
+
+  if (!(flags & IORING_CQE_F_BUFFER))
+  {
+    invoke_error_handler(
+      dbn,
+      true,
+      "Receive completed without a provided buffer");
+    errno = EBADMSG;
+    return -1;
+  }
+
+  int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+  uint8_t *buffer = dbn->provided_buffers + (size_t)bid * dbn->opts.provided_buffer_size;
+  uint8_t *ptr = buffer;
+  int num_messages = 0;
+
+  if (dbn->opts.rx_timestamps)
+  {
+    struct msghdr *msg = &dbn->rx_msgs[0];
+    struct io_uring_recvmsg_out *out = io_uring_recvmsg_validate(buffer, n, msg);
+    if (!out)
+    {
+      invoke_error_handler(
+        dbn,
+        true,
+        "Malformed multishot recvmsg completion");
+      errno = EBADMSG;
+      return -1;
+    }
+
+    for (struct cmsghdr *cmsg = io_uring_recvmsg_cmsg_firsthdr(out, msg); cmsg; cmsg = io_uring_recvmsg_cmsg_nexthdr(out, msg, cmsg))
+    {
+      uint64_t ts = cmsg_rx_timestamp(cmsg);
+      if (ts)
+      {
+        dbn->rx_timestamp = ts;
+        break;
+      }
+    }
+
+    ptr = io_uring_recvmsg_payload(out, msg);
+    n = io_uring_recvmsg_payload_length(out, n, msg);
+    if (n == 0)
+    {
+      invoke_error_handler(
+        dbn,
+        true,
+        "Connection closed unexpectedly");
+      errno = ECONNRESET;
+      return -1;
+    }
+  }
+
+  uint8_t *received = ptr;
+  size_t num_received = n;
+
+
+  /*
+   * Completions arrive in stream order, so a message left incomplete at the
+   * end of the previous buffer continues at the start of this one. Copy
+   * just enough to complete it (never more than one record) and dispatch it
+   * from the leftover buffer.
+   */
+  if (dbn->leftover_count)
+  {
+    int rlength = 4 * dbn->leftover[0];
+    if (rlength < 16)
+    {
+      invoke_error_handler(
+        dbn,
+        true,
+        "Bad message length %d",
+        rlength);
+      errno = EBADMSG;
+      return -1;
+    }
+
+    ssize_t m = rlength - dbn->leftover_count;
+    if (m > n) m = n;
+    memcpy(dbn->leftover + dbn->leftover_count, ptr, m);
+    dbn->leftover_count += m;
+    ptr += m;
+    n -= m;
+
+    ssize_t consumed;
+    int r = decode(dbn, dbn->leftover, dbn->leftover_count, &consumed);
+    if (r < 0) return -1;
+    if (consumed) dbn->leftover_count = 0;
+    num_messages += r;
+  }
+
+
+  /*
+   * Decode the rest of the buffer in place, and keep any incomplete message
+   * at the end.
+   */
+  ssize_t consumed;
+  int r = decode(dbn, ptr, n, &consumed);
+  if (r < 0) return -1;
+  num_messages += r;
+
+  count_read(dbn, num_received, num_messages, n - consumed);
+  if (n - consumed)
+  {
+    memcpy(dbn->leftover, ptr + consumed, n - consumed);
+    dbn->leftover_count = n - consumed;
+  }
+  if (dbn->opts.backpressure_bytes) check_backpressure(dbn, n - consumed);
+
+
+  /*
+   * Hand the buffer back to the kernel (once its data is in the capture
+   * file, if any), and re-arm the recv if the kernel terminated it.
+   */
+  if (dbn->opts.capture_path)
+  {
+    prep_capture(dbn, received, num_received, bid);
+    io_uring_submit(dbn->uring);
+  }
+  else
+  {
+    io_uring_buf_ring_add(
+      dbn->buf_ring,
+      buffer,
+      dbn->opts.provided_buffer_size,
+      bid,
+      io_uring_buf_ring_mask(dbn->opts.num_provided_buffers),
+      0);
+    io_uring_buf_ring_advance(dbn->buf_ring, 1);
+  }
+
+  if (!(flags & IORING_CQE_F_MORE)) arm_multishot(dbn);
+
+  return num_messages;
+}
+
+
+/**
+ * @brief Configure a newly created or attached socket, and allocate receive
+ * buffers and the io_uring according to the receive mode.
+ *
+ * @param dbn Pointer to client object, with sock set.
+ *
+ * @return 0 on success, or -1 on failure with errno set and error handler
+ * invoked (if not NULL).
+ */
+static int setup_socket(dbn_t *dbn)
+{
+  /*
+   * Set the socket buffer size (64 MiB by default).
+   */
+  int buffer_size = dbn->opts.rcvbuf;
+  if (setsockopt(
+    dbn->sock,
+    SOL_SOCKET,
+    SO_RCVBUF,
+    &buffer_size,
+    sizeof(int)) < 0)
+  {
+    int e = errno;
+    invoke_error_handler(
+      dbn,
+      true,
+      "Failed to set socket buffer size (errno %d: %s)",
+      e,
+      strerror(e));
+    errno = e;
+    return -1;
+  }
+
+
+  /*
+   * Actual buffer size could end up bigger. Unless configured otherwise,
+   * make our buffer size the same.
+   */
+  socklen_t optlen = sizeof(int);
+  getsockopt(
+    dbn->sock,
+    SOL_SOCKET,
+    SO_RCVBUF,
+    &buffer_size,
+    &optlen);
+
+  if (buffer_size < dbn->opts.rcvbuf)
+  {
+    invoke_error_handler(
+      dbn,
+      true,
+      "Failed to set socket buffer size (size is %d)",
+      buffer_size);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  dbn->capacity = dbn->opts.capacity ? dbn->opts.capacity : buffer_size;
+
+  if (dbn->capacity < 2 * DBN_MAX_RECORD_SIZE)
+  {
+    invoke_error_handler(
+      dbn,
+      true,
+      "Invalid buffer capacity %d",
+      dbn->capacity);
+    errno = EINVAL;
+    return -1;
+  }
+
+
+  /*
+   * Optionally busy poll the device queue when the socket has no data,
+   * rather than waiting for an interrupt. Raising this above
+   * net.core.busy_read requires CAP_NET_ADMIN, so failure is not fatal.
+   */
+  if (dbn->opts.busy_poll_us > 0 && setsockopt(
+    dbn->sock,
+    SOL_SOCKET,
+    SO_BUSY_POLL,
+    &dbn->opts.busy_poll_us,
+    sizeof(int)) < 0)
+  {
+    int e = errno;
+    invoke_error_handler(
+      dbn,
+      false,
+      "Failed to enable socket busy polling (errno %d: %s)",
+      e,
+      strerror(e));
+  }
+
+
+  /*
+   * Optionally have the kernel timestamp each received packet, in software
+   * and, if requested and supported by the NIC, in hardware. Hardware
+   * timestamping must also be enabled on the device (SIOCSHWTSTAMP), which
+   * is left to the host configuration.
+   */
+  if (dbn->opts.rx_timestamps)
+  {
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (dbn->opts.hw_timestamps)
+      flags |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+
+    if (setsockopt(
+      dbn->sock,
+      SOL_SOCKET,
+      SO_TIMESTAMPING,
+      &flags,
+      sizeof(int)) < 0)
+    {
+      int e = errno;
+      invoke_error_handler(
+        dbn,
+        true,
+        "Failed to enable receive timestamps (errno %d: %s)",
+        e,
+        strerror(e));
+      errno = e;
+      return -1;
+    }
+  }
+
+
+  /*
+   * In multishot mode the kernel fills provided buffers of its choosing.
+   */
+  if (dbn->opts.recv_mode == DBN_RECV_MODE_MULTISHOT)
+  {
+    if (setup_multishot(dbn)) return -1;
+  }
+
+
+  /*
+   * In mirror mode a single ring buffer holds everything in flight.
+   */
+  else if (dbn->opts.recv_mode == DBN_RECV_MODE_MIRROR)
+  {
+    if (setup_mirror(dbn)) return -1;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    if (init_ring(dbn, 2, &params)) return -1;
+  }
+  else
+  {
+    /*
+     * Allocate two buffers for liburing plus one buffer for "leftover" data
+     * that might happen when TCP read timing misaligns with internal kernel
+     * buffering of Databento TCP packets (which themselves always align with
+     * messages). Leftover data is always less than one record.
+     */
+    dbn->buffer0 = alloc_buffer(dbn, dbn->capacity);
+    dbn->buffer1 = alloc_buffer(dbn, dbn->capacity);
+    dbn->leftover = malloc(DBN_MAX_RECORD_SIZE);
+    if (!dbn->buffer0 || !dbn->buffer1 || !dbn->leftover)
+    {
+      int e = errno;
+      invoke_error_handler(
+        dbn,
+        true,
+        "Failed to allocate buffer (errno %d: %s)",
+        e,
+        strerror(e));
+      errno = e;
+      return -1;
+    }
+
+
+    /*
+     * Initialize the io_uring. Won't be used until we finish all early
+     * comms and are ready to receive dbn-encoded messages. Each buffer may
+     * have a capture write in flight along with its recv.
+     */
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    if (init_ring(dbn, 4, &params)) return -1;
+  }
+
+
+  return 0;
+}
+
+
+/**
+ * @brief Receive the DBN stream header and start receiving DBN-encoded
+ * messages.
+ *
+ * @param dbn Pointer to client object, with socket set up.
+ *
+ * @return 0 on success, or -1 on failure with errno set and error handler
+ * invoked (if not NULL).
+ */
+static int start_stream(dbn_t *dbn)
+{
+  /*
+   * Receive the DBN stream header.
+   */
+  uint8_t preheader[8];
+  int preheader_head = 0;
+
+  while (preheader_head < 8)
+  {
+    ssize_t m = recv(dbn->sock, preheader + preheader_head, 8 - preheader_head, 0);
+    if (m > 0)
+    {
+      preheader_head += m;
+    }
+    else if (m == 0)
+    {
+      invoke_error_handler(
+        dbn,
+        true,
+        "Connection closed unexpectedly");
+      errno = ECONNRESET;
+      return -1;
+    }
+    else
+    {
+      int e = errno;
+      invoke_error_handler(
+        dbn,
+        true,
+        "Error reading from socket (errno %d: %s)",
+        e,
+        strerror(e));
+      errno = e;
+      return -1;
+    }
+  }
+
+  if (strncmp((char *)preheader, "DBN", 3))
+  {
+    invoke_error_handler(
+      dbn,
+      true,
+      "Stream header has invalid signature");
+    errno = EBADMSG;
+    return -1;
+  }
+
+  if (preheader[3] != 1)
+  {
+    invoke_error_handler(
+      dbn,
+      true,
+      "Stream header version %d unsupported",
+      preheader[3]);
+    errno = EBADMSG;
+    return -1;
+  }
+
+  int header_length = (int)*(uint32_t *)(preheader + 4);
+
+
+  /*
+   * Receive the rest of the DBN stream header.
+   */
+  uint8_t *header = malloc(header_length);
+  int header_head = 0;
+  while (header_head < header_length)
+  {
+    ssize_t m = recv(
+      dbn->sock,
+      header + header_head,
+      header_length - header_head,
+      0);
+    if (m > 0)
+    {
+      header_head += m;
+    }
+    else if (m == 0)
+    {
+      invoke_error_handler(
+        dbn,
+        true,
+        "Connection closed unexpectedly");
+      free(header);
+      errno = ECONNRESET;
+      return -1;
+    }
+    else
+    {
+      int e = errno;
+      invoke_error_handler(
+        dbn,
+        true,
+        "Error reading from socket (errno %d: %s)",
+        e,
+        strerror(e));
+      free(header);
+      errno = e;
+      return -1;
+    }
+  }
+
+
+  /*
+   * If capturing, start the file with the stream header so that it is a
+   * complete DBN stream. Received data follows asynchronously.
+   */
+  if (dbn->opts.capture_path)
+  {
+    dbn->capture_fd = open(dbn->opts.capture_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (dbn->capture_fd < 0
+      || write(dbn->capture_fd, preheader, 8) != 8
+      || write(dbn->capture_fd, header, header_length) != header_length)
+    {
+      int e = errno;
+      invoke_error_handler(
+        dbn,
+        true,
+        "Failed to write capture file %s (errno %d: %s)",
+        dbn->opts.capture_path,
+        e,
+        strerror(e));
+      free(header);
+      errno = e;
+      return -1;
+    }
+
+    dbn->capture_offset = 8 + header_length;
+
+
+    /*
+     * One capture write may be in flight per receive buffer.
+     */
+    int num_captures = dbn->opts.recv_mode == DBN_RECV_MODE_MULTISHOT ? dbn->opts.num_provided_buffers : 2;
+    dbn->captures = calloc(num_captures, sizeof(dbn_capture_t));
+    if (!dbn->captures)
+    {
+      int e = errno;
+      invoke_error_handler(
+        dbn,
+        true,
+        "Failed to allocate capture state (errno %d: %s)",
+        e,
+        strerror(e));
+      free(header);
+      errno = e;
+      return -1;
+    }
+  }
+
+  free(header);
+
+
+  arm_wake(dbn);
+
+
+  /*
+   * DBN-encoded messages will be received now. In multishot mode a single
+   * request keeps receiving into provided buffers.
+   */
+  if (dbn->opts.recv_mode == DBN_RECV_MODE_MULTISHOT)
+  {
+    arm_multishot(dbn);
+    return 0;
+  }
+  else if (dbn->opts.recv_mode == DBN_RECV_MODE_MIRROR)
+  {
+    arm_mirror(dbn);
+    return 0;
+  }
+
+
+  /*
+   * Otherwise submit a read request for each of our two buffers. Tag each
+   * read with the buffer for reference later. Reads leave room for one
+   * record at the end of the buffer, so that leftover data from the other
+   * buffer always fits in front of a full read.
+   */
+  struct io_uring_sqe *sqe = io_uring_get_sqe(dbn->uring);
+  prep_recv(dbn, sqe, 0, dbn->buffer0, dbn->capacity - DBN_MAX_RECORD_SIZE);
+  tag_sqe(dbn, sqe, (uintptr_t)dbn->buffer0);
+
+  sqe = io_uring_get_sqe(dbn->uring);
+  prep_recv(dbn, sqe, 1, dbn->buffer1, dbn->capacity - DBN_MAX_RECORD_SIZE);
+  tag_sqe(dbn, sqe, (uintptr_t)dbn->buffer1);
+
+  io_uring_submit(dbn->uring);
+
+  return 0;
+}
+
+
+void dbn_opts_init(dbn_opts_t *opts)
+{
+  memset(opts, 0, sizeof(dbn_opts_t));
+  opts->rcvbuf = 1024 * 1024 * 64;
+  opts->capacity = 0;
+  opts->hugepages = DBN_HUGEPAGES_NONE;
+  opts->numa_node = DBN_NUMA_NODE_NONE;
+  opts->recv_mode = DBN_RECV_MODE_DOUBLE_BUFFER;
+  opts->num_provided_buffers = 64;
+  opts->provided_buffer_size = 1024 * 1024;
+  opts->sqpoll = false;
+  opts->sqpoll_cpu = -1;
+  opts->sqpoll_idle_ms = 1000;
+  opts->busy_poll_us = 0;
+  opts->rx_timestamps = false;
+  opts->hw_timestamps = false;
+  opts->capture_path = NULL;
+  opts->backpressure_bytes = 0;
+  opts->sequence = DBN_SEQUENCE_NONE;
+}
+
+
+void dbn_init(
+  dbn_t *dbn,
+  dbn_on_error_t on_error,
+  dbn_on_msg_t on_msg,
+  void *ctx)
+{
+  memset(dbn, 0, sizeof(dbn_t));
+  dbn_opts_init(&dbn->opts);
+  dbn->on_error = on_error;
+  dbn->on_msg = on_msg;
+  for (int i = 0; i < 256; i++)
+    dbn->handlers[i] = on_msg;
+  dbn->ctx = ctx;
+  dbn->sock = -1;
+  dbn->uring = &dbn->ring;
+  dbn->buffer_group = DBN_BUFFER_GROUP;
+  pthread_mutex_init(&dbn->send_lock, NULL);
+  pthread_mutex_init(&dbn->pending_lock, NULL);
+  dbn->wake_fd = eventfd(0, EFD_CLOEXEC);
+}
+
+
+void dbn_set_msg_handler(
+  dbn_t *dbn,
+  dbn_rtype_t rtype,
+  dbn_on_msg_t on_msg)
+{
+  dbn->handlers[(uint8_t)rtype] = on_msg;
+}
+
+
+void dbn_set_batch_handler(
+  dbn_t *dbn,
+  dbn_on_batch_t on_batch)
+{
+  dbn->on_batch = on_batch;
+}
+
+
+void dbn_set_backpressure_handler(
+  dbn_t *dbn,
+  dbn_on_backpressure_t on_backpressure)
+{
+  dbn->on_backpressure = on_backpressure;
+}
+
+
+void dbn_set_sequence_handler(
+  dbn_t *dbn,
+  dbn_on_sequence_t on_sequence)
+{
+  dbn->on_sequence = on_sequence;
+}
+
+
+void dbn_set_quotes(
+  dbn_t *dbn,
+  struct dbn_quotes *quotes)
+{
+  dbn->quotes = quotes;
+}
+
+
+int dbn_set_export(
+  dbn_t *dbn,
+  struct dbn_export *exporter)
+{
+  if (!exporter)
+  {
+    dbn->export_producer = NULL;
+    return 0;
+  }
+
+  dbn->export_producer = dbn_export_attach(exporter);
+  if (!dbn->export_producer)
+  {
+    invoke_error_handler(
+      dbn,
+      false,
+      "Failed to attach exporter, all %d producers claimed",
+      exporter->num_producers);
+    errno = ENOSPC;
+    return -1;
+  }
+
+  return 0;
+}
+
+
+int dbn_connect(
+  dbn_t *dbn,
+  const char *api_key,
+  const char *dataset,
+  bool ts_out)
+{
+  /*
+   * Create socket.
+   */
+  if ((dbn->sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+  {
+    int e = errno;
+    invoke_error_handler(
+      dbn,
+      true,
+      "Failed to create socket (errno %d: %s)",
+      e,
+      strerror(e));
+    errno = e;
+    return -1;
+  }
+
+
+  if (setup_socket(dbn)) return -1;
+
+
+  /*
+   * Build the API FQDN.
+   */
+  int dataset_length = 1 + strlen(dataset);
+  char *adjusted_dataset = malloc(dataset_length);
+  memcpy(adjusted_dataset, dataset, dataset_length);
+  for (int i = 0; i < dataset_length; i++)
+  {
+    if (adjusted_dataset[i] == '.') adjusted_dataset[i] = '-';
+  }
+
+  int fqdn_length = 1 + snprintf(NULL, 0, "%s.lsg.databento.com", adjusted_dataset);
+  char *fqdn = malloc(fqdn_length);
+  snprintf(fqdn, fqdn_length, "%s.lsg.databento.com", adjusted_dataset);
+
+  free(adjusted_dataset);
+
+
+  /*
+   * Resolve the API FQDN.
+   */
+  struct sockaddr_in addr;
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(13000);
+
+  int r = resolve(dbn, fqdn, &addr.sin_addr);
+  free(fqdn);
+  if (r) return -1;
+
+
+  /*
+   * Connect.
+   */
+  char ipstr[INET_ADDRSTRLEN];
+  inet_ntop(addr.sin_family, &addr.sin_addr, ipstr, sizeof(ipstr));
+
+  if (connect(dbn->sock, (struct sockaddr *)&addr, sizeof(addr)))
+  {
+    int e = errno;
+    invoke_error_handler(
+      dbn,
+      true,
+      "Failed to connect (errno %d: %s)",
+      e,
+      strerror(e));
+    errno = e;
+    return -1;
+  }
+
+
+  /*
+   * Receive lsg_version message.
+   */
+  char *msg0 = receive_control_message(dbn->sock);
+
+  if (!msg0)
+  {
+    invoke_error_handler(
+      dbn,
+      true,
+      "Error receiving first control message");
+    errno = EBADMSG;
+    return -1;
+  }
+
+  char *lsg_version = get_control_message_field(msg0, "lsg_version");
+  free(msg0);
+  if (!lsg_version)
+  {
+    invoke_error_handler(
+      dbn,
+      true,
+      "First control message is missing lsg_version field");
+    errno = EBADMSG;
+    return -1;
+  }
+
+  free(lsg_version);
+
+
+  /*
+   * Receive cram message.
+   */
+  char *msg1 = receive_control_message(dbn->sock);
+
+  if (!msg1)
+  {
+    invoke_error_handler(
       dbn,
       true,
       "Error receiving second control message");
@@ -434,9 +2489,10 @@ int dbn_connect(
     dataset,
     ts_out ? 1 : 0);
 
-  send(dbn->sock, auth, strlen(auth), 0);
-
+  r = send_all(dbn, auth, strlen(auth));
   free(auth);
+  if (r) return -1;
+  dbn->ts_out = ts_out;
 
 
   /*
@@ -497,140 +2553,493 @@ int dbn_start(
   bool replay)
 {
   /*
-   * Subscribing to all symbols means subscribing only to the special
-   * ALL_SYMBOLS symbol. Suffix is ignored.
+   * Subscribe and start the streaming session in one request. All
+   * subsequent data received will be DBN-encoded.
    */
-  if (num_roots == 0)
-  {
-    char *subscribe;
-    if (replay)
-    {
-      int n = snprintf(NULL, 0, "schema=%s|stype_in=%s|start=0|symbols=ALL_SYMBOLS\n", schema, symbology);
-      subscribe = malloc(n + 1);
-      memset(subscribe, 0, n + 1);
-      snprintf(subscribe, n + 1, "schema=%s|stype_in=%s|start=0|symbols=ALL_SYMBOLS\n", schema, symbology);
-    }
-    else
-    {
-      int n = snprintf(NULL, 0, "schema=%s|stype_in=%s|symbols=ALL_SYMBOLS\n", schema, symbology);
-      subscribe = malloc(n + 1);
-      memset(subscribe, 0, n + 1);
-      snprintf(subscribe, n + 1, "schema=%s|stype_in=%s|symbols=ALL_SYMBOLS\n", schema, symbology);
-    }
+  size_t subscribe_length;
+  char *subscribe = build_subscription(
+    schema,
+    symbology,
+    num_roots,
+    roots,
+    suffix,
+    replay,
+    true,
+    &subscribe_length);
+
+  int r = send_all(dbn, subscribe, subscribe_length);
+  free(subscribe);
+  if (r) return -1;
+
+
+  return start_stream(dbn);
+}
 
-    send(dbn->sock, subscribe, strlen(subscribe), 0);
 
-    free(subscribe);
-  }
+int dbn_subscribe(
+  dbn_t *dbn,
+  const char *schema,
+  const char *symbology,
+  int num_roots,
+  const char * const *roots,
+  const char *suffix,
+  bool replay,
+  uint64_t *id)
+{
+  size_t subscribe_length;
+  char *subscribe = build_subscription(
+    schema,
+    symbology,
+    num_roots,
+    roots,
+    suffix,
+    replay,
+    false,
+    &subscribe_length);
 
 
   /*
-   * Otherwise we have to subscribe in chunks of up to 1000 symbols at a time
-   * (Databento limitation).
+   * Register the symbols as pending before sending, so that their SMAPs
+   * can't be missed.
    */
-  else for (int i = 0; i < num_roots; i += 1000)
+  int n = num_roots ? num_roots : 1;
+  pthread_mutex_lock(&dbn->pending_lock);
+  dbn_pending_t *pending = realloc(dbn->pending, (dbn->num_pending_symbols + n) * sizeof(dbn_pending_t));
+  if (!pending)
   {
-    int num_roots_i = num_roots - i;
-    if (num_roots_i > 1000) num_roots_i = 1000;
+    pthread_mutex_unlock(&dbn->pending_lock);
+    free(subscribe);
+    invoke_error_handler(dbn, false, "Failed to allocate pending subscription");
+    errno = ENOMEM;
+    return -1;
+  }
+  dbn->pending = pending;
+  *id = ++dbn->next_subscription;
+  for (int i = 0; i < n; i++)
+  {
+    dbn_pending_t *p = &dbn->pending[dbn->num_pending_symbols++];
+    p->id = *id;
+    p->sent = false;
+    if (num_roots) snprintf(p->symbol, sizeof(p->symbol), "%s%s", roots[i], suffix);
+    else p->symbol[0] = 0;
+  }
+  atomic_store_explicit(&dbn->num_pending, dbn->num_pending_symbols, memory_order_release);
+  pthread_mutex_unlock(&dbn->pending_lock);
 
-    bool is_last = i + 1000 >= num_roots;
+  pthread_mutex_lock(&dbn->send_lock);
+  int r = send_all(dbn, subscribe, subscribe_length);
+  pthread_mutex_unlock(&dbn->send_lock);
+  free(subscribe);
 
 
-    /*
-     * Build the subscription string.
-     */
-    char *subscribe;
-    if (replay)
-    {
-      int n = snprintf(NULL, 0, "schema=%s|stype_in=%s|start=0|is_last=%s|symbols=", schema, symbology, is_last ? "1" : "0");
-      subscribe = malloc(n + 1);
-      memset(subscribe, 0, n + 1);
-      snprintf(subscribe, n + 1, "schema=%s|stype_in=%s|start=0|is_last=%s|symbols=", schema, symbology, is_last ? "1" : "0");
-    }
-    else
+  /*
+   * Only now may SMAPs complete an all-symbols request. Any processed before
+   * were for the session's existing subscriptions.
+   */
+  if (!r)
+  {
+    pthread_mutex_lock(&dbn->pending_lock);
+    for (int i = 0; i < dbn->num_pending_symbols; i++)
     {
-      int n = snprintf(NULL, 0, "schema=%s|stype_in=%s|is_last=%s|symbols=", schema, symbology, is_last ? "1" : "0");
-      subscribe = malloc(n + 1);
-      memset(subscribe, 0, n + 1);
-      snprintf(subscribe, n + 1, "schema=%s|stype_in=%s|is_last=%s|symbols=", schema, symbology, is_last ? "1" : "0");
+      if (dbn->pending[i].id == *id) dbn->pending[i].sent = true;
     }
+    pthread_mutex_unlock(&dbn->pending_lock);
+    return 0;
+  }
 
-    for (int j = 0; j < num_roots_i; j++)
-    {
-      if (j == num_roots_i - 1) // Last symbol in this chunk
-      {
-        int m = snprintf(NULL, 0, "%s%s%s\n", subscribe, roots[i + j], suffix);
-        char *t = malloc(m + 1);
-        memset(t, 0, m + 1);
-        snprintf(t, m + 1, "%s%s%s\n", subscribe, roots[i + j], suffix);
-        free(subscribe);
-        subscribe = t;
-      }
-      else // Not the last symbol in this chunk
-      {
-        int m = snprintf(NULL, 0, "%s%s%s,", subscribe, roots[i + j], suffix);
-        char *t = malloc(m + 1);
-        memset(t, 0, m + 1);
-        snprintf(t, m + 1, "%s%s%s,", subscribe, roots[i + j], suffix);
-        free(subscribe);
-        subscribe = t;
-      }
-    }
+
+  /*
+   * The request never went out, so its SMAPs will never arrive.
+   */
+  int e = errno;
+  pthread_mutex_lock(&dbn->pending_lock);
+  for (int i = 0; i < dbn->num_pending_symbols; )
+  {
+    if (dbn->pending[i].id == *id) dbn->pending[i] = dbn->pending[--dbn->num_pending_symbols];
+    else i++;
+  }
+  atomic_store_explicit(&dbn->num_pending, dbn->num_pending_symbols, memory_order_relaxed);
+  pthread_mutex_unlock(&dbn->pending_lock);
+  errno = e;
+  return r;
+}
 
 
-    /*
-     * Subscribe to this chunk.
-     */
-    send(dbn->sock, subscribe, strlen(subscribe), 0);
-    free(subscribe);
+bool dbn_is_subscribed(
+  dbn_t *dbn,
+  uint64_t id)
+{
+  bool subscribed = true;
+  pthread_mutex_lock(&dbn->pending_lock);
+  for (int i = 0; i < dbn->num_pending_symbols && subscribed; i++)
+    subscribed = dbn->pending[i].id != id;
+  pthread_mutex_unlock(&dbn->pending_lock);
+  return subscribed;
+}
+
+
+void dbn_get_metrics(
+  dbn_t *dbn,
+  dbn_metrics_t *metrics)
+{
+  const uint64_t *src = (const uint64_t *)&dbn->metrics;
+  uint64_t *dst = (uint64_t *)metrics;
+  for (size_t i = 0; i < sizeof(dbn_metrics_t) / sizeof(uint64_t); i++)
+    dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+}
+
+
+void dbn_add_metrics(
+  dbn_metrics_t *total,
+  const dbn_metrics_t *metrics)
+{
+  const uint64_t *src = (const uint64_t *)metrics;
+  uint64_t *dst = (uint64_t *)total;
+  for (size_t i = 0; i < sizeof(dbn_metrics_t) / sizeof(uint64_t); i++)
+    dst[i] += src[i];
+}
+
+
+int dbn_attach(
+  dbn_t *dbn,
+  int fd)
+{
+  dbn->sock = fd;
+  if (setup_socket(dbn)) return -1;
+  return start_stream(dbn);
+}
+
+
+/**
+ * @brief Submit the recv request of one of the two buffers, for
+ * DBN_RECV_MODE_DOUBLE_BUFFER. Reads leave room for one record at the end
+ * of the buffer, so that leftover data from the other buffer always fits in
+ * front of a full read.
+ *
+ * @param dbn Pointer to client object.
+ * @param slot 0 for buffer0, or 1 for buffer1.
+ */
+static void arm_buffer(
+  dbn_t *dbn,
+  int slot)
+{
+  uint8_t *buffer = slot ? dbn->buffer1 : dbn->buffer0;
+  struct io_uring_sqe *sqe = io_uring_get_sqe(dbn->uring);
+  prep_recv(dbn, sqe, slot, buffer, dbn->capacity - DBN_MAX_RECORD_SIZE);
+  tag_sqe(dbn, sqe, (uintptr_t)buffer);
+
+  io_uring_submit(dbn->uring);
+}
+
+
+/**
+ * @brief Handle a completion of one of the two recv requests, for
+ * DBN_RECV_MODE_DOUBLE_BUFFER.
+ *
+ * @param dbn Pointer to client object.
+ * @param cqe Pointer to completion queue entry. Marked as seen by this function.
+ *
+ * @return Number of messages received, or -1 on failure with errno set and
+ * error handler invoked (if not NULL).
+ */
+static int get_double_buffer(
+  dbn_t *dbn,
+  struct io_uring_cqe *cqe)
+{
+  void *buffer = (void *)(uintptr_t)(cqe->user_data & DBN_TAG_DATA_MASK);
+  ssize_t n = cqe->res;
+  io_uring_cqe_seen(dbn->uring, cqe);
+
+  if (n == 0)
+  {
+    invoke_error_handler(
+      dbn,
+      true,
+      "Connection closed unexpectedly");
+    errno = ECONNRESET;
+    return -1;
+  }
+  else if (n < 0)
+  {
+    int e = errno;
+    invoke_error_handler(
+      dbn,
+      true,
+      "Error reading from socket (errno %d: %s)",
+      e,
+      strerror(e));
+    errno = e;
+    return -1;
   }
 
+  if (dbn->opts.rx_timestamps) read_rx_timestamp(dbn, &dbn->rx_msgs[buffer == dbn->buffer1]);
 
-  /*
-   * Start the streaming session. All subsequent data received will
-   * be DBN-encoded.
-   */
-  char start[] = "start_session=0\n";
-  send(dbn->sock, start, strlen(start), 0);
+  uint8_t *received = (uint8_t *)buffer + dbn->leftover_count;
+  size_t num_received = n;
 
 
   /*
-   * Receive the DBN stream header.
+   * If we have leftover data from a previous read, copy it into the buffer
+   * into which the latest data arrives. This is slow, but luckily it is very
+   * rare, because:
+   *  (1) Each TCP packet contains an integral number of Databento messages.
+   *  (2) Our buffers and the kernel receiver buffer far exceed Databento message size.
+   *
+   * In fact, this can ONLY happen due to timing between userland calls, kernel DMA,
+   * and NIC DMA.
    */
-  uint8_t preheader[8];
-  int preheader_head = 0;
-
-  while (preheader_head < 8)
+  if (dbn->leftover_count)
   {
-    ssize_t m = recv(dbn->sock, preheader + preheader_head, 8 - preheader_head, 0);
-    if (m > 0)
-    {
-      preheader_head += m;
-    }
-    else if (m == 0)
-    {
-      invoke_error_handler(
-        dbn,
-        true,
-        "Connection closed unexpectedly");
-      errno = ECONNRESET;
-      return -1;
-    }
-    else
+    if (dbn->leftover_count + n > dbn->capacity)
     {
-      int e = errno;
       invoke_error_handler(
         dbn,
         true,
-        "Error reading from socket (errno %d: %s)",
-        e,
-        strerror(e));
-      errno = e;
+        "Leftover data would cause buffer overflow");
+      errno = ENOMEM;
       return -1;
     }
+
+    memmove(buffer + dbn->leftover_count, buffer, n);
+    memcpy(buffer, dbn->leftover, dbn->leftover_count);
+    n += dbn->leftover_count;
+    dbn->leftover_count = 0;
+  }
+
+
+  /*
+   * Decode as many messages as we can, and dispatch them.
+   */
+  ssize_t consumed;
+  int num_messages = decode(dbn, buffer, n, &consumed);
+  if (num_messages < 0) return -1;
+
+
+  /*
+   * Keep any leftover data. See comments earlier in this function for
+   * more info.
+   */
+  count_read(dbn, num_received, num_messages, n - consumed);
+  if (n - consumed)
+  {
+    memcpy(dbn->leftover, (uint8_t *)buffer + consumed, n - consumed);
+    dbn->leftover_count = n - consumed;
+  }
+  if (dbn->opts.backpressure_bytes) check_backpressure(dbn, n - consumed);
+
+
+  /*
+   * Re-enqueue this buffer for more data, once its data is in the capture
+   * file (if any). Meanwhile the other buffer keeps receiving.
+   */
+  if (dbn->opts.capture_path)
+  {
+    prep_capture(dbn, received, num_received, buffer == dbn->buffer1);
+    io_uring_submit(dbn->uring);
+  }
+  else arm_buffer(dbn, buffer == dbn->buffer1);
+
+  return num_messages;
+}
+
+
+/**
+ * @brief Handle a completion of a capture write. A short write is resubmitted
+ * for the remainder. Once complete, the buffer held back for it is handed
+ * back for receiving.
+ *
+ * @param dbn Pointer to client object.
+ * @param cqe Pointer to completion queue entry. Marked as seen by this function.
+ *
+ * @return 0 on success, or -1 on failure with errno set and error handler
+ * invoked (if not NULL).
+ */
+static int handle_capture(
+  dbn_t *dbn,
+  struct io_uring_cqe *cqe)
+{
+  int n = cqe->res;
+  uint64_t tag = (cqe->user_data & DBN_TAG_DATA_MASK) >> 1;
+  io_uring_cqe_seen(dbn->uring, cqe);
+  metric_add(&dbn->metrics.num_cqes, 1);
+
+  dbn_capture_t *capture = &dbn->captures[tag];
+  if (n <= 0)
+  {
+    int e = n ? -n : EIO;
+    dbn->capture_pending--;
+    capture->length = 0;
+    invoke_error_handler(
+      dbn,
+      true,
+      "Error writing capture file (errno %d: %s)",
+      e,
+      strerror(e));
+    errno = e;
+    return -1;
+  }
+
+  capture->data += n;
+  capture->length -= n;
+  capture->offset += n;
+  if (dbn->opts.recv_mode == DBN_RECV_MODE_MIRROR) dbn->mirror_captured += n;
+
+  if (capture->length)
+  {
+    submit_capture(dbn, tag);
+    io_uring_submit(dbn->uring);
+    return 0;
+  }
+
+  dbn->capture_pending--;
+
+
+  /*
+   * Hand the buffer back. In mirror mode, more may have been received
+   * meanwhile, and the recv may have been waiting for space.
+   */
+  if (dbn->opts.recv_mode == DBN_RECV_MODE_MULTISHOT)
+  {
+    io_uring_buf_ring_add(
+      dbn->buf_ring,
+      dbn->provided_buffers + tag * dbn->opts.provided_buffer_size,
+      dbn->opts.provided_buffer_size,
+      tag,
+      io_uring_buf_ring_mask(dbn->opts.num_provided_buffers),
+      0);
+    io_uring_buf_ring_advance(dbn->buf_ring, 1);
+  }
+  else if (dbn->opts.recv_mode == DBN_RECV_MODE_MIRROR)
+  {
+    capture_mirror(dbn);
+    arm_mirror(dbn);
+  }
+  else arm_buffer(dbn, tag);
+
+  return 0;
+}
+
+
+/**
+ * @brief Decode the next chunk of a mapped capture file.
+ *
+ * @param dbn Pointer to client object.
+ *
+ * @return Number of messages decoded, or -1 on failure or end of file with
+ * errno set (and error handler invoked, unless end of file).
+ */
+static int get_file(dbn_t *dbn)
+{
+  size_t n = dbn->file_length - dbn->file_head;
+  if (n == 0)
+  {
+    errno = ENODATA;
+    return -1;
+  }
+
+  if (n > (size_t)dbn->capacity) n = dbn->capacity;
+
+  ssize_t consumed;
+  int num_messages = decode(dbn, dbn->file + dbn->file_head, n, &consumed);
+  if (num_messages < 0) return -1;
+
+  if (consumed == 0)
+  {
+    invoke_error_handler(
+      dbn,
+      true,
+      "Capture file ends with a truncated message");
+    errno = EBADMSG;
+    return -1;
+  }
+
+  dbn->file_head += consumed;
+  count_read(dbn, consumed, num_messages, false);
+
+  return num_messages;
+}
+
+
+/**
+ * @brief Handle a completion according to the receive mode.
+ *
+ * @param dbn Pointer to client object.
+ * @param cqe Pointer to completion queue entry. Marked as seen by this function.
+ *
+ * @return Number of messages received, or -1 on failure with errno set and
+ * error handler invoked (if not NULL).
+ */
+static inline int handle_cqe(
+  dbn_t *dbn,
+  struct io_uring_cqe *cqe)
+{
+  metric_add(&dbn->metrics.num_cqes, 1);
+
+  if (dbn->opts.recv_mode == DBN_RECV_MODE_MULTISHOT)
+    return get_multishot(dbn, cqe);
+  else if (dbn->opts.recv_mode == DBN_RECV_MODE_MIRROR)
+    return get_mirror(dbn, cqe);
+  else
+    return get_double_buffer(dbn, cqe);
+}
+
+
+uint64_t dbn_get_rx_timestamp(dbn_t *dbn)
+{
+  return dbn->rx_timestamp;
+}
+
+
+int dbn_open_file(
+  dbn_t *dbn,
+  const char *path)
+{
+  /*
+   * Map the whole file.
+   */
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st))
+  {
+    int e = errno;
+    invoke_error_handler(
+      dbn,
+      true,
+      "Failed to open %s (errno %d: %s)",
+      path,
+      e,
+      strerror(e));
+    if (fd >= 0) close(fd);
+    errno = e;
+    return -1;
   }
 
-  if (strncmp((char *)preheader, "DBN", 3))
+  dbn->file_length = st.st_size;
+  dbn->file = dbn->file_length ? mmap(NULL, dbn->file_length, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0) : MAP_FAILED;
+  int e = errno;
+  close(fd);
+
+  if (dbn->file == MAP_FAILED)
+  {
+    dbn->file = NULL;
+    invoke_error_handler(
+      dbn,
+      true,
+      "Failed to map %s (errno %d: %s)",
+      path,
+      e,
+      strerror(e));
+    errno = e;
+    return -1;
+  }
+
+  madvise(dbn->file, dbn->file_length, MADV_SEQUENTIAL);
+
+
+  /*
+   * Validate and skip the stream header.
+   */
+  if (dbn->file_length < 8 || strncmp((char *)dbn->file, "DBN", 3))
   {
     invoke_error_handler(
       dbn,
@@ -640,223 +3049,366 @@ int dbn_start(
     return -1;
   }
 
-  if (preheader[3] != 1)
+  if (dbn->file[3] != 1)
   {
     invoke_error_handler(
       dbn,
       true,
       "Stream header version %d unsupported",
-      preheader[3]);
+      dbn->file[3]);
     errno = EBADMSG;
     return -1;
   }
 
-  int header_length = (int)*(uint32_t *)(preheader + 4);
+  dbn->file_head = 8 + (size_t)*(uint32_t *)(dbn->file + 4);
+  if (dbn->file_head > dbn->file_length)
+  {
+    invoke_error_handler(
+      dbn,
+      true,
+      "Capture file ends within the stream header");
+    errno = EBADMSG;
+    return -1;
+  }
 
 
   /*
-   * Receive the rest of the DBN stream header.
+   * Dispatch in chunks the size of a live session's receive buffers.
    */
-  uint8_t *header = malloc(header_length);
-  int header_head = 0;
-  while (header_head < header_length)
+  dbn->capacity = dbn->opts.capacity ? dbn->opts.capacity : dbn->opts.rcvbuf;
+  if (dbn->capacity < DBN_MAX_RECORD_SIZE) dbn->capacity = DBN_MAX_RECORD_SIZE;
+
+  return 0;
+}
+
+
+/**
+ * @brief Receive data, waiting for it if necessary. See dbn_get().
+ *
+ * @param dbn Pointer to client object.
+ * @param timeout If not NULL, maximum time to wait for each completion.
+ *
+ * @return Number of messages received, 0 if timed out, woken or
+ * interrupted, or -1 on failure with errno set and error handler invoked
+ * (if not NULL).
+ */
+static int get(
+  dbn_t *dbn,
+  struct __kernel_timespec *timeout)
+{
+  if (dbn->file) return get_file(dbn);
+
+  while (true)
   {
-    ssize_t m = recv(
-      dbn->sock,
-      header + header_head,
-      header_length - header_head,
-      0);
-    if (m > 0)
-    {
-      header_head += m;
-    }
-    else if (m == 0)
+    /*
+     * Wait for some data to arrive in one of our io_uring buffers, timing
+     * the wait only if there is nothing ready already.
+     */
+    struct io_uring_cqe *cqe;
+    int m = io_uring_peek_cqe(dbn->uring, &cqe);
+    if (m == -EAGAIN)
     {
-      invoke_error_handler(
-        dbn,
-        true,
-        "Connection closed unexpectedly");
-      free(header);
-      errno = ECONNRESET;
-      return -1;
+      struct timespec t0, t1;
+      clock_gettime(CLOCK_MONOTONIC, &t0);
+      if (timeout) m = io_uring_wait_cqe_timeout(dbn->uring, &cqe, timeout);
+      else m = io_uring_wait_cqe(dbn->uring, &cqe);
+      clock_gettime(CLOCK_MONOTONIC, &t1);
+      metric_add(&dbn->metrics.num_waits, 1);
+      metric_add(&dbn->metrics.wait_ns, (t1.tv_sec - t0.tv_sec) * 1000000000ull + t1.tv_nsec - t0.tv_nsec);
     }
-    else
+    if (m < 0)
     {
-      int e = errno;
+      if (m == -EINTR || m == -ETIME) return 0;
+      int e = -m;
       invoke_error_handler(
         dbn,
         true,
-        "Error reading from socket (errno %d: %s)",
+        "Error waiting on io_uring (errno %d: %s)",
         e,
         strerror(e));
-      free(header);
       errno = e;
       return -1;
     }
-  }
 
-  free(header);
 
+    /*
+     * Capture writes don't count as receiving anything. Keep waiting.
+     */
+    if (cqe->user_data & DBN_TAG_CAPTURE)
+    {
+      if (handle_capture(dbn, cqe)) return -1;
+      continue;
+    }
 
-  /*
-   * DBN-encoded messages will be received now. Submit a read request for each
-   * of our two buffers. Tag each read with the buffer for reference later.
-   */
-  struct io_uring_sqe *sqe = io_uring_get_sqe(&dbn->ring);
-  io_uring_prep_recv(sqe, dbn->sock, dbn->buffer0, dbn->capacity, 0);
-  io_uring_sqe_set_data(sqe, dbn->buffer0);
+    if ((cqe->user_data & DBN_TAG_DATA_MASK) == DBN_TAG_WAKE) return handle_wake(dbn, cqe);
 
-  sqe = io_uring_get_sqe(&dbn->ring);
-  io_uring_prep_recv(sqe, dbn->sock, dbn->buffer1, dbn->capacity, 0);
-  io_uring_sqe_set_data(sqe, dbn->buffer1);
+    return handle_cqe(dbn, cqe);
+  }
+}
 
-  io_uring_submit(&dbn->ring);
 
-  return 0;
+int dbn_get(dbn_t *dbn)
+{
+  return get(dbn, NULL);
 }
 
 
-int dbn_get(dbn_t *dbn)
+int dbn_get_timeout(
+  dbn_t *dbn,
+  uint64_t timeout_ns)
 {
-  /*
-   * Wait for some data to arrive in one of our two io_uring buffers.
-   */
-  struct io_uring_cqe *cqe;
-  int m = io_uring_wait_cqe(&dbn->ring, &cqe);
-  if (m < 0)
-  {
-    if (m == -EINTR) return 0;
-    int e = errno;
-    invoke_error_handler(
-      dbn,
-      true,
-      "Error waiting on io_uring (errno %d: %s)",
-      e,
-      strerror(e));
-    errno = e;
-    return -1;
-  }
+  struct __kernel_timespec timeout;
+  timeout.tv_sec = timeout_ns / 1000000000;
+  timeout.tv_nsec = timeout_ns % 1000000000;
+  return get(dbn, &timeout);
+}
 
-  void *buffer = io_uring_cqe_get_data(cqe);
-  ssize_t n = cqe->res;
-  io_uring_cqe_seen(&dbn->ring, cqe);
 
-  if (n == 0)
-  {
-    invoke_error_handler(
-      dbn,
-      true,
-      "Connection closed unexpectedly");
-    errno = ECONNRESET;
-    return -1;
-  }
-  else if (n < 0)
+int dbn_wake(dbn_t *dbn)
+{
+  if (dbn->wake_fd < 0)
   {
-    int e = errno;
-    invoke_error_handler(
-      dbn,
-      true,
-      "Error reading from socket (errno %d: %s)",
-      e,
-      strerror(e));
-    errno = e;
+    errno = EBADF;
     return -1;
   }
 
+  uint64_t one = 1;
+  return write(dbn->wake_fd, &one, sizeof(one)) == sizeof(one) ? 0 : -1;
+}
 
-  /*
-   * If we have leftover data from a previous read, copy it into the buffer
-   * into which the latest data arrives. This is slow, but luckily it is very
-   * rare, because:
-   *  (1) Each TCP packet contains an integral number of Databento messages.
-   *  (2) Our buffers and the kernel receiver buffer far exceed Databento message size.
-   *
-   * In fact, this can ONLY happen due to timing between userland calls, kernel DMA,
-   * and NIC DMA.
-   */
-  if (dbn->leftover_count)
+
+int dbn_poll(dbn_t *dbn)
+{
+  if (dbn->file) return get_file(dbn);
+
+  while (true)
   {
-    if (dbn->leftover_count + n > dbn->capacity)
+    /*
+     * Check for a completion without entering the kernel.
+     */
+    struct io_uring_cqe *cqe;
+    int m = io_uring_peek_cqe(dbn->uring, &cqe);
+    if (m == -EAGAIN) return 0;
+    else if (m < 0)
     {
       invoke_error_handler(
         dbn,
         true,
-        "Leftover data would cause buffer overflow");
-      errno = ENOMEM;
+        "Error peeking io_uring (errno %d: %s)",
+        -m,
+        strerror(-m));
+      errno = -m;
       return -1;
     }
 
-    memmove(buffer + dbn->leftover_count, buffer, n);
-    memcpy(buffer, dbn->leftover, dbn->leftover_count);
-    n += dbn->leftover_count;
-    dbn->leftover_count = 0;
+    if (cqe->user_data & DBN_TAG_CAPTURE)
+    {
+      if (handle_capture(dbn, cqe)) return -1;
+      continue;
+    }
+
+    if ((cqe->user_data & DBN_TAG_DATA_MASK) == DBN_TAG_WAKE) return handle_wake(dbn, cqe);
+
+    return handle_cqe(dbn, cqe);
   }
+}
+
 
+void dbn_close(dbn_t *dbn)
+{
+  if (dbn->wake_fd >= 0) close(dbn->wake_fd);
+
+  if (dbn->file)
+  {
+    munmap(dbn->file, dbn->file_length);
+    memset(dbn, 0, sizeof(dbn_t));
+    return;
+  }
 
   /*
-   * Decode as many messages as we can, and dispatch them.
+   * Let capture writes finish, so the file holds everything dispatched.
+   * Receive completions arriving meanwhile are dropped. Group members
+   * share the io_uring, which dbn_group_close() has already drained and
+   * torn down.
    */
-  uint8_t *ptr = buffer;
-  int num_messages;
-  for (num_messages = 0; ; num_messages++)
+  while (dbn->ring_initialized && dbn->capture_pending > 0)
   {
-    if (n < 16) break; // Not enough data for a header
-
-    int rlength = 4 * ptr[0];
-    if (rlength < 16)
+    struct io_uring_cqe *cqe;
+    if (io_uring_wait_cqe(dbn->uring, &cqe) < 0) break;
+    if (cqe->user_data & DBN_TAG_CAPTURE)
     {
-      invoke_error_handler(
-        dbn,
-        true,
-        "Bad message length %d",
-        rlength);
-      errno = EBADMSG;
-      return -1;
+      if (handle_capture(dbn, cqe)) break;
     }
-    if (n < rlength) break; // Not enough data for this message
+    else io_uring_cqe_seen(dbn->uring, cqe);
+  }
+
+  if (dbn->ring_initialized) io_uring_queue_exit(dbn->uring);
+
+  if (dbn->sock >= 0) close(dbn->sock);
+
+  if (dbn->capture_fd > 0) close(dbn->capture_fd);
+  if (dbn->captures) free(dbn->captures);
+
+  if (dbn->mirror) munmap(dbn->mirror, 2 * (size_t)dbn->capacity);
+  free_buffer(dbn, dbn->buffer0, dbn->capacity);
+  free_buffer(dbn, dbn->buffer1, dbn->capacity);
+  if (dbn->leftover) free(dbn->leftover);
+  free_buffer(dbn, dbn->provided_buffers, (size_t)dbn->opts.num_provided_buffers * dbn->opts.provided_buffer_size);
+  if (dbn->buf_ring) munmap(dbn->buf_ring, dbn->opts.num_provided_buffers * sizeof(struct io_uring_buf));
+  if (dbn->pending) free(dbn->pending);
+  if (dbn->sequences) free(dbn->sequences);
+  pthread_mutex_destroy(&dbn->send_lock);
+  pthread_mutex_destroy(&dbn->pending_lock);
+
+  memset(dbn, 0, sizeof(dbn_t));
+}
+
+
+int dbn_group_init(
+  dbn_group_t *group,
+  unsigned int entries)
+{
+  memset(group, 0, sizeof(dbn_group_t));
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = 2 * entries;
+
+  int r = io_uring_queue_init_params(entries, &group->ring, &params);
+  if (r < 0)
+  {
+    errno = -r;
+    return -1;
+  }
+
+  return 0;
+}
+
 
-    if (dbn->on_msg) dbn->on_msg(
+int dbn_group_add(
+  dbn_group_t *group,
+  dbn_t *dbn)
+{
+  if (group->num_members == DBN_GROUP_MAX_MEMBERS)
+  {
+    invoke_error_handler(
       dbn,
-      (dbn_hdr_t *)ptr);
+      true,
+      "Too many group members");
+    errno = ENOSPC;
+    return -1;
+  }
 
-    ptr += rlength;
-    n -= rlength;
+  int i = group->num_members++;
+  group->members[i] = dbn;
+  dbn->group = group;
+  dbn->uring = &group->ring;
+  dbn->group_tag = (uint64_t)(i + 1) << DBN_TAG_MEMBER_SHIFT;
+  dbn->buffer_group = DBN_BUFFER_GROUP + i;
+  return 0;
+}
+
+
+/**
+ * @brief Handle a completion on a group's io_uring, on behalf of the member
+ * that it is tagged with.
+ *
+ * @param group Pointer to group object.
+ * @param cqe Pointer to completion queue entry. Marked as seen by this function.
+ *
+ * @return Number of messages received, or -1 on failure with errno set and
+ * the member's error handler invoked (if not NULL).
+ */
+static int group_handle_cqe(
+  dbn_group_t *group,
+  struct io_uring_cqe *cqe)
+{
+  int i = (int)(cqe->user_data >> DBN_TAG_MEMBER_SHIFT) - 1;
+  if (i < 0 || i >= group->num_members)
+  {
+    io_uring_cqe_seen(&group->ring, cqe);
+    return 0;
   }
 
+  dbn_t *dbn = group->members[i];
+  if (cqe->user_data & DBN_TAG_CAPTURE) return handle_capture(dbn, cqe) ? -1 : 0;
+  if ((cqe->user_data & DBN_TAG_DATA_MASK) == DBN_TAG_WAKE) return handle_wake(dbn, cqe);
+  return handle_cqe(dbn, cqe);
+}
 
-  /*
-   * Keep any leftover data. See comments earlier in this function for
-   * more info.
-   */
-  if (n)
+
+int dbn_group_get(dbn_group_t *group)
+{
+  struct io_uring_cqe *cqe;
+  int m = io_uring_wait_cqe(&group->ring, &cqe);
+  if (m < 0)
   {
-    memcpy(dbn->leftover, ptr, n);
-    dbn->leftover_count = n;
+    if (m == -EINTR) return 0;
+    errno = -m;
+    return -1;
   }
 
 
   /*
-   * Re-enqueue this buffer for more data.
+   * Handle everything that is ready, not just the completion waited for.
    */
-  struct io_uring_sqe *sqe = io_uring_get_sqe(&dbn->ring);
-  io_uring_prep_recv(sqe, dbn->sock, buffer, dbn->capacity, 0);
-  io_uring_sqe_set_data(sqe, buffer);
+  int num_messages = 0;
+  do
+  {
+    int n = group_handle_cqe(group, cqe);
+    if (n < 0) return -1;
+    num_messages += n;
+  }
+  while (!io_uring_peek_cqe(&group->ring, &cqe));
+
+  return num_messages;
+}
+
 
-  io_uring_submit(&dbn->ring);
+int dbn_group_poll(dbn_group_t *group)
+{
+  int num_messages = 0;
+  struct io_uring_cqe *cqe;
+  while (!io_uring_peek_cqe(&group->ring, &cqe))
+  {
+    int n = group_handle_cqe(group, cqe);
+    if (n < 0) return -1;
+    num_messages += n;
+  }
 
   return num_messages;
 }
 
 
-void dbn_close(dbn_t *dbn)
+void dbn_group_close(dbn_group_t *group)
 {
-  io_uring_queue_exit(&dbn->ring);
+  /*
+   * Let members' capture writes finish, dropping receive completions, then
+   * tear down the io_uring (cancelling the receives) before any member's
+   * buffers are freed.
+   */
+  while (true)
+  {
+    bool pending = false;
+    for (int i = 0; i < group->num_members; i++)
+      pending |= group->members[i]->capture_pending > 0;
+    if (!pending) break;
+
+    struct io_uring_cqe *cqe;
+    if (io_uring_wait_cqe(&group->ring, &cqe) < 0) break;
+    int i = (int)(cqe->user_data >> DBN_TAG_MEMBER_SHIFT) - 1;
+    if (i >= 0 && i < group->num_members && (cqe->user_data & DBN_TAG_CAPTURE))
+    {
+      if (handle_capture(group->members[i], cqe)) break;
+    }
+    else io_uring_cqe_seen(&group->ring, cqe);
+  }
 
-  close(dbn->sock);
+  io_uring_queue_exit(&group->ring);
 
-  if (dbn->buffer0) free(dbn->buffer0);
-  if (dbn->buffer1) free(dbn->buffer1);
-  if (dbn->leftover) free(dbn->leftover);
+  for (int i = 0; i < group->num_members; i++)
+    dbn_close(group->members[i]);
 
-  memset(dbn, 0, sizeof(dbn_t));
+  memset(group, 0, sizeof(dbn_group_t));
 }
@@ -12,6 +12,8 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include <liburing.h>
 
 
@@ -199,6 +201,184 @@ typedef struct __attribute__((packed))
 } dbn_bbo_t;
 
 
+/**
+ * @brief DBN MBO (market by order) message.
+ */
+typedef struct __attribute__((packed))
+{
+  dbn_hdr_t hdr;
+  uint64_t order_id;
+  int64_t price;
+  uint32_t size;
+  uint8_t flags;
+  uint8_t channel_id;
+  char action;
+  char side;
+  uint64_t ts_recv;
+  int32_t ts_in_delta;
+  uint32_t sequence;
+  uint64_t ts_out; // Only valid if ts_out enabled during authentication
+} dbn_mbo_t;
+
+
+/**
+ * @brief DBN trade (MBP-0) message.
+ */
+typedef struct __attribute__((packed))
+{
+  dbn_hdr_t hdr;
+  int64_t price;
+  uint32_t size;
+  char action;
+  char side;
+  uint8_t flags;
+  uint8_t depth;
+  uint64_t ts_recv;
+  int32_t ts_in_delta;
+  uint32_t sequence;
+  uint64_t ts_out; // Only valid if ts_out enabled during authentication
+} dbn_trade_t;
+
+
+/**
+ * @brief DBN book level, as used by MBP-1 and MBP-10 messages.
+ */
+typedef struct __attribute__((packed))
+{
+  uint64_t bid_px;
+  uint64_t ask_px;
+  uint32_t bid_sz;
+  uint32_t ask_sz;
+  uint32_t bid_ct;
+  uint32_t ask_ct;
+} dbn_level_t;
+
+
+/**
+ * @brief DBN MBP-1 message.
+ */
+typedef struct __attribute__((packed))
+{
+  dbn_hdr_t hdr;
+  int64_t price;
+  uint32_t size;
+  char action;
+  char side;
+  uint8_t flags;
+  uint8_t depth;
+  uint64_t ts_recv;
+  int32_t ts_in_delta;
+  uint32_t sequence;
+  dbn_level_t levels[1];
+  uint64_t ts_out; // Only valid if ts_out enabled during authentication
+} dbn_mbp1_t;
+
+
+/**
+ * @brief DBN MBP-10 message.
+ */
+typedef struct __attribute__((packed))
+{
+  dbn_hdr_t hdr;
+  int64_t price;
+  uint32_t size;
+  char action;
+  char side;
+  uint8_t flags;
+  uint8_t depth;
+  uint64_t ts_recv;
+  int32_t ts_in_delta;
+  uint32_t sequence;
+  dbn_level_t levels[10];
+  uint64_t ts_out; // Only valid if ts_out enabled during authentication
+} dbn_mbp10_t;
+
+
+/**
+ * @brief DBN OHLCV message, of any interval.
+ */
+typedef struct __attribute__((packed))
+{
+  dbn_hdr_t hdr;
+  int64_t open;
+  int64_t high;
+  int64_t low;
+  int64_t close;
+  uint64_t volume;
+  uint64_t ts_out; // Only valid if ts_out enabled during authentication
+} dbn_ohlcv_t;
+
+
+/**
+ * @brief DBN trading status message.
+ */
+typedef struct __attribute__((packed))
+{
+  dbn_hdr_t hdr;
+  uint64_t ts_recv;
+  uint16_t action;
+  uint16_t reason;
+  uint16_t trading_event;
+  char is_trading;
+  char is_quoting;
+  char is_short_sell_restricted;
+  uint8_t reserved[7];
+  uint64_t ts_out; // Only valid if ts_out enabled during authentication
+} dbn_status_t;
+
+
+/**
+ * @brief DBN auction imbalance message.
+ */
+typedef struct __attribute__((packed))
+{
+  dbn_hdr_t hdr;
+  uint64_t ts_recv;
+  int64_t ref_price;
+  uint64_t auction_time;
+  int64_t cont_book_clr_price;
+  int64_t auct_interest_clr_price;
+  int64_t ssr_filling_price;
+  int64_t ind_match_price;
+  int64_t upper_collar;
+  int64_t lower_collar;
+  uint32_t paired_qty;
+  uint32_t total_imbalance_qty;
+  uint32_t market_imbalance_qty;
+  uint32_t unpaired_qty;
+  char auction_type;
+  char side;
+  uint8_t auction_status;
+  uint8_t freeze_status;
+  uint8_t num_extensions;
+  char unpaired_side;
+  char significant_imbalance;
+  uint8_t reserved;
+  uint64_t ts_out; // Only valid if ts_out enabled during authentication
+} dbn_imbalance_t;
+
+
+/**
+ * @brief DBN statistics message.
+ */
+typedef struct __attribute__((packed))
+{
+  dbn_hdr_t hdr;
+  uint64_t ts_recv;
+  uint64_t ts_ref;
+  int64_t price;
+  int32_t quantity;
+  uint32_t sequence;
+  int32_t ts_in_delta;
+  uint16_t stat_type;
+  uint16_t channel_id;
+  uint8_t update_action;
+  uint8_t stat_flags;
+  uint8_t reserved[6];
+  uint64_t ts_out; // Only valid if ts_out enabled during authentication
+} dbn_stat_t;
+
+
 /**
  * @brief DBN error message.
  */
@@ -232,13 +412,109 @@ typedef struct __attribute__((packed))
 /**
  * @brief Maximum size of a supported DBN message, compile-time constant.
  */
-#define DBN_MAX_MESSAGE_SIZE MAX6( \
-  sizeof(dbn_smap_t), \
-  sizeof(dbn_sdef_t), \
-  sizeof(dbn_cmbp1_t), \
-  sizeof(dbn_bbo_t), \
-  sizeof(dbn_emsg_t), \
-  sizeof(dbn_smsg_t))
+#define DBN_MAX_MESSAGE_SIZE MAX3( \
+  MAX6( \
+    sizeof(dbn_smap_t), \
+    sizeof(dbn_sdef_t), \
+    sizeof(dbn_cmbp1_t), \
+    sizeof(dbn_bbo_t), \
+    sizeof(dbn_emsg_t), \
+    sizeof(dbn_smsg_t)), \
+  MAX6( \
+    sizeof(dbn_mbo_t), \
+    sizeof(dbn_trade_t), \
+    sizeof(dbn_mbp1_t), \
+    sizeof(dbn_mbp10_t), \
+    sizeof(dbn_ohlcv_t), \
+    sizeof(dbn_status_t)), \
+  MAX2( \
+    sizeof(dbn_imbalance_t), \
+    sizeof(dbn_stat_t)))
+
+
+/**
+ * @brief Maximum size of any DBN record, as limited by the 8-bit rlength
+ * field (which counts 32-bit words), in bytes.
+ */
+#define DBN_MAX_RECORD_SIZE (4 * 255)
+
+
+/**
+ * @brief Size of the ancillary data buffer used to receive timestamps, in bytes.
+ */
+#define DBN_RX_CONTROL_SIZE 128
+
+
+/**
+ * @brief Socket receive modes.
+ */
+typedef enum
+{
+  DBN_RECV_MODE_DOUBLE_BUFFER = 0,  ///< @brief Two alternating recv requests, one per local buffer (default)
+  DBN_RECV_MODE_MULTISHOT,          ///< @brief One multishot recv into a ring of kernel-selected provided buffers
+  DBN_RECV_MODE_MIRROR              ///< @brief One recv at a time into a ring buffer mapped twice back to back, so messages are always contiguous
+} dbn_recv_mode_t;
+
+
+/**
+ * @brief Per-instrument sequence number checking, for rtypes that carry one
+ * (see dbn_set_sequence_handler()).
+ */
+typedef enum
+{
+  DBN_SEQUENCE_NONE = 0,    ///< @brief No checking (default)
+  DBN_SEQUENCE_MONOTONIC,   ///< @brief Report duplicates and regressions, for subsampled schemas (ex. bbo-1s) in which sequence numbers skip
+  DBN_SEQUENCE_CONTIGUOUS   ///< @brief Also report gaps, for streams in which each instrument's sequence numbers are consecutive
+} dbn_sequence_t;
+
+
+/**
+ * @brief Huge page backing for local buffers.
+ */
+typedef enum
+{
+  DBN_HUGEPAGES_NONE = 0,   ///< @brief Regular pages (default)
+  DBN_HUGEPAGES_THP,        ///< @brief Transparent huge pages (madvise(MADV_HUGEPAGE))
+  DBN_HUGEPAGES_HUGETLB     ///< @brief Explicit huge pages (MAP_HUGETLB), falling back to transparent huge pages if none are reserved
+} dbn_hugepages_t;
+
+
+/**
+ * @brief Value for dbn_opts_t.numa_node: don't bind local buffers to a NUMA node.
+ */
+#define DBN_NUMA_NODE_NONE -1
+
+
+/**
+ * @brief Value for dbn_opts_t.numa_node: bind local buffers to the NUMA node
+ * of the CPU calling dbn_connect().
+ */
+#define DBN_NUMA_NODE_CURRENT -2
+
+
+/**
+ * @brief Client options. Populated with defaults by dbn_init(), and may be
+ * modified by the owner before calling dbn_connect().
+ */
+typedef struct
+{
+  int rcvbuf;                 ///< @brief Required kernel socket receive buffer size (SO_RCVBUF), in bytes
+  int capacity;               ///< @brief Size of each local receive buffer, in bytes, or 0 to match the kernel receive buffer
+  dbn_hugepages_t hugepages;  ///< @brief Huge page backing for local receive buffers
+  int numa_node;              ///< @brief NUMA node to bind local receive buffers to, or DBN_NUMA_NODE_NONE / DBN_NUMA_NODE_CURRENT
+  dbn_recv_mode_t recv_mode;  ///< @brief Socket receive mode
+  int num_provided_buffers;   ///< @brief For DBN_RECV_MODE_MULTISHOT, number of provided buffers (power of 2)
+  int provided_buffer_size;   ///< @brief For DBN_RECV_MODE_MULTISHOT, size of each provided buffer, in bytes
+  bool sqpoll;                ///< @brief If true, use a kernel submission queue polling thread (IORING_SETUP_SQPOLL)
+  int sqpoll_cpu;             ///< @brief If sqpoll and not -1, CPU to which the submission queue polling thread is pinned
+  int sqpoll_idle_ms;         ///< @brief If sqpoll, milliseconds without submissions before the polling thread sleeps
+  int busy_poll_us;           ///< @brief If not 0, socket busy poll duration (SO_BUSY_POLL), in microseconds
+  bool rx_timestamps;         ///< @brief If true, record the kernel receive timestamp (SO_TIMESTAMPING) of each read
+  bool hw_timestamps;         ///< @brief If rx_timestamps, prefer NIC hardware receive timestamps where the device provides them
+  const char *capture_path;   ///< @brief If not NULL, path of a file to which the raw DBN stream is written as it is received, for later use with dbn_open_file(). Must be unique per session
+  size_t backpressure_bytes;  ///< @brief If not 0, receive backlog high watermark, in bytes, checked after each read. See dbn_set_backpressure_handler()
+  dbn_sequence_t sequence;    ///< @brief Per-instrument sequence number checking. See dbn_set_sequence_handler()
+} dbn_opts_t;
 
 
 /*
@@ -248,6 +524,55 @@ struct dbn;
 typedef struct dbn dbn_t;
 
 
+/**
+ * @brief Number of buckets in each dbn_metrics_t histogram.
+ */
+#define DBN_METRICS_BUCKETS 16
+
+
+/**
+ * @brief Session metrics.
+ *
+ * Updated with relaxed atomic stores by the thread receiving, so they cost
+ * no more than plain counters, and read from any thread with
+ * dbn_get_metrics(). Histogram bucket 0 counts zeros, and bucket i > 0
+ * counts values in [2^(i-1), 2^i) units, with the last bucket unbounded.
+ */
+typedef struct
+{
+  uint64_t num_bytes;         ///< @brief Bytes received
+  uint64_t num_messages;      ///< @brief Messages decoded and dispatched
+  uint64_t num_cqes;          ///< @brief io_uring completions handled, including capture writes
+  uint64_t num_reads;         ///< @brief Completed socket reads
+  uint64_t num_straddles;     ///< @brief Socket reads that ended partway through a message (and so took the leftover path)
+  uint64_t num_waits;         ///< @brief Times dbn_get() blocked waiting for a completion
+  uint64_t wait_ns;           ///< @brief Total time dbn_get() spent blocked, in nanoseconds
+  uint64_t num_backpressure;  ///< @brief Socket reads after which the receive backlog was at or above opts.backpressure_bytes
+  uint64_t num_sequence_gaps; ///< @brief If opts.sequence is DBN_SEQUENCE_CONTIGUOUS, messages whose sequence number skipped ahead
+  uint64_t num_sequence_duplicates; ///< @brief If opts.sequence, messages whose sequence number was at or behind the highest one received for the instrument
+  uint64_t read_messages[DBN_METRICS_BUCKETS]; ///< @brief Histogram of messages decoded per read
+  uint64_t read_bytes[DBN_METRICS_BUCKETS];    ///< @brief Histogram of bytes per read, in units of 64 bytes
+} dbn_metrics_t;
+
+
+/**
+ * @brief Maximum number of clients in a dbn_group_t.
+ */
+#define DBN_GROUP_MAX_MEMBERS 255
+
+
+/**
+ * @brief Group of clients driven together, from one thread, through one
+ * shared io_uring.
+ */
+typedef struct
+{
+  struct io_uring ring;       ///< @brief io_uring shared by all members
+  int num_members;            ///< @brief Number of members
+  dbn_t *members[DBN_GROUP_MAX_MEMBERS]; ///< @brief Members, in the order added
+} dbn_group_t;
+
+
 /**
  * @brief Signature for an error handler.
  *
@@ -272,27 +597,365 @@ typedef void (*dbn_on_msg_t)(
   dbn_hdr_t *msg);
 
 
+/**
+ * @brief Contiguous run of complete messages, all received by one read.
+ */
+typedef struct
+{
+  uint8_t *data;    ///< @brief Pointer to the first message
+  size_t length;    ///< @brief Number of bytes at data, consisting only of complete messages
+  int count;        ///< @brief Number of messages at data
+  uint64_t ts_rx;   ///< @brief Kernel (or NIC) receive timestamp of the read that completed this batch, in Unix nanoseconds, or 0 if not enabled
+} dbn_batch_t;
+
+
+/**
+ * @brief Iterate over the messages in a batch.
+ *
+ * @param batch Pointer to batch.
+ * @param msg Name of the dbn_hdr_t pointer declared for the loop body.
+ */
+#define dbn_batch_foreach(batch, msg) \
+  for (dbn_hdr_t *msg = (dbn_hdr_t *)(batch)->data; \
+    (uint8_t *)msg < (batch)->data + (batch)->length; \
+    msg = (dbn_hdr_t *)((uint8_t *)msg + 4 * msg->rlength))
+
+
+/**
+ * @brief Iterate over the messages of one record type in a batch, as typed
+ * pointers, skipping all others (ex. heartbeats and symbol mappings).
+ *
+ * Each message is tested against the type inline, with no dispatch. The loop
+ * steps by each message's rlength rather than by sizeof(type), since records
+ * end 8 bytes early without ts_out and other rtypes may be interleaved.
+ *
+ * @param batch Pointer to batch.
+ * @param type Record type, ex. dbn_mbo_t.
+ * @param msg Name of the type pointer declared for the loop body.
+ * @param is_type Predicate taking a dbn_hdr_t pointer, ex. dbn_is_mbo.
+ */
+#define dbn_batch_foreach_type(batch, type, msg, is_type) \
+  for (type *msg = (type *)(batch)->data; \
+    (uint8_t *)msg < (batch)->data + (batch)->length; \
+    msg = (type *)((uint8_t *)msg + 4 * msg->hdr.rlength)) \
+    if (is_type(&msg->hdr))
+
+
+/**
+ * @brief Test whether a message is an MBO message (dbn_mbo_t).
+ */
+static inline bool dbn_is_mbo(const dbn_hdr_t *msg)
+{
+  return msg->rtype == DBN_RTYPE_MBO;
+}
+
+
+/**
+ * @brief Test whether a message is a trade message (dbn_trade_t).
+ */
+static inline bool dbn_is_trade(const dbn_hdr_t *msg)
+{
+  return msg->rtype == DBN_RTYPE_MBP0;
+}
+
+
+/**
+ * @brief Test whether a message is an MBP-1 message (dbn_mbp1_t).
+ */
+static inline bool dbn_is_mbp1(const dbn_hdr_t *msg)
+{
+  return msg->rtype == DBN_RTYPE_MBP1;
+}
+
+
+/**
+ * @brief Test whether a message is an MBP-10 message (dbn_mbp10_t).
+ */
+static inline bool dbn_is_mbp10(const dbn_hdr_t *msg)
+{
+  return msg->rtype == DBN_RTYPE_MBP10;
+}
+
+
+/**
+ * @brief Test whether a message has the CMBP-1 layout (dbn_cmbp1_t): CMBP-1
+ * or TCBBO.
+ */
+static inline bool dbn_is_cmbp1(const dbn_hdr_t *msg)
+{
+  return msg->rtype == DBN_RTYPE_CMBP1 || msg->rtype == DBN_RTYPE_TCBBO;
+}
+
+
+/**
+ * @brief Test whether a message has the BBO layout (dbn_bbo_t): BBO or CBBO,
+ * of either interval.
+ */
+static inline bool dbn_is_bbo(const dbn_hdr_t *msg)
+{
+  return (msg->rtype >= DBN_RTYPE_CBBO1S && msg->rtype <= DBN_RTYPE_CBBO1M)
+    || (msg->rtype >= DBN_RTYPE_BBO1S && msg->rtype <= DBN_RTYPE_BBO1M);
+}
+
+
+/**
+ * @brief Test whether a message is an OHLCV message (dbn_ohlcv_t), of any
+ * interval.
+ */
+static inline bool dbn_is_ohlcv(const dbn_hdr_t *msg)
+{
+  return msg->rtype >= DBN_RTYPE_OHLCV1S && msg->rtype <= DBN_RTYPE_OHLCV1D;
+}
+
+
+/**
+ * @brief Test whether a message is a status message (dbn_status_t).
+ */
+static inline bool dbn_is_status(const dbn_hdr_t *msg)
+{
+  return msg->rtype == DBN_RTYPE_STATUS;
+}
+
+
+/**
+ * @brief Test whether a message is an imbalance message (dbn_imbalance_t).
+ */
+static inline bool dbn_is_imbalance(const dbn_hdr_t *msg)
+{
+  return msg->rtype == DBN_RTYPE_IMBALANCE;
+}
+
+
+/**
+ * @brief Test whether a message is a statistics message (dbn_stat_t).
+ */
+static inline bool dbn_is_stat(const dbn_hdr_t *msg)
+{
+  return msg->rtype == DBN_RTYPE_STAT;
+}
+
+
+/*
+ * Typed iterators, one per record type. See dbn_batch_foreach_type().
+ */
+#define dbn_batch_foreach_mbo(batch, msg)       dbn_batch_foreach_type(batch, dbn_mbo_t, msg, dbn_is_mbo)
+#define dbn_batch_foreach_trade(batch, msg)     dbn_batch_foreach_type(batch, dbn_trade_t, msg, dbn_is_trade)
+#define dbn_batch_foreach_mbp1(batch, msg)      dbn_batch_foreach_type(batch, dbn_mbp1_t, msg, dbn_is_mbp1)
+#define dbn_batch_foreach_mbp10(batch, msg)     dbn_batch_foreach_type(batch, dbn_mbp10_t, msg, dbn_is_mbp10)
+#define dbn_batch_foreach_cmbp1(batch, msg)     dbn_batch_foreach_type(batch, dbn_cmbp1_t, msg, dbn_is_cmbp1)
+#define dbn_batch_foreach_bbo(batch, msg)       dbn_batch_foreach_type(batch, dbn_bbo_t, msg, dbn_is_bbo)
+#define dbn_batch_foreach_ohlcv(batch, msg)     dbn_batch_foreach_type(batch, dbn_ohlcv_t, msg, dbn_is_ohlcv)
+#define dbn_batch_foreach_status(batch, msg)    dbn_batch_foreach_type(batch, dbn_status_t, msg, dbn_is_status)
+#define dbn_batch_foreach_imbalance(batch, msg) dbn_batch_foreach_type(batch, dbn_imbalance_t, msg, dbn_is_imbalance)
+#define dbn_batch_foreach_stat(batch, msg)      dbn_batch_foreach_type(batch, dbn_stat_t, msg, dbn_is_stat)
+
+
+/**
+ * @brief Get a message's ts_recv, or its ts_event if it has no ts_recv.
+ *
+ * @param msg Pointer to message.
+ *
+ * @return Timestamp, in Unix nanoseconds.
+ */
+static inline uint64_t dbn_ts_recv(const dbn_hdr_t *msg)
+{
+  switch (msg->rtype)
+  {
+    case DBN_RTYPE_SDEF:
+      return ((const dbn_sdef_t *)msg)->ts_recv;
+    case DBN_RTYPE_CMBP1:
+    case DBN_RTYPE_TCBBO:
+      return ((const dbn_cmbp1_t *)msg)->ts_recv;
+    case DBN_RTYPE_CBBO1S:
+    case DBN_RTYPE_CBBO1M:
+    case DBN_RTYPE_BBO1S:
+    case DBN_RTYPE_BBO1M:
+      return ((const dbn_bbo_t *)msg)->ts_recv;
+    case DBN_RTYPE_MBO:
+      return ((const dbn_mbo_t *)msg)->ts_recv;
+    case DBN_RTYPE_MBP0:
+    case DBN_RTYPE_MBP1:
+    case DBN_RTYPE_MBP10:
+      return ((const dbn_trade_t *)msg)->ts_recv;
+    case DBN_RTYPE_STATUS:
+      return ((const dbn_status_t *)msg)->ts_recv;
+    case DBN_RTYPE_IMBALANCE:
+      return ((const dbn_imbalance_t *)msg)->ts_recv;
+    case DBN_RTYPE_STAT:
+      return ((const dbn_stat_t *)msg)->ts_recv;
+    default:
+      return msg->ts_event;
+  }
+}
+
+
+/**
+ * @brief Symbol of a live subscription request awaiting its SMAP.
+ */
+typedef struct
+{
+  uint64_t id;                ///< @brief Subscription request ID, see dbn_subscribe()
+  char symbol[23];            ///< @brief Symbol with suffix, as it will appear in stype_in_symbol, or empty for all symbols
+  bool sent;                  ///< @brief Whether the request has been sent. An all-symbols entry only completes on an SMAP processed after this is set
+} dbn_pending_t;
+
+
+/**
+ * @brief Signature for a Databento message batch handler.
+ *
+ * @param dbn Pointer to client object.
+ * @param batch Pointer to batch. Handler must not free, and must not rely on it or its messages after the handler returns.
+ */
+typedef void (*dbn_on_batch_t)(
+  dbn_t *dbn,
+  dbn_batch_t *batch);
+
+
+/**
+ * @brief Signature for a backpressure handler.
+ *
+ * @param dbn Pointer to client object.
+ * @param backlog Receive backlog, in bytes: data queued in the kernel socket buffer plus data received but not yet decoded.
+ * @param lag Current time minus the ts_out of the last message decoded (or its ts_recv, if ts_out is not enabled), in nanoseconds, or 0 if no message has been decoded.
+ */
+typedef void (*dbn_on_backpressure_t)(
+  dbn_t *dbn,
+  uint64_t backlog,
+  int64_t lag);
+
+
+/**
+ * @brief Signature for a sequence handler.
+ *
+ * @param dbn Pointer to client object.
+ * @param msg Pointer to the out of sequence message, which is still dispatched as usual after the handler returns.
+ * @param last Highest sequence number previously received for the instrument.
+ * @param sequence Sequence number of msg.
+ */
+typedef void (*dbn_on_sequence_t)(
+  dbn_t *dbn,
+  dbn_hdr_t *msg,
+  uint32_t last,
+  uint32_t sequence);
+
+
+/**
+ * @brief Entry of a per-instrument sequence number table.
+ */
+typedef struct
+{
+  uint32_t instrument_id;     ///< @brief Instrument ID, or DBN_SEQUENCE_EMPTY if unused
+  uint32_t sequence;          ///< @brief Highest sequence number received
+} dbn_sequence_entry_t;
+
+
+/**
+ * @brief dbn_sequence_entry_t.instrument_id of an unused entry.
+ */
+#define DBN_SEQUENCE_EMPTY 0xFFFFFFFF
+
+
+/**
+ * @brief Capture write in flight, see dbn_opts_t.capture_path.
+ */
+typedef struct
+{
+  const uint8_t *data;        ///< @brief Unwritten remainder of the received data
+  size_t length;              ///< @brief Length of the unwritten remainder, in bytes
+  uint64_t offset;            ///< @brief File offset of the unwritten remainder
+} dbn_capture_t;
+
+
+/*
+ * Top-of-book store, see dbn_quotes.h.
+ */
+struct dbn_quotes;
+
+
+/*
+ * Columnar exporter, see dbn_export.h.
+ */
+struct dbn_export;
+struct dbn_export_producer;
+
+
 /**
  * @brief Databento live data client
  */
 struct dbn
 {
-  int sock;                   ///< @brief Socket file descriptor
-  int capacity;               ///< @brief Kernel receive buffer size, and size of local buffers, in bytes
-  struct io_uring ring;       ///< @brief io_uring used to communicate with the socket
+  dbn_opts_t opts;            ///< @brief Options, see dbn_opts_t
+  int sock;                   ///< @brief Socket file descriptor, or -1 if not connected
+  int capacity;               ///< @brief Size of local receive buffers, in bytes
+  struct io_uring ring;       ///< @brief io_uring used to communicate with the socket, unless a group member
+  struct io_uring *uring;     ///< @brief io_uring in use: ring, or the group's
+  bool ring_initialized;      ///< @brief Whether ring has been initialized, and must be torn down by dbn_close()
+  dbn_group_t *group;         ///< @brief If not NULL, group this client is a member of
+  uint64_t group_tag;         ///< @brief If a group member, tag identifying it in every request's user_data
+  uint16_t buffer_group;      ///< @brief For DBN_RECV_MODE_MULTISHOT, io_uring buffer group ID of provided buffers
   uint8_t *buffer0;           ///< @brief First receive buffer, to be filled by the kernel while the client is handling data in the second buffer
   uint8_t *buffer1;           ///< @brief Second receive buffer, to be filled by the kernel while the client is handling data in the first buffer
+  struct io_uring_buf_ring *buf_ring; ///< @brief For DBN_RECV_MODE_MULTISHOT, ring through which provided buffers are handed to the kernel
+  uint8_t *provided_buffers;  ///< @brief For DBN_RECV_MODE_MULTISHOT, contiguous storage for all provided buffers
+  uint8_t *mirror;            ///< @brief For DBN_RECV_MODE_MIRROR, ring buffer of capacity bytes, mapped twice back to back
+  uint64_t mirror_head;       ///< @brief For DBN_RECV_MODE_MIRROR, stream offset of the first byte not yet decoded
+  uint64_t mirror_tail;       ///< @brief For DBN_RECV_MODE_MIRROR, stream offset of the first byte not yet received
+  uint64_t mirror_captured;   ///< @brief For DBN_RECV_MODE_MIRROR with opts.capture_path, stream offset of the first byte not yet in the capture file
+  bool mirror_armed;          ///< @brief For DBN_RECV_MODE_MIRROR, if a recv is outstanding
+  uint64_t rx_timestamp;      ///< @brief If opts.rx_timestamps, receive timestamp of the most recent read, in Unix nanoseconds
+  struct msghdr rx_msgs[2];   ///< @brief If opts.rx_timestamps, recvmsg headers, one per outstanding request
+  struct iovec rx_iovs[2];    ///< @brief If opts.rx_timestamps, recvmsg data vectors, one per outstanding request
+  uint8_t rx_controls[2][DBN_RX_CONTROL_SIZE]; ///< @brief If opts.rx_timestamps, recvmsg ancillary data, one per outstanding request
+  int wake_fd;                ///< @brief eventfd written by dbn_wake(), with a read kept outstanding on the io_uring, or -1 if unavailable
+  uint64_t wake_count;        ///< @brief Buffer of the outstanding read of wake_fd
+  int capture_fd;             ///< @brief If opts.capture_path, capture file descriptor
+  uint64_t capture_offset;    ///< @brief If opts.capture_path, file offset at which the next received data is written
+  int capture_pending;        ///< @brief If opts.capture_path, number of capture writes in flight
+  dbn_capture_t *captures;    ///< @brief If opts.capture_path, capture writes, one per receive buffer (per provided buffer for DBN_RECV_MODE_MULTISHOT), indexed by completion tag
+  uint8_t *file;              ///< @brief If opened with dbn_open_file(), mapped capture file
+  size_t file_length;         ///< @brief If opened with dbn_open_file(), size of file, in bytes
+  size_t file_head;           ///< @brief If opened with dbn_open_file(), offset of the first byte not yet decoded
   uint8_t *leftover;          ///< @brief Leftover data buffer, used to hold incomplete message data that spans multiple io_uring reads
   int leftover_count;         ///< @brief Number of bytes in the leftover data buffer
+  dbn_metrics_t metrics;      ///< @brief Metrics, see dbn_get_metrics()
+  pthread_mutex_t send_lock;  ///< @brief Serializes dbn_subscribe() requests
+  pthread_mutex_t pending_lock; ///< @brief Protects pending, num_pending_symbols and next_subscription
+  dbn_pending_t *pending;     ///< @brief Symbols of dbn_subscribe() requests not yet confirmed by SMAP
+  int num_pending_symbols;    ///< @brief Number of entries in pending
+  _Atomic int num_pending;    ///< @brief Copy of num_pending_symbols, checked without the lock on receipt of each message
+  uint64_t next_subscription; ///< @brief ID of the most recent dbn_subscribe() request
   dbn_on_error_t on_error;    ///< @brief If not NULL, called on runtime client error
-  dbn_on_msg_t on_msg;        ///< @brief If not NULL, called on receipt of a Databento message
+  dbn_on_msg_t on_msg;        ///< @brief Default message handler, with which every entry of handlers is initialized
+  dbn_on_msg_t handlers[256]; ///< @brief Per-rtype message handlers. If not NULL, called on receipt of a message of that rtype
+  dbn_on_batch_t on_batch;    ///< @brief If not NULL, called once per batch of received messages instead of on_msg
+  dbn_on_backpressure_t on_backpressure; ///< @brief If not NULL, called while the receive backlog is at or above opts.backpressure_bytes
+  bool ts_out;                ///< @brief If ts_out was enabled during authentication
+  uint64_t last_ts;           ///< @brief If opts.backpressure_bytes, ts_out (or ts_recv) of the last message decoded, in Unix nanoseconds
+  bool backpressured;         ///< @brief If the receive backlog was at or above opts.backpressure_bytes at the last check
+  dbn_on_sequence_t on_sequence; ///< @brief If not NULL, called on receipt of a message out of sequence for its instrument
+  dbn_sequence_entry_t *sequences; ///< @brief If opts.sequence, open-addressed table of last sequence number by instrument
+  uint32_t sequences_mask;    ///< @brief If opts.sequence, number of entries in sequences minus 1
+  uint32_t num_sequences;     ///< @brief If opts.sequence, number of entries of sequences in use
+  struct dbn_quotes *quotes;  ///< @brief If not NULL, top-of-book store updated from each CMBP-1 and BBO message before it is dispatched
+  struct dbn_export_producer *export_producer; ///< @brief If not NULL, exporter ring to which each CMBP-1 and BBO message is copied before it is dispatched
   void *ctx;                  ///< @brief Optional, arbitrary owner-provided pointer
 };
 
 
+/**
+ * @brief Populate client options with defaults.
+ *
+ * @param opts Pointer to options to populate.
+ */
+extern void dbn_opts_init(dbn_opts_t *opts);
+
+
 /**
  * @brief Initialize a Databento live data client, but don't connect yet.
  *
+ * Options (dbn->opts) are set to defaults, and may be modified before calling
+ * dbn_connect().
+ *
  * @param dbn Pointer to an uninitialized client object.
  * @param on_error Pointer to client error handler. May be NULL.
  * @param on_msg Pointer to client message handler. May be NULL.
@@ -305,6 +968,101 @@ extern void dbn_init(
   void *ctx);
 
 
+/**
+ * @brief Set the message handler for a single rtype.
+ *
+ * Every rtype initially dispatches to the on_msg handler given to dbn_init().
+ * To receive only specific rtypes, pass NULL to dbn_init() and register a
+ * handler for each wanted rtype. Messages of rtypes without a handler are
+ * skipped without any call.
+ *
+ * @param dbn Pointer to an initialized client object.
+ * @param rtype Message type.
+ * @param on_msg Pointer to message handler, or NULL to ignore messages of this rtype.
+ */
+extern void dbn_set_msg_handler(
+  dbn_t *dbn,
+  dbn_rtype_t rtype,
+  dbn_on_msg_t on_msg);
+
+
+/**
+ * @brief Set a batch handler, called once for each contiguous run of messages
+ * received by a single read. While set, on_msg is not called.
+ *
+ * @param dbn Pointer to an initialized client object.
+ * @param on_batch Pointer to batch handler, or NULL to revert to on_msg.
+ */
+extern void dbn_set_batch_handler(
+  dbn_t *dbn,
+  dbn_on_batch_t on_batch);
+
+
+/**
+ * @brief Set a backpressure handler, to learn that the client is falling
+ * behind while there is still kernel buffer to spare, and shed load.
+ *
+ * If opts.backpressure_bytes is not 0, then after each socket read the
+ * client asks the kernel how much data is queued on the socket (SIOCINQ, one
+ * system call). The handler is called after every read at which the backlog
+ * is at or above opts.backpressure_bytes, and once more at the first read at
+ * which it has dropped back below, so load shed on the way up can be
+ * restored.
+ *
+ * @param dbn Pointer to an initialized client object.
+ * @param on_backpressure Pointer to backpressure handler, or NULL for none.
+ */
+extern void dbn_set_backpressure_handler(
+  dbn_t *dbn,
+  dbn_on_backpressure_t on_backpressure);
+
+
+/**
+ * @brief Set a sequence handler, to tell missed or replayed data apart from
+ * a quiet instrument.
+ *
+ * If opts.sequence is not DBN_SEQUENCE_NONE, the highest sequence number of
+ * each instrument is tracked for rtypes that carry one (BBO-1S and BBO-1M),
+ * at the cost of one table probe per such message. A message whose sequence
+ * number is at or behind the highest one received for its instrument, or
+ * (with DBN_SEQUENCE_CONTIGUOUS) more than one ahead, is counted in the
+ * metrics and reported to the handler.
+ *
+ * @param dbn Pointer to an initialized client object.
+ * @param on_sequence Pointer to sequence handler, or NULL for none.
+ */
+extern void dbn_set_sequence_handler(
+  dbn_t *dbn,
+  dbn_on_sequence_t on_sequence);
+
+
+/**
+ * @brief Attach a top-of-book store (see dbn_quotes.h), to be updated from
+ * each CMBP-1 and BBO message received, before the message is dispatched.
+ *
+ * @param dbn Pointer to an initialized client object.
+ * @param quotes Pointer to initialized store, or NULL to detach. Must outlive the client.
+ */
+extern void dbn_set_quotes(
+  dbn_t *dbn,
+  struct dbn_quotes *quotes);
+
+
+/**
+ * @brief Attach a columnar exporter (see dbn_export.h), to which each CMBP-1
+ * and BBO message received is copied, before the message is dispatched.
+ *
+ * @param dbn Pointer to an initialized client object.
+ * @param exporter Pointer to opened exporter, or NULL to detach. Must outlive the client.
+ *
+ * @return 0 on success, or -1 on failure (all of the exporter's producers
+ * have been claimed) with errno set and error handler invoked (if not NULL).
+ */
+extern int dbn_set_export(
+  dbn_t *dbn,
+  struct dbn_export *exporter);
+
+
 /**
  * @brief Establish a connection to Databento and authenticate.
  *
@@ -313,6 +1071,9 @@ extern void dbn_init(
  * @param dataset Pointer to null-terminated Databento dataset name.
  * @param ts_out Indicates if Databento should perform ts_out timestamping.
  *
+ * On failure, whatever was set up before the error is released by
+ * dbn_close(), which must still be called.
+ *
  * @return 0 on success, or -1 on failure with errno set and error handler
  * invoked (if not NULL).
  */
@@ -346,16 +1107,189 @@ extern int dbn_start(
   bool replay);
 
 
+/**
+ * @brief Subscribe to more symbols on a started session, without
+ * reconnecting. Thread-safe: may be called from any thread, concurrently
+ * with dbn_get() / dbn_poll() on another.
+ *
+ * Databento has no way to unsubscribe from symbols, short of ending the
+ * session.
+ *
+ * @param dbn Pointer to a started client object.
+ * @param schema Pointer to null-terminated schema name.
+ * @param symbology Pointer to null-terminated symbology name.
+ * @param num_symbols Number of symbols in symbols, or 0 for all symbols.
+ * @param symbols Pointer to array of pointers to null-terminated symbols.
+ * @param suffix Pointer to null-terminated suffix string to be applied to symbols.
+ * @param replay If true, replay the current day's worth of data for these symbols before live data.
+ * @param id Pointer to populate with the request ID, for dbn_is_subscribed(). Only meaningful on success.
+ *
+ * @return 0 on success, or -1 on failure with errno set and error handler invoked (if not NULL).
+ */
+extern int dbn_subscribe(
+  dbn_t *dbn,
+  const char *schema,
+  const char *symbology,
+  int num_symbols,
+  const char * const *symbols,
+  const char *suffix,
+  bool replay,
+  uint64_t *id);
+
+
+/**
+ * @brief Determine if a dbn_subscribe() request is complete, meaning that a
+ * symbol mapping (SMAP) message has been received for each of its symbols
+ * (or, for all symbols, that any has since the request was sent). Thread-safe.
+ *
+ * A symbol that the gateway rejects gets no SMAP. Instead, a symbol named
+ * in an error or system message is retired without one and reported to the
+ * error handler, and an error message completes every all-symbols request
+ * already sent. So a request with rejected symbols still completes.
+ *
+ * @param dbn Pointer to a started client object.
+ * @param id Request ID, from dbn_subscribe().
+ *
+ * @return true if complete, false if still pending.
+ */
+extern bool dbn_is_subscribed(
+  dbn_t *dbn,
+  uint64_t id);
+
+
+/**
+ * @brief Take a snapshot of a client's metrics. Thread-safe: may be called
+ * from any thread, concurrently with dbn_get() / dbn_poll() on another. Each
+ * counter is read atomically, though not all at the same instant.
+ *
+ * @param dbn Pointer to an initialized client object.
+ * @param metrics Pointer to populate.
+ */
+extern void dbn_get_metrics(
+  dbn_t *dbn,
+  dbn_metrics_t *metrics);
+
+
+/**
+ * @brief Add one metrics snapshot into another, ex. to aggregate sessions.
+ *
+ * @param total Pointer to metrics to add to.
+ * @param metrics Pointer to metrics to add.
+ */
+extern void dbn_add_metrics(
+  dbn_metrics_t *total,
+  const dbn_metrics_t *metrics);
+
+
+/**
+ * @brief Attach a client to an already connected stream socket, such as one
+ * end of a socketpair, instead of connecting to Databento. Replaces
+ * dbn_connect() and dbn_start().
+ *
+ * The peer must send a DBN stream (stream header followed by records). The
+ * socket is configured according to dbn->opts like any other session, so
+ * this is suitable for exercising the receive path offline.
+ *
+ * @param dbn Pointer to an initialized client object.
+ * @param fd Connected stream socket. Owned (and closed) by the client once attached.
+ *
+ * @return 0 on success, or -1 on failure with errno set and error handler invoked (if not NULL).
+ */
+extern int dbn_attach(
+  dbn_t *dbn,
+  int fd);
+
+
+/**
+ * @brief Open a capture file, written by a client with opts.capture_path
+ * set, as the data source for a client. Replaces dbn_connect() and
+ * dbn_start().
+ *
+ * The file is mapped and decoded in place. Each call to dbn_get() or
+ * dbn_poll() then dispatches up to one receive buffer's worth of messages
+ * (see opts.capacity and opts.rcvbuf) through the same handlers as a live
+ * session, at memory speed and identically on every run.
+ *
+ * @param dbn Pointer to an initialized client object.
+ * @param path Pointer to null-terminated path of capture file (any DBN version 1 stream).
+ *
+ * @return 0 on success, or -1 on failure with errno set and error handler invoked (if not NULL).
+ */
+extern int dbn_open_file(
+  dbn_t *dbn,
+  const char *path);
+
+
 /**
  * @brief Receive data from Databento. Blocks until at least one message is received.
  *
  * @param dbn Pointer to an initialized and started client object.
  *
- * @return Number of messages received by this call.
+ * @return Number of messages received by this call. For a client opened with
+ * dbn_open_file(), -1 with errno set to ENODATA once the whole file has been
+ * dispatched (the error handler is not invoked). 0 if woken by dbn_wake().
  */
 extern int dbn_get(dbn_t *dbn);
 
 
+/**
+ * @brief Like dbn_get(), but give up waiting after a timeout.
+ *
+ * @param dbn Pointer to an initialized and started client object.
+ * @param timeout_ns Maximum time to wait for a completion, in nanoseconds.
+ *
+ * @return Number of messages received by this call, 0 if timed out, woken by
+ * dbn_wake() or interrupted, or -1 on failure with errno set and error
+ * handler invoked (if not NULL).
+ */
+extern int dbn_get_timeout(
+  dbn_t *dbn,
+  uint64_t timeout_ns);
+
+
+/**
+ * @brief Wake the thread blocked in dbn_get() or dbn_get_timeout() on a
+ * client, making it return 0. If no thread is blocked, the next such call
+ * returns 0 immediately instead. May be called from any thread, ex. to stop
+ * a session promptly on a quiet feed.
+ *
+ * @param dbn Pointer to an initialized client object.
+ *
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+extern int dbn_wake(dbn_t *dbn);
+
+
+/**
+ * @brief Get the kernel receive timestamp of the most recent read.
+ *
+ * Only available if opts.rx_timestamps was set before dbn_connect(). Valid
+ * from within message and batch handlers, where it is the receive time of
+ * the data being dispatched, free of any handler queueing delay.
+ *
+ * @param dbn Pointer to an initialized and started client object.
+ *
+ * @return Receive timestamp in Unix nanoseconds (software, or hardware if
+ * opts.hw_timestamps and supported by the NIC), or 0 if none is available.
+ */
+extern uint64_t dbn_get_rx_timestamp(dbn_t *dbn);
+
+
+/**
+ * @brief Receive data from Databento if any is available. Never blocks.
+ *
+ * Completions are checked without a system call, so a thread may spin on this
+ * (or service several clients in turn). Combine with opts.sqpoll to also
+ * avoid system calls when re-arming receive requests.
+ *
+ * @param dbn Pointer to an initialized and started client object.
+ *
+ * @return Number of messages received by this call (possibly 0), or -1 on
+ * failure with errno set and error handler invoked (if not NULL).
+ */
+extern int dbn_poll(dbn_t *dbn);
+
+
 /**
  * @brief Disconnect from Databento and free any allocated memory.
  *
@@ -365,3 +1299,63 @@ extern int dbn_get(dbn_t *dbn);
  */
 extern void dbn_close(dbn_t *dbn);
 
+
+/**
+ * @brief Initialize a group, allocating its shared io_uring.
+ *
+ * @param group Pointer to an uninitialized group object.
+ * @param entries Submission queue size, shared by all members: at least 4 per member (plus, for DBN_RECV_MODE_MULTISHOT, completion queue room for each member's provided buffers, at twice this).
+ *
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+extern int dbn_group_init(
+  dbn_group_t *group,
+  unsigned int entries);
+
+
+/**
+ * @brief Add an initialized client to a group, before it is connected (or
+ * attached). Its requests then go through the group's io_uring, tagged so
+ * that completions find their way back to it, and its messages are
+ * dispatched to its own handlers (with its own ctx) by dbn_group_get().
+ *
+ * A member's opts.sqpoll is ignored. Don't call dbn_get(), dbn_poll() or
+ * dbn_close() on a member; use the group functions instead.
+ *
+ * @param group Pointer to an initialized group object.
+ * @param dbn Pointer to an initialized, unconnected client object.
+ *
+ * @return 0 on success, or -1 on failure with errno set and error handler invoked (if not NULL).
+ */
+extern int dbn_group_add(
+  dbn_group_t *group,
+  dbn_t *dbn);
+
+
+/**
+ * @brief Block until at least one completion arrives for any member of a
+ * group, then process every completion that is ready.
+ *
+ * @param group Pointer to an initialized group object.
+ *
+ * @return Number of messages received across all members, 0 if interrupted, or -1 on failure with errno set (and, if a member failed, its error handler invoked).
+ */
+extern int dbn_group_get(dbn_group_t *group);
+
+
+/**
+ * @brief Like dbn_group_get(), but never blocks or enters the kernel.
+ *
+ * @param group Pointer to an initialized group object.
+ *
+ * @return Number of messages received across all members (possibly 0), or -1 on failure with errno set.
+ */
+extern int dbn_group_poll(dbn_group_t *group);
+
+
+/**
+ * @brief Close every member of a group, and free the group's io_uring.
+ *
+ * @param group Pointer to an initialized group object.
+ */
+extern void dbn_group_close(dbn_group_t *group);
@@ -0,0 +1,1012 @@
+/**
+ * @file dbn_export.c
+ * @brief Streaming columnar export of quotes to Arrow IPC files
+ * @author Nathan Blythe
+ * @copyright Copyright 2025 Nathan Blythe
+ * @copyright Released under the Apache-2.0 license, see LICENSE
+ *
+ * See dbn_export.h for details.
+ *
+ * The Arrow IPC file format is the magic "ARROW1" (padded to 8 bytes), then
+ * a stream of encapsulated messages (a schema, then record batches), an
+ * end-of-stream marker, and a footer locating every record batch, followed
+ * by its length and the magic again. Each encapsulated message is a 0xFFFFFFFF
+ * continuation marker, the length of its metadata, the metadata (a
+ * flatbuffer, padded to 8 bytes) and the body. The metadata is small and its
+ * shape fixed, so it is encoded here directly rather than with a flatbuffers
+ * library. See https://arrow.apache.org/docs/format/Columnar.html.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <liburing.h>
+
+#include "dbn.h"
+#include "dbn_spsc.h"
+#include "dbn_export.h"
+
+
+/**
+ * @brief Arrow metadata version 5.
+ */
+#define ARROW_METADATA_V5 4
+
+
+/**
+ * @brief Arrow message header types.
+ */
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_RECORD_BATCH 3
+
+
+/**
+ * @brief Arrow field types.
+ */
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_TIMESTAMP 10
+
+
+/**
+ * @brief Arrow nanosecond time unit.
+ */
+#define ARROW_TIME_UNIT_NANOSECOND 3
+
+
+/**
+ * @brief Alignment of column buffers, in bytes.
+ */
+#define COLUMN_ALIGNMENT 64
+
+
+/**
+ * @brief Microseconds the export thread sleeps when every ring is empty.
+ */
+#define IDLE_US 100
+
+
+/**
+ * @brief Columns, in schema order.
+ */
+enum
+{
+  COLUMN_TS_RECV,
+  COLUMN_TS_EVENT,
+  COLUMN_TS_OUT,
+  COLUMN_RTYPE,
+  COLUMN_PUBLISHER_ID,
+  COLUMN_INSTRUMENT_ID,
+  COLUMN_BID_PX,
+  COLUMN_ASK_PX,
+  COLUMN_BID_SZ,
+  COLUMN_ASK_SZ,
+  COLUMN_PRICE,
+  COLUMN_SIZE,
+  COLUMN_SIDE,
+  COLUMN_FLAGS
+};
+
+
+/**
+ * @brief Description of a column.
+ */
+typedef struct
+{
+  const char *name;
+  bool is_timestamp;  // Nanosecond timestamp, otherwise integer
+  uint8_t width;      // In bytes
+  bool is_signed;
+} column_t;
+
+
+static const column_t columns[DBN_EXPORT_NUM_COLUMNS] =
+{
+  [COLUMN_TS_RECV]       = { "ts_recv", true, 8, true },
+  [COLUMN_TS_EVENT]      = { "ts_event", true, 8, true },
+  [COLUMN_TS_OUT]        = { "ts_out", true, 8, true },
+  [COLUMN_RTYPE]         = { "rtype", false, 1, false },
+  [COLUMN_PUBLISHER_ID]  = { "publisher_id", false, 2, false },
+  [COLUMN_INSTRUMENT_ID] = { "instrument_id", false, 4, false },
+  [COLUMN_BID_PX]        = { "bid_px", false, 8, true },
+  [COLUMN_ASK_PX]        = { "ask_px", false, 8, true },
+  [COLUMN_BID_SZ]        = { "bid_sz", false, 4, false },
+  [COLUMN_ASK_SZ]        = { "ask_sz", false, 4, false },
+  [COLUMN_PRICE]         = { "price", false, 8, true },
+  [COLUMN_SIZE]          = { "size", false, 4, false },
+  [COLUMN_SIDE]          = { "side", false, 1, false },
+  [COLUMN_FLAGS]         = { "flags", false, 1, false }
+};
+
+
+/**
+ * @brief Round up to a multiple of a power of 2.
+ */
+static inline uint64_t align_up(uint64_t n, uint64_t alignment)
+{
+  return (n + alignment - 1) & ~(alignment - 1);
+}
+
+
+/**
+ * @brief Reserve zeroed, aligned space at the end of a flatbuffer.
+ *
+ * @return Position of the space, or 0 if storage could not be grown (and
+ * the buffer is marked failed).
+ */
+static size_t fb_reserve(
+  dbn_export_fb_t *fb,
+  size_t size,
+  size_t alignment)
+{
+  if (fb->failed) return 0;
+
+  size_t position = align_up(fb->length, alignment);
+  if (position + size > fb->capacity)
+  {
+    size_t capacity = fb->capacity ? fb->capacity : 4096;
+    while (capacity < position + size)
+      capacity *= 2;
+
+    uint8_t *data = realloc(fb->data, capacity);
+    if (!data)
+    {
+      fb->failed = true;
+      return 0;
+    }
+    fb->data = data;
+    fb->capacity = capacity;
+  }
+
+  memset(fb->data + fb->length, 0, position + size - fb->length);
+  fb->length = position + size;
+  return position;
+}
+
+
+/**
+ * @brief Store a little-endian scalar in a flatbuffer.
+ */
+static void fb_put(
+  dbn_export_fb_t *fb,
+  size_t position,
+  uint64_t value,
+  int size)
+{
+  if (fb->failed) return;
+
+  for (int i = 0; i < size; i++)
+    fb->data[position + i] = value >> (8 * i);
+}
+
+
+/**
+ * @brief Point an offset field at an object after it.
+ */
+static void fb_offset(
+  dbn_export_fb_t *fb,
+  size_t field,
+  size_t object)
+{
+  fb_put(fb, field, object - field, 4);
+}
+
+
+/**
+ * @brief Append a table, preceded by its vtable.
+ *
+ * Objects the table refers to must be appended after it, since offsets only
+ * point forwards.
+ *
+ * @param fb Pointer to flatbuffer.
+ * @param num_fields Number of fields in the table's schema.
+ * @param sizes Pointer to array of num_fields sizes of fields, in bytes (1, 2, 4 or 8, or 0 if absent).
+ * @param fields Pointer to array of num_fields to populate with the position of each present field.
+ *
+ * @return Position of the table.
+ */
+static size_t fb_table(
+  dbn_export_fb_t *fb,
+  int num_fields,
+  const uint8_t *sizes,
+  size_t *fields)
+{
+  size_t vtable = fb_reserve(fb, 4 + 2 * num_fields, 2);
+  size_t table = fb_reserve(fb, 4, 8);
+  for (int i = 0; i < num_fields; i++)
+  {
+    fields[i] = sizes[i] ? fb_reserve(fb, sizes[i], sizes[i]) : 0;
+    fb_put(fb, vtable + 4 + 2 * i, sizes[i] ? fields[i] - table : 0, 2);
+  }
+
+  fb_put(fb, vtable, 4 + 2 * num_fields, 2);
+  fb_put(fb, vtable + 2, fb->length - table, 2);
+  fb_put(fb, table, table - vtable, 4);
+  return table;
+}
+
+
+/**
+ * @brief Append a vector, with its elements zeroed.
+ *
+ * @param fb Pointer to flatbuffer.
+ * @param count Number of elements.
+ * @param size Size of each element, in bytes.
+ * @param alignment Alignment of elements, at least 4.
+ *
+ * @return Position of the vector. Its elements follow its 4-byte length.
+ */
+static size_t fb_vector(
+  dbn_export_fb_t *fb,
+  uint32_t count,
+  size_t size,
+  size_t alignment)
+{
+  size_t end = align_up(fb->length, 4);
+  fb_reserve(fb, align_up(end + 4, alignment) - 4 - fb->length, 1);
+  size_t vector = fb_reserve(fb, 4 + count * size, 4);
+  fb_put(fb, vector, count, 4);
+  return vector;
+}
+
+
+/**
+ * @brief Append a string.
+ *
+ * @return Position of the string.
+ */
+static size_t fb_string(
+  dbn_export_fb_t *fb,
+  const char *s)
+{
+  size_t n = strlen(s);
+  size_t string = fb_reserve(fb, 4 + n + 1, 4);
+  fb_put(fb, string, n, 4);
+  if (!fb->failed) memcpy(fb->data + string + 4, s, n);
+  return string;
+}
+
+
+/**
+ * @brief Append an Arrow Field table describing a column.
+ *
+ * @return Position of the table.
+ */
+static size_t build_field(
+  dbn_export_fb_t *fb,
+  const column_t *column)
+{
+  /*
+   * name, nullable, type_type, type, dictionary, children.
+   */
+  const uint8_t sizes[6] = { 4, 1, 1, 4, 0, 4 };
+  size_t f[6];
+  size_t field = fb_table(fb, 6, sizes, f);
+  fb_put(fb, f[1], false, 1);
+  fb_put(fb, f[2], column->is_timestamp ? ARROW_TYPE_TIMESTAMP : ARROW_TYPE_INT, 1);
+
+  fb_offset(fb, f[0], fb_string(fb, column->name));
+
+  if (column->is_timestamp)
+  {
+    /*
+     * unit, timezone.
+     */
+    const uint8_t type_sizes[2] = { 2, 4 };
+    size_t t[2];
+    size_t type = fb_table(fb, 2, type_sizes, t);
+    fb_put(fb, t[0], ARROW_TIME_UNIT_NANOSECOND, 2);
+    fb_offset(fb, f[3], type);
+    fb_offset(fb, t[1], fb_string(fb, "UTC"));
+  }
+  else
+  {
+    /*
+     * bitWidth, is_signed.
+     */
+    const uint8_t type_sizes[2] = { 4, 1 };
+    size_t t[2];
+    size_t type = fb_table(fb, 2, type_sizes, t);
+    fb_put(fb, t[0], 8 * column->width, 4);
+    fb_put(fb, t[1], column->is_signed, 1);
+    fb_offset(fb, f[3], type);
+  }
+
+  fb_offset(fb, f[5], fb_vector(fb, 0, 4, 4));
+  return field;
+}
+
+
+/**
+ * @brief Append an Arrow Schema table describing all columns.
+ *
+ * @return Position of the table.
+ */
+static size_t build_schema(dbn_export_fb_t *fb)
+{
+  /*
+   * endianness, fields.
+   */
+  const uint8_t sizes[2] = { 2, 4 };
+  size_t s[2];
+  size_t schema = fb_table(fb, 2, sizes, s);
+  fb_put(fb, s[0], __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__, 2);
+
+  size_t fields = fb_vector(fb, DBN_EXPORT_NUM_COLUMNS, 4, 4);
+  fb_offset(fb, s[1], fields);
+  for (int i = 0; i < DBN_EXPORT_NUM_COLUMNS; i++)
+    fb_offset(fb, fields + 4 + 4 * i, build_field(fb, &columns[i]));
+
+  return schema;
+}
+
+
+/**
+ * @brief Start a flatbuffer holding an Arrow Message table.
+ *
+ * @return Position of the message's header field, to point at the header.
+ */
+static size_t build_message(
+  dbn_export_fb_t *fb,
+  uint8_t header_type,
+  uint64_t body_length)
+{
+  fb->length = 0;
+  fb->failed = false;
+  size_t root = fb_reserve(fb, 4, 4);
+
+  /*
+   * version, header_type, header, bodyLength.
+   */
+  const uint8_t sizes[4] = { 2, 1, 4, 8 };
+  size_t m[4];
+  size_t message = fb_table(fb, 4, sizes, m);
+  fb_offset(fb, root, message);
+  fb_put(fb, m[0], ARROW_METADATA_V5, 2);
+  fb_put(fb, m[1], header_type, 1);
+  fb_put(fb, m[3], body_length, 8);
+  return m[2];
+}
+
+
+/**
+ * @brief Build the metadata of a record batch whose columns are at the given
+ * offsets within its body.
+ */
+static void build_record_batch(
+  dbn_export_fb_t *fb,
+  uint32_t num_rows,
+  const uint64_t *offsets,
+  uint64_t body_length)
+{
+  size_t header = build_message(fb, ARROW_HEADER_RECORD_BATCH, body_length);
+
+  /*
+   * length, nodes, buffers.
+   */
+  const uint8_t sizes[3] = { 8, 4, 4 };
+  size_t r[3];
+  size_t batch = fb_table(fb, 3, sizes, r);
+  fb_offset(fb, header, batch);
+  fb_put(fb, r[0], num_rows, 8);
+
+
+  /*
+   * One node per column, with no nulls, and two buffers per column: an empty
+   * validity bitmap and the values.
+   */
+  size_t nodes = fb_vector(fb, DBN_EXPORT_NUM_COLUMNS, 16, 8);
+  fb_offset(fb, r[1], nodes);
+  for (int i = 0; i < DBN_EXPORT_NUM_COLUMNS; i++)
+    fb_put(fb, nodes + 4 + 16 * i, num_rows, 8);
+
+  size_t buffers = fb_vector(fb, 2 * DBN_EXPORT_NUM_COLUMNS, 16, 8);
+  fb_offset(fb, r[2], buffers);
+  for (int i = 0; i < DBN_EXPORT_NUM_COLUMNS; i++)
+  {
+    fb_put(fb, buffers + 4 + 32 * i, offsets[i], 8);
+    fb_put(fb, buffers + 4 + 32 * i + 16, offsets[i], 8);
+    fb_put(fb, buffers + 4 + 32 * i + 24, (uint64_t)num_rows * columns[i].width, 8);
+  }
+}
+
+
+/**
+ * @brief Get the offsets of column buffers within the body of a record batch
+ * of the given number of rows.
+ *
+ * @return Length of the body, in bytes.
+ */
+static uint64_t layout_columns(
+  uint32_t num_rows,
+  uint64_t *offsets)
+{
+  uint64_t offset = 0;
+  for (int i = 0; i < DBN_EXPORT_NUM_COLUMNS; i++)
+  {
+    offsets[i] = offset;
+    offset += align_up((uint64_t)num_rows * columns[i].width, COLUMN_ALIGNMENT);
+  }
+  return offset;
+}
+
+
+/**
+ * @brief Write a buffer at an offset of a file, synchronously.
+ *
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+static int write_all(
+  int fd,
+  const void *data,
+  size_t length,
+  uint64_t offset)
+{
+  while (length)
+  {
+    ssize_t n = pwrite(fd, data, length, offset);
+    if (n < 0)
+    {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    data = (const uint8_t *)data + n;
+    length -= n;
+    offset += n;
+  }
+  return 0;
+}
+
+
+/**
+ * @brief Write an encapsulated message from the scratch flatbuffer, with no
+ * body, synchronously at the end of the file.
+ *
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+static int write_message(dbn_export_t *exporter)
+{
+  dbn_export_fb_t *fb = &exporter->fb;
+  if (fb->failed)
+  {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  uint32_t length = align_up(fb->length, 8);
+  uint8_t prefix[8] = { 0xFF, 0xFF, 0xFF, 0xFF, length, length >> 8, length >> 16, length >> 24 };
+  uint8_t padding[8] = { 0 };
+  if (write_all(exporter->fd, prefix, 8, exporter->offset)
+    || write_all(exporter->fd, fb->data, fb->length, exporter->offset + 8)
+    || write_all(exporter->fd, padding, length - fb->length, exporter->offset + 8 + fb->length)) return -1;
+
+  exporter->offset += 8 + length;
+  return 0;
+}
+
+
+/**
+ * @brief Record the first write failure, after which nothing more is written.
+ */
+static void set_error(
+  dbn_export_t *exporter,
+  int error)
+{
+  if (!exporter->stats.error) __atomic_store_n(&exporter->stats.error, error, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * @brief Queue a write of the unwritten remainder of a batch.
+ */
+static void submit_batch(
+  dbn_export_t *exporter,
+  int index)
+{
+  dbn_export_batch_t *batch = &exporter->batches[index];
+  struct io_uring_sqe *sqe = io_uring_get_sqe(&exporter->ring);
+  io_uring_prep_write(sqe, exporter->fd, batch->write_data, batch->write_length, batch->write_offset);
+  io_uring_sqe_set_data64(sqe, index);
+  io_uring_submit(&exporter->ring);
+}
+
+
+/**
+ * @brief Handle write completions.
+ *
+ * @param exporter Pointer to exporter.
+ * @param wait If true, wait for at least one completion.
+ */
+static void reap(
+  dbn_export_t *exporter,
+  bool wait)
+{
+  struct io_uring_cqe *cqe;
+  while (!(wait ? io_uring_wait_cqe(&exporter->ring, &cqe) : io_uring_peek_cqe(&exporter->ring, &cqe)))
+  {
+    wait = false;
+    int index = (int)cqe->user_data;
+    int n = cqe->res;
+    io_uring_cqe_seen(&exporter->ring, cqe);
+
+    dbn_export_batch_t *batch = &exporter->batches[index];
+    if (n <= 0)
+    {
+      set_error(exporter, n ? -n : EIO);
+      batch->in_flight = false;
+      continue;
+    }
+
+
+    /*
+     * Write the remainder of a short write.
+     */
+    batch->write_data += n;
+    batch->write_length -= n;
+    batch->write_offset += n;
+    __atomic_store_n(&exporter->stats.num_bytes, exporter->stats.num_bytes + n, __ATOMIC_RELAXED);
+    if (batch->write_length) submit_batch(exporter, index);
+    else
+    {
+      batch->in_flight = false;
+      __atomic_store_n(&exporter->stats.num_batches, exporter->stats.num_batches + 1, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+
+/**
+ * @brief Write the current batch, if it has any rows, and move on to the
+ * next, once any earlier write of it has completed.
+ */
+static void flush(dbn_export_t *exporter)
+{
+  dbn_export_batch_t *batch = &exporter->batches[exporter->current];
+  if (!batch->num_rows) return;
+
+
+  /*
+   * A partial batch is compacted, moving each column down to follow the one
+   * before.
+   */
+  uint64_t offsets[DBN_EXPORT_NUM_COLUMNS];
+  uint64_t body_length = layout_columns(batch->num_rows, offsets);
+  uint8_t *body = batch->data + exporter->metadata_length;
+  if (batch->num_rows < exporter->batch_rows)
+  {
+    for (int i = 1; i < DBN_EXPORT_NUM_COLUMNS; i++)
+      memmove(body + offsets[i], batch->columns[i], (uint64_t)batch->num_rows * columns[i].width);
+  }
+
+
+  /*
+   * The metadata is the same size for any number of rows.
+   */
+  dbn_export_fb_t *fb = &exporter->fb;
+  build_record_batch(fb, batch->num_rows, offsets, body_length);
+  if (fb->failed || 8 + align_up(fb->length, 8) != exporter->metadata_length)
+    set_error(exporter, ENOMEM);
+
+  if (exporter->num_blocks == exporter->max_blocks)
+  {
+    size_t max_blocks = exporter->max_blocks ? 2 * exporter->max_blocks : 1024;
+    dbn_export_block_t *blocks = realloc(exporter->blocks, max_blocks * sizeof(dbn_export_block_t));
+    if (!blocks) set_error(exporter, ENOMEM);
+    else
+    {
+      exporter->blocks = blocks;
+      exporter->max_blocks = max_blocks;
+    }
+  }
+
+  if (!exporter->stats.error)
+  {
+    uint32_t length = exporter->metadata_length - 8;
+    uint8_t prefix[8] = { 0xFF, 0xFF, 0xFF, 0xFF, length, length >> 8, length >> 16, length >> 24 };
+    memcpy(batch->data, prefix, 8);
+    memcpy(batch->data + 8, fb->data, fb->length);
+    memset(batch->data + 8 + fb->length, 0, length - fb->length);
+
+    dbn_export_block_t *block = &exporter->blocks[exporter->num_blocks++];
+    block->offset = exporter->offset;
+    block->metadata_length = exporter->metadata_length;
+    block->body_length = body_length;
+
+    batch->in_flight = true;
+    batch->write_offset = exporter->offset;
+    batch->write_data = batch->data;
+    batch->write_length = exporter->metadata_length + body_length;
+    submit_batch(exporter, exporter->current);
+    exporter->offset += exporter->metadata_length + body_length;
+  }
+
+
+  /*
+   * Fill the next batch, once it has been written.
+   */
+  exporter->current = (exporter->current + 1) % DBN_EXPORT_NUM_BATCHES;
+  batch = &exporter->batches[exporter->current];
+  while (batch->in_flight)
+    reap(exporter, true);
+  batch->num_rows = 0;
+}
+
+
+/**
+ * @brief Transpose a run of quotes from a ring into rows of the current
+ * batch, flushing it whenever it fills.
+ */
+static void transpose(
+  dbn_export_t *exporter,
+  const uint8_t *data,
+  uint64_t length)
+{
+  for (uint64_t offset = 0; offset < length; offset += 4 * (uint64_t)data[offset])
+  {
+    const dbn_hdr_t *msg = (const dbn_hdr_t *)(data + offset);
+    dbn_export_batch_t *batch = &exporter->batches[exporter->current];
+    uint32_t r = batch->num_rows;
+
+    uint64_t ts_recv, ts_out = 0;
+    int64_t bid_px, ask_px, price;
+    uint32_t bid_sz, ask_sz, size;
+    uint8_t side, flags;
+    if (dbn_is_cmbp1(msg))
+    {
+      const dbn_cmbp1_t *m = (const void *)msg;
+      ts_recv = m->ts_recv;
+      if (4 * msg->rlength >= sizeof(dbn_cmbp1_t)) ts_out = m->ts_out;
+      bid_px = m->bid_px;
+      ask_px = m->ask_px;
+      bid_sz = m->bid_sz;
+      ask_sz = m->ask_sz;
+      price = m->price;
+      size = m->size;
+      side = m->side;
+      flags = m->flags;
+    }
+    else
+    {
+      const dbn_bbo_t *m = (const void *)msg;
+      ts_recv = m->ts_recv;
+      if (4 * msg->rlength >= sizeof(dbn_bbo_t)) ts_out = m->ts_out;
+      bid_px = m->bid_px;
+      ask_px = m->ask_px;
+      bid_sz = m->bid_sz;
+      ask_sz = m->ask_sz;
+      price = m->price;
+      size = m->size;
+      side = m->side;
+      flags = m->flags;
+    }
+
+    ((uint64_t *)batch->columns[COLUMN_TS_RECV])[r] = ts_recv;
+    ((uint64_t *)batch->columns[COLUMN_TS_EVENT])[r] = msg->ts_event;
+    ((uint64_t *)batch->columns[COLUMN_TS_OUT])[r] = ts_out;
+    ((uint8_t *)batch->columns[COLUMN_RTYPE])[r] = msg->rtype;
+    ((uint16_t *)batch->columns[COLUMN_PUBLISHER_ID])[r] = msg->publisher_id;
+    ((uint32_t *)batch->columns[COLUMN_INSTRUMENT_ID])[r] = msg->instrument_id;
+    ((int64_t *)batch->columns[COLUMN_BID_PX])[r] = bid_px;
+    ((int64_t *)batch->columns[COLUMN_ASK_PX])[r] = ask_px;
+    ((uint32_t *)batch->columns[COLUMN_BID_SZ])[r] = bid_sz;
+    ((uint32_t *)batch->columns[COLUMN_ASK_SZ])[r] = ask_sz;
+    ((int64_t *)batch->columns[COLUMN_PRICE])[r] = price;
+    ((uint32_t *)batch->columns[COLUMN_SIZE])[r] = size;
+    ((uint8_t *)batch->columns[COLUMN_SIDE])[r] = side;
+    ((uint8_t *)batch->columns[COLUMN_FLAGS])[r] = flags;
+
+    batch->num_rows++;
+    __atomic_store_n(&exporter->stats.num_rows, exporter->stats.num_rows + 1, __ATOMIC_RELAXED);
+    if (batch->num_rows == exporter->batch_rows) flush(exporter);
+  }
+}
+
+
+/**
+ * @brief Export thread. Drains every attached producer's ring until stopped
+ * and all rings are empty.
+ */
+static void *worker(void *arg)
+{
+  dbn_export_t *exporter = arg;
+
+  while (true)
+  {
+    bool stopping = atomic_load_explicit(&exporter->stop, memory_order_acquire);
+    bool idle = true;
+
+    int n = atomic_load_explicit(&exporter->num_attached, memory_order_acquire);
+    if (n > exporter->num_producers) n = exporter->num_producers;
+    for (int i = 0; i < n; i++)
+    {
+      dbn_spsc_t *ring = &exporter->producers[i].ring;
+      uint64_t length;
+      uint8_t *data;
+      while ((data = dbn_spsc_read(ring, &length)))
+      {
+        transpose(exporter, data, length);
+        dbn_spsc_release(ring);
+        idle = false;
+      }
+    }
+
+    reap(exporter, false);
+
+    if (idle)
+    {
+      if (stopping) break;
+      usleep(IDLE_US);
+    }
+  }
+
+  return NULL;
+}
+
+
+/**
+ * @brief Free an exporter's storage.
+ */
+static void destroy(dbn_export_t *exporter)
+{
+  if (exporter->producers)
+  {
+    for (int i = 0; i < exporter->num_producers; i++)
+      dbn_spsc_free(&exporter->producers[i].ring);
+    free(exporter->producers);
+  }
+
+  for (int i = 0; i < DBN_EXPORT_NUM_BATCHES; i++)
+    free(exporter->batches[i].base);
+
+  free(exporter->blocks);
+  free(exporter->fb.data);
+  memset(exporter, 0, sizeof(dbn_export_t));
+  exporter->fd = -1;
+}
+
+
+int dbn_export_open(
+  dbn_export_t *exporter,
+  const char *path,
+  int num_producers,
+  uint32_t batch_rows,
+  uint64_t ring_size)
+{
+  memset(exporter, 0, sizeof(dbn_export_t));
+  exporter->fd = -1;
+
+  if (!batch_rows) batch_rows = DBN_EXPORT_DEFAULT_BATCH_ROWS;
+  if (!ring_size) ring_size = DBN_EXPORT_DEFAULT_RING_SIZE;
+  if (num_producers < 1 || num_producers > DBN_EXPORT_MAX_PRODUCERS || batch_rows > DBN_EXPORT_MAX_BATCH_ROWS)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  exporter->batch_rows = batch_rows;
+  exporter->num_producers = num_producers;
+  exporter->body_length = layout_columns(batch_rows, exporter->column_offsets);
+
+
+  /*
+   * Size the metadata once, since it doesn't vary.
+   */
+  build_record_batch(&exporter->fb, batch_rows, exporter->column_offsets, exporter->body_length);
+  if (exporter->fb.failed)
+  {
+    destroy(exporter);
+    errno = ENOMEM;
+    return -1;
+  }
+  exporter->metadata_length = 8 + align_up(exporter->fb.length, 8);
+
+
+  /*
+   * Allocate rings and batches. Each batch's body is cache line aligned.
+   */
+  exporter->producers = aligned_alloc(DBN_SPSC_CACHE_LINE, num_producers * sizeof(dbn_export_producer_t));
+  if (!exporter->producers)
+  {
+    destroy(exporter);
+    errno = ENOMEM;
+    return -1;
+  }
+  memset(exporter->producers, 0, num_producers * sizeof(dbn_export_producer_t));
+
+  for (int i = 0; i < num_producers; i++)
+  {
+    if (dbn_spsc_init(&exporter->producers[i].ring, ring_size))
+    {
+      int e = errno;
+      destroy(exporter);
+      errno = e;
+      return -1;
+    }
+  }
+
+  uint64_t pad = align_up(exporter->metadata_length, COLUMN_ALIGNMENT) - exporter->metadata_length;
+  for (int i = 0; i < DBN_EXPORT_NUM_BATCHES; i++)
+  {
+    dbn_export_batch_t *batch = &exporter->batches[i];
+    batch->base = aligned_alloc(COLUMN_ALIGNMENT, align_up(pad + exporter->metadata_length + exporter->body_length, COLUMN_ALIGNMENT));
+    if (!batch->base)
+    {
+      destroy(exporter);
+      errno = ENOMEM;
+      return -1;
+    }
+
+    batch->data = batch->base + pad;
+    for (int j = 0; j < DBN_EXPORT_NUM_COLUMNS; j++)
+      batch->columns[j] = batch->data + exporter->metadata_length + exporter->column_offsets[j];
+  }
+
+
+  /*
+   * Create the file and write the magic and schema.
+   */
+  exporter->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (exporter->fd < 0)
+  {
+    int e = errno;
+    destroy(exporter);
+    errno = e;
+    return -1;
+  }
+
+  static const uint8_t magic[8] = { 'A', 'R', 'R', 'O', 'W', '1', 0, 0 };
+  size_t header = build_message(&exporter->fb, ARROW_HEADER_SCHEMA, 0);
+  fb_offset(&exporter->fb, header, build_schema(&exporter->fb));
+  if (write_all(exporter->fd, magic, 8, 0))
+  {
+    int e = errno;
+    close(exporter->fd);
+    destroy(exporter);
+    errno = e;
+    return -1;
+  }
+  exporter->offset = 8;
+
+  if (write_message(exporter))
+  {
+    int e = errno;
+    close(exporter->fd);
+    destroy(exporter);
+    errno = e;
+    return -1;
+  }
+
+
+  /*
+   * Start the export thread.
+   */
+  int r = io_uring_queue_init(2 * DBN_EXPORT_NUM_BATCHES, &exporter->ring, 0);
+  if (r < 0)
+  {
+    close(exporter->fd);
+    destroy(exporter);
+    errno = -r;
+    return -1;
+  }
+
+  r = pthread_create(&exporter->thread, NULL, worker, exporter);
+  if (r)
+  {
+    io_uring_queue_exit(&exporter->ring);
+    close(exporter->fd);
+    destroy(exporter);
+    errno = r;
+    return -1;
+  }
+
+  return 0;
+}
+
+
+dbn_export_producer_t *dbn_export_attach(dbn_export_t *exporter)
+{
+  int i = atomic_fetch_add(&exporter->num_attached, 1);
+  if (i >= exporter->num_producers)
+  {
+    errno = ENOSPC;
+    return NULL;
+  }
+  return &exporter->producers[i];
+}
+
+
+int dbn_export_close(dbn_export_t *exporter)
+{
+  /*
+   * Drain the rings, then write the partial batch and wait for every write.
+   */
+  atomic_store_explicit(&exporter->stop, true, memory_order_release);
+  pthread_join(exporter->thread, NULL);
+
+  flush(exporter);
+  for (int i = 0; i < DBN_EXPORT_NUM_BATCHES; i++)
+  {
+    while (exporter->batches[i].in_flight)
+      reap(exporter, true);
+  }
+  io_uring_queue_exit(&exporter->ring);
+
+
+  /*
+   * End the stream, then write the footer: the schema again, and the location
+   * of every record batch.
+   */
+  int error = exporter->stats.error;
+  if (!error)
+  {
+    static const uint8_t eos[8] = { 0xFF, 0xFF, 0xFF, 0xFF, 0, 0, 0, 0 };
+    if (write_all(exporter->fd, eos, 8, exporter->offset)) error = errno;
+    exporter->offset += 8;
+  }
+
+  if (!error)
+  {
+    dbn_export_fb_t *fb = &exporter->fb;
+    fb->length = 0;
+    fb->failed = false;
+    size_t root = fb_reserve(fb, 4, 4);
+
+    /*
+     * version, schema, dictionaries, recordBatches.
+     */
+    const uint8_t sizes[4] = { 2, 4, 4, 4 };
+    size_t f[4];
+    size_t footer = fb_table(fb, 4, sizes, f);
+    fb_offset(fb, root, footer);
+    fb_put(fb, f[0], ARROW_METADATA_V5, 2);
+    fb_offset(fb, f[1], build_schema(fb));
+    fb_offset(fb, f[2], fb_vector(fb, 0, 24, 8));
+
+    size_t blocks = fb_vector(fb, exporter->num_blocks, 24, 8);
+    fb_offset(fb, f[3], blocks);
+    for (size_t i = 0; i < exporter->num_blocks; i++)
+    {
+      fb_put(fb, blocks + 4 + 24 * i, exporter->blocks[i].offset, 8);
+      fb_put(fb, blocks + 4 + 24 * i + 8, exporter->blocks[i].metadata_length, 4);
+      fb_put(fb, blocks + 4 + 24 * i + 16, exporter->blocks[i].body_length, 8);
+    }
+
+    uint32_t length = fb->length;
+    uint8_t trailer[10] = { length, length >> 8, length >> 16, length >> 24, 'A', 'R', 'R', 'O', 'W', '1' };
+    if (fb->failed) error = ENOMEM;
+    else if (write_all(exporter->fd, fb->data, fb->length, exporter->offset)
+      || write_all(exporter->fd, trailer, sizeof(trailer), exporter->offset + fb->length)) error = errno;
+  }
+
+  if (close(exporter->fd) && !error) error = errno;
+  destroy(exporter);
+
+  if (error)
+  {
+    errno = error;
+    return -1;
+  }
+  return 0;
+}
+
+
+void dbn_export_get_stats(
+  dbn_export_t *exporter,
+  dbn_export_stats_t *stats)
+{
+  stats->num_rows = __atomic_load_n(&exporter->stats.num_rows, __ATOMIC_RELAXED);
+  stats->num_batches = __atomic_load_n(&exporter->stats.num_batches, __ATOMIC_RELAXED);
+  stats->num_bytes = __atomic_load_n(&exporter->stats.num_bytes, __ATOMIC_RELAXED);
+  stats->error = __atomic_load_n(&exporter->stats.error, __ATOMIC_RELAXED);
+
+  stats->num_dropped = 0;
+  int n = atomic_load_explicit(&exporter->num_attached, memory_order_acquire);
+  if (n > exporter->num_producers) n = exporter->num_producers;
+  for (int i = 0; i < n; i++)
+    stats->num_dropped += __atomic_load_n(&exporter->producers[i].num_dropped, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,245 @@
+/**
+ * @file dbn_export.h
+ * @brief Streaming columnar export of quotes to Arrow IPC files
+ * @author Nathan Blythe
+ * @copyright Copyright 2025 Nathan Blythe
+ * @copyright Released under the Apache-2.0 license, see LICENSE
+ *
+ * An exporter archives every CMBP-1 and BBO message received by the clients
+ * attached to it (with dbn_set_export() or dbn_multi_set_export()) to a
+ * single Arrow IPC file, readable by any Arrow implementation (ex.
+ * pyarrow.ipc.open_file()).
+ *
+ * The decode path of each client only copies each quote into a ring of its
+ * own, without blocking: if the ring is full the quote is dropped and
+ * counted instead. A background thread drains the rings, transposes quotes
+ * into preallocated column buffers, one per field, and once a batch of rows
+ * is full writes it to the file as an Arrow record batch with an
+ * asynchronous io_uring write, while filling the next.
+ *
+ * Columns, none nullable, are ts_recv, ts_event and ts_out (nanosecond
+ * timestamps, ts_out 0 unless enabled during authentication), rtype,
+ * publisher_id, instrument_id, bid_px and ask_px (nanodollars), bid_sz,
+ * ask_sz, price and size (of the last trade, for BBO), side and flags.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <liburing.h>
+
+#include "dbn.h"
+#include "dbn_spsc.h"
+
+
+/**
+ * @brief Maximum number of clients that can be attached to one exporter.
+ */
+#define DBN_EXPORT_MAX_PRODUCERS 256
+
+
+/**
+ * @brief Default number of rows per record batch.
+ */
+#define DBN_EXPORT_DEFAULT_BATCH_ROWS 65536
+
+
+/**
+ * @brief Maximum number of rows per record batch.
+ */
+#define DBN_EXPORT_MAX_BATCH_ROWS (1 << 24)
+
+
+/**
+ * @brief Default size of each client's ring to the export thread, in bytes.
+ */
+#define DBN_EXPORT_DEFAULT_RING_SIZE (1 << 24)
+
+
+/**
+ * @brief Number of record batches being filled or written at once.
+ */
+#define DBN_EXPORT_NUM_BATCHES 4
+
+
+/**
+ * @brief Number of columns.
+ */
+#define DBN_EXPORT_NUM_COLUMNS 14
+
+
+/**
+ * @brief A client's ring to the export thread.
+ */
+typedef struct dbn_export_producer
+{
+  dbn_spsc_t ring;              ///< @brief Quotes from the client, in receipt order
+  uint64_t num_dropped;         ///< @brief Number of quotes dropped because ring was full, updated atomically
+} dbn_export_producer_t;
+
+
+/**
+ * @brief Record batch being filled or written.
+ */
+typedef struct
+{
+  uint8_t *base;                ///< @brief Storage
+  uint8_t *data;                ///< @brief Encapsulated message within base: prefix, metadata, then body, which is cache line aligned
+  uint8_t *columns[DBN_EXPORT_NUM_COLUMNS]; ///< @brief Column buffers within the body, each of batch_rows rows
+  uint32_t num_rows;            ///< @brief Number of rows filled
+  bool in_flight;               ///< @brief If a write of the batch is in progress
+  uint64_t write_offset;        ///< @brief If in_flight, file offset of the unwritten remainder
+  uint8_t *write_data;          ///< @brief If in_flight, pointer to the unwritten remainder
+  size_t write_length;          ///< @brief If in_flight, length of the unwritten remainder, in bytes
+} dbn_export_batch_t;
+
+
+/**
+ * @brief Location of a record batch in the file, for the footer.
+ */
+typedef struct
+{
+  uint64_t offset;              ///< @brief File offset of the encapsulated message
+  uint32_t metadata_length;     ///< @brief Length of prefix and metadata, in bytes
+  uint64_t body_length;         ///< @brief Length of body, in bytes
+} dbn_export_block_t;
+
+
+/**
+ * @brief Exporter counters, see dbn_export_get_stats().
+ */
+typedef struct
+{
+  uint64_t num_rows;            ///< @brief Number of quotes transposed into record batches
+  uint64_t num_batches;         ///< @brief Number of record batches written
+  uint64_t num_bytes;           ///< @brief Number of bytes written to the file
+  uint64_t num_dropped;         ///< @brief Number of quotes dropped because a client's ring was full
+  int error;                    ///< @brief errno of the first failed write, or 0. Nothing more is written after one
+} dbn_export_stats_t;
+
+
+/**
+ * @brief Flatbuffer under construction.
+ */
+typedef struct
+{
+  uint8_t *data;                ///< @brief Storage
+  size_t length;                ///< @brief Number of bytes used
+  size_t capacity;              ///< @brief Size of storage, in bytes
+  bool failed;                  ///< @brief If growing storage failed, in which case the contents are invalid
+} dbn_export_fb_t;
+
+
+/**
+ * @brief Columnar exporter.
+ */
+typedef struct dbn_export
+{
+  int fd;                       ///< @brief File descriptor
+  struct io_uring ring;         ///< @brief io_uring through which record batches are written
+  pthread_t thread;             ///< @brief Export thread
+  _Atomic bool stop;            ///< @brief Set by dbn_export_close() to stop the export thread, once the rings are drained
+  uint32_t batch_rows;          ///< @brief Number of rows per record batch
+  uint32_t metadata_length;     ///< @brief Length of each record batch's prefix and metadata, in bytes
+  uint64_t column_offsets[DBN_EXPORT_NUM_COLUMNS]; ///< @brief Offset of each column buffer within a full batch's body
+  uint64_t body_length;         ///< @brief Length of a full batch's body, in bytes
+  dbn_export_batch_t batches[DBN_EXPORT_NUM_BATCHES]; ///< @brief Record batches, used in turn
+  int current;                  ///< @brief Index of the batch being filled
+  uint64_t offset;              ///< @brief File offset at which the next record batch is written
+  int num_producers;            ///< @brief Number of producers
+  _Atomic int num_attached;     ///< @brief Number of producers attached to clients
+  dbn_export_producer_t *producers; ///< @brief Producers, one per attached client
+  dbn_export_block_t *blocks;   ///< @brief Locations of record batches written
+  size_t num_blocks;            ///< @brief Number of entries in blocks in use
+  size_t max_blocks;            ///< @brief Number of entries in blocks
+  dbn_export_fb_t fb;           ///< @brief Scratch flatbuffer, for metadata
+  dbn_export_stats_t stats;     ///< @brief Counters, updated atomically by the export thread
+} dbn_export_t;
+
+
+/**
+ * @brief Create an Arrow IPC file and start exporting to it.
+ *
+ * @param exporter Pointer to an uninitialized exporter.
+ * @param path Pointer to null-terminated path of file to create, or truncate.
+ * @param num_producers Maximum number of clients that will be attached, at most DBN_EXPORT_MAX_PRODUCERS.
+ * @param batch_rows Number of rows per record batch, or 0 for DBN_EXPORT_DEFAULT_BATCH_ROWS.
+ * @param ring_size Size of each client's ring to the export thread, in bytes (power of 2), or 0 for DBN_EXPORT_DEFAULT_RING_SIZE.
+ *
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+extern int dbn_export_open(
+  dbn_export_t *exporter,
+  const char *path,
+  int num_producers,
+  uint32_t batch_rows,
+  uint64_t ring_size);
+
+
+/**
+ * @brief Claim a producer, for a client. Used by dbn_set_export(); a producer
+ * is never released before dbn_export_close().
+ *
+ * @param exporter Pointer to opened exporter.
+ *
+ * @return Pointer to producer, or NULL with errno set to ENOSPC if all have been claimed.
+ */
+extern dbn_export_producer_t *dbn_export_attach(dbn_export_t *exporter);
+
+
+/**
+ * @brief Export the remaining quotes, write the file's footer and close it,
+ * then free the exporter. Every attached client must have been closed or
+ * detached.
+ *
+ * @param exporter Pointer to opened exporter.
+ *
+ * @return 0 on success, or -1 on failure with errno set, in which case the
+ * file is incomplete.
+ */
+extern int dbn_export_close(dbn_export_t *exporter);
+
+
+/**
+ * @brief Take a snapshot of an exporter's counters. Thread-safe.
+ *
+ * @param exporter Pointer to opened exporter.
+ * @param stats Pointer to populate.
+ */
+extern void dbn_export_get_stats(
+  dbn_export_t *exporter,
+  dbn_export_stats_t *stats);
+
+
+/**
+ * @brief Copy a message to the export thread, if it is a CMBP-1 or BBO
+ * message, without publishing it. Called by the client's decode path.
+ *
+ * @param producer Pointer to producer.
+ * @param msg Pointer to message.
+ */
+static inline void dbn_export_push(
+  dbn_export_producer_t *producer,
+  const dbn_hdr_t *msg)
+{
+  if (!dbn_is_cmbp1(msg) && !dbn_is_bbo(msg)) return;
+
+  if (!dbn_spsc_write(&producer->ring, msg))
+    __atomic_store_n(&producer->num_dropped, producer->num_dropped + 1, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * @brief Publish the messages copied so far to the export thread. Called by
+ * the client's decode path, once per read.
+ *
+ * @param producer Pointer to producer.
+ */
+static inline void dbn_export_commit(dbn_export_producer_t *producer)
+{
+  dbn_spsc_commit(&producer->ring);
+}
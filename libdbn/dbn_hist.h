@@ -0,0 +1,180 @@
+/**
+ * @file dbn_hist.h
+ * @brief Constant-memory log-linear histograms, for latency percentiles
+ * @author Nathan Blythe
+ * @copyright Copyright 2025 Nathan Blythe
+ * @copyright Released under the Apache-2.0 license, see LICENSE
+ *
+ * Values below 2^DBN_HIST_SUB_BITS are counted exactly. Above that, each power
+ * of 2 is split into 2^DBN_HIST_SUB_BITS equal buckets, so any recorded value
+ * is reported to within 1 part in 2^DBN_HIST_SUB_BITS (under 1%) over the
+ * full 64-bit range, in a fixed 59 KB. Recording is a count leading zeros, a
+ * shift and an increment, with no locks: give each thread its own
+ * histograms and merge them once at the end.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+
+/**
+ * @brief Number of bits of each value kept exactly.
+ */
+#define DBN_HIST_SUB_BITS 7
+
+
+/**
+ * @brief Number of buckets per power of 2.
+ */
+#define DBN_HIST_SUB_BUCKETS (1 << DBN_HIST_SUB_BITS)
+
+
+/**
+ * @brief Number of buckets: one per value below DBN_HIST_SUB_BUCKETS, then
+ * DBN_HIST_SUB_BUCKETS per power of 2 up to 2^63.
+ */
+#define DBN_HIST_NUM_BUCKETS (DBN_HIST_SUB_BUCKETS * (64 - DBN_HIST_SUB_BITS + 1))
+
+
+/**
+ * @brief Histogram.
+ */
+typedef struct
+{
+  uint64_t count;                          ///< @brief Number of values recorded
+  uint64_t num_negative;                   ///< @brief Number of negative values, recorded as 0
+  uint64_t sum;                            ///< @brief Sum of values recorded
+  uint64_t min;                            ///< @brief Minimum value recorded, if count is not 0
+  uint64_t max;                            ///< @brief Maximum value recorded
+  uint64_t buckets[DBN_HIST_NUM_BUCKETS];  ///< @brief Number of values recorded in each bucket
+} dbn_hist_t;
+
+
+/**
+ * @brief Initialize a histogram.
+ *
+ * @param hist Pointer to histogram.
+ */
+static inline void dbn_hist_init(dbn_hist_t *hist)
+{
+  memset(hist, 0, sizeof(dbn_hist_t));
+  hist->min = UINT64_MAX;
+}
+
+
+/**
+ * @brief Get the bucket of a value.
+ */
+static inline int dbn_hist_bucket(uint64_t value)
+{
+  if (value < DBN_HIST_SUB_BUCKETS) return value;
+
+  int e = 63 - __builtin_clzll(value);
+  int shift = e - DBN_HIST_SUB_BITS;
+  return DBN_HIST_SUB_BUCKETS * (shift + 1) + (int)((value >> shift) - DBN_HIST_SUB_BUCKETS);
+}
+
+
+/**
+ * @brief Get the smallest value of a bucket.
+ */
+static inline uint64_t dbn_hist_bucket_low(int bucket)
+{
+  if (bucket < DBN_HIST_SUB_BUCKETS) return bucket;
+
+  int shift = bucket / DBN_HIST_SUB_BUCKETS - 1;
+  return (uint64_t)(DBN_HIST_SUB_BUCKETS + bucket % DBN_HIST_SUB_BUCKETS) << shift;
+}
+
+
+/**
+ * @brief Record a value.
+ *
+ * @param hist Pointer to histogram.
+ * @param value Value to record. Negative values (ex. from clock skew) are recorded as 0 and counted in num_negative.
+ */
+static inline void dbn_hist_record(
+  dbn_hist_t *hist,
+  int64_t value)
+{
+  uint64_t v = value < 0 ? 0 : value;
+  hist->num_negative += value < 0;
+  hist->count++;
+  hist->sum += v;
+  if (v < hist->min) hist->min = v;
+  if (v > hist->max) hist->max = v;
+  hist->buckets[dbn_hist_bucket(v)]++;
+}
+
+
+/**
+ * @brief Add the values recorded in one histogram to another.
+ *
+ * @param hist Pointer to histogram to add to.
+ * @param other Pointer to histogram to add.
+ */
+static inline void dbn_hist_merge(
+  dbn_hist_t *hist,
+  const dbn_hist_t *other)
+{
+  hist->count += other->count;
+  hist->num_negative += other->num_negative;
+  hist->sum += other->sum;
+  if (other->min < hist->min) hist->min = other->min;
+  if (other->max > hist->max) hist->max = other->max;
+  for (int i = 0; i < DBN_HIST_NUM_BUCKETS; i++)
+    hist->buckets[i] += other->buckets[i];
+}
+
+
+/**
+ * @brief Get a percentile of the values recorded.
+ *
+ * @param hist Pointer to histogram.
+ * @param percentile Percentile, from 0 to 100.
+ *
+ * @return Value at or below which the percentile of values lie, to within the
+ * histogram's precision (the middle of its bucket, clamped to the recorded
+ * range), or 0 if no values were recorded.
+ */
+static inline uint64_t dbn_hist_percentile(
+  const dbn_hist_t *hist,
+  double percentile)
+{
+  if (!hist->count) return 0;
+
+  uint64_t rank = (uint64_t)(percentile / 100.0 * hist->count + 0.5);
+  if (rank < 1) rank = 1;
+  if (rank > hist->count) rank = hist->count;
+
+  uint64_t seen = 0;
+  for (int i = 0; i < DBN_HIST_NUM_BUCKETS; i++)
+  {
+    seen += hist->buckets[i];
+    if (seen < rank) continue;
+
+    uint64_t low = dbn_hist_bucket_low(i);
+    uint64_t high = i + 1 < DBN_HIST_NUM_BUCKETS ? dbn_hist_bucket_low(i + 1) - 1 : UINT64_MAX;
+    uint64_t value = low + (high - low) / 2;
+    if (value < hist->min) value = hist->min;
+    if (value > hist->max) value = hist->max;
+    return value;
+  }
+
+  return hist->max;
+}
+
+
+/**
+ * @brief Get the mean of the values recorded.
+ *
+ * @param hist Pointer to histogram.
+ *
+ * @return Mean, or 0 if no values were recorded.
+ */
+static inline double dbn_hist_mean(const dbn_hist_t *hist)
+{
+  return hist->count ? (double)hist->sum / hist->count : 0;
+}
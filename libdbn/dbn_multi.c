@@ -8,15 +8,52 @@
  * See README.md for example usage.
  */
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
 
 #include <pthread.h>
 
 #include "dbn.h"
 #include "dbn_multi.h"
+#include "dbn_export.h"
+
+
+/**
+ * @brief Result of a session's connection, for a caller waiting on it.
+ */
+typedef struct
+{
+  pthread_mutex_t lock;           ///< @brief Protects the remaining fields.
+  pthread_cond_t cond;            ///< @brief Signaled when done is set.
+  bool done;                      ///< @brief Set once the connection attempt is complete.
+  int result;                     ///< @brief Result of dbn_connect().
+  int error;                      ///< @brief errno from dbn_connect(), if it failed.
+} connect_wait_t;
+
+
+/**
+ * @brief Session client, with its pipeline-mode state.
+ */
+typedef struct
+{
+  dbn_t dbn;                      ///< @brief Client. Must be first, so that a dbn_t pointer is a session_t pointer.
+  dbn_spsc_t *rings;              ///< @brief For pipeline mode, ring to each handler thread.
+  int ring_index;                 ///< @brief For pipeline mode, index of rings in dbn_multi_t.rings.
+  uint32_t next;                  ///< @brief For pipeline mode with round-robin routing, next handler thread.
+  int index;                      ///< @brief Index of the session in dbn_multi_t.clients.
+} session_t;
 
 
 /**
@@ -26,6 +63,12 @@ typedef struct
 {
   dbn_multi_t *dbn_multi;         ///< @brief Back-pointer to the dbn_multi_t client with which this thread is associated.
   dbn_t *dbn;                     ///< @brief dbn_t client with which this thread is associated.
+  int index;                      ///< @brief Session index.
+  dbn_multi_thread_opts_t thread_opts; ///< @brief Thread options.
+  connect_wait_t *wait;           ///< @brief If not NULL, caller waiting for the connection result. The thread owns arg only once connected.
+  const char *api_key;            ///< @brief API key with which this thread connects its client before subscribing.
+  const char *dataset;            ///< @brief Dataset to connect to.
+  bool ts_out;                    ///< @brief Whether to request ts_out timestamping.
   const char *schema;             ///< @brief Schema to subscribe to.
   const char *symbology;          ///< @brief Symbology name.
   int num_symbols;                ///< @brief Number of symbols this thread / client / session will subscribe to.
@@ -35,6 +78,177 @@ typedef struct
 } thread_arg_t;
 
 
+/**
+ * @brief Merge mode position within a session's ring.
+ */
+typedef struct
+{
+  uint8_t *data;                  ///< @brief Current run of messages from the ring, or NULL if none.
+  uint64_t length;                ///< @brief Length of the run, in bytes.
+  uint64_t offset;                ///< @brief Offset of the head message within the run.
+  uint64_t ts_seen;               ///< @brief Monotonic time at which the run was read from the ring.
+  uint64_t ts;                    ///< @brief dbn_ts_recv() of the head message.
+} merge_cursor_t;
+
+
+/**
+ * @brief Handler thread start argument.
+ */
+typedef struct
+{
+  dbn_multi_t *dbn_multi;         ///< @brief Back-pointer to the dbn_multi_t client with which this thread is associated.
+  int index;                      ///< @brief Handler thread index.
+} handler_arg_t;
+
+
+/**
+ * @brief Invoke the dbn_multi_t-scope error handler, if not NULL.
+ */
+static void invoke_error_handler(
+  dbn_multi_t *dbn_multi,
+  bool fatal,
+  const char *format,
+  ...)
+{
+  if (!dbn_multi->on_error) return;
+
+  char msg[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(msg, sizeof(msg), format, args);
+  va_end(args);
+
+  dbn_multi->on_error(dbn_multi, fatal, msg);
+}
+
+
+/**
+ * @brief Get the CPUs of a NUMA node.
+ *
+ * @param node NUMA node.
+ * @param cpus Pointer to CPU set to populate.
+ *
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+static int get_node_cpus(
+  int node,
+  cpu_set_t *cpus)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return -1;
+
+  char list[4096];
+  ssize_t n = read(fd, list, sizeof(list) - 1);
+  int e = errno;
+  close(fd);
+  if (n <= 0)
+  {
+    errno = n < 0 ? e : ENOENT;
+    return -1;
+  }
+  list[n] = 0;
+
+
+  /*
+   * Format is comma-separated CPUs and ranges, ex. "0-3,8-11".
+   */
+  CPU_ZERO(cpus);
+  char *ptr = list;
+  while (*ptr >= '0' && *ptr <= '9')
+  {
+    int first = strtol(ptr, &ptr, 10);
+    int last = first;
+    if (*ptr == '-') last = strtol(ptr + 1, &ptr, 10);
+    for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+      CPU_SET(cpu, cpus);
+    if (*ptr == ',') ptr++;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief Apply thread options to the calling worker thread. Failures are not
+ * fatal, but are reported as warnings.
+ */
+static void apply_thread_opts(thread_arg_t *thread_arg)
+{
+  dbn_multi_t *dbn_multi = thread_arg->dbn_multi;
+  dbn_multi_thread_opts_t *opts = &thread_arg->thread_opts;
+
+  char name[16];
+  if (opts->name[0]) snprintf(name, sizeof(name), "%s", opts->name);
+  else snprintf(name, sizeof(name), "dbn-%d", thread_arg->index);
+  pthread_setname_np(pthread_self(), name);
+
+
+  /*
+   * Pin to the requested CPUs, or else to the CPUs of the requested NUMA
+   * node.
+   */
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  bool pin = false;
+  if (opts->num_cpus > 0)
+  {
+    for (int i = 0; i < opts->num_cpus && i < DBN_MULTI_MAX_CPUS; i++)
+    {
+      if (opts->cpus[i] >= 0 && opts->cpus[i] < CPU_SETSIZE) CPU_SET(opts->cpus[i], &cpus);
+    }
+    pin = true;
+  }
+  else if (thread_arg->dbn->opts.numa_node >= 0)
+  {
+    if (get_node_cpus(thread_arg->dbn->opts.numa_node, &cpus))
+    {
+      int e = errno;
+      invoke_error_handler(
+        dbn_multi,
+        false,
+        "Failed to get CPUs of NUMA node %d (errno %d: %s)",
+        thread_arg->dbn->opts.numa_node,
+        e,
+        strerror(e));
+    }
+    else pin = true;
+  }
+
+  int r;
+  if (pin && (r = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus)))
+  {
+    invoke_error_handler(
+      dbn_multi,
+      false,
+      "Failed to set affinity of thread %s (errno %d: %s)",
+      name,
+      r,
+      strerror(r));
+  }
+
+  if (opts->sched_priority)
+  {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = opts->sched_priority;
+    if ((r = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)))
+    {
+      invoke_error_handler(
+        dbn_multi,
+        false,
+        "Failed to set SCHED_FIFO priority %d on thread %s (errno %d: %s)",
+        opts->sched_priority,
+        name,
+        r,
+        strerror(r));
+    }
+  }
+}
+
+
 /**
  * @brief Worker thread entry point.
  */
@@ -44,6 +258,45 @@ static void *thread(void *arg)
   dbn_multi_t *dbn_multi = thread_arg->dbn_multi;
   dbn_t *dbn = thread_arg->dbn;
 
+
+  /*
+   * Place the thread, then connect. Connecting allocates and first touches
+   * the client's buffers, so they land on the thread's NUMA node.
+   */
+  apply_thread_opts(thread_arg);
+
+  int r = dbn_connect(
+    dbn,
+    thread_arg->api_key,
+    thread_arg->dataset,
+    thread_arg->ts_out);
+
+  connect_wait_t *wait = thread_arg->wait;
+  if (wait)
+  {
+    pthread_mutex_lock(&wait->lock);
+    wait->result = r;
+    wait->error = errno;
+    wait->done = true;
+    pthread_cond_signal(&wait->cond);
+    pthread_mutex_unlock(&wait->lock);
+  }
+
+  /*
+   * A session that fails from here on is left in place, so count it for
+   * dbn_multi_get_num_failed(). A synchronous connect failure instead removes
+   * the session.
+   */
+  if (r)
+  {
+    if (!wait)
+    {
+      atomic_fetch_add(&dbn_multi->num_failed, 1);
+      free(arg);
+    }
+    return NULL;
+  }
+
   if (dbn_start(
     dbn,
     thread_arg->schema,
@@ -52,21 +305,364 @@ static void *thread(void *arg)
     thread_arg->symbols,
     thread_arg->suffix,
     thread_arg->replay))
+  {
+    atomic_fetch_add(&dbn_multi->num_failed, 1);
+    free(arg);
     return NULL;
+  }
 
+  session_t *session = (session_t *)dbn;
+  if (session->rings) atomic_store_explicit(&dbn_multi->rings_live[session->ring_index], true, memory_order_release);
   atomic_fetch_add(&dbn_multi->num_subscribed, 1);
 
   free(arg);
 
-  while (!dbn_multi->stop)
+  while (!atomic_load_explicit(&dbn_multi->stop, memory_order_acquire))
+  {
+    if (dbn_multi->spin) dbn_poll(dbn);
+    else dbn_get(dbn);
+  }
+
+  return NULL;
+}
+
+
+/**
+ * @brief Pick the handler thread for a message.
+ */
+static inline uint32_t route(
+  dbn_multi_t *dbn_multi,
+  session_t *session,
+  const dbn_hdr_t *msg)
+{
+  uint32_t n = dbn_multi->num_handler_threads;
+  if (dbn_multi->route == DBN_MULTI_ROUTE_ROUND_ROBIN)
+  {
+    uint32_t j = session->next;
+    session->next = j + 1 == n ? 0 : j + 1;
+    return j;
+  }
+
+
+  /*
+   * Multiplicative hash, then scale to [0, n) without a division.
+   */
+  uint32_t h = msg->instrument_id * 0x9E3779B1u;
+  return ((uint64_t)h * n) >> 32;
+}
+
+
+/**
+ * @brief Pipeline mode batch handler: copy each message that has a handler
+ * into the ring of the handler thread it routes to, then publish all rings
+ * at once.
+ */
+static void on_batch_pipeline(
+  dbn_t *dbn,
+  dbn_batch_t *batch)
+{
+  dbn_multi_t *dbn_multi = dbn->ctx;
+  session_t *session = (session_t *)dbn;
+
+  dbn_batch_foreach(batch, msg)
+  {
+    if (!dbn_multi->on_batch && !dbn_multi->handlers[msg->rtype]) continue;
+
+    dbn_spsc_t *ring = &session->rings[route(dbn_multi, session, msg)];
+    while (!dbn_spsc_write(ring, msg))
+    {
+      if (atomic_load_explicit(&dbn_multi->stop, memory_order_relaxed)) return;
+      if (!dbn_multi->spin) sched_yield();
+    }
+  }
+
+  for (int j = 0; j < dbn_multi->num_handler_threads; j++)
+    dbn_spsc_commit(&session->rings[j]);
+}
+
+
+/**
+ * @brief Dispatch a contiguous run of messages from a ring, on a handler
+ * thread.
+ */
+static void dispatch(
+  dbn_multi_t *dbn_multi,
+  uint8_t *data,
+  uint64_t length)
+{
+  if (dbn_multi->on_batch)
+  {
+    dbn_batch_t batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.data = data;
+    batch.length = length;
+    for (uint64_t offset = 0; offset < length; offset += 4 * (uint64_t)data[offset])
+      batch.count++;
+    dbn_multi->on_batch(dbn_multi, &batch);
+    return;
+  }
+
+  for (uint64_t offset = 0; offset < length; offset += 4 * (uint64_t)data[offset])
+  {
+    dbn_hdr_t *msg = (dbn_hdr_t *)(data + offset);
+    dbn_multi_on_msg_t handler = dbn_multi->handlers[msg->rtype];
+    if (handler) handler(dbn_multi, msg);
+  }
+}
+
+
+/**
+ * @brief Get monotonic time in nanoseconds.
+ */
+static inline uint64_t monotime()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+
+/**
+ * @brief Whether heap entry a orders before heap entry b.
+ */
+static inline bool merge_before(
+  merge_cursor_t *cursors,
+  int a,
+  int b)
+{
+  return cursors[a].ts < cursors[b].ts || (cursors[a].ts == cursors[b].ts && a < b);
+}
+
+
+/**
+ * @brief Restore the heap property downward from position k.
+ */
+static void merge_sift_down(
+  merge_cursor_t *cursors,
+  int *heap,
+  int size,
+  int k)
+{
+  while (true)
+  {
+    int min = k;
+    int l = 2 * k + 1;
+    int r = l + 1;
+    if (l < size && merge_before(cursors, heap[l], heap[min])) min = l;
+    if (r < size && merge_before(cursors, heap[r], heap[min])) min = r;
+    if (min == k) return;
+    int t = heap[k];
+    heap[k] = heap[min];
+    heap[min] = t;
+    k = min;
+  }
+}
+
+
+/**
+ * @brief Add a session to the heap.
+ */
+static void merge_push(
+  merge_cursor_t *cursors,
+  int *heap,
+  int *size,
+  int i)
+{
+  int k = (*size)++;
+  heap[k] = i;
+  while (k && merge_before(cursors, heap[k], heap[(k - 1) / 2]))
+  {
+    int p = (k - 1) / 2;
+    heap[k] = heap[p];
+    heap[p] = i;
+    k = p;
+  }
+}
+
+
+/**
+ * @brief Read the next run of messages from a session's ring into its
+ * cursor.
+ *
+ * @return true if there is a run, false if the ring is empty.
+ */
+static inline bool merge_read(
+  dbn_multi_t *dbn_multi,
+  merge_cursor_t *cursor,
+  int i,
+  uint64_t now)
+{
+  cursor->data = dbn_spsc_read(&dbn_multi->rings[i][0], &cursor->length);
+  if (!cursor->data) return false;
+  cursor->offset = 0;
+  cursor->ts_seen = now;
+  cursor->ts = dbn_ts_recv((dbn_hdr_t *)cursor->data);
+  return true;
+}
+
+
+/**
+ * @brief Merge mode handler thread body. Repeatedly delivers the earliest
+ * head message across sessions, as long as every subscribed session has one
+ * ready or it has waited out the reorder window. Sessions not subscribed
+ * (still connecting, or failed) aren't waited for.
+ */
+static void merge(dbn_multi_t *dbn_multi)
+{
+  merge_cursor_t cursors[DBN_MULTI_MAX_SESSIONS];
+  int heap[DBN_MULTI_MAX_SESSIONS];
+  int size = 0;
+  uint64_t ts_last = 0;
+  memset(cursors, 0, sizeof(cursors));
+
+  bool stopping = false;
+  while (true)
+  {
+    bool idle = true;
+    uint64_t now = monotime();
+    int n = atomic_load_explicit(&dbn_multi->num_rings, memory_order_acquire);
+    int missing = 0;
+    for (int i = 0; i < n; i++)
+    {
+      if (cursors[i].data) continue;
+      if (merge_read(dbn_multi, &cursors[i], i, now)) merge_push(cursors, heap, &size, i);
+      else if (atomic_load_explicit(&dbn_multi->rings_live[i], memory_order_acquire)) missing++;
+    }
+
+    while (size)
+    {
+      int i = heap[0];
+      merge_cursor_t *cursor = &cursors[i];
+      if (missing && !stopping && now - cursor->ts_seen < dbn_multi->merge_window) break;
+
+      dbn_hdr_t *msg = (dbn_hdr_t *)(cursor->data + cursor->offset);
+      if (cursor->ts < ts_last) atomic_fetch_add_explicit(&dbn_multi->num_late, 1, memory_order_relaxed);
+      else ts_last = cursor->ts;
+      dispatch(dbn_multi, (uint8_t *)msg, 4 * (uint64_t)msg->rlength);
+      idle = false;
+
+
+      /*
+       * Advance the session, reading its next run once this one is done.
+       */
+      cursor->offset += 4 * (uint64_t)msg->rlength;
+      if (cursor->offset == cursor->length)
+      {
+        dbn_spsc_release(&dbn_multi->rings[i][0]);
+        if (!merge_read(dbn_multi, cursor, i, now))
+        {
+          missing++;
+          heap[0] = heap[--size];
+          merge_sift_down(cursors, heap, size, 0);
+          continue;
+        }
+      }
+      else cursor->ts = dbn_ts_recv((dbn_hdr_t *)(cursor->data + cursor->offset));
+      merge_sift_down(cursors, heap, size, 0);
+    }
+
+    if (stopping) break;
+    if (atomic_load_explicit(&dbn_multi->stop_handlers, memory_order_acquire)) stopping = true;
+    else if (idle && !dbn_multi->spin) sched_yield();
+  }
+}
+
+
+/**
+ * @brief Handler thread entry point. Drains this thread's ring from every
+ * session until stopped, then drains once more.
+ */
+static void *handler_thread(void *arg)
+{
+  handler_arg_t *handler_arg = arg;
+  dbn_multi_t *dbn_multi = handler_arg->dbn_multi;
+  int j = handler_arg->index;
+  free(arg);
+
+  char name[16];
+  snprintf(name, sizeof(name), "dbn-h%d", j);
+  pthread_setname_np(pthread_self(), name);
+
+  if (dbn_multi->merge)
   {
-    dbn_get(dbn);
+    merge(dbn_multi);
+    return NULL;
+  }
+
+  bool stopping = false;
+  while (true)
+  {
+    bool idle = true;
+    int n = atomic_load_explicit(&dbn_multi->num_rings, memory_order_acquire);
+    for (int i = 0; i < n; i++)
+    {
+      dbn_spsc_t *ring = &dbn_multi->rings[i][j];
+      uint64_t length;
+      uint8_t *data;
+      while ((data = dbn_spsc_read(ring, &length)))
+      {
+        dispatch(dbn_multi, data, length);
+        idle = false;
+      }
+      dbn_spsc_release(ring);
+    }
+
+    if (stopping) break;
+    if (atomic_load_explicit(&dbn_multi->stop_handlers, memory_order_acquire)) stopping = true;
+    else if (idle && !dbn_multi->spin) sched_yield();
   }
 
   return NULL;
 }
 
 
+/**
+ * @brief Start pipeline mode handler threads, if not yet started.
+ *
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+static int start_handler_threads(dbn_multi_t *dbn_multi)
+{
+  if (dbn_multi->handler_threads) return 0;
+
+  int n = dbn_multi->num_handler_threads;
+  dbn_multi->handler_threads = calloc(n, sizeof(pthread_t));
+  if (!dbn_multi->handler_threads) return -1;
+
+  for (int j = 0; j < n; j++)
+  {
+    handler_arg_t *arg = malloc(sizeof(handler_arg_t));
+    int r = arg ? 0 : errno;
+    if (arg)
+    {
+      arg->dbn_multi = dbn_multi;
+      arg->index = j;
+      r = pthread_create(&dbn_multi->handler_threads[j], NULL, handler_thread, arg);
+      if (r) free(arg);
+    }
+    if (r)
+    {
+      invoke_error_handler(
+        dbn_multi,
+        true,
+        "Failed to create handler thread (errno %d: %s)",
+        r,
+        strerror(r));
+      atomic_store(&dbn_multi->stop_handlers, true);
+      for (int k = 0; k < j; k++)
+        pthread_join(dbn_multi->handler_threads[k], NULL);
+      free(dbn_multi->handler_threads);
+      dbn_multi->handler_threads = NULL;
+      atomic_store(&dbn_multi->stop_handlers, false);
+      errno = r;
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+
 /**
  * @brief On dbn_t client error, invoke the dbn_multi_t-scope client error
  * handler.
@@ -86,19 +682,73 @@ static void on_error(
 
 /**
  * @brief On Databento message, invoke the dbn_multi_t-scope mesasge
- * handler.
+ * handler for its rtype. Only registered with the underlying client for
+ * rtypes that have one.
  */
 static void on_msg(
   dbn_t *dbn,
   dbn_hdr_t *msg)
 {
   dbn_multi_t *dbn_multi = dbn->ctx;
-  if (dbn_multi->on_msg) dbn_multi->on_msg(
+  dbn_multi->handlers[msg->rtype](
     dbn_multi,
     msg);
 }
 
 
+/**
+ * @brief On batch of Databento messages, invoke the dbn_multi_t-scope batch
+ * handler.
+ */
+static void on_batch(
+  dbn_t *dbn,
+  dbn_batch_t *batch)
+{
+  dbn_multi_t *dbn_multi = dbn->ctx;
+  dbn_multi->on_batch(
+    dbn_multi,
+    batch);
+}
+
+
+/**
+ * @brief On backpressure, invoke the dbn_multi_t-scope backpressure handler
+ * with the index of the session.
+ */
+static void on_backpressure(
+  dbn_t *dbn,
+  uint64_t backlog,
+  int64_t lag)
+{
+  dbn_multi_t *dbn_multi = dbn->ctx;
+  dbn_multi->on_backpressure(
+    dbn_multi,
+    ((session_t *)dbn)->index,
+    backlog,
+    lag);
+}
+
+
+/**
+ * @brief On a message out of sequence, invoke the dbn_multi_t-scope sequence
+ * handler with the index of the session.
+ */
+static void on_sequence(
+  dbn_t *dbn,
+  dbn_hdr_t *msg,
+  uint32_t last,
+  uint32_t sequence)
+{
+  dbn_multi_t *dbn_multi = dbn->ctx;
+  dbn_multi->on_sequence(
+    dbn_multi,
+    ((session_t *)dbn)->index,
+    msg,
+    last,
+    sequence);
+}
+
+
 void dbn_multi_init(
   dbn_multi_t *dbn_multi,
   dbn_multi_on_error_t on_error,
@@ -106,12 +756,94 @@ void dbn_multi_init(
   void *ctx)
 {
   memset(dbn_multi, 0, sizeof(dbn_multi_t));
+  dbn_opts_init(&dbn_multi->opts);
+  dbn_multi->thread_opts.num_cpus = 0;
+  dbn_multi->thread_opts.name[0] = 0;
+  dbn_multi->thread_opts.sched_priority = 0;
+  dbn_multi->num_handler_threads = 0;
+  dbn_multi->route = DBN_MULTI_ROUTE_INSTRUMENT;
+  dbn_multi->merge = false;
+  dbn_multi->merge_window = 1000000;
+  dbn_multi->ring_size = 1 << 20;
   dbn_multi->on_error = on_error;
   dbn_multi->on_msg = on_msg;
+  for (int i = 0; i < 256; i++)
+    dbn_multi->handlers[i] = on_msg;
   dbn_multi->ctx = ctx;
 }
 
 
+void dbn_multi_set_msg_handler(
+  dbn_multi_t *dbn_multi,
+  dbn_rtype_t rtype,
+  dbn_multi_on_msg_t handler)
+{
+  dbn_multi->handlers[(uint8_t)rtype] = handler;
+  if (dbn_multi->num_handler_threads) return;
+  for (int i = 0; i < dbn_multi->num_sessions; i++)
+    dbn_set_msg_handler(dbn_multi->clients[i], rtype, handler ? on_msg : NULL);
+}
+
+
+void dbn_multi_set_batch_handler(
+  dbn_multi_t *dbn_multi,
+  dbn_multi_on_batch_t handler)
+{
+  dbn_multi->on_batch = handler;
+  if (dbn_multi->num_handler_threads) return;
+  for (int i = 0; i < dbn_multi->num_sessions; i++)
+    dbn_set_batch_handler(dbn_multi->clients[i], handler ? on_batch : NULL);
+}
+
+
+void dbn_multi_set_backpressure_handler(
+  dbn_multi_t *dbn_multi,
+  dbn_multi_on_backpressure_t handler)
+{
+  dbn_multi->on_backpressure = handler;
+}
+
+
+void dbn_multi_set_sequence_handler(
+  dbn_multi_t *dbn_multi,
+  dbn_multi_on_sequence_t handler)
+{
+  dbn_multi->on_sequence = handler;
+}
+
+
+void dbn_multi_set_quotes(
+  dbn_multi_t *dbn_multi,
+  struct dbn_quotes *quotes)
+{
+  dbn_multi->quotes = quotes;
+}
+
+
+void dbn_multi_set_export(
+  dbn_multi_t *dbn_multi,
+  struct dbn_export *exporter)
+{
+  dbn_multi->exporter = exporter;
+}
+
+
+/**
+ * @brief Remove the last session, which never started receiving: release its
+ * client and keep its exporter producer for the next session.
+ */
+static void remove_session(
+  dbn_multi_t *dbn_multi,
+  int i)
+{
+  dbn_t *dbn = dbn_multi->clients[i];
+  if (dbn->export_producer) dbn_multi->spare_producer = dbn->export_producer;
+  dbn_close(dbn);
+  free(dbn);
+  dbn_multi->num_sessions--;
+}
+
+
 int dbn_multi_connect_and_start(
   dbn_multi_t *dbn_multi,
   const char *api_key,
@@ -124,16 +856,106 @@ int dbn_multi_connect_and_start(
   const char *suffix,
   bool replay)
 {
+  /*
+   * Claim the session's exporter producer before anything is published, so
+   * that running out of producers leaves nothing to unwind. Producers can't
+   * be released, so one left by a removed session is reused.
+   */
+  dbn_export_producer_t *producer = dbn_multi->spare_producer;
+  dbn_multi->spare_producer = NULL;
+  if (dbn_multi->exporter && !producer && !(producer = dbn_export_attach(dbn_multi->exporter)))
+  {
+    invoke_error_handler(
+      dbn_multi,
+      true,
+      "Failed to attach exporter, all %d producers claimed",
+      dbn_multi->exporter->num_producers);
+    errno = ENOSPC;
+    return -1;
+  }
+
+
+  /*
+   * In pipeline mode, give the session a ring to each handler thread. Rings
+   * are never reused, and live until dbn_multi_close_all().
+   */
+  dbn_spsc_t *rings = NULL;
+  if (dbn_multi->merge) dbn_multi->num_handler_threads = 1;
+  if (dbn_multi->num_handler_threads)
+  {
+    int k = atomic_load(&dbn_multi->num_rings);
+    if (k == DBN_MULTI_MAX_SESSIONS)
+    {
+      invoke_error_handler(dbn_multi, true, "Too many sessions for pipeline mode");
+      dbn_multi->spare_producer = producer;
+      errno = ENOSPC;
+      return -1;
+    }
+
+    rings = calloc(dbn_multi->num_handler_threads, sizeof(dbn_spsc_t));
+    int j = 0;
+    while (rings && j < dbn_multi->num_handler_threads && !dbn_spsc_init(&rings[j], dbn_multi->ring_size))
+      j++;
+    if (!rings || j < dbn_multi->num_handler_threads)
+    {
+      int e = errno;
+      invoke_error_handler(
+        dbn_multi,
+        true,
+        "Failed to allocate pipeline rings of %" PRIu64 " bytes (errno %d: %s)",
+        dbn_multi->ring_size,
+        e,
+        strerror(e));
+      while (rings && j--) dbn_spsc_free(&rings[j]);
+      free(rings);
+      dbn_multi->spare_producer = producer;
+      errno = e;
+      return -1;
+    }
+
+    dbn_multi->rings[k] = rings;
+    atomic_store_explicit(&dbn_multi->num_rings, k + 1, memory_order_release);
+
+    if (start_handler_threads(dbn_multi))
+    {
+      dbn_multi->spare_producer = producer;
+      return -1;
+    }
+  }
+
   dbn_multi->num_sessions++;
   dbn_multi->clients = realloc(dbn_multi->clients, dbn_multi->num_sessions * sizeof(dbn_t *));
 
   int i = dbn_multi->num_sessions - 1;
-  dbn_multi->clients[i] = malloc(sizeof(dbn_t));
-  dbn_init(dbn_multi->clients[i], on_error, on_msg, dbn_multi);
+  session_t *session = calloc(1, sizeof(session_t));
+  session->rings = rings;
+  session->ring_index = atomic_load(&dbn_multi->num_rings) - 1;
+  session->index = i;
+  dbn_multi->clients[i] = &session->dbn;
+  dbn_init(dbn_multi->clients[i], on_error, NULL, dbn_multi);
+  dbn_multi->clients[i]->opts = dbn_multi->opts;
+  if (dbn_multi->on_backpressure) dbn_set_backpressure_handler(dbn_multi->clients[i], on_backpressure);
+  if (dbn_multi->on_sequence) dbn_set_sequence_handler(dbn_multi->clients[i], on_sequence);
+  dbn_set_quotes(dbn_multi->clients[i], dbn_multi->quotes);
+  dbn_multi->clients[i]->export_producer = producer;
+  if (rings) dbn_set_batch_handler(dbn_multi->clients[i], on_batch_pipeline);
+  else
+  {
+    for (int j = 0; j < 256; j++)
+    {
+      if (dbn_multi->handlers[j]) dbn_set_msg_handler(dbn_multi->clients[i], j, on_msg);
+    }
+    if (dbn_multi->on_batch) dbn_set_batch_handler(dbn_multi->clients[i], on_batch);
+  }
 
   thread_arg_t *arg = calloc(1, sizeof(thread_arg_t));
   arg->dbn_multi = dbn_multi;
   arg->dbn = dbn_multi->clients[i];
+  arg->index = i;
+  arg->thread_opts = dbn_multi->thread_opts;
+  arg->api_key = api_key;
+  arg->dataset = dataset;
+  arg->ts_out = ts_out;
   arg->schema = schema;
   arg->symbology = symbology;
   arg->suffix = suffix;
@@ -141,20 +963,402 @@ int dbn_multi_connect_and_start(
   arg->symbols = symbols;
   arg->replay = replay;
 
-  int r = dbn_connect(
-    dbn_multi->clients[dbn_multi->num_sessions - 1],
-    api_key,
-    dataset,
-    ts_out);
-  if (r) return r;
+
+  /*
+   * The worker thread connects, so that it can place itself first. Unless
+   * connecting asynchronously, wait for the outcome.
+   */
+  connect_wait_t wait;
+  if (!dbn_multi->async_connect)
+  {
+    memset(&wait, 0, sizeof(wait));
+    pthread_mutex_init(&wait.lock, NULL);
+    pthread_cond_init(&wait.cond, NULL);
+    arg->wait = &wait;
+  }
 
   dbn_multi->threads = realloc(dbn_multi->threads, dbn_multi->num_sessions * sizeof(pthread_t));
-  pthread_create(&dbn_multi->threads[dbn_multi->num_sessions - 1], NULL, thread, arg);
+  int r = pthread_create(&dbn_multi->threads[i], NULL, thread, arg);
+  if (r)
+  {
+    invoke_error_handler(
+      dbn_multi,
+      true,
+      "Failed to create thread (errno %d: %s)",
+      r,
+      strerror(r));
+    if (!dbn_multi->async_connect)
+    {
+      pthread_cond_destroy(&wait.cond);
+      pthread_mutex_destroy(&wait.lock);
+    }
+    free(arg);
+    remove_session(dbn_multi, i);
+    errno = r;
+    return -1;
+  }
+
+  if (dbn_multi->async_connect) return 0;
+
+  pthread_mutex_lock(&wait.lock);
+  while (!wait.done)
+    pthread_cond_wait(&wait.cond, &wait.lock);
+  pthread_mutex_unlock(&wait.lock);
+
+  pthread_cond_destroy(&wait.cond);
+  pthread_mutex_destroy(&wait.lock);
+
+
+  /*
+   * On failure the thread has already exited, leaving its argument and
+   * client to us.
+   */
+  if (wait.result)
+  {
+    pthread_join(dbn_multi->threads[i], NULL);
+    free(arg);
+    remove_session(dbn_multi, i);
+    errno = wait.error;
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief Compare symbol indices by descending weight, for qsort_r().
+ */
+static int compare_weights(
+  const void *a,
+  const void *b,
+  void *weights)
+{
+  double wa = ((const double *)weights)[*(const int *)a];
+  double wb = ((const double *)weights)[*(const int *)b];
+  if (wa != wb) return wa < wb ? 1 : -1;
+  return *(const int *)a - *(const int *)b;
+}
+
 
+int dbn_multi_partition(
+  int num_symbols,
+  const double *weights,
+  int num_sessions,
+  int *assignment)
+{
+  if (num_symbols < 0 || num_sessions <= 0)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (!weights)
+  {
+    for (int i = 0; i < num_symbols; i++)
+      assignment[i] = i % num_sessions;
+    return 0;
+  }
+
+  int *order = malloc(num_symbols * sizeof(int));
+  double *loads = calloc(num_sessions, sizeof(double));
+  if (!order || !loads)
+  {
+    free(order);
+    free(loads);
+    return -1;
+  }
+
+  for (int i = 0; i < num_symbols; i++)
+    order[i] = i;
+  qsort_r(order, num_symbols, sizeof(int), compare_weights, (void *)weights);
+
+  for (int k = 0; k < num_symbols; k++)
+  {
+    int min = 0;
+    for (int j = 1; j < num_sessions; j++)
+    {
+      if (loads[j] < loads[min]) min = j;
+    }
+    assignment[order[k]] = min;
+    loads[min] += weights[order[k]];
+  }
+
+  free(order);
+  free(loads);
   return 0;
 }
 
 
+/**
+ * @brief FNV-1a hash of a null-terminated string.
+ */
+static inline uint32_t hash_symbol(const char *symbol)
+{
+  uint32_t h = 2166136261u;
+  while (*symbol)
+    h = (h ^ (uint8_t)*symbol++) * 16777619u;
+  return h;
+}
+
+
+int dbn_multi_load_weights(
+  const char *path,
+  int num_symbols,
+  const char * const *symbols,
+  double *weights)
+{
+  FILE *file = fopen(path, "r");
+  if (!file) return -1;
+
+
+  /*
+   * Index symbols by hash, open addressing.
+   */
+  uint32_t size = 2;
+  while (size < 2 * (uint32_t)num_symbols) size <<= 1;
+  int *table = malloc(size * sizeof(int));
+  bool *found = calloc(num_symbols ? num_symbols : 1, sizeof(bool));
+  if (!table || !found)
+  {
+    free(table);
+    free(found);
+    fclose(file);
+    return -1;
+  }
+  memset(table, 0xFF, size * sizeof(int));
+  for (int i = 0; i < num_symbols; i++)
+  {
+    uint32_t k = hash_symbol(symbols[i]) & (size - 1);
+    while (table[k] >= 0) k = (k + 1) & (size - 1);
+    table[k] = i;
+    weights[i] = 0;
+  }
+
+  char line[256];
+  while (fgets(line, sizeof(line), file))
+  {
+    char *tab = strrchr(line, '\t');
+    if (!tab) continue;
+    *tab = 0;
+    double weight = strtod(tab + 1, NULL);
+
+    uint32_t k = hash_symbol(line) & (size - 1);
+    while (table[k] >= 0)
+    {
+      if (!strcmp(symbols[table[k]], line))
+      {
+        weights[table[k]] += weight;
+        found[table[k]] = true;
+        break;
+      }
+      k = (k + 1) & (size - 1);
+    }
+  }
+
+  bool failed = ferror(file);
+  fclose(file);
+
+
+  /*
+   * Give symbols missing from the file the mean weight.
+   */
+  double sum = 0;
+  int count = 0;
+  for (int i = 0; i < num_symbols; i++)
+  {
+    if (found[i])
+    {
+      sum += weights[i];
+      count++;
+    }
+  }
+  for (int i = 0; i < num_symbols; i++)
+  {
+    if (!found[i]) weights[i] = count ? sum / count : 1;
+  }
+
+  free(table);
+  free(found);
+
+  if (failed)
+  {
+    errno = EIO;
+    return -1;
+  }
+  return 0;
+}
+
+
+int dbn_multi_save_weights(
+  const char *path,
+  int num_symbols,
+  const char * const *symbols,
+  const double *weights)
+{
+  FILE *file = fopen(path, "w");
+  if (!file) return -1;
+
+  for (int i = 0; i < num_symbols; i++)
+    fprintf(file, "%s\t%.17g\n", symbols[i], weights[i]);
+
+  if (fclose(file))
+    return -1;
+  return 0;
+}
+
+
+int dbn_multi_connect_and_start_balanced(
+  dbn_multi_t *dbn_multi,
+  const char *api_key,
+  const char *dataset,
+  bool ts_out,
+  const char *schema,
+  const char *symbology,
+  int num_symbols,
+  const char * const *symbols,
+  const double *weights,
+  int num_sessions,
+  const char *suffix,
+  bool replay,
+  int *assignment)
+{
+  int *sessions = assignment ? assignment : malloc(num_symbols * sizeof(int));
+  if (!sessions || dbn_multi_partition(num_symbols, weights, num_sessions, sessions))
+  {
+    int e = errno;
+    invoke_error_handler(
+      dbn_multi,
+      true,
+      "Failed to partition %d symbols across %d sessions (errno %d: %s)",
+      num_symbols,
+      num_sessions,
+      e,
+      strerror(e));
+    if (sessions != assignment) free(sessions);
+    errno = e;
+    return -1;
+  }
+
+
+  /*
+   * Gather each session's symbols into an array that lives until
+   * dbn_multi_close_all(), as threads subscribe from it.
+   */
+  int r = 0;
+  for (int j = 0; j < num_sessions && !r; j++)
+  {
+    int n = 0;
+    for (int i = 0; i < num_symbols; i++)
+    {
+      if (sessions[i] == j) n++;
+    }
+    if (!n) continue;
+
+    const char **partition = malloc(n * sizeof(char *));
+    const char ***partitions = realloc(dbn_multi->partitions, (dbn_multi->num_partitions + 1) * sizeof(char **));
+    if (!partition || !partitions)
+    {
+      int e = errno;
+      free(partition);
+      if (partitions) dbn_multi->partitions = partitions;
+      invoke_error_handler(dbn_multi, true, "Failed to allocate session symbols");
+      errno = e;
+      r = -1;
+      break;
+    }
+    dbn_multi->partitions = partitions;
+    dbn_multi->partitions[dbn_multi->num_partitions++] = partition;
+
+    n = 0;
+    for (int i = 0; i < num_symbols; i++)
+    {
+      if (sessions[i] == j) partition[n++] = symbols[i];
+    }
+
+    r = dbn_multi_connect_and_start(
+      dbn_multi,
+      api_key,
+      dataset,
+      ts_out,
+      schema,
+      symbology,
+      n,
+      partition,
+      suffix,
+      replay);
+  }
+
+  if (sessions != assignment)
+  {
+    int e = errno;
+    free(sessions);
+    errno = e;
+  }
+  return r;
+}
+
+
+int dbn_multi_subscribe(
+  dbn_multi_t *dbn_multi,
+  int session,
+  const char *schema,
+  const char *symbology,
+  int num_symbols,
+  const char * const *symbols,
+  const char *suffix,
+  bool replay,
+  uint64_t *id)
+{
+  if (session < 0 || session >= dbn_multi->num_sessions)
+  {
+    invoke_error_handler(dbn_multi, false, "No session %d", session);
+    errno = EINVAL;
+    return -1;
+  }
+
+  return dbn_subscribe(
+    dbn_multi->clients[session],
+    schema,
+    symbology,
+    num_symbols,
+    symbols,
+    suffix,
+    replay,
+    id);
+}
+
+
+bool dbn_multi_is_subscribed(
+  dbn_multi_t *dbn_multi,
+  int session,
+  uint64_t id)
+{
+  if (session < 0 || session >= dbn_multi->num_sessions)
+  {
+    invoke_error_handler(dbn_multi, false, "No session %d", session);
+    errno = EINVAL;
+    return false;
+  }
+
+  return dbn_is_subscribed(dbn_multi->clients[session], id);
+}
+
+
+void dbn_multi_get_metrics(
+  dbn_multi_t *dbn_multi,
+  dbn_metrics_t *metrics)
+{
+  memset(metrics, 0, sizeof(dbn_metrics_t));
+  for (int i = 0; i < dbn_multi->num_sessions; i++)
+  {
+    dbn_metrics_t session;
+    dbn_get_metrics(dbn_multi->clients[i], &session);
+    dbn_add_metrics(metrics, &session);
+  }
+}
+
+
 bool dbn_multi_is_fully_subscribed(
   dbn_multi_t *dbn_multi)
 {
@@ -162,12 +1366,23 @@ bool dbn_multi_is_fully_subscribed(
 }
 
 
+uint64_t dbn_multi_get_num_failed(
+  dbn_multi_t *dbn_multi)
+{
+  return atomic_load(&dbn_multi->num_failed);
+}
+
+
 void dbn_multi_close_all(dbn_multi_t *dbn_multi)
 {
   /*
-   * Stop all threads.
+   * Stop all threads, waking any blocked waiting for data so that shutdown
+   * doesn't wait on a quiet feed.
    */
-  dbn_multi->stop = true;
+  atomic_store(&dbn_multi->stop, true);
+
+  for (int i = 0; i < dbn_multi->num_sessions; i++)
+    dbn_wake(dbn_multi->clients[i]);
 
   for (int i = 0; i < dbn_multi->num_sessions; i++)
     pthread_join(dbn_multi->threads[i], NULL);
@@ -177,12 +1392,38 @@ void dbn_multi_close_all(dbn_multi_t *dbn_multi)
    * Close / disconnect all clients.
    */
   for (int i = 0; i < dbn_multi->num_sessions; i++)
+  {
     dbn_close(dbn_multi->clients[i]);
+    free(dbn_multi->clients[i]);
+  }
+
+
+  /*
+   * Stop handler threads once sessions can no longer feed them. They drain
+   * their rings before exiting.
+   */
+  if (dbn_multi->handler_threads)
+  {
+    atomic_store(&dbn_multi->stop_handlers, true);
+    for (int j = 0; j < dbn_multi->num_handler_threads; j++)
+      pthread_join(dbn_multi->handler_threads[j], NULL);
+    free(dbn_multi->handler_threads);
+  }
+
+  for (int k = 0; k < dbn_multi->num_rings; k++)
+  {
+    for (int j = 0; j < dbn_multi->num_handler_threads; j++)
+      dbn_spsc_free(&dbn_multi->rings[k][j]);
+    free(dbn_multi->rings[k]);
+  }
 
 
   /*
    * Clean up.
    */
+  for (int i = 0; i < dbn_multi->num_partitions; i++)
+    free(dbn_multi->partitions[i]);
+  if (dbn_multi->partitions) free(dbn_multi->partitions);
   if (dbn_multi->clients) free(dbn_multi->clients);
   if (dbn_multi->threads) free(dbn_multi->threads);
 
@@ -17,6 +17,7 @@
 #include <pthread.h>
 
 #include "dbn.h"
+#include "dbn_spsc.h"
 
 
 /*
@@ -50,18 +51,122 @@ typedef void (*dbn_multi_on_msg_t)(
   dbn_hdr_t *msg);
 
 
+/**
+ * @brief Signature for a Databento message batch handler.
+ *
+ * @param dbn_multi Pointer to client object.
+ * @param batch Pointer to batch. Handler must not free, and must not rely on it or its messages after the handler returns.
+ */
+typedef void (*dbn_multi_on_batch_t)(
+  dbn_multi_t *dbn_multi,
+  dbn_batch_t *batch);
+
+
+/**
+ * @brief Signature for a backpressure handler. See dbn_on_backpressure_t.
+ *
+ * @param dbn_multi Pointer to client object.
+ * @param session Index of the session falling behind, in connection order.
+ * @param backlog Receive backlog of the session, in bytes.
+ * @param lag Lag of the session, in nanoseconds.
+ */
+typedef void (*dbn_multi_on_backpressure_t)(
+  dbn_multi_t *dbn_multi,
+  int session,
+  uint64_t backlog,
+  int64_t lag);
+
+
+/**
+ * @brief Signature for a sequence handler. See dbn_on_sequence_t.
+ *
+ * @param dbn_multi Pointer to client object.
+ * @param session Index of the session that received the message, in connection order.
+ * @param msg Pointer to the out of sequence message.
+ * @param last Previous sequence number received for the instrument by the session.
+ * @param sequence Sequence number of msg.
+ */
+typedef void (*dbn_multi_on_sequence_t)(
+  dbn_multi_t *dbn_multi,
+  int session,
+  dbn_hdr_t *msg,
+  uint32_t last,
+  uint32_t sequence);
+
+
+/**
+ * @brief Maximum number of CPUs in dbn_multi_thread_opts_t.cpus.
+ */
+#define DBN_MULTI_MAX_CPUS 64
+
+
+/**
+ * @brief Session worker thread options. Applied by the thread itself before
+ * it connects, so that its buffers are first touched where it will run.
+ */
+typedef struct
+{
+  int num_cpus;                   ///< @brief Number of CPUs in cpus, or 0 for every CPU of opts.numa_node (if any), else no affinity
+  int cpus[DBN_MULTI_MAX_CPUS];   ///< @brief CPUs the thread may run on
+  char name[16];                  ///< @brief Thread name, or empty for "dbn-<session index>"
+  int sched_priority;             ///< @brief If not 0, run the thread under SCHED_FIFO at this priority (requires CAP_SYS_NICE)
+} dbn_multi_thread_opts_t;
+
+
+/**
+ * @brief Maximum number of sessions with pipeline rings (see
+ * dbn_multi_t.num_handler_threads).
+ */
+#define DBN_MULTI_MAX_SESSIONS 256
+
+
+/**
+ * @brief Pipeline mode routing of messages to handler threads.
+ */
+typedef enum
+{
+  DBN_MULTI_ROUTE_INSTRUMENT = 0, ///< @brief By hash of instrument_id, so that each instrument's messages are handled in order by one thread
+  DBN_MULTI_ROUTE_ROUND_ROBIN     ///< @brief Each message to the next thread in turn, for even load with no ordering guarantee
+} dbn_multi_route_t;
+
+
 /**
  * @brief Multi-threaded, multi-session Databento live data client
  */
 struct dbn_multi
 {
+  dbn_opts_t opts;                  ///< @brief Options applied to each subsequently connected session, see dbn_opts_t
+  dbn_multi_thread_opts_t thread_opts; ///< @brief Worker thread options applied to each subsequently connected session
   int num_sessions;                 ///< @brief Number of parallel clients / threads
   dbn_t **clients;                  ///< @brief Underlying clients, one per session
   pthread_t *threads;               ///< @brief Threads, one per session
-  bool stop;                        ///< @brief Stop flag for threads
+  _Atomic bool stop;                ///< @brief Stop flag for threads
+  bool spin;                        ///< @brief If true, worker threads spin on dbn_poll() instead of blocking in dbn_get()
+  bool async_connect;               ///< @brief If true, each session connects and authenticates on its own worker thread, concurrently with others
+  int num_handler_threads;          ///< @brief If not 0, pipeline mode: sessions copy messages into rings drained by this many handler threads, which call the handlers. Set before the first session
+  dbn_multi_route_t route;          ///< @brief For pipeline mode, how messages are assigned to handler threads
+  bool merge;                       ///< @brief If true, pipeline mode with one handler thread, which merges all sessions into one stream ordered by dbn_ts_recv(). Set before the first session
+  uint64_t merge_window;            ///< @brief For merge mode, reorder window in nanoseconds: a message is held until every session has a message ready, or for at most this long
+  _Atomic uint64_t num_late;        ///< @brief For merge mode, number of messages delivered out of order because they arrived too late for the window
+  uint64_t ring_size;               ///< @brief For pipeline mode, size of each session-to-handler-thread ring, in bytes (power of 2)
+  dbn_spsc_t *rings[DBN_MULTI_MAX_SESSIONS]; ///< @brief For pipeline mode, rings[i][j] carries messages from the i-th session to handler thread j
+  _Atomic int num_rings;            ///< @brief For pipeline mode, number of entries of rings in use
+  _Atomic bool rings_live[DBN_MULTI_MAX_SESSIONS]; ///< @brief For merge mode, if the session feeding rings[i] is subscribed. Merge waits only for these
+  pthread_t *handler_threads;       ///< @brief For pipeline mode, handler threads
+  _Atomic bool stop_handlers;       ///< @brief For pipeline mode, stop flag for handler threads
   _Atomic uint64_t num_subscribed;  ///< @brief Number of sessions subscribed to their symbols
+  _Atomic uint64_t num_failed;      ///< @brief Number of sessions whose worker thread failed to connect or subscribe, see dbn_multi_get_num_failed()
+  int num_partitions;               ///< @brief Number of entries in partitions
+  const char ***partitions;         ///< @brief Symbol arrays allocated by dbn_multi_connect_and_start_balanced(), freed by dbn_multi_close_all()
   dbn_multi_on_error_t on_error;    ///< @brief If not NULL, called on runtime client error
-  dbn_multi_on_msg_t on_msg;        ///< @brief If not NULL, called on receipt of a Databento message
+  dbn_multi_on_msg_t on_msg;        ///< @brief Default message handler, with which every entry of handlers is initialized
+  dbn_multi_on_msg_t handlers[256]; ///< @brief Per-rtype message handlers. If not NULL, called on receipt of a message of that rtype
+  dbn_multi_on_batch_t on_batch;    ///< @brief If not NULL, called once per batch of received messages instead of on_msg
+  dbn_multi_on_backpressure_t on_backpressure; ///< @brief If not NULL, called while a session's receive backlog is at or above opts.backpressure_bytes
+  dbn_multi_on_sequence_t on_sequence; ///< @brief If not NULL, called on receipt by a session of a message out of sequence for its instrument
+  struct dbn_quotes *quotes;        ///< @brief If not NULL, top-of-book store attached to every session, see dbn_set_quotes()
+  struct dbn_export *exporter;      ///< @brief If not NULL, columnar exporter attached to every session, see dbn_set_export()
+  struct dbn_export_producer *spare_producer; ///< @brief If not NULL, exporter producer claimed for a session that was removed before receiving, reused by the next
   void *ctx;                        ///< @brief Optional, arbitrary owner-provided pointer associated with this client
 };
 
@@ -70,6 +175,10 @@ struct dbn_multi
  * @brief Initialize a multi-threaded, mult-session Databento live data
  * client, but don't connect any sessions yet.
  *
+ * Session options (dbn_multi->opts and dbn_multi->thread_opts) are set to
+ * defaults, and may be modified before each call to
+ * dbn_multi_connect_and_start().
+ *
  * @param dbn_multi Pointer to an uninitialized client object.
  * @param on_error Error handler. May be NULL.
  * @param on_msg Message handler. May be NULL.
@@ -82,6 +191,101 @@ extern void dbn_multi_init(
   void *ctx);
 
 
+/**
+ * @brief Set the message handler for a single rtype, on all sessions.
+ *
+ * Every rtype initially dispatches to the on_msg handler given to
+ * dbn_multi_init(). Messages of rtypes without a handler are skipped by the
+ * underlying clients without any call.
+ *
+ * @param dbn_multi Pointer to an initialized client object.
+ * @param rtype Message type.
+ * @param on_msg Pointer to message handler, or NULL to ignore messages of this rtype.
+ *
+ * Should be called before dbn_multi_connect_and_start().
+ */
+extern void dbn_multi_set_msg_handler(
+  dbn_multi_t *dbn_multi,
+  dbn_rtype_t rtype,
+  dbn_multi_on_msg_t on_msg);
+
+
+/**
+ * @brief Set a batch handler, called once for each contiguous run of messages
+ * received by a single read on any session. While set, on_msg is not called.
+ *
+ * @param dbn_multi Pointer to an initialized client object.
+ * @param on_batch Pointer to batch handler, or NULL to revert to on_msg.
+ *
+ * Should be called before dbn_multi_connect_and_start().
+ */
+extern void dbn_multi_set_batch_handler(
+  dbn_multi_t *dbn_multi,
+  dbn_multi_on_batch_t on_batch);
+
+
+/**
+ * @brief Set a backpressure handler, called from a session's worker thread
+ * as described for dbn_set_backpressure_handler(). Takes effect only if
+ * opts.backpressure_bytes is not 0.
+ *
+ * @param dbn_multi Pointer to an initialized client object.
+ * @param on_backpressure Pointer to backpressure handler, or NULL for none.
+ *
+ * Should be called before dbn_multi_connect_and_start().
+ */
+extern void dbn_multi_set_backpressure_handler(
+  dbn_multi_t *dbn_multi,
+  dbn_multi_on_backpressure_t on_backpressure);
+
+
+/**
+ * @brief Set a sequence handler, called from a session's worker thread as
+ * described for dbn_set_sequence_handler(). Takes effect only if
+ * opts.sequence is not DBN_SEQUENCE_NONE. Each session tracks the
+ * instruments it receives independently.
+ *
+ * @param dbn_multi Pointer to an initialized client object.
+ * @param on_sequence Pointer to sequence handler, or NULL for none.
+ *
+ * Should be called before dbn_multi_connect_and_start().
+ */
+extern void dbn_multi_set_sequence_handler(
+  dbn_multi_t *dbn_multi,
+  dbn_multi_on_sequence_t on_sequence);
+
+
+/**
+ * @brief Attach a top-of-book store to every session, see dbn_set_quotes().
+ * Sessions update it from their worker threads, so each instrument must be
+ * subscribed by only one session.
+ *
+ * @param dbn_multi Pointer to an initialized client object.
+ * @param quotes Pointer to initialized store, or NULL for none. Must outlive the client.
+ *
+ * Should be called before dbn_multi_connect_and_start().
+ */
+extern void dbn_multi_set_quotes(
+  dbn_multi_t *dbn_multi,
+  struct dbn_quotes *quotes);
+
+
+/**
+ * @brief Attach a columnar exporter to every session, see dbn_set_export().
+ * Each session claims one of the exporter's producers (kept even if the
+ * session then fails to connect), so it must have at least as many as there
+ * will be sessions.
+ *
+ * @param dbn_multi Pointer to an initialized client object.
+ * @param exporter Pointer to opened exporter, or NULL for none. Must outlive the client.
+ *
+ * Should be called before dbn_multi_connect_and_start().
+ */
+extern void dbn_multi_set_export(
+  dbn_multi_t *dbn_multi,
+  struct dbn_export *exporter);
+
+
 /**
  * @brief Establish a new parallel session / thread with Databento,
  * authenticate, and subscribe to one or more symbols.
@@ -97,6 +301,13 @@ extern void dbn_multi_init(
  * @param suffix Pointer to null-terminated suffix string to be applied to symbols.
  * @param replay If true, client will replay the current day's worth of data instead of subscribing to live data.
  *
+ * If async_connect is set, this returns as soon as the session's worker
+ * thread is created, and connection, authentication and subscription all
+ * happen on that thread, concurrently with other sessions. Failures are then
+ * reported only through the error handler, and api_key and dataset must
+ * remain valid until dbn_multi_is_fully_subscribed() (as symbols must in
+ * any case).
+ *
  * @return 0 on success, or -1 on failure with errno set and error handler
  * invoked (if not NULL).
  */
@@ -113,17 +324,186 @@ extern int dbn_multi_connect_and_start(
   bool replay);
 
 
+/**
+ * @brief Partition symbols across sessions, balancing total weight per
+ * session.
+ *
+ * Symbols are assigned heaviest first, each to the session with the least
+ * weight so far (the longest-processing-time rule, within 4/3 of optimal).
+ *
+ * @param num_symbols Number of symbols.
+ * @param weights Pointer to array of per-symbol weights (ex. message counts from a previous run), or NULL for equal weights.
+ * @param num_sessions Number of sessions.
+ * @param assignment Pointer to array of num_symbols to populate with each symbol's session index.
+ *
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+extern int dbn_multi_partition(
+  int num_symbols,
+  const double *weights,
+  int num_sessions,
+  int *assignment);
+
+
+/**
+ * @brief Load per-symbol weights from a file of tab-separated symbol and
+ * weight lines, as written by dbn_multi_save_weights(). Weights of repeated
+ * symbols are summed.
+ *
+ * @param path Pointer to null-terminated path.
+ * @param num_symbols Number of symbols.
+ * @param symbols Pointer to array of pointers to null-terminated symbols.
+ * @param weights Pointer to array of num_symbols to populate. Symbols absent from the file get the mean weight of those present (or 1, if none are).
+ *
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+extern int dbn_multi_load_weights(
+  const char *path,
+  int num_symbols,
+  const char * const *symbols,
+  double *weights);
+
+
+/**
+ * @brief Save per-symbol weights to a file of tab-separated symbol and weight
+ * lines.
+ *
+ * @param path Pointer to null-terminated path.
+ * @param num_symbols Number of symbols.
+ * @param symbols Pointer to array of pointers to null-terminated symbols.
+ * @param weights Pointer to array of num_symbols weights.
+ *
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+extern int dbn_multi_save_weights(
+  const char *path,
+  int num_symbols,
+  const char * const *symbols,
+  const double *weights);
+
+
+/**
+ * @brief Partition symbols across a number of new sessions with
+ * dbn_multi_partition(), then establish each session with
+ * dbn_multi_connect_and_start().
+ *
+ * @param dbn_multi Pointer to an initialized client object.
+ * @param api_key Pointer to null-terminated Databento API key.
+ * @param dataset Pointer to null-terminated Databento dataset name.
+ * @param ts_out Indicates if Databento should perform ts_out timestamping.
+ * @param schema Pointer to null-terminated schema name.
+ * @param symbology Pointer to null-terminated symbology name.
+ * @param num_symbols Number of symbols in symbols.
+ * @param symbols Pointer to array of pointers to null-terminated symbols.
+ * @param weights Pointer to array of per-symbol weights, or NULL for equal weights.
+ * @param num_sessions Number of sessions. Sessions that would get no symbols are not established.
+ * @param suffix Pointer to null-terminated suffix string to be applied to symbols.
+ * @param replay If true, client will replay the current day's worth of data instead of subscribing to live data.
+ * @param assignment If not NULL, pointer to array of num_symbols to populate with each symbol's session index, ex. to persist the partition.
+ *
+ * @return 0 on success, or -1 on failure with errno set and error handler
+ * invoked (if not NULL).
+ */
+extern int dbn_multi_connect_and_start_balanced(
+  dbn_multi_t *dbn_multi,
+  const char *api_key,
+  const char *dataset,
+  bool ts_out,
+  const char *schema,
+  const char *symbology,
+  int num_symbols,
+  const char * const *symbols,
+  const double *weights,
+  int num_sessions,
+  const char *suffix,
+  bool replay,
+  int *assignment);
+
+
+/**
+ * @brief Subscribe one running session to more symbols, without
+ * reconnecting. See dbn_subscribe().
+ *
+ * @param dbn_multi Pointer to an initialized client object.
+ * @param session Index of a session that has completed its initial subscription.
+ * @param schema Pointer to null-terminated schema name.
+ * @param symbology Pointer to null-terminated symbology name.
+ * @param num_symbols Number of symbols in symbols, or 0 for all symbols.
+ * @param symbols Pointer to array of pointers to null-terminated symbols.
+ * @param suffix Pointer to null-terminated suffix string to be applied to symbols.
+ * @param replay If true, replay the current day's worth of data for these symbols before live data.
+ * @param id Pointer to populate with the request ID, for dbn_multi_is_subscribed().
+ *
+ * @return 0 on success, or -1 on failure with errno set and error handler
+ * invoked (if not NULL).
+ */
+extern int dbn_multi_subscribe(
+  dbn_multi_t *dbn_multi,
+  int session,
+  const char *schema,
+  const char *symbology,
+  int num_symbols,
+  const char * const *symbols,
+  const char *suffix,
+  bool replay,
+  uint64_t *id);
+
+
+/**
+ * @brief Determine if a dbn_multi_subscribe() request is complete. See
+ * dbn_is_subscribed().
+ *
+ * @param dbn_multi Pointer to an initialized client object.
+ * @param session Index of the session the request was made on.
+ * @param id Request ID, from dbn_multi_subscribe().
+ *
+ * @return true if complete, false if still pending or (with errno set to
+ * EINVAL and error handler invoked) there is no such session.
+ */
+extern bool dbn_multi_is_subscribed(
+  dbn_multi_t *dbn_multi,
+  int session,
+  uint64_t id);
+
+
+/**
+ * @brief Take a snapshot of the metrics of all sessions, summed. See
+ * dbn_get_metrics(). Thread-safe, once all sessions are established.
+ *
+ * @param dbn_multi Pointer to an initialized client object.
+ * @param metrics Pointer to populate.
+ */
+extern void dbn_multi_get_metrics(
+  dbn_multi_t *dbn_multi,
+  dbn_metrics_t *metrics);
+
+
 /**
  * @brief Determine if all sessions in a multi-session client are subscribed.
  *
  * @param dbn_multi Pointer to an initialized client object.
  *
- * @return true if all sessions are subscribed, false if some are still subscribing.
+ * @return true if all sessions are subscribed, false if some are still
+ * subscribing or have failed (see dbn_multi_get_num_failed()).
  */
 extern bool dbn_multi_is_fully_subscribed(
   dbn_multi_t *dbn_multi);
 
 
+/**
+ * @brief Get the number of sessions that failed on their worker thread: to
+ * connect, with async_connect set, or to subscribe. Such sessions never
+ * subscribe, so a caller waiting for dbn_multi_is_fully_subscribed() should
+ * also stop waiting once this is not 0.
+ *
+ * @param dbn_multi Pointer to an initialized client object.
+ *
+ * @return Number of failed sessions.
+ */
+extern uint64_t dbn_multi_get_num_failed(
+  dbn_multi_t *dbn_multi);
+
+
 /**
  * @brief Disconnect all sessions from Databento and free any allocated memory.
  *
@@ -0,0 +1,294 @@
+/**
+ * @file dbn_quotes.h
+ * @brief Lock-free per-instrument top-of-book store
+ * @author Nathan Blythe
+ * @copyright Copyright 2025 Nathan Blythe
+ * @copyright Released under the Apache-2.0 license, see LICENSE
+ *
+ * A dense table of the latest bid and ask of a fixed set of instruments, one
+ * cache line per instrument. Once attached to a client with dbn_set_quotes()
+ * (or dbn_multi_set_quotes()), it is updated from CMBP-1 and BBO messages
+ * (including TCBBO and CBBO) in the decode path, before they are dispatched,
+ * and can be read from any thread without blocking the feed.
+ *
+ * Each slot is protected by a sequence lock: the writer makes the sequence
+ * odd, writes, and makes it even again, and a reader retries its copy if the
+ * sequence was odd or changed meanwhile. Each instrument must therefore be
+ * received by only one client at a time.
+ *
+ * Slots are numbered in the order instruments are given to dbn_quotes_init().
+ * For OPRA, passing the instrument_id column of a dbn_opra_chain_t makes each
+ * slot the position of its contract in the chain.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "dbn.h"
+
+
+/**
+ * @brief Assumed cache line size, in bytes.
+ */
+#define DBN_QUOTES_CACHE_LINE 64
+
+
+/**
+ * @brief Slot position meaning none.
+ */
+#define DBN_QUOTES_NONE ((size_t)-1)
+
+
+/**
+ * @brief dbn_quotes_entry_t.instrument_id of an unused entry.
+ */
+#define DBN_QUOTES_EMPTY 0xFFFFFFFF
+
+
+/**
+ * @brief Top of book of an instrument, as copied out by dbn_quotes_read().
+ */
+typedef struct
+{
+  uint32_t instrument_id;     ///< @brief Instrument ID
+  uint32_t num_updates;       ///< @brief Number of updates received, wrapping
+  uint64_t ts_event;          ///< @brief ts_event of the last update, in Unix nanoseconds
+  uint64_t ts_recv;           ///< @brief ts_recv of the last update, in Unix nanoseconds
+  uint64_t bid_px;            ///< @brief Best bid price, in nanodollars
+  uint64_t ask_px;            ///< @brief Best ask price, in nanodollars
+  uint32_t bid_sz;            ///< @brief Best bid size
+  uint32_t ask_sz;            ///< @brief Best ask size
+} dbn_quote_t;
+
+
+/**
+ * @brief Slot of the store: a quote and its sequence lock, alone on a cache
+ * line.
+ */
+typedef struct
+{
+  _Alignas(DBN_QUOTES_CACHE_LINE) uint32_t sequence; ///< @brief Sequence lock, odd while being written
+  dbn_quote_t quote;                                 ///< @brief Quote
+} dbn_quotes_slot_t;
+
+
+/**
+ * @brief Entry of the open-addressed index of slots by instrument ID.
+ */
+typedef struct
+{
+  uint32_t instrument_id;     ///< @brief Instrument ID, or DBN_QUOTES_EMPTY if unused
+  uint32_t slot;              ///< @brief Position of the instrument's slot
+} dbn_quotes_entry_t;
+
+
+/**
+ * @brief Top-of-book store.
+ */
+typedef struct dbn_quotes
+{
+  size_t num_slots;           ///< @brief Number of slots
+  dbn_quotes_slot_t *slots;   ///< @brief Slots
+  dbn_quotes_entry_t *index;  ///< @brief Index of slots by instrument ID, fixed after dbn_quotes_init()
+  size_t index_mask;          ///< @brief Number of entries in index minus 1
+} dbn_quotes_t;
+
+
+/**
+ * @brief Find the slot of an instrument.
+ *
+ * @param quotes Pointer to initialized store.
+ * @param instrument_id Instrument ID.
+ *
+ * @return Position of the slot, or DBN_QUOTES_NONE if the instrument isn't in the store.
+ */
+static inline size_t dbn_quotes_find(
+  const dbn_quotes_t *quotes,
+  uint32_t instrument_id)
+{
+  size_t i = (instrument_id * 0x9E3779B1u) & quotes->index_mask;
+  while (quotes->index[i].instrument_id != DBN_QUOTES_EMPTY)
+  {
+    if (quotes->index[i].instrument_id == instrument_id) return quotes->index[i].slot;
+    i = (i + 1) & quotes->index_mask;
+  }
+  return DBN_QUOTES_NONE;
+}
+
+
+/**
+ * @brief Initialize a store.
+ *
+ * @param quotes Pointer to an uninitialized store.
+ * @param num_instruments Number of instruments.
+ * @param instrument_ids Pointer to array of instrument IDs, one per slot. Duplicates share the first's slot.
+ *
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+static inline int dbn_quotes_init(
+  dbn_quotes_t *quotes,
+  size_t num_instruments,
+  const uint32_t *instrument_ids)
+{
+  memset(quotes, 0, sizeof(dbn_quotes_t));
+  if (num_instruments >= DBN_QUOTES_EMPTY)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+
+  /*
+   * Keep the index at most half full.
+   */
+  size_t n = 16;
+  while (n < 2 * num_instruments)
+    n *= 2;
+
+  quotes->slots = aligned_alloc(DBN_QUOTES_CACHE_LINE, (num_instruments + 1) * sizeof(dbn_quotes_slot_t));
+  quotes->index = malloc(n * sizeof(dbn_quotes_entry_t));
+  if (!quotes->slots || !quotes->index)
+  {
+    free(quotes->slots);
+    free(quotes->index);
+    memset(quotes, 0, sizeof(dbn_quotes_t));
+    errno = ENOMEM;
+    return -1;
+  }
+
+  memset(quotes->slots, 0, (num_instruments + 1) * sizeof(dbn_quotes_slot_t));
+  quotes->num_slots = num_instruments;
+  quotes->index_mask = n - 1;
+  for (size_t i = 0; i < n; i++)
+    quotes->index[i].instrument_id = DBN_QUOTES_EMPTY;
+
+  for (size_t i = 0; i < num_instruments; i++)
+  {
+    uint32_t id = instrument_ids[i];
+    quotes->slots[i].quote.instrument_id = id;
+    if (id == DBN_QUOTES_EMPTY) continue;
+
+    size_t k = (id * 0x9E3779B1u) & quotes->index_mask;
+    while (quotes->index[k].instrument_id != DBN_QUOTES_EMPTY && quotes->index[k].instrument_id != id)
+      k = (k + 1) & quotes->index_mask;
+    if (quotes->index[k].instrument_id == id) continue;
+
+    quotes->index[k].instrument_id = id;
+    quotes->index[k].slot = i;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief Free a store's storage. It must not be attached to any client.
+ *
+ * @param quotes Pointer to initialized store.
+ */
+static inline void dbn_quotes_free(dbn_quotes_t *quotes)
+{
+  free(quotes->slots);
+  free(quotes->index);
+  memset(quotes, 0, sizeof(dbn_quotes_t));
+}
+
+
+/**
+ * @brief Update the store from a message, if it is a CMBP-1, TCBBO, CBBO or
+ * BBO message for an instrument in the store. Only one thread may update a given instrument.
+ *
+ * @param quotes Pointer to initialized store.
+ * @param msg Pointer to message.
+ */
+static inline void dbn_quotes_update(
+  dbn_quotes_t *quotes,
+  const dbn_hdr_t *msg)
+{
+  uint64_t ts_recv, bid_px, ask_px;
+  uint32_t bid_sz, ask_sz;
+  if (dbn_is_cmbp1(msg))
+  {
+    const dbn_cmbp1_t *m = (const void *)msg;
+    ts_recv = m->ts_recv;
+    bid_px = m->bid_px;
+    ask_px = m->ask_px;
+    bid_sz = m->bid_sz;
+    ask_sz = m->ask_sz;
+  }
+  else if (dbn_is_bbo(msg))
+  {
+    const dbn_bbo_t *m = (const void *)msg;
+    ts_recv = m->ts_recv;
+    bid_px = m->bid_px;
+    ask_px = m->ask_px;
+    bid_sz = m->bid_sz;
+    ask_sz = m->ask_sz;
+  }
+  else return;
+
+  size_t i = dbn_quotes_find(quotes, msg->instrument_id);
+  if (i == DBN_QUOTES_NONE) return;
+
+  dbn_quotes_slot_t *slot = &quotes->slots[i];
+  uint32_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->sequence, sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  __atomic_store_n(&slot->quote.num_updates, slot->quote.num_updates + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->quote.ts_event, msg->ts_event, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->quote.ts_recv, ts_recv, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->quote.bid_px, bid_px, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->quote.ask_px, ask_px, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->quote.bid_sz, bid_sz, __ATOMIC_RELAXED);
+  __atomic_store_n(&slot->quote.ask_sz, ask_sz, __ATOMIC_RELAXED);
+
+  __atomic_store_n(&slot->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * @brief Copy the quote of a slot, from any thread, without blocking the
+ * writer.
+ *
+ * @param quotes Pointer to initialized store.
+ * @param slot Position of the slot, see dbn_quotes_find().
+ * @param quote Pointer where the quote will be stored.
+ *
+ * @return true on success, or false if the slot has never been updated.
+ */
+static inline bool dbn_quotes_read(
+  const dbn_quotes_t *quotes,
+  size_t slot,
+  dbn_quote_t *quote)
+{
+  const dbn_quotes_slot_t *s = &quotes->slots[slot];
+  uint32_t before, after;
+  do
+  {
+    do
+    {
+      before = __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE);
+    } while (before & 1);
+
+    quote->instrument_id = s->quote.instrument_id;
+    quote->num_updates = __atomic_load_n(&s->quote.num_updates, __ATOMIC_RELAXED);
+    quote->ts_event = __atomic_load_n(&s->quote.ts_event, __ATOMIC_RELAXED);
+    quote->ts_recv = __atomic_load_n(&s->quote.ts_recv, __ATOMIC_RELAXED);
+    quote->bid_px = __atomic_load_n(&s->quote.bid_px, __ATOMIC_RELAXED);
+    quote->ask_px = __atomic_load_n(&s->quote.ask_px, __ATOMIC_RELAXED);
+    quote->bid_sz = __atomic_load_n(&s->quote.bid_sz, __ATOMIC_RELAXED);
+    quote->ask_sz = __atomic_load_n(&s->quote.ask_sz, __ATOMIC_RELAXED);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&s->sequence, __ATOMIC_RELAXED);
+  } while (before != after);
+
+  return before != 0;
+}
@@ -0,0 +1,200 @@
+/**
+ * @file dbn_spsc.h
+ * @brief Lock-free single-producer, single-consumer ring of DBN messages
+ * @author Nathan Blythe
+ * @copyright Copyright 2025 Nathan Blythe
+ * @copyright Released under the Apache-2.0 license, see LICENSE
+ *
+ * Messages are copied into the ring whole and contiguous, so the consumer
+ * can dispatch them in place. The producer writes any number of messages and
+ * then publishes them with a single store, and the consumer likewise
+ * releases space in bulk, so the cache lines shared between the two threads
+ * change hands once per batch rather than once per message.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+
+#include "dbn.h"
+
+
+/**
+ * @brief Assumed cache line size, in bytes.
+ */
+#define DBN_SPSC_CACHE_LINE 64
+
+
+/**
+ * @brief Single-producer, single-consumer ring of DBN messages.
+ *
+ * Positions are free-running byte offsets. A message never wraps around the
+ * end of the ring: if it doesn't fit before the end, the producer writes a
+ * zero rlength marker (never a valid message) and starts again at offset 0.
+ */
+typedef struct
+{
+  _Alignas(DBN_SPSC_CACHE_LINE) _Atomic uint64_t head; ///< @brief Consumer position, published by the consumer
+  uint64_t read;                                       ///< @brief Consumer-private position of the next message to read
+  uint64_t tail_cache;                                 ///< @brief Consumer-private copy of tail
+
+  _Alignas(DBN_SPSC_CACHE_LINE) _Atomic uint64_t tail; ///< @brief Producer position, published by the producer
+  uint64_t write;                                      ///< @brief Producer-private position at which the next message is written
+  uint64_t head_cache;                                 ///< @brief Producer-private copy of head
+
+  _Alignas(DBN_SPSC_CACHE_LINE) uint8_t *data;         ///< @brief Storage
+  uint64_t capacity;                                   ///< @brief Size of storage, in bytes (power of 2)
+} dbn_spsc_t;
+
+
+/**
+ * @brief Initialize a ring.
+ *
+ * @param ring Pointer to an uninitialized ring.
+ * @param capacity Size of the ring, in bytes. Must be a power of 2 and at least 2 * DBN_MAX_RECORD_SIZE.
+ *
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+static inline int dbn_spsc_init(
+  dbn_spsc_t *ring,
+  uint64_t capacity)
+{
+  memset(ring, 0, sizeof(dbn_spsc_t));
+
+  if (capacity < 2 * DBN_MAX_RECORD_SIZE || (capacity & (capacity - 1)))
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  ring->data = aligned_alloc(DBN_SPSC_CACHE_LINE, capacity);
+  if (!ring->data) return -1;
+
+  ring->capacity = capacity;
+  return 0;
+}
+
+
+/**
+ * @brief Free a ring's storage. Neither thread may use it afterwards.
+ *
+ * @param ring Pointer to an initialized ring.
+ */
+static inline void dbn_spsc_free(dbn_spsc_t *ring)
+{
+  free(ring->data);
+  memset(ring, 0, sizeof(dbn_spsc_t));
+}
+
+
+/**
+ * @brief Copy a message into the ring, without publishing it. Producer only.
+ *
+ * @param ring Pointer to ring.
+ * @param msg Pointer to message.
+ *
+ * @return true on success, false if the ring is full (after publishing what
+ * has been written, so the consumer can make room).
+ */
+static inline bool dbn_spsc_write(
+  dbn_spsc_t *ring,
+  const dbn_hdr_t *msg)
+{
+  uint64_t n = 4 * (uint64_t)msg->rlength;
+  uint64_t offset = ring->write & (ring->capacity - 1);
+  uint64_t pad = ring->capacity - offset < n ? ring->capacity - offset : 0;
+
+  if (ring->write + pad + n - ring->head_cache > ring->capacity)
+  {
+    ring->head_cache = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (ring->write + pad + n - ring->head_cache > ring->capacity)
+    {
+      atomic_store_explicit(&ring->tail, ring->write, memory_order_release);
+      return false;
+    }
+  }
+
+  if (pad)
+  {
+    ring->data[offset] = 0;
+    ring->write += pad;
+    offset = 0;
+  }
+
+  memcpy(ring->data + offset, msg, n);
+  ring->write += n;
+  return true;
+}
+
+
+/**
+ * @brief Publish everything written so far to the consumer. Producer only.
+ *
+ * @param ring Pointer to ring.
+ */
+static inline void dbn_spsc_commit(dbn_spsc_t *ring)
+{
+  atomic_store_explicit(&ring->tail, ring->write, memory_order_release);
+}
+
+
+/**
+ * @brief Get the next contiguous run of published messages. Consumer only.
+ *
+ * The messages remain valid until dbn_spsc_release().
+ *
+ * @param ring Pointer to ring.
+ * @param length Pointer to populate with the length of the run, in bytes.
+ *
+ * @return Pointer to the first message of the run, or NULL if the ring is empty.
+ */
+static inline uint8_t *dbn_spsc_read(
+  dbn_spsc_t *ring,
+  uint64_t *length)
+{
+  if (ring->read == ring->tail_cache)
+  {
+    ring->tail_cache = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (ring->read == ring->tail_cache) return NULL;
+  }
+
+  uint64_t offset = ring->read & (ring->capacity - 1);
+  if (ring->data[offset] == 0) // Wrap marker
+  {
+    ring->read += ring->capacity - offset;
+    offset = 0;
+    if (ring->read == ring->tail_cache) return NULL;
+  }
+
+  uint64_t n = ring->tail_cache - ring->read;
+  if (n > ring->capacity - offset) n = ring->capacity - offset;
+
+
+  /*
+   * Stop short of a wrap marker within the run.
+   */
+  uint64_t m = 0;
+  while (m < n && ring->data[offset + m])
+    m += 4 * (uint64_t)ring->data[offset + m];
+
+  ring->read += m;
+  *length = m;
+  return ring->data + offset;
+}
+
+
+/**
+ * @brief Release everything read so far back to the producer. Consumer only.
+ *
+ * @param ring Pointer to ring.
+ */
+static inline void dbn_spsc_release(dbn_spsc_t *ring)
+{
+  atomic_store_explicit(&ring->head, ring->read, memory_order_release);
+}
@@ -0,0 +1,378 @@
+/**
+ * @file test_dbn.c
+ * @brief Tests for the Databento live data client
+ * @author Nathan Blythe
+ * @copyright Copyright 2025 Nathan Blythe
+ * @copyright Released under the Apache-2.0 license, see LICENSE
+ *
+ * Run with ctest. No connection to Databento is made: messages are written
+ * to a capture file and replayed with dbn_open_file(), or fed through a
+ * socketpair to a client attached with dbn_attach().
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "dbn.h"
+
+
+/**
+ * @brief Number of failed checks.
+ */
+static int num_failed = 0;
+
+
+/**
+ * @brief Check a condition, and print it with its location if it fails.
+ */
+#define CHECK(cond) \
+  do \
+  { \
+    if (!(cond)) \
+    { \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      num_failed++; \
+    } \
+  } while (0)
+
+
+/**
+ * @brief Message of a synthetic stream.
+ */
+typedef struct
+{
+  uint32_t instrument_id;
+  uint32_t sequence;
+} message_t;
+
+
+/**
+ * @brief Arguments of each call to the sequence handler.
+ */
+static struct
+{
+  uint32_t instrument_id;
+  uint32_t last;
+  uint32_t sequence;
+} calls[16];
+
+static int num_calls = 0;
+
+
+/**
+ * @brief Number of warnings reported to the error handler, and the last.
+ */
+static int num_warnings = 0;
+static char last_warning[256];
+
+
+static void on_error(dbn_t *dbn, bool fatal, char *msg)
+{
+  if (fatal) fprintf(stderr, "Client error: %s\n", msg);
+  else
+  {
+    num_warnings++;
+    snprintf(last_warning, sizeof(last_warning), "%s", msg);
+  }
+}
+
+
+static void on_sequence(dbn_t *dbn, dbn_hdr_t *msg, uint32_t last, uint32_t sequence)
+{
+  if (num_calls < (int)(sizeof(calls) / sizeof(calls[0])))
+  {
+    calls[num_calls].instrument_id = msg->instrument_id;
+    calls[num_calls].last = last;
+    calls[num_calls].sequence = sequence;
+  }
+  num_calls++;
+}
+
+
+/**
+ * @brief Write a capture file of BBO-1S messages, and replay all of it with
+ * sequence checking.
+ *
+ * @param path Pointer to null-terminated path of capture file.
+ * @param sequence Sequence checking mode.
+ * @param messages Pointer to messages.
+ * @param n Number of messages.
+ * @param metrics Pointer where metrics will be stored once replayed.
+ */
+static void replay(
+  const char *path,
+  dbn_sequence_t sequence,
+  const message_t *messages,
+  int n,
+  dbn_metrics_t *metrics)
+{
+  FILE *f = fopen(path, "wb");
+  CHECK(f);
+  if (!f) return;
+
+  uint8_t preheader[8] = { 'D', 'B', 'N', 1 };
+  uint32_t header_length = 8;
+  memcpy(preheader + 4, &header_length, sizeof(header_length));
+  uint8_t header[8] = { 0 };
+  fwrite(preheader, 1, sizeof(preheader), f);
+  fwrite(header, 1, sizeof(header), f);
+
+  for (int i = 0; i < n; i++)
+  {
+    dbn_bbo_t bbo;
+    memset(&bbo, 0, sizeof(bbo));
+    bbo.hdr.rlength = sizeof(bbo) / 4;
+    bbo.hdr.rtype = DBN_RTYPE_BBO1S;
+    bbo.hdr.instrument_id = messages[i].instrument_id;
+    bbo.hdr.ts_event = 1748869200000000000ull + i;
+    bbo.sequence = messages[i].sequence;
+    fwrite(&bbo, 1, sizeof(bbo), f);
+  }
+  CHECK(!fclose(f));
+
+  num_calls = 0;
+
+  dbn_t dbn;
+  dbn_init(&dbn, on_error, NULL, NULL);
+  dbn.opts.sequence = sequence;
+  dbn_set_sequence_handler(&dbn, on_sequence);
+  CHECK(!dbn_open_file(&dbn, path));
+
+  int r;
+  while ((r = dbn_get(&dbn)) > 0);
+  CHECK(r == -1 && errno == ENODATA);
+
+  dbn_get_metrics(&dbn, metrics);
+  CHECK(metrics->num_messages == (uint64_t)n);
+  dbn_close(&dbn);
+  unlink(path);
+}
+
+
+static void test_sequence(const char *path)
+{
+  dbn_metrics_t metrics;
+
+
+  /*
+   * A repeat and a stale message are both duplicates, and neither moves the
+   * tracker backwards, so the next message in order is not a gap.
+   */
+  const message_t stale[] = { { 1, 5 }, { 1, 6 }, { 1, 6 }, { 1, 3 }, { 1, 7 } };
+  replay(path, DBN_SEQUENCE_CONTIGUOUS, stale, 5, &metrics);
+  CHECK(metrics.num_sequence_duplicates == 2);
+  CHECK(metrics.num_sequence_gaps == 0);
+  CHECK(num_calls == 2);
+  CHECK(calls[0].instrument_id == 1 && calls[0].last == 6 && calls[0].sequence == 6);
+  CHECK(calls[1].instrument_id == 1 && calls[1].last == 6 && calls[1].sequence == 3);
+
+
+  /*
+   * A real gap, on one instrument of two.
+   */
+  const message_t gap[] = { { 1, 5 }, { 2, 100 }, { 1, 6 }, { 2, 101 }, { 1, 9 }, { 2, 102 }, { 1, 10 } };
+  replay(path, DBN_SEQUENCE_CONTIGUOUS, gap, 7, &metrics);
+  CHECK(metrics.num_sequence_duplicates == 0);
+  CHECK(metrics.num_sequence_gaps == 1);
+  CHECK(num_calls == 1);
+  CHECK(calls[0].instrument_id == 1 && calls[0].last == 6 && calls[0].sequence == 9);
+
+
+  /*
+   * Monotonic checking ignores gaps, but still reports every message behind
+   * the highest received, not just the first.
+   */
+  const message_t monotonic[] = { { 1, 5 }, { 1, 6 }, { 1, 3 }, { 1, 4 }, { 1, 20 } };
+  replay(path, DBN_SEQUENCE_MONOTONIC, monotonic, 5, &metrics);
+  CHECK(metrics.num_sequence_duplicates == 2);
+  CHECK(metrics.num_sequence_gaps == 0);
+  CHECK(num_calls == 2);
+  CHECK(calls[0].last == 6 && calls[0].sequence == 3);
+  CHECK(calls[1].last == 6 && calls[1].sequence == 4);
+
+
+  /*
+   * Sequence numbers wrap.
+   */
+  const message_t wrap[] = { { 1, 0xFFFFFFFE }, { 1, 0xFFFFFFFF }, { 1, 0 }, { 1, 0xFFFFFFFF } };
+  replay(path, DBN_SEQUENCE_CONTIGUOUS, wrap, 4, &metrics);
+  CHECK(metrics.num_sequence_duplicates == 1);
+  CHECK(metrics.num_sequence_gaps == 0);
+  CHECK(num_calls == 1);
+  CHECK(calls[0].last == 0 && calls[0].sequence == 0xFFFFFFFF);
+
+
+  /*
+   * Nothing is checked unless requested.
+   */
+  replay(path, DBN_SEQUENCE_NONE, stale, 5, &metrics);
+  CHECK(metrics.num_sequence_duplicates == 0);
+  CHECK(num_calls == 0);
+}
+
+
+/**
+ * @brief Send one message to an attached client, and wait for it to be
+ * dispatched.
+ *
+ * @param dbn Pointer to attached client object.
+ * @param fd Other end of the client's socketpair.
+ * @param msg Pointer to message.
+ */
+static void feed(
+  dbn_t *dbn,
+  int fd,
+  const void *msg)
+{
+  dbn_metrics_t metrics;
+  dbn_get_metrics(dbn, &metrics);
+  uint64_t target = metrics.num_messages + 1;
+
+  size_t n = 4 * ((const uint8_t *)msg)[0];
+  CHECK(write(fd, msg, n) == (ssize_t)n);
+
+  while (metrics.num_messages < target)
+  {
+    if (dbn_get(dbn) < 0) break;
+    dbn_get_metrics(dbn, &metrics);
+  }
+  CHECK(metrics.num_messages == target);
+}
+
+
+/**
+ * @brief Send an SMAP for a symbol.
+ */
+static void feed_smap(dbn_t *dbn, int fd, const char *symbol)
+{
+  dbn_smap_t smap;
+  memset(&smap, 0, sizeof(smap));
+  smap.hdr.rlength = sizeof(smap) / 4;
+  smap.hdr.rtype = DBN_RTYPE_SMAP;
+  snprintf(smap.stype_in_symbol, sizeof(smap.stype_in_symbol), "%s", symbol);
+  feed(dbn, fd, &smap);
+}
+
+
+/**
+ * @brief Send a system or error message.
+ */
+static void feed_text(dbn_t *dbn, int fd, dbn_rtype_t rtype, const char *text)
+{
+  dbn_smsg_t smsg;
+  memset(&smsg, 0, sizeof(smsg));
+  smsg.hdr.rlength = sizeof(smsg) / 4;
+  smsg.hdr.rtype = rtype;
+  snprintf(smsg.msg, sizeof(smsg.msg), "%s", text);
+  feed(dbn, fd, &smsg);
+}
+
+
+static void test_subscribe(void)
+{
+  int fds[2];
+  CHECK(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+  uint8_t preheader[8] = { 'D', 'B', 'N', 1 };
+  uint32_t header_length = 8;
+  memcpy(preheader + 4, &header_length, sizeof(header_length));
+  uint8_t header[8] = { 0 };
+  CHECK(write(fds[1], preheader, sizeof(preheader)) == sizeof(preheader));
+  CHECK(write(fds[1], header, sizeof(header)) == sizeof(header));
+
+  dbn_t dbn;
+  dbn_init(&dbn, on_error, NULL, NULL);
+  dbn.opts.rcvbuf = 65536;
+  CHECK(!dbn_attach(&dbn, fds[0]));
+  num_warnings = 0;
+
+
+  /*
+   * Named symbols complete on their SMAPs, or on a message naming them as a
+   * whole word.
+   */
+  const char *symbols[] = { "AAA", "BBB", "CCC" };
+  uint64_t id;
+  CHECK(!dbn_subscribe(&dbn, "cmbp-1", "parent", 3, symbols, ".OPT", false, &id));
+  CHECK(!dbn_is_subscribed(&dbn, id));
+
+  feed_smap(&dbn, fds[1], "AAA.OPT");
+  feed_text(&dbn, fds[1], DBN_RTYPE_SMSG, "Heartbeat");
+  feed_text(&dbn, fds[1], DBN_RTYPE_EMSG, "Symbol BBB.OPTX not found");
+  feed_text(&dbn, fds[1], DBN_RTYPE_EMSG, "Symbol XBBB.OPT not found");
+  CHECK(!dbn_is_subscribed(&dbn, id));
+  CHECK(num_warnings == 0);
+
+  feed_text(&dbn, fds[1], DBN_RTYPE_EMSG, "Symbol BBB.OPT not found");
+  CHECK(!dbn_is_subscribed(&dbn, id));
+  CHECK(num_warnings == 1);
+  CHECK(strstr(last_warning, "1 pending symbol") && strstr(last_warning, "BBB.OPT not found"));
+
+  feed_smap(&dbn, fds[1], "CCC.OPT");
+  CHECK(dbn_is_subscribed(&dbn, id));
+
+
+  /*
+   * All symbols complete on an SMAP after the request is sent, but not on a
+   * system message.
+   */
+  CHECK(!dbn_subscribe(&dbn, "cmbp-1", "parent", 0, NULL, "", false, &id));
+  CHECK(!dbn_is_subscribed(&dbn, id));
+  feed_text(&dbn, fds[1], DBN_RTYPE_SMSG, "Heartbeat");
+  CHECK(!dbn_is_subscribed(&dbn, id));
+  feed_smap(&dbn, fds[1], "ZZZ.OPT");
+  CHECK(dbn_is_subscribed(&dbn, id));
+
+
+  /*
+   * An error message fails an all-symbols request.
+   */
+  num_warnings = 0;
+  CHECK(!dbn_subscribe(&dbn, "cmbp-1", "parent", 0, NULL, "", false, &id));
+  feed_text(&dbn, fds[1], DBN_RTYPE_EMSG, "Schema not supported");
+  CHECK(dbn_is_subscribed(&dbn, id));
+  CHECK(num_warnings == 1);
+
+  CHECK(dbn_is_subscribed(&dbn, id + 1000));
+
+  dbn_metrics_t metrics;
+  dbn_get_metrics(&dbn, &metrics);
+  CHECK(metrics.num_messages == 9);
+
+  dbn_close(&dbn);
+  close(fds[1]);
+}
+
+
+int main(int argc, char **argv)
+{
+  char dir[] = "/tmp/test_dbn.XXXXXX";
+  if (!mkdtemp(dir))
+  {
+    perror("mkdtemp");
+    return EXIT_FAILURE;
+  }
+
+  char path[sizeof(dir) + 16];
+  snprintf(path, sizeof(path), "%s/capture.dbn", dir);
+
+  test_sequence(path);
+  test_subscribe();
+
+  rmdir(dir);
+
+  if (num_failed)
+  {
+    fprintf(stderr, "%d check%s failed\n", num_failed, num_failed == 1 ? "" : "s");
+    return EXIT_FAILURE;
+  }
+
+  printf("All checks passed\n");
+  return EXIT_SUCCESS;
+}
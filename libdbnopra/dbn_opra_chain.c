@@ -0,0 +1,328 @@
+/**
+ * @file dbn_opra_chain.c
+ * @brief Columnar option chain index
+ * @author Nathan Blythe
+ * @copyright Copyright 2025 Nathan Blythe
+ * @copyright Released under the Apache-2.0 license, see LICENSE
+ *
+ * See dbn_opra_chain.h for details.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+#include "osi.h"
+#include "dbn_opra_discover.h"
+#include "dbn_opra_snapshot.h"
+#include "dbn_opra_chain.h"
+
+
+/**
+ * @brief Contract being sorted.
+ */
+typedef struct
+{
+  uint64_t key;
+  uint32_t instrument_id;
+} contract_t;
+
+
+/**
+ * @brief Compare two contracts by key, for qsort().
+ */
+static int compare_contracts(const void *a, const void *b)
+{
+  uint64_t x = ((const contract_t *)a)->key;
+  uint64_t y = ((const contract_t *)b)->key;
+  return (x > y) - (x < y);
+}
+
+
+/**
+ * @brief Allocate an index of the given size, with roots and columns
+ * uninitialized.
+ *
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+static int allocate(
+  dbn_opra_chain_t *chain,
+  size_t num_roots,
+  size_t num_contracts)
+{
+  memset(chain, 0, sizeof(dbn_opra_chain_t));
+  if (num_roots > OSI_KEY_MAX_ROOT_ID + 1 || num_contracts > UINT32_MAX)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  chain->num_roots = num_roots;
+  chain->num_contracts = num_contracts;
+  chain->roots = calloc(num_roots + 1, sizeof(dbn_opra_chain_root_t));
+  chain->expiries = malloc((num_contracts + 1) * sizeof(dbn_opra_chain_expiry_t));
+  chain->key = malloc((num_contracts + 1) * sizeof(uint64_t));
+  chain->expiry = malloc((num_contracts + 1) * sizeof(uint16_t));
+  chain->strike = malloc((num_contracts + 1) * sizeof(uint64_t));
+  chain->is_call = malloc((num_contracts + 1) * sizeof(bool));
+  chain->instrument_id = malloc((num_contracts + 1) * sizeof(uint32_t));
+  if (!chain->roots || !chain->expiries || !chain->key || !chain->expiry || !chain->strike || !chain->is_call || !chain->instrument_id)
+  {
+    dbn_opra_chain_destroy(chain);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/**
+ * @brief Sort contracts and fill in the columns, and the contract and
+ * expiration runs of each root.
+ */
+static void fill(
+  dbn_opra_chain_t *chain,
+  contract_t *contracts)
+{
+  qsort(contracts, chain->num_contracts, sizeof(contract_t), compare_contracts);
+
+  for (size_t i = 0; i < chain->num_contracts; i++)
+  {
+    uint64_t key = contracts[i].key;
+    osi_t osi;
+    osi_key_unpack(key, &osi);
+
+    chain->key[i] = key;
+    chain->expiry[i] = dbn_opra_chain_expiry(osi.exp_year, osi.exp_month, osi.exp_day);
+    chain->strike[i] = osi.strike;
+    chain->is_call[i] = osi.is_call;
+    chain->instrument_id[i] = contracts[i].instrument_id;
+
+
+    /*
+     * Start a new root and/or expiration run where either changes.
+     */
+    dbn_opra_chain_root_t *root = &chain->roots[osi_key_root_id(key)];
+    if (!root->num)
+    {
+      root->first = i;
+      root->first_expiry = chain->num_expiries;
+    }
+    root->num++;
+
+    if (!root->num_expiries || chain->expiries[chain->num_expiries - 1].expiry != chain->expiry[i])
+    {
+      dbn_opra_chain_expiry_t *expiry = &chain->expiries[chain->num_expiries++];
+      expiry->expiry = chain->expiry[i];
+      expiry->first = i;
+      expiry->num = 0;
+      root->num_expiries++;
+    }
+    chain->expiries[chain->num_expiries - 1].num++;
+  }
+}
+
+
+int dbn_opra_chain_build(
+  dbn_opra_chain_t *chain,
+  const dbn_opra_discover_t *discover)
+{
+  if (discover->state != DBN_OPRA_DISCOVER_STATE_DONE)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (allocate(chain, discover->num_roots, discover->num_options)) return -1;
+
+  contract_t *contracts = malloc((chain->num_contracts + 1) * sizeof(contract_t));
+  if (!contracts)
+  {
+    dbn_opra_chain_destroy(chain);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  size_t n = 0;
+  for (size_t i = 0; i < discover->num_roots; i++)
+  {
+    strncpy(chain->roots[i].root, discover->roots[i].root, sizeof(chain->roots[i].root) - 1);
+    for (size_t j = 0; j < discover->roots[i].num_options; j++)
+    {
+      const dbn_opra_discover_option_t *option = &discover->roots[i].options[j];
+      contracts[n].key = osi_key(&option->symbol, i);
+      contracts[n].instrument_id = option->instrument_id;
+      n++;
+    }
+  }
+
+  fill(chain, contracts);
+  free(contracts);
+  return 0;
+}
+
+
+int dbn_opra_chain_build_snapshot(
+  dbn_opra_chain_t *chain,
+  const dbn_opra_snapshot_t *snapshot)
+{
+  if (allocate(chain, snapshot->header->num_roots, snapshot->header->num_options)) return -1;
+
+  contract_t *contracts = malloc((chain->num_contracts + 1) * sizeof(contract_t));
+  if (!contracts)
+  {
+    dbn_opra_chain_destroy(chain);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  for (size_t i = 0; i < chain->num_roots; i++)
+    memcpy(chain->roots[i].root, snapshot->roots[i].root, sizeof(chain->roots[i].root) - 1);
+
+  for (size_t i = 0; i < chain->num_contracts; i++)
+  {
+    const dbn_opra_snapshot_option_t *option = &snapshot->options[i];
+    if (option->root >= chain->num_roots)
+    {
+      free(contracts);
+      dbn_opra_chain_destroy(chain);
+      errno = EINVAL;
+      return -1;
+    }
+
+    contracts[i].key = osi_key(&option->symbol, option->root);
+    contracts[i].instrument_id = option->instrument_id;
+  }
+
+  fill(chain, contracts);
+  free(contracts);
+  return 0;
+}
+
+
+void dbn_opra_chain_destroy(dbn_opra_chain_t *chain)
+{
+  if (chain->roots) free(chain->roots);
+  if (chain->expiries) free(chain->expiries);
+  if (chain->key) free(chain->key);
+  if (chain->expiry) free(chain->expiry);
+  if (chain->strike) free(chain->strike);
+  if (chain->is_call) free(chain->is_call);
+  if (chain->instrument_id) free(chain->instrument_id);
+  memset(chain, 0, sizeof(dbn_opra_chain_t));
+}
+
+
+const dbn_opra_chain_root_t *dbn_opra_chain_find_root(
+  const dbn_opra_chain_t *chain,
+  const char *root)
+{
+  size_t lo = 0;
+  size_t hi = chain->num_roots;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    int c = strcmp(chain->roots[mid].root, root);
+    if (!c) return &chain->roots[mid];
+    else if (c < 0) lo = mid + 1;
+    else hi = mid;
+  }
+  return NULL;
+}
+
+
+const dbn_opra_chain_expiry_t *dbn_opra_chain_find_expiry(
+  const dbn_opra_chain_t *chain,
+  const dbn_opra_chain_root_t *root,
+  uint16_t expiry)
+{
+  const dbn_opra_chain_expiry_t *expiries = &chain->expiries[root->first_expiry];
+  size_t lo = 0;
+  size_t hi = root->num_expiries;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (expiries[mid].expiry == expiry) return &expiries[mid];
+    else if (expiries[mid].expiry < expiry) lo = mid + 1;
+    else hi = mid;
+  }
+  return NULL;
+}
+
+
+size_t dbn_opra_chain_find(
+  const dbn_opra_chain_t *chain,
+  const dbn_opra_chain_root_t *root,
+  uint16_t expiry,
+  uint64_t strike,
+  bool is_call)
+{
+  osi_t osi = { 0 };
+  osi.exp_year = expiry >> 9;
+  osi.exp_month = (expiry >> 5) & 0xF;
+  osi.exp_day = expiry & 0x1F;
+  osi.strike = strike;
+  osi.is_call = is_call;
+  uint64_t key = osi_key(&osi, root - chain->roots);
+
+  size_t lo = root->first;
+  size_t hi = root->first + root->num;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (chain->key[mid] == key) return chain->strike[mid] == strike ? mid : DBN_OPRA_CHAIN_NONE;
+    else if (chain->key[mid] < key) lo = mid + 1;
+    else hi = mid;
+  }
+  return DBN_OPRA_CHAIN_NONE;
+}
+
+
+size_t dbn_opra_chain_nearest(
+  const dbn_opra_chain_t *chain,
+  const dbn_opra_chain_expiry_t *expiry,
+  uint64_t price,
+  bool is_call,
+  size_t n,
+  size_t *positions)
+{
+  /*
+   * Find the first strike at or above the price, then walk outwards from it,
+   * taking whichever side is nearer each time.
+   */
+  size_t begin = expiry->first;
+  size_t end = expiry->first + expiry->num;
+  size_t lo = begin;
+  size_t hi = end;
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    if (chain->strike[mid] < price) lo = mid + 1;
+    else hi = mid;
+  }
+
+  size_t up = lo;
+  size_t down = lo;
+  size_t count = 0;
+  while (count < n)
+  {
+    while (up < end && chain->is_call[up] != is_call)
+      up++;
+    while (down > begin && chain->is_call[down - 1] != is_call)
+      down--;
+
+    bool has_up = up < end;
+    bool has_down = down > begin;
+    if (!has_up && !has_down) break;
+
+    if (has_up && (!has_down || chain->strike[up] - price <= price - chain->strike[down - 1]))
+      positions[count++] = up++;
+    else
+      positions[count++] = --down;
+  }
+
+  return count;
+}
@@ -0,0 +1,192 @@
+/**
+ * @file dbn_opra_chain.h
+ * @brief Columnar option chain index
+ * @author Nathan Blythe
+ * @copyright Copyright 2025 Nathan Blythe
+ * @copyright Released under the Apache-2.0 license, see LICENSE
+ *
+ * Built once from a completed discovery or a snapshot, the index stores every
+ * contract as structure-of-arrays columns, sorted by root, then expiration,
+ * then strike, then put before call (the order of osi_key()). Each root's
+ * contracts, and each expiration's within it, are therefore a contiguous run
+ * of every column, which chain sweeps can read sequentially.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "osi.h"
+#include "dbn_opra_discover.h"
+#include "dbn_opra_snapshot.h"
+
+
+/**
+ * @brief Position meaning none.
+ */
+#define DBN_OPRA_CHAIN_NONE ((size_t)-1)
+
+
+/**
+ * @brief An expiration of a root and its run of contracts.
+ */
+typedef struct
+{
+  uint16_t expiry;               ///< @brief Expiration, see dbn_opra_chain_expiry()
+  uint32_t first;                ///< @brief Position of the first contract in the columns
+  uint32_t num;                  ///< @brief Number of contracts, which follow the first contiguously
+} dbn_opra_chain_expiry_t;
+
+
+/**
+ * @brief A root and its runs of contracts and expirations.
+ */
+typedef struct
+{
+  char root[8];                  ///< @brief Root symbol without .OPT suffix, null-terminated
+  uint32_t first;                ///< @brief Position of the first contract in the columns
+  uint32_t num;                  ///< @brief Number of contracts, which follow the first contiguously
+  uint32_t first_expiry;         ///< @brief Position of the first expiration in expiries
+  uint32_t num_expiries;         ///< @brief Number of expirations, which follow the first contiguously, in order
+} dbn_opra_chain_root_t;
+
+
+/**
+ * @brief Option chain index.
+ */
+typedef struct
+{
+  size_t num_roots;              ///< @brief Number of roots
+  dbn_opra_chain_root_t *roots;  ///< @brief Roots, sorted by root
+  size_t num_expiries;           ///< @brief Number of expirations, over all roots
+  dbn_opra_chain_expiry_t *expiries; ///< @brief Expirations, grouped by root
+  size_t num_contracts;          ///< @brief Number of contracts, over all roots
+  uint64_t *key;                 ///< @brief Column: contract key, see osi_key(), with the position of the root in roots as root ID
+  uint16_t *expiry;              ///< @brief Column: expiration, see dbn_opra_chain_expiry()
+  uint64_t *strike;              ///< @brief Column: strike price in nanodollars
+  bool *is_call;                 ///< @brief Column: call or put
+  uint32_t *instrument_id;       ///< @brief Column: Databento instrument ID
+} dbn_opra_chain_t;
+
+
+/**
+ * @brief Pack an expiration into a value that sorts chronologically.
+ *
+ * @param year Expiration year, since 2000.
+ * @param month Expiration month (1 - 12).
+ * @param day Expiration day (1 - 31).
+ *
+ * @return Packed expiration. Equal to the expiration bits of osi_key().
+ */
+static inline uint16_t dbn_opra_chain_expiry(
+  uint8_t year,
+  uint8_t month,
+  uint8_t day)
+{
+  return ((year & 0x7F) << 9) | ((month & 0xF) << 5) | (day & 0x1F);
+}
+
+
+/**
+ * @brief Build an index from a completed discovery.
+ *
+ * @param chain Pointer to index object to populate.
+ * @param discover Pointer to client wrapper object, in the DONE state.
+ *
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+extern int dbn_opra_chain_build(
+  dbn_opra_chain_t *chain,
+  const dbn_opra_discover_t *discover);
+
+
+/**
+ * @brief Build an index from an opened snapshot.
+ *
+ * @param chain Pointer to index object to populate.
+ * @param snapshot Pointer to opened snapshot object.
+ *
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+extern int dbn_opra_chain_build_snapshot(
+  dbn_opra_chain_t *chain,
+  const dbn_opra_snapshot_t *snapshot);
+
+
+/**
+ * @brief Free an index.
+ *
+ * @param chain Pointer to built index object.
+ */
+extern void dbn_opra_chain_destroy(dbn_opra_chain_t *chain);
+
+
+/**
+ * @brief Find a root.
+ *
+ * @param chain Pointer to built index object.
+ * @param root Pointer to null-terminated root symbol without .OPT suffix.
+ *
+ * @return Pointer to the root, or NULL if not found.
+ */
+extern const dbn_opra_chain_root_t *dbn_opra_chain_find_root(
+  const dbn_opra_chain_t *chain,
+  const char *root);
+
+
+/**
+ * @brief Find an expiration of a root, whose run of contracts holds all
+ * strikes of both types for that expiration.
+ *
+ * @param chain Pointer to built index object.
+ * @param root Pointer to root.
+ * @param expiry Expiration, see dbn_opra_chain_expiry().
+ *
+ * @return Pointer to the expiration, or NULL if the root has no contracts expiring then.
+ */
+extern const dbn_opra_chain_expiry_t *dbn_opra_chain_find_expiry(
+  const dbn_opra_chain_t *chain,
+  const dbn_opra_chain_root_t *root,
+  uint16_t expiry);
+
+
+/**
+ * @brief Find a contract.
+ *
+ * @param chain Pointer to built index object.
+ * @param root Pointer to root.
+ * @param expiry Expiration, see dbn_opra_chain_expiry().
+ * @param strike Strike price in nanodollars.
+ * @param is_call Call or put.
+ *
+ * @return Position of the contract in the columns, or DBN_OPRA_CHAIN_NONE if not found.
+ */
+extern size_t dbn_opra_chain_find(
+  const dbn_opra_chain_t *chain,
+  const dbn_opra_chain_root_t *root,
+  uint16_t expiry,
+  uint64_t strike,
+  bool is_call);
+
+
+/**
+ * @brief Find the contracts of one type with the strikes nearest a price.
+ *
+ * @param chain Pointer to built index object.
+ * @param expiry Pointer to expiration.
+ * @param price Price in nanodollars.
+ * @param is_call Call or put.
+ * @param n Maximum number of contracts to find.
+ * @param positions Pointer to array of at least n entries, where the positions of the contracts in the columns will be stored, nearest first.
+ *
+ * @return Number of contracts found, at most n.
+ */
+extern size_t dbn_opra_chain_nearest(
+  const dbn_opra_chain_t *chain,
+  const dbn_opra_chain_expiry_t *expiry,
+  uint64_t price,
+  bool is_call,
+  size_t n,
+  size_t *positions);
@@ -14,14 +14,35 @@
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include <pthread.h>
 
 #include "dbn.h"
+#include "dbn_multi.h"
 #include "osi.h"
 #include "dbn_opra_discover.h"
 
 
+/**
+ * @brief Save an error message and transition to the ERROR state.
+ */
+static void set_error(dbn_opra_discover_t *discover, const char *msg)
+{
+  if (discover->error) free(discover->error);
+  int n = 1 + strlen(msg);
+  discover->error = calloc(1, n);
+  if (!discover->error)
+  {
+    perror("calloc");
+    abort();
+  }
+
+  memcpy(discover->error, msg, n);
+  discover->state = DBN_OPRA_DISCOVER_STATE_ERROR;
+}
+
+
 /**
  * @brief On client error, save the provided error message and transition to
  * the ERROR state.
@@ -29,299 +50,508 @@
 static void on_error(dbn_t *dbn, bool fatal, char *msg)
 {
   dbn_opra_discover_t *discover = dbn->ctx;
-  if (fatal)
+  if (fatal) set_error(discover, msg);
+}
+
+
+/**
+ * @brief Find the index entry of an instrument: either the entry holding
+ * it, or the unused entry at which to insert it.
+ */
+static inline dbn_opra_discover_index_entry_t *probe(
+  dbn_opra_discover_index_entry_t *index,
+  size_t mask,
+  uint32_t instrument_id)
+{
+  size_t i = (instrument_id * 0x9E3779B1u) & mask;
+  while (index[i].instrument_id != instrument_id && index[i].instrument_id != DBN_OPRA_DISCOVER_NONE)
+    i = (i + 1) & mask;
+  return &index[i];
+}
+
+
+/**
+ * @brief Get the index entry of an instrument, adding one if it isn't
+ * indexed yet. The index is doubled whenever it would become more than half
+ * full.
+ */
+static dbn_opra_discover_index_entry_t *index_instrument(
+  dbn_opra_discover_t *discover,
+  uint32_t instrument_id)
+{
+  if (2 * (discover->num_indexed + 1) > (discover->index ? discover->index_mask + 1 : 0))
   {
-    if (discover->error) free(discover->error);
-    int n = 1 + strlen(msg);
-    discover->error = calloc(1, n);
-    if (!discover->error)
+    size_t n = discover->index ? 2 * (discover->index_mask + 1) : DBN_OPRA_DISCOVER_INDEX_INITIAL_ENTRIES;
+    dbn_opra_discover_index_entry_t *index = malloc(n * sizeof(dbn_opra_discover_index_entry_t));
+    if (!index)
     {
-      perror("calloc");
+      perror("malloc");
       abort();
     }
+    for (size_t i = 0; i < n; i++)
+      index[i].instrument_id = DBN_OPRA_DISCOVER_NONE;
 
-    memcpy(discover->error, msg, n);
-    discover->state = DBN_OPRA_DISCOVER_STATE_ERROR;
+    if (discover->index)
+    {
+      for (size_t i = 0; i <= discover->index_mask; i++)
+      {
+        if (discover->index[i].instrument_id != DBN_OPRA_DISCOVER_NONE)
+          *probe(index, n - 1, discover->index[i].instrument_id) = discover->index[i];
+      }
+      free(discover->index);
+    }
+
+    discover->index = index;
+    discover->index_mask = n - 1;
+  }
+
+  dbn_opra_discover_index_entry_t *entry = probe(discover->index, discover->index_mask, instrument_id);
+  if (entry->instrument_id == DBN_OPRA_DISCOVER_NONE)
+  {
+    entry->instrument_id = instrument_id;
+    entry->sdef = DBN_OPRA_DISCOVER_NONE;
+    entry->option = NULL;
+    discover->num_indexed++;
   }
+
+  return entry;
 }
 
 
 /**
- * @brief Databento message handler.
+ * @brief Pack a root symbol (at most 6 characters) into a non-zero integer.
  */
-static void on_msg(dbn_t *dbn, dbn_hdr_t *msg)
+static inline uint64_t root_key(const char *root)
 {
-  dbn_opra_discover_t *discover = dbn->ctx;
+  uint64_t key = 0;
+  memcpy(&key, root, strnlen(root, sizeof(key) - 1));
+  return key;
+}
+
+
+/**
+ * @brief Find the root index entry of a root: either the entry holding it,
+ * or the unused entry at which to insert it.
+ */
+static inline dbn_opra_discover_root_entry_t *probe_root(
+  dbn_opra_discover_root_entry_t *index,
+  size_t mask,
+  uint64_t key)
+{
+  size_t i = ((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+  while (index[i].key != key && index[i].key)
+    i = (i + 1) & mask;
+  return &index[i];
+}
 
 
+/**
+ * @brief Get the position in roots of a root, appending it if it isn't
+ * listed yet. Roots are sorted once receipt is complete, see group_roots().
+ */
+static uint32_t find_root(
+  dbn_opra_discover_t *discover,
+  const char *root)
+{
   /*
-   * On symbol mapping message for an option, find the option's root
-   * in the root list (or add it if not listed yet) and add the option
-   * to the root.
+   * Keep the index at most half full.
    */
-  if (msg->rtype == DBN_RTYPE_SMAP)
+  if (2 * (discover->num_roots + 1) > (discover->root_index ? discover->root_index_mask + 1 : 0))
   {
-    /*
-     * Decode the symbol.
-     */
-    dbn_smap_t *smap = (void *)msg;
-    osi_t osi;
-    if (!osi_parse(smap->stype_out_symbol, &osi)) return; // Not an option contract
-
-
-    /*
-     * Binary search the roots array for the insertion point.
-     */
-    size_t insertion_point = 0;
-    bool insertion_needed = true;
-    if (discover->num_roots)
+    size_t n = discover->root_index ? 2 * (discover->root_index_mask + 1) : DBN_OPRA_DISCOVER_ROOT_INDEX_INITIAL_ENTRIES;
+    dbn_opra_discover_root_entry_t *index = calloc(n, sizeof(dbn_opra_discover_root_entry_t));
+    if (!index)
     {
-      size_t last_index = -1;
-      size_t index = discover->num_roots / 2;
-      size_t step = discover->num_roots / 2;
-      while(true)
-      {
-        int d = strcmp(osi.root, discover->roots[index].root);
-        if (!d) // Root already listed
-        {
-          insertion_point = index;
-          insertion_needed = false;
-          break;
-        }
-        else if (d < 0) // Want to step left
-        {
-          if (index == 0) // But at the start of the array
-          {
-            insertion_point = 0;
-            insertion_needed = true;
-            break;
-          }
-          else if (last_index == index - 1) // But just stepped right by 1
-          {
-            insertion_point = index;
-            insertion_needed = true;
-            break;
-          }
-          else
-          {
-            last_index = index;
-            step /= 2;
-            if (!step) step = 1;
-            if (step > index) index = 0;
-            else index -= step;
-          }
-        }
-        else // Want to step right
-        {
-          if (index == discover->num_roots - 1) // But at the end of the array
-          {
-            insertion_point = discover->num_roots;
-            insertion_needed = true;
-            break;
-          }
-          else if (last_index == index + 1) // But just stepped left by 1
-          {
-            insertion_point = index + 1;
-            insertion_needed = true;
-            break;
-          }
-          else
-          {
-            last_index = index;
-            step /= 2;
-            if (!step) step = 1;
-            index += step;
-            if (index >= discover->num_roots) index = discover->num_roots - 1;
-          }
-        }
-      }
+      perror("calloc");
+      abort();
     }
 
-
-    /*
-     * Insert new root if needed.
-     */
-    if (insertion_needed)
+    if (discover->root_index)
     {
-      int n = strlen(osi.root);
-      char *copy = calloc(1, 1 + n);
-      if (!copy)
+      for (size_t i = 0; i <= discover->root_index_mask; i++)
       {
-        perror("calloc");
-        abort();
+        if (discover->root_index[i].key)
+          *probe_root(index, n - 1, discover->root_index[i].key) = discover->root_index[i];
       }
-      memcpy(copy, osi.root, n);
+      free(discover->root_index);
+    }
 
-      discover->num_roots++;
-      discover->roots = realloc(discover->roots, discover->num_roots * sizeof(dbn_opra_discover_root_t));
-      if (!discover->roots)
-      {
-        perror("realloc");
-        abort();
-      }
+    discover->root_index = index;
+    discover->root_index_mask = n - 1;
+  }
 
-      memmove(&discover->roots[insertion_point + 1], &discover->roots[insertion_point], (discover->num_roots - insertion_point - 1) * sizeof(dbn_opra_discover_root_t));
-      memset(&discover->roots[insertion_point], 0, sizeof(dbn_opra_discover_root_t));
-      discover->roots[insertion_point].root = copy;
-    }
+  uint64_t key = root_key(root);
+  dbn_opra_discover_root_entry_t *entry = probe_root(discover->root_index, discover->root_index_mask, key);
+  if (entry->key) return entry->root;
 
 
-    /*
-     * Add option to this root.
-     */
-    dbn_opra_discover_root_t *root = &discover->roots[insertion_point];
-    if (root->num_options == root->cap_options)
+  /*
+   * Append new root.
+   */
+  if (discover->num_roots == discover->cap_roots)
+  {
+    discover->cap_roots = discover->cap_roots ? 2 * discover->cap_roots : 1024;
+    discover->roots = realloc(discover->roots, discover->cap_roots * sizeof(dbn_opra_discover_root_t));
+    if (!discover->roots)
     {
-      root->cap_options = root->cap_options ? 2 * root->cap_options : 64;
-      root->options = realloc(root->options, root->cap_options * sizeof(dbn_opra_discover_option_t));
-      if (!root->options)
-      {
-        perror("realloc");
-        abort();
-      }
+      perror("realloc");
+      abort();
     }
-
-    dbn_opra_discover_option_t *option = &root->options[root->num_options++];
-    memset(option, 0, sizeof(dbn_opra_discover_option_t));
-    option->instrument_id = smap->hdr.instrument_id;
-    option->symbol = osi;
-
-    discover->num_options++;
   }
 
-
-  /*
-   * On security definition message, add the security definition to the
-   * security definition map.
-   */
-  else if (msg->rtype == DBN_RTYPE_SDEF)
+  char *copy = strdup(root);
+  if (!copy)
   {
-    dbn_sdef_t *sdef = (void *)msg;
+    perror("strdup");
+    abort();
+  }
 
-    /*
-     * Find the bucket for this security definition, by instrument ID.
-     */
-    size_t bindex = sdef->hdr.instrument_id % DBN_OPRA_DISCOVER_NUM_SDEF_BUCKETS;
-    dbn_opra_discover_sdef_bucket_t *bucket = &discover->sdefs[bindex];
+  dbn_opra_discover_root_t *r = &discover->roots[discover->num_roots];
+  memset(r, 0, sizeof(dbn_opra_discover_root_t));
+  r->root = copy;
 
+  entry->key = key;
+  entry->root = discover->num_roots++;
+  return entry->root;
+}
 
-    /*
-     * Add the security definition to the bucket.
-     */
-    if (bucket->count == bucket->capacity)
-    {
-      bucket->capacity = bucket->capacity ? 2 * bucket->capacity : 4;
-      bucket->sdefs = realloc(bucket->sdefs, bucket->capacity * sizeof(dbn_sdef_t));
-      if (!bucket->sdefs)
-      {
-        perror("realloc");
-        abort();
-      }
-    }
 
-    memcpy(&bucket->sdefs[bucket->count], sdef, sizeof(dbn_sdef_t));
-    bucket->count++;
+/**
+ * @brief On symbol mapping message for an option, append the option to the
+ * received options, noting its root.
+ */
+static void handle_smap(dbn_opra_discover_t *discover, dbn_hdr_t *msg)
+{
+  /*
+   * Decode the symbol.
+   */
+  dbn_smap_t *smap = (void *)msg;
+  osi_t osi;
+  if (!osi_parse(smap->stype_out_symbol, &osi)) return; // Not an option contract
 
-    discover->num_sdefs++;
-  }
+  uint32_t root = find_root(discover, osi.root);
 
 
   /*
-   * The special "Finished definition replay" message indicates that intra-day
-   * replay of instrument definitions is complete, and so discovery can move
-   * to cross-referencing of security definitions and options.
+   * Append the option.
    */
-  else if (msg->rtype == DBN_RTYPE_SMSG)
+  if (discover->num_options == discover->cap_received)
   {
-    dbn_smsg_t *smsg = (void *)msg;
-    if (!strcmp(smsg->msg, "Finished definition replay"))
-      discover->state = DBN_OPRA_DISCOVER_STATE_XREF;
+    discover->cap_received = discover->cap_received ? 2 * discover->cap_received : 65536;
+    discover->received = realloc(discover->received, discover->cap_received * sizeof(dbn_opra_discover_option_t));
+    discover->received_roots = realloc(discover->received_roots, discover->cap_received * sizeof(uint32_t));
+    if (!discover->received || !discover->received_roots)
+    {
+      perror("realloc");
+      abort();
+    }
   }
 
+  dbn_opra_discover_option_t *option = &discover->received[discover->num_options];
+  memset(option, 0, sizeof(dbn_opra_discover_option_t));
+  option->instrument_id = smap->hdr.instrument_id;
+  option->symbol = osi;
+
+  discover->received_roots[discover->num_options] = root;
+  discover->roots[root].num_options++;
+  discover->num_options++;
+}
+
+
+/**
+ * @brief On security definition message, append the security definition to
+ * the arena and index it by instrument ID.
+ */
+static void handle_sdef(dbn_opra_discover_t *discover, dbn_hdr_t *msg)
+{
+  dbn_sdef_t *sdef = (void *)msg;
 
   /*
-   * On error message, transition to the ERROR state.
+   * Start a new chunk if the last is full. Chunks are never reallocated, so
+   * security definitions stay put.
    */
-  else if (msg->rtype == DBN_RTYPE_EMSG)
+  size_t chunk = discover->num_sdefs / DBN_OPRA_DISCOVER_SDEF_CHUNK;
+  if (chunk == discover->num_sdef_chunks)
   {
-    dbn_emsg_t *emsg = (void *)msg;
-    if (discover->error) free(discover->error);
-    int n = 1 + strlen(emsg->msg);
-    discover->error = calloc(1, n);
-    if (!discover->error)
+    discover->sdef_chunks = realloc(discover->sdef_chunks, (chunk + 1) * sizeof(dbn_sdef_t *));
+    if (!discover->sdef_chunks)
     {
-      perror("calloc");
+      perror("realloc");
       abort();
     }
 
-    memcpy(discover->error, emsg->msg, n);
-    discover->state = DBN_OPRA_DISCOVER_STATE_ERROR;
+    discover->sdef_chunks[chunk] = malloc(DBN_OPRA_DISCOVER_SDEF_CHUNK * sizeof(dbn_sdef_t));
+    if (!discover->sdef_chunks[chunk])
+    {
+      perror("malloc");
+      abort();
+    }
+
+    discover->num_sdef_chunks++;
   }
+
+  memcpy(&discover->sdef_chunks[chunk][discover->num_sdefs % DBN_OPRA_DISCOVER_SDEF_CHUNK], sdef, sizeof(dbn_sdef_t));
+
+  index_instrument(discover, sdef->hdr.instrument_id)->sdef = discover->num_sdefs;
+
+  discover->num_sdefs++;
 }
 
 
 /**
- * @brief Worker thread entry point.
+ * @brief On system message, check for the special "Finished definition
+ * replay" message, which indicates that intra-day replay of instrument
+ * definitions is complete, and so discovery can move to cross-referencing of
+ * security definitions and options. If sharded, every session must finish.
  */
-static void *worker(void *arg)
+static void handle_smsg(dbn_opra_discover_t *discover, dbn_hdr_t *msg)
 {
-  dbn_opra_discover_t *discover = arg;
+  dbn_smsg_t *smsg = (void *)msg;
+  if (strcmp(smsg->msg, "Finished definition replay")) return;
 
+  if (discover->num_shards && ++discover->num_finished < discover->num_shards) return;
+  if (discover->state != DBN_OPRA_DISCOVER_STATE_ERROR) discover->state = DBN_OPRA_DISCOVER_STATE_XREF;
+  if (discover->num_shards) pthread_cond_broadcast(&discover->cond);
+}
+
+
+/**
+ * @brief On error message, transition to the ERROR state.
+ */
+static void handle_emsg(dbn_opra_discover_t *discover, dbn_hdr_t *msg)
+{
+  dbn_emsg_t *emsg = (void *)msg;
+  set_error(discover, emsg->msg);
+  if (discover->num_shards) pthread_cond_broadcast(&discover->cond);
+}
+
+
+/*
+ * Handlers for the single session.
+ */
+static void on_smap(dbn_t *dbn, dbn_hdr_t *msg) { handle_smap(dbn->ctx, msg); }
+static void on_sdef(dbn_t *dbn, dbn_hdr_t *msg) { handle_sdef(dbn->ctx, msg); }
+static void on_smsg(dbn_t *dbn, dbn_hdr_t *msg) { handle_smsg(dbn->ctx, msg); }
+static void on_emsg(dbn_t *dbn, dbn_hdr_t *msg) { handle_emsg(dbn->ctx, msg); }
 
-  /*
-   * Subscribe to symbol definitions in intra-day replay mode.
-   */
-  const char * const symbols[] = { "ALL_SYMBOLS" };
-  if (dbn_start(
-    &discover->dbn,
-    "definition",
-    "parent",
-    1, symbols,
-    "",
-    true)) return NULL;
 
-  discover->state = DBN_OPRA_DISCOVER_STATE_SUBSCRIBED;
+/**
+ * @brief If sharded sessions' messages should still be handled. Sessions keep
+ * running after every shard has finished, and anything received after that
+ * must not touch the receive buffers (freed by group_roots()), the index
+ * (read by the worker and by dbn_opra_discover_find()), or the state. Called
+ * with lock held.
+ */
+static bool is_receiving(dbn_opra_discover_t *discover)
+{
+  return discover->state == DBN_OPRA_DISCOVER_STATE_CONNECTED
+    || discover->state == DBN_OPRA_DISCOVER_STATE_SUBSCRIBED;
+}
+
+
+/**
+ * @brief On client error in any sharded session, as on_error().
+ */
+static void on_multi_error(dbn_multi_t *dbn_multi, bool fatal, char *msg)
+{
+  dbn_opra_discover_t *discover = dbn_multi->ctx;
+  if (!fatal) return;
+
+  pthread_mutex_lock(&discover->lock);
+  if (!is_receiving(discover))
+  {
+    pthread_mutex_unlock(&discover->lock);
+    return;
+  }
+
+  set_error(discover, msg);
+  pthread_cond_broadcast(&discover->cond);
+  pthread_mutex_unlock(&discover->lock);
+}
+
+
+/**
+ * @brief On message in any sharded session, handle it as for the single
+ * session, one session at a time.
+ */
+static void on_multi_msg(dbn_multi_t *dbn_multi, dbn_hdr_t *msg)
+{
+  dbn_opra_discover_t *discover = dbn_multi->ctx;
+  pthread_mutex_lock(&discover->lock);
+  if (!is_receiving(discover))
+  {
+    pthread_mutex_unlock(&discover->lock);
+    return;
+  }
+
+  switch (msg->rtype)
+  {
+    case DBN_RTYPE_SMAP: handle_smap(discover, msg); break;
+    case DBN_RTYPE_SDEF: handle_sdef(discover, msg); break;
+    case DBN_RTYPE_SMSG: handle_smsg(discover, msg); break;
+    case DBN_RTYPE_EMSG: handle_emsg(discover, msg); break;
+    default: break;
+  }
+  pthread_mutex_unlock(&discover->lock);
+}
+
+
+/**
+ * @brief Root name and position in roots, for sorting.
+ */
+typedef struct
+{
+  const char *root;
+  uint32_t i;
+} root_order_t;
+
+
+/**
+ * @brief Compare two roots by name, for qsort().
+ */
+static int compare_roots(const void *a, const void *b)
+{
+  return strcmp(((const root_order_t *)a)->root, ((const root_order_t *)b)->root);
+}
+
+
+/**
+ * @brief Once receipt is complete, sort the roots, and group the received
+ * options by root into one array, in a single counting pass.
+ */
+static void group_roots(dbn_opra_discover_t *discover)
+{
+  size_t n = discover->num_roots;
+  root_order_t *order = malloc(n * sizeof(root_order_t));
+  uint32_t *rank = malloc(n * sizeof(uint32_t));
+  size_t *next = malloc(n * sizeof(size_t));
+  dbn_opra_discover_root_t *roots = malloc(n * sizeof(dbn_opra_discover_root_t));
+  discover->options = malloc(discover->num_options * sizeof(dbn_opra_discover_option_t));
+  if ((n && (!order || !rank || !next || !roots)) || (discover->num_options && !discover->options))
+  {
+    perror("malloc");
+    abort();
+  }
+
+  for (size_t i = 0; i < n; i++)
+    order[i] = (root_order_t){ discover->roots[i].root, i };
+  qsort(order, n, sizeof(root_order_t), compare_roots);
 
 
   /*
-   * Process messages until stopped, errored out, or done receiving messages.
+   * Lay out the roots in sorted order, each followed by its options.
    */
-  while (!discover->stop && discover->state == DBN_OPRA_DISCOVER_STATE_SUBSCRIBED)
+  size_t offset = 0;
+  for (size_t k = 0; k < n; k++)
+  {
+    roots[k] = discover->roots[order[k].i];
+    roots[k].options = discover->options + offset;
+    rank[order[k].i] = k;
+    next[k] = offset;
+    offset += roots[k].num_options;
+  }
+
+  for (size_t i = 0; i < discover->num_options; i++)
+    discover->options[next[rank[discover->received_roots[i]]]++] = discover->received[i];
+
+  free(discover->roots);
+  discover->roots = roots;
+  discover->cap_roots = n;
+
+  free(discover->received);
+  free(discover->received_roots);
+  free(discover->root_index);
+  discover->received = NULL;
+  discover->received_roots = NULL;
+  discover->cap_received = 0;
+  discover->root_index = NULL;
+  discover->root_index_mask = 0;
+
+  free(order);
+  free(rank);
+  free(next);
+}
+
+
+/**
+ * @brief Worker thread entry point.
+ */
+static void *worker(void *arg)
+{
+  dbn_opra_discover_t *discover = arg;
+
+  if (discover->num_shards)
   {
-    dbn_get(&discover->dbn);
+    /*
+     * Sessions receive on their own threads. Wait for them all to
+     * subscribe, and then to finish.
+     */
+    while (!atomic_load(&discover->stop)
+      && discover->state == DBN_OPRA_DISCOVER_STATE_CONNECTED
+      && !dbn_multi_is_fully_subscribed(&discover->multi)
+      && !dbn_multi_get_num_failed(&discover->multi))
+      usleep(1000);
+
+    pthread_mutex_lock(&discover->lock);
+    if (discover->state == DBN_OPRA_DISCOVER_STATE_CONNECTED && dbn_multi_get_num_failed(&discover->multi))
+      set_error(discover, "Shard session failed to connect or subscribe");
+    if (discover->state == DBN_OPRA_DISCOVER_STATE_CONNECTED) discover->state = DBN_OPRA_DISCOVER_STATE_SUBSCRIBED;
+    while (!atomic_load(&discover->stop) && discover->state == DBN_OPRA_DISCOVER_STATE_SUBSCRIBED)
+      pthread_cond_wait(&discover->cond, &discover->lock);
+    pthread_mutex_unlock(&discover->lock);
+  }
+  else
+  {
+    /*
+     * Subscribe to symbol definitions in intra-day replay mode.
+     */
+    const char * const symbols[] = { "ALL_SYMBOLS" };
+    if (dbn_start(
+      &discover->dbn,
+      "definition",
+      "parent",
+      1, symbols,
+      "",
+      true)) return NULL;
+
+    discover->state = DBN_OPRA_DISCOVER_STATE_SUBSCRIBED;
+
+
+    /*
+     * Process messages until stopped, errored out, or done receiving messages.
+     */
+    while (!atomic_load(&discover->stop) && discover->state == DBN_OPRA_DISCOVER_STATE_SUBSCRIBED)
+    {
+      dbn_get(&discover->dbn);
+    }
   }
 
 
   /*
    * If we finished receiving messages normally and are now in the cross-
-   * reference state, cross-reference sdefs to instruments for easy access
-   * later.
+   * reference state, group options by root, and cross-reference sdefs to
+   * instruments for easy access later.
    */
-  for (size_t i = 0; i < discover->num_roots; i++)
+  if (discover->state != DBN_OPRA_DISCOVER_STATE_XREF) return NULL;
+
+  group_roots(discover);
+
+  for (size_t i = 0; i < discover->num_options; i++)
   {
-    dbn_opra_discover_root_t *root = &discover->roots[i];
-    for (size_t j = 0; j < root->num_options; j++)
-    {
-      dbn_opra_discover_option_t *option = &root->options[j];
-      size_t bindex = option->instrument_id % DBN_OPRA_DISCOVER_NUM_SDEF_BUCKETS;
-      dbn_opra_discover_sdef_bucket_t *bucket = &discover->sdefs[bindex];
-      for (int k = 0; k < bucket->count; k++)
-      {
-        dbn_sdef_t *sdef = &bucket->sdefs[k];
-        if (sdef->hdr.instrument_id == option->instrument_id)
-        {
-          option->sdef = sdef;
-          break;
-        }
-      }
-    }
+    dbn_opra_discover_option_t *option = &discover->options[i];
+    dbn_opra_discover_index_entry_t *entry = index_instrument(discover, option->instrument_id);
+    if (entry->sdef != DBN_OPRA_DISCOVER_NONE)
+      option->sdef = &discover->sdef_chunks[entry->sdef / DBN_OPRA_DISCOVER_SDEF_CHUNK][entry->sdef % DBN_OPRA_DISCOVER_SDEF_CHUNK];
+    entry->option = option;
   }
 
 
   /*
    * Now we're actually done.
    */
+  if (discover->num_shards) pthread_mutex_lock(&discover->lock);
   discover->state = DBN_OPRA_DISCOVER_STATE_DONE;
+  if (discover->num_shards) pthread_mutex_unlock(&discover->lock);
   return NULL;
 }
 
@@ -330,7 +560,13 @@ void dbn_opra_discover_init(
   dbn_opra_discover_t *discover)
 {
   memset(discover, 0, sizeof(dbn_opra_discover_t));
-  dbn_init(&discover->dbn, on_error, on_msg, discover);
+  dbn_init(&discover->dbn, on_error, NULL, discover);
+  dbn_set_msg_handler(&discover->dbn, DBN_RTYPE_SMAP, on_smap);
+  dbn_set_msg_handler(&discover->dbn, DBN_RTYPE_SDEF, on_sdef);
+  dbn_set_msg_handler(&discover->dbn, DBN_RTYPE_SMSG, on_smsg);
+  dbn_set_msg_handler(&discover->dbn, DBN_RTYPE_EMSG, on_emsg);
+  pthread_mutex_init(&discover->lock, NULL);
+  pthread_cond_init(&discover->cond, NULL);
 }
 
 
@@ -368,28 +604,126 @@ int dbn_opra_discover_start(
 }
 
 
+/**
+ * @brief Compare two root strings, for qsort().
+ */
+static int compare_strings(const void *a, const void *b)
+{
+  return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
+
+
+int dbn_opra_discover_start_sharded(
+  dbn_opra_discover_t *discover,
+  const char *api_key,
+  int num_sessions,
+  size_t num_roots,
+  const char * const *roots)
+{
+  if (num_sessions < 1 || (size_t)num_sessions > num_roots)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+
+  /*
+   * Split the sorted roots into alphabetical ranges of equal size, one per
+   * session.
+   */
+  discover->shard_roots = malloc(num_roots * sizeof(const char *));
+  if (!discover->shard_roots) return -1;
+  memcpy(discover->shard_roots, roots, num_roots * sizeof(const char *));
+  qsort(discover->shard_roots, num_roots, sizeof(const char *), compare_strings);
+
+  dbn_multi_init(&discover->multi, on_multi_error, NULL, discover);
+  dbn_multi_set_msg_handler(&discover->multi, DBN_RTYPE_SMAP, on_multi_msg);
+  dbn_multi_set_msg_handler(&discover->multi, DBN_RTYPE_SDEF, on_multi_msg);
+  dbn_multi_set_msg_handler(&discover->multi, DBN_RTYPE_SMSG, on_multi_msg);
+  dbn_multi_set_msg_handler(&discover->multi, DBN_RTYPE_EMSG, on_multi_msg);
+  discover->num_shards = num_sessions;
+  discover->state = DBN_OPRA_DISCOVER_STATE_CONNECTED;
+
+  for (int i = 0; i < num_sessions; i++)
+  {
+    size_t begin = i * num_roots / num_sessions;
+    size_t end = (i + 1) * num_roots / num_sessions;
+    if (dbn_multi_connect_and_start(
+      &discover->multi,
+      api_key,
+      "OPRA.PILLAR",
+      false,
+      "definition",
+      "parent",
+      end - begin,
+      discover->shard_roots + begin,
+      ".OPT",
+      true)) return -1;
+  }
+
+
+  /*
+   * Start the worker thread, which waits for the sessions to finish.
+   */
+  if (pthread_create(
+    &discover->thread,
+    NULL,
+    worker,
+    discover))
+  {
+    perror("pthread_create");
+    abort();
+  }
+
+  return 0;
+}
+
+
 void dbn_opra_discover_destroy(dbn_opra_discover_t *discover)
 {
   if (discover->state != DBN_OPRA_DISCOVER_STATE_NOT_STARTED)
   {
-    discover->stop = true;
-    pthread_join(discover->thread, NULL);
-    dbn_close(&discover->dbn);
-
-    if (discover->roots)
+    atomic_store(&discover->stop, true);
+    if (discover->num_shards)
     {
-      for (size_t i = 0; i < discover->num_roots; i++)
-        free(discover->roots[i].options);
-      free(discover->roots);
-
-      for (size_t i = 0; i < DBN_OPRA_DISCOVER_NUM_SDEF_BUCKETS; i++)
-      {
-        if (discover->sdefs[i].sdefs)
-          free(discover->sdefs[i].sdefs);
-      }
+      pthread_mutex_lock(&discover->lock);
+      pthread_cond_broadcast(&discover->cond);
+      pthread_mutex_unlock(&discover->lock);
     }
-
-    memset(discover, 0, sizeof(dbn_opra_discover_t));
+    else dbn_wake(&discover->dbn);
+    if (discover->thread) pthread_join(discover->thread, NULL);
   }
+
+  if (discover->num_shards) dbn_multi_close_all(&discover->multi);
+  dbn_close(&discover->dbn);
+
+  for (size_t i = 0; i < discover->num_roots; i++)
+    free(discover->roots[i].root);
+  if (discover->roots) free(discover->roots);
+  if (discover->options) free(discover->options);
+  if (discover->received) free(discover->received);
+  if (discover->received_roots) free(discover->received_roots);
+  if (discover->root_index) free(discover->root_index);
+  if (discover->shard_roots) free(discover->shard_roots);
+
+  for (size_t i = 0; i < discover->num_sdef_chunks; i++)
+    free(discover->sdef_chunks[i]);
+  if (discover->sdef_chunks) free(discover->sdef_chunks);
+  if (discover->index) free(discover->index);
+  if (discover->error) free(discover->error);
+
+  pthread_mutex_destroy(&discover->lock);
+  pthread_cond_destroy(&discover->cond);
+
+  memset(discover, 0, sizeof(dbn_opra_discover_t));
 }
 
+dbn_opra_discover_option_t *dbn_opra_discover_find(
+  const dbn_opra_discover_t *discover,
+  uint32_t instrument_id)
+{
+  if (!discover->index || instrument_id == DBN_OPRA_DISCOVER_NONE) return NULL;
+
+  dbn_opra_discover_index_entry_t *entry = probe(discover->index, discover->index_mask, instrument_id);
+  return entry->instrument_id == instrument_id ? entry->option : NULL;
+}
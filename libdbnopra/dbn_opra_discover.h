@@ -17,6 +17,7 @@
 #include <pthread.h>
 
 #include "dbn.h"
+#include "dbn_multi.h"
 #include "osi.h"
 
 
@@ -51,31 +52,55 @@ typedef struct
 typedef struct
 {
   char *root;                          ///< @brief Root symbol without .OPT suffix (ex. "MSFT", "SPY")
-  size_t cap_options;                  ///< @brief Capacity of the options list
   size_t num_options;                  ///< @brief Number of options discovered for this root
-  dbn_opra_discover_option_t *options; ///< @brief Discovered options for this root
+  dbn_opra_discover_option_t *options; ///< @brief Discovered options for this root, in order of receipt. Points into the options array shared by all roots
 } dbn_opra_discover_root_t;
 
 
 /**
- * @brief Number of buckets in an instrument ID to sdef map.
- *
- * There are approx. 7000 optionable symbols as of this writing. Some have
- * as few as 100 options available, and others have many thousands. Anything
- * from 25000 to 100000 is a decent choice for number of buckets.
+ * @brief Number of security definitions in each chunk of the security
+ * definition arena.
+ */
+#define DBN_OPRA_DISCOVER_SDEF_CHUNK 16384
+
+
+/**
+ * @brief Initial number of entries in the instrument ID index.
+ */
+#define DBN_OPRA_DISCOVER_INDEX_INITIAL_ENTRIES 16384
+
+
+/**
+ * @brief Initial number of entries in the root index.
+ */
+#define DBN_OPRA_DISCOVER_ROOT_INDEX_INITIAL_ENTRIES 16384
+
+
+/**
+ * @brief Entry of the root index, used while receiving.
+ */
+typedef struct
+{
+  uint64_t key;                       ///< @brief Root symbol packed into an integer (zero padded), or 0 if the entry is unused
+  uint32_t root;                      ///< @brief Position of the root in roots
+} dbn_opra_discover_root_entry_t;
+
+
+/**
+ * @brief dbn_opra_discover_index_entry_t field value meaning none.
  */
-#define DBN_OPRA_DISCOVER_NUM_SDEF_BUCKETS 50000
+#define DBN_OPRA_DISCOVER_NONE 0xFFFFFFFF
 
 
 /**
- * @brief Bucket in an instrument ID to sdef map.
+ * @brief Entry of the instrument ID index.
  */
 typedef struct
 {
-  size_t capacity;       ///< @brief Allocated slots in this bucket
-  size_t count;          ///< @brief Used slots in this bucket
-  dbn_sdef_t *sdefs;     ///< @brief Slots
-} dbn_opra_discover_sdef_bucket_t;
+  uint32_t instrument_id;             ///< @brief Instrument ID, or DBN_OPRA_DISCOVER_NONE if the entry is unused
+  uint32_t sdef;                      ///< @brief Position of the instrument's security definition in the arena, or DBN_OPRA_DISCOVER_NONE if none received
+  dbn_opra_discover_option_t *option; ///< @brief Option with this instrument ID, or NULL if none. Set once cross-referencing is done
+} dbn_opra_discover_index_entry_t;
 
 
 /**
@@ -86,13 +111,30 @@ typedef struct
   dbn_t dbn;                        ///< @brief Underlying client
   dbn_opra_discover_state_t state;  ///< @brief State
   size_t num_roots;                 ///< @brief Number of discovered optionable roots
-  dbn_opra_discover_root_t *roots;  ///< @brief Optionable roots and their contracts, do not read unless state is DONE
+  dbn_opra_discover_root_t *roots;  ///< @brief Optionable roots and their contracts, sorted by root. Do not read unless state is DONE
+  size_t cap_roots;                 ///< @brief While receiving, allocated entries of roots
+  dbn_opra_discover_option_t *options; ///< @brief All options, grouped by root. Do not read unless state is DONE
+  dbn_opra_discover_option_t *received; ///< @brief While receiving, options in order of receipt
+  uint32_t *received_roots;         ///< @brief While receiving, position in roots of the root of each option in received
+  size_t cap_received;              ///< @brief While receiving, allocated entries of received and received_roots
+  dbn_opra_discover_root_entry_t *root_index; ///< @brief While receiving, open-addressed index of roots by symbol
+  size_t root_index_mask;           ///< @brief Number of entries in root_index minus 1
   char *error;                      ///< @brief Error message, for state ERROR. NULL in other states.
   pthread_t thread;                 ///< @brief Worker thread
-  bool stop;                        ///< @brief Stop flag for worker thread
+  _Atomic bool stop;                ///< @brief Stop flag for worker thread
   size_t num_options;               ///< @brief Total number of options discovered
   size_t num_sdefs;                 ///< @brief Total number of security definitions received
-  dbn_opra_discover_sdef_bucket_t sdefs[DBN_OPRA_DISCOVER_NUM_SDEF_BUCKETS]; ///< @brief Maps instrument ID to security definition
+  dbn_sdef_t **sdef_chunks;         ///< @brief Arena of received security definitions, in chunks of DBN_OPRA_DISCOVER_SDEF_CHUNK that never move
+  size_t num_sdef_chunks;           ///< @brief Number of chunks in sdef_chunks
+  dbn_opra_discover_index_entry_t *index; ///< @brief Open-addressed index of instruments by ID, grown with the number of security definitions
+  size_t index_mask;                ///< @brief Number of entries in index minus 1
+  size_t num_indexed;               ///< @brief Number of entries of index in use
+  int num_shards;                   ///< @brief If started with dbn_opra_discover_start_sharded(), number of sessions, else 0
+  const char **shard_roots;         ///< @brief If sharded, sorted roots, split into a contiguous range per session
+  int num_finished;                 ///< @brief If sharded, number of sessions that have finished replay
+  dbn_multi_t multi;                ///< @brief If sharded, underlying multi-session client
+  pthread_mutex_t lock;             ///< @brief If sharded, serializes message handling across sessions
+  pthread_cond_t cond;              ///< @brief If sharded, signaled when every session has finished, on error, and on stop
 } dbn_opra_discover_t;
 
 
@@ -119,6 +161,29 @@ extern int dbn_opra_discover_start(
   const char *api_key);
 
 
+/**
+ * @brief Like dbn_opra_discover_start(), but spread the definition replay
+ * across several parallel sessions, each subscribed to a contiguous
+ * alphabetical range of a known list of roots (ex. the previous day's
+ * dbn_roots output). Options of roots missing from the list are not
+ * discovered.
+ *
+ * @param discover Pointer to an initialized client wrapper object.
+ * @param api_key Pointer to null-terminated Databento API key.
+ * @param num_sessions Number of sessions, at most num_roots.
+ * @param num_roots Number of roots in roots.
+ * @param roots Pointer to array of pointers to null-terminated roots, without .OPT suffix. Must remain valid until state is SUBSCRIBED.
+ *
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+extern int dbn_opra_discover_start_sharded(
+  dbn_opra_discover_t *discover,
+  const char *api_key,
+  int num_sessions,
+  size_t num_roots,
+  const char * const *roots);
+
+
 /**
  * @brief Stop / disconnect from Databento and destroy a client wrapper
  * object.
@@ -130,3 +195,17 @@ extern int dbn_opra_discover_start(
  */
 extern void dbn_opra_discover_destroy(dbn_opra_discover_t *discover);
 
+
+/**
+ * @brief Look up an option contract by instrument ID, ex. for the
+ * instrument_id of each CMBP-1 quote.
+ *
+ * @param discover Pointer to a client wrapper object in the DONE state.
+ * @param instrument_id Databento instrument ID.
+ *
+ * @return Pointer to option, or NULL if none has this instrument ID.
+ */
+extern dbn_opra_discover_option_t *dbn_opra_discover_find(
+  const dbn_opra_discover_t *discover,
+  uint32_t instrument_id);
+
@@ -0,0 +1,268 @@
+/**
+ * @file dbn_opra_snapshot.c
+ * @brief Persistent snapshot of completed OPRA option discovery
+ * @author Nathan Blythe
+ * @copyright Copyright 2025 Nathan Blythe
+ * @copyright Released under the Apache-2.0 license, see LICENSE
+ *
+ * See dbn_opra_snapshot.h for details.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dbn_opra_discover.h"
+#include "dbn_opra_snapshot.h"
+
+
+/**
+ * @brief Alignment of each section of the file, in bytes.
+ */
+#define SECTION_ALIGN 64
+
+
+/**
+ * @brief Round up to a multiple of SECTION_ALIGN.
+ */
+static inline uint64_t align_section(uint64_t n)
+{
+  return (n + SECTION_ALIGN - 1) & ~(uint64_t)(SECTION_ALIGN - 1);
+}
+
+
+/**
+ * @brief Write a buffer to a file descriptor, looping as needed to write the
+ * full buffer.
+ *
+ * @return 0 on success or -1 on failure with errno set
+ */
+static int write_all(int fd, const uint8_t *buf, size_t n)
+{
+  size_t d = 0;
+  while (d < n)
+  {
+    ssize_t r = write(fd, buf + d, n - d);
+    if (r < 0 && errno == EINTR) continue;
+    if (r <= 0) return -1;
+    d += r;
+  }
+  return 0;
+}
+
+
+int dbn_opra_snapshot_save(
+  const dbn_opra_discover_t *discover,
+  const char *path,
+  uint32_t trading_date)
+{
+  if (discover->state != DBN_OPRA_DISCOVER_STATE_DONE || discover->num_options >= DBN_OPRA_DISCOVER_NONE)
+  {
+    errno = EINVAL;
+    return -1;
+  }
+
+
+  /*
+   * Lay out the file. The index is kept at most half full.
+   */
+  uint64_t num_index = 16;
+  while (num_index < 2 * discover->num_options)
+    num_index *= 2;
+
+  dbn_opra_snapshot_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, DBN_OPRA_SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = DBN_OPRA_SNAPSHOT_VERSION;
+  header.byte_order = 0x01020304;
+  header.trading_date = trading_date;
+  header.num_roots = discover->num_roots;
+  header.num_options = discover->num_options;
+  header.num_index = num_index;
+  header.roots_offset = align_section(sizeof(header));
+  header.options_offset = align_section(header.roots_offset + header.num_roots * sizeof(dbn_opra_snapshot_root_t));
+  header.index_offset = align_section(header.options_offset + header.num_options * sizeof(dbn_opra_snapshot_option_t));
+  header.size = header.index_offset + num_index * sizeof(dbn_opra_snapshot_index_entry_t);
+
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  header.ts_created = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+  uint8_t *buf = calloc(1, header.size);
+  if (!buf) return -1;
+
+  memcpy(buf, &header, sizeof(header));
+  dbn_opra_snapshot_root_t *roots = (void *)(buf + header.roots_offset);
+  dbn_opra_snapshot_option_t *options = (void *)(buf + header.options_offset);
+  dbn_opra_snapshot_index_entry_t *index = (void *)(buf + header.index_offset);
+
+
+  /*
+   * Fill in roots and options. Options of a root are contiguous in the
+   * discovery, so keep them in the same order.
+   */
+  for (size_t i = 0; i < discover->num_roots; i++)
+  {
+    const dbn_opra_discover_root_t *root = &discover->roots[i];
+    strncpy(roots[i].root, root->root, sizeof(roots[i].root) - 1);
+    roots[i].first_option = root->options - discover->options;
+    roots[i].num_options = root->num_options;
+
+    for (size_t j = 0; j < root->num_options; j++)
+    {
+      const dbn_opra_discover_option_t *option = &root->options[j];
+      dbn_opra_snapshot_option_t *o = &options[roots[i].first_option + j];
+      o->instrument_id = option->instrument_id;
+      o->root = i;
+      o->symbol = option->symbol;
+
+      const dbn_sdef_t *sdef = option->sdef;
+      if (!sdef) continue;
+
+      o->expiration = sdef->expiration;
+      o->activation = sdef->activation;
+      o->min_price_increment = sdef->min_price_increment;
+      o->strike_price = sdef->strike_price;
+      o->high_limit_price = sdef->high_limit_price;
+      o->low_limit_price = sdef->low_limit_price;
+      o->underlying_id = sdef->underlying_id;
+      o->contract_multiplier = sdef->contract_multiplier;
+      o->publisher_id = sdef->hdr.publisher_id;
+      o->has_sdef = true;
+    }
+  }
+
+
+  /*
+   * Fill in the index.
+   */
+  for (size_t i = 0; i < num_index; i++)
+    index[i].instrument_id = DBN_OPRA_DISCOVER_NONE;
+
+  for (size_t i = 0; i < discover->num_options; i++)
+  {
+    uint32_t id = options[i].instrument_id;
+    size_t k = (id * 0x9E3779B1u) & (num_index - 1);
+    while (index[k].instrument_id != DBN_OPRA_DISCOVER_NONE && index[k].instrument_id != id)
+      k = (k + 1) & (num_index - 1);
+    index[k].instrument_id = id;
+    index[k].option = i;
+  }
+
+
+  /*
+   * Write to a temporary file and move it into place.
+   */
+  size_t n = strlen(path);
+  char *tmp = malloc(n + 5);
+  if (!tmp)
+  {
+    free(buf);
+    return -1;
+  }
+  memcpy(tmp, path, n);
+  memcpy(tmp + n, ".tmp", 5);
+
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  int r = fd < 0 ? -1 : write_all(fd, buf, header.size);
+  if (!r) r = fsync(fd);
+  if (fd >= 0 && close(fd) && !r) r = -1;
+  if (!r) r = rename(tmp, path);
+
+  int e = errno;
+  if (r && fd >= 0) unlink(tmp);
+  free(tmp);
+  free(buf);
+  errno = e;
+  return r;
+}
+
+
+int dbn_opra_snapshot_open(
+  dbn_opra_snapshot_t *snapshot,
+  const char *path,
+  uint32_t trading_date)
+{
+  memset(snapshot, 0, sizeof(dbn_opra_snapshot_t));
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return -1;
+
+  struct stat st;
+  if (fstat(fd, &st))
+  {
+    int e = errno;
+    close(fd);
+    errno = e;
+    return -1;
+  }
+
+  if ((size_t)st.st_size < sizeof(dbn_opra_snapshot_header_t))
+  {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+
+  void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  int e = errno;
+  close(fd);
+  if (base == MAP_FAILED)
+  {
+    errno = e;
+    return -1;
+  }
+
+
+  /*
+   * Check that the file is a complete snapshot this build can read in place.
+   */
+  const dbn_opra_snapshot_header_t *header = base;
+  uint64_t size = st.st_size;
+  bool valid = !memcmp(header->magic, DBN_OPRA_SNAPSHOT_MAGIC, sizeof(header->magic))
+    && header->version == DBN_OPRA_SNAPSHOT_VERSION
+    && header->byte_order == 0x01020304
+    && header->size == size
+    && header->num_index && !(header->num_index & (header->num_index - 1))
+    && header->num_index > header->num_options
+    && !(header->roots_offset % SECTION_ALIGN)
+    && !(header->options_offset % SECTION_ALIGN)
+    && !(header->index_offset % SECTION_ALIGN)
+    && header->roots_offset <= size
+    && header->options_offset <= size
+    && header->index_offset <= size
+    && header->num_roots <= (size - header->roots_offset) / sizeof(dbn_opra_snapshot_root_t)
+    && header->num_options <= (size - header->options_offset) / sizeof(dbn_opra_snapshot_option_t)
+    && header->num_index <= (size - header->index_offset) / sizeof(dbn_opra_snapshot_index_entry_t);
+
+  if (!valid || (trading_date && header->trading_date != trading_date))
+  {
+    munmap(base, st.st_size);
+    errno = valid ? ESTALE : EINVAL;
+    return -1;
+  }
+
+  snapshot->base = base;
+  snapshot->size = st.st_size;
+  snapshot->header = header;
+  snapshot->roots = (const void *)((const uint8_t *)base + header->roots_offset);
+  snapshot->options = (const void *)((const uint8_t *)base + header->options_offset);
+  snapshot->index = (const void *)((const uint8_t *)base + header->index_offset);
+  snapshot->index_mask = header->num_index - 1;
+  return 0;
+}
+
+
+void dbn_opra_snapshot_close(dbn_opra_snapshot_t *snapshot)
+{
+  if (snapshot->base) munmap(snapshot->base, snapshot->size);
+  memset(snapshot, 0, sizeof(dbn_opra_snapshot_t));
+}
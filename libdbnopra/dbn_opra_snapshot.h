@@ -0,0 +1,184 @@
+/**
+ * @file dbn_opra_snapshot.h
+ * @brief Persistent snapshot of completed OPRA option discovery
+ * @author Nathan Blythe
+ * @copyright Copyright 2025 Nathan Blythe
+ * @copyright Released under the Apache-2.0 license, see LICENSE
+ *
+ * A snapshot file holds the roots, options, and the commonly used security
+ * definition fields discovered by dbn_opra_discover, tagged with the trading
+ * date they are valid for (instrument IDs are only reliable within the same
+ * trading day). Everything in the file is addressed by offset or position, so
+ * it is opened with a single mmap() and used in place, with no parsing.
+ *
+ * Files are written in host byte order and rejected on a host of different
+ * byte order or with a different format version.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "osi.h"
+#include "dbn_opra_discover.h"
+
+
+/**
+ * @brief Snapshot file magic.
+ */
+#define DBN_OPRA_SNAPSHOT_MAGIC "DBNOSNAP"
+
+
+/**
+ * @brief Snapshot file format version. Incremented on any layout change.
+ */
+#define DBN_OPRA_SNAPSHOT_VERSION 1
+
+
+/**
+ * @brief Snapshot file header, at offset 0.
+ */
+typedef struct
+{
+  char magic[8];             ///< @brief DBN_OPRA_SNAPSHOT_MAGIC, not null-terminated
+  uint32_t version;          ///< @brief DBN_OPRA_SNAPSHOT_VERSION
+  uint32_t byte_order;       ///< @brief 0x01020304 in host byte order of the writer
+  uint32_t trading_date;     ///< @brief Trading date the snapshot is valid for, as YYYYMMDD
+  uint32_t num_roots;        ///< @brief Number of roots
+  uint64_t num_options;      ///< @brief Number of options
+  uint64_t num_index;        ///< @brief Number of index entries (a power of 2)
+  uint64_t roots_offset;     ///< @brief Offset of the roots, in bytes from the start of the file
+  uint64_t options_offset;   ///< @brief Offset of the options, in bytes from the start of the file
+  uint64_t index_offset;     ///< @brief Offset of the index, in bytes from the start of the file
+  uint64_t size;             ///< @brief Size of the file, in bytes
+  uint64_t ts_created;       ///< @brief Time the snapshot was written, in nanoseconds since the UNIX epoch
+} dbn_opra_snapshot_header_t;
+
+
+/**
+ * @brief Snapshot root.
+ */
+typedef struct
+{
+  char root[8];              ///< @brief Root symbol without .OPT suffix, null-terminated
+  uint32_t first_option;     ///< @brief Position of the root's first option in the options
+  uint32_t num_options;      ///< @brief Number of options of this root, which follow the first contiguously
+} dbn_opra_snapshot_root_t;
+
+
+/**
+ * @brief Snapshot option: symbol, instrument ID, and slim security definition.
+ */
+typedef struct
+{
+  uint32_t instrument_id;        ///< @brief Databento instrument ID
+  uint32_t root;                 ///< @brief Position of the option's root in the roots
+  osi_t symbol;                  ///< @brief OSI (OCC) option symbol
+  uint64_t expiration;           ///< @brief From the security definition: expiration, in nanoseconds since the UNIX epoch
+  uint64_t activation;           ///< @brief From the security definition: activation, in nanoseconds since the UNIX epoch
+  int64_t min_price_increment;   ///< @brief From the security definition: tick size, in nanodollars
+  int64_t strike_price;          ///< @brief From the security definition: strike, in nanodollars
+  int64_t high_limit_price;      ///< @brief From the security definition
+  int64_t low_limit_price;       ///< @brief From the security definition
+  uint32_t underlying_id;        ///< @brief From the security definition
+  int32_t contract_multiplier;   ///< @brief From the security definition
+  uint16_t publisher_id;         ///< @brief From the security definition header
+  bool has_sdef;                 ///< @brief false if no security definition was received, in which case the fields above are 0
+  uint8_t _reserved[5];
+} dbn_opra_snapshot_option_t;
+
+
+/**
+ * @brief Snapshot index entry. The index is open-addressed by instrument ID,
+ * see dbn_opra_snapshot_find().
+ */
+typedef struct
+{
+  uint32_t instrument_id;        ///< @brief Instrument ID, or DBN_OPRA_DISCOVER_NONE if the entry is unused
+  uint32_t option;               ///< @brief Position of the option in the options
+} dbn_opra_snapshot_index_entry_t;
+
+
+/**
+ * @brief Opened snapshot. All pointers are into the mapped file.
+ */
+typedef struct
+{
+  void *base;                                   ///< @brief Start of the mapping
+  size_t size;                                  ///< @brief Size of the mapping, in bytes
+  const dbn_opra_snapshot_header_t *header;     ///< @brief Header
+  const dbn_opra_snapshot_root_t *roots;        ///< @brief Roots, sorted by root
+  const dbn_opra_snapshot_option_t *options;    ///< @brief Options, grouped by root
+  const dbn_opra_snapshot_index_entry_t *index; ///< @brief Index of options by instrument ID
+  size_t index_mask;                            ///< @brief Number of entries in index minus 1
+} dbn_opra_snapshot_t;
+
+
+/**
+ * @brief Write a snapshot of completed discovery to a file.
+ *
+ * The snapshot is written to a temporary file alongside the target, which
+ * then replaces the target, so readers never see a partial snapshot.
+ *
+ * @param discover Pointer to client wrapper object, in the DONE state.
+ * @param path Pointer to null-terminated path of the snapshot file.
+ * @param trading_date Trading date the discovery is valid for, as YYYYMMDD.
+ *
+ * @return 0 on success, or -1 on failure with errno set.
+ */
+extern int dbn_opra_snapshot_save(
+  const dbn_opra_discover_t *discover,
+  const char *path,
+  uint32_t trading_date);
+
+
+/**
+ * @brief Open and map a snapshot file.
+ *
+ * @param snapshot Pointer to snapshot object to populate.
+ * @param path Pointer to null-terminated path of the snapshot file.
+ * @param trading_date Required trading date, as YYYYMMDD, or 0 to accept any.
+ *
+ * @return 0 on success, or -1 on failure with errno set: EINVAL if the file
+ * is not a valid snapshot of this version and byte order, or ESTALE if it is
+ * for a different trading date.
+ */
+extern int dbn_opra_snapshot_open(
+  dbn_opra_snapshot_t *snapshot,
+  const char *path,
+  uint32_t trading_date);
+
+
+/**
+ * @brief Unmap a snapshot. Pointers into it are invalid afterwards.
+ *
+ * @param snapshot Pointer to opened snapshot object.
+ */
+extern void dbn_opra_snapshot_close(dbn_opra_snapshot_t *snapshot);
+
+
+/**
+ * @brief Find the option of an instrument.
+ *
+ * @param snapshot Pointer to opened snapshot object.
+ * @param instrument_id Databento instrument ID.
+ *
+ * @return Pointer to the option, or NULL if the instrument isn't an option
+ * in the snapshot.
+ */
+static inline const dbn_opra_snapshot_option_t *dbn_opra_snapshot_find(
+  const dbn_opra_snapshot_t *snapshot,
+  uint32_t instrument_id)
+{
+  if (instrument_id == DBN_OPRA_DISCOVER_NONE) return NULL;
+
+  size_t i = (instrument_id * 0x9E3779B1u) & snapshot->index_mask;
+  while (snapshot->index[i].instrument_id != DBN_OPRA_DISCOVER_NONE)
+  {
+    if (snapshot->index[i].instrument_id == instrument_id) return &snapshot->options[snapshot->index[i].option];
+    i = (i + 1) & snapshot->index_mask;
+  }
+  return NULL;
+}
@@ -15,39 +15,127 @@
 
 #include "osi.h"
 
+
+/**
+ * @brief Convert 8 ASCII digits to an integer.
+ *
+ * On little-endian hosts the digits are converted in a single 64-bit word:
+ * adjacent digits are combined into pairs, then pairs into quads, then quads
+ * into the result.
+ */
+static inline uint32_t parse_8_digits(const char *s)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  uint64_t v;
+  memcpy(&v, s, 8);
+  v -= 0x3030303030303030ull;
+  v = (v * 10) + (v >> 8);
+  v = (((v & 0x000000FF000000FFull) * (100 + (1000000ull << 32)))
+    + (((v >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+  return v;
+#else
+  uint32_t v = 0;
+  for (int i = 0; i < 8; i++)
+    v = 10 * v + (s[i] - '0');
+  return v;
+#endif
+}
+
+
+/**
+ * @brief Convert 2 ASCII digits to an integer.
+ */
+static inline uint8_t parse_2_digits(const char *s)
+{
+  return 10 * (s[0] - '0') + (s[1] - '0');
+}
+
+
 bool osi_parse(
   const char *symbol,
   osi_t *osi)
 {
-  if (strlen(symbol) != 21) return false;
+  /*
+   * Validate every character. The root is the leading non-space characters,
+   * and anything after its first space must also be a space. Stop early only
+   * at a null terminator, so as not to read past a short string.
+   */
+  int len = 0;
+  bool ok = true;
+  for (int i = 0; i < 6; i++)
+  {
+    char c = symbol[i];
+    if (!c) return false;
+    bool root = len == i && c > ' ' && c < 0x7F;
+    ok &= root | ((c == ' ') & (i > 0));
+    len += root;
+  }
 
-  osi->root[6] = 0;
-  memcpy(osi->root, symbol, 6);
-  for (int i = 0; i <= 6; i++)
+  for (int i = 6; i < 21; i++)
   {
-    if (osi->root[i] == ' ') osi->root[i] = 0;
+    char c = symbol[i];
+    if (!c) return false;
+    if (i == 12) ok &= (c == 'C') | (c == 'P');
+    else ok &= (unsigned char)(c - '0') < 10;
   }
 
-  char t[3];
-  t[2] = 0;
-  t[0] = symbol[6];
-  t[1] = symbol[7];
-  osi->exp_year = strtol(t, NULL, 10);
+  if (!ok || symbol[21]) return false;
 
-  t[0] = symbol[8];
-  t[1] = symbol[9];
-  osi->exp_month = strtol(t, NULL, 10);
+  uint8_t month = parse_2_digits(symbol + 8);
+  uint8_t day = parse_2_digits(symbol + 10);
+  if (month < 1 || month > 12 || day < 1 || day > 31) return false;
 
-  t[0] = symbol[10];
-  t[1] = symbol[11];
-  osi->exp_day = strtol(t, NULL, 10);
 
-  osi->is_call = symbol[12] == 'C' ? true : false;
+  /*
+   * Decode.
+   */
+  for (int i = 0; i < 7; i++)
+    osi->root[i] = i < len ? symbol[i] : 0;
+  osi->exp_year = parse_2_digits(symbol + 6);
+  osi->exp_month = month;
+  osi->exp_day = day;
+  osi->is_call = symbol[12] == 'C';
+  memset(osi->pad, 0, sizeof(osi->pad));
+  osi->strike = 1000000ull * parse_8_digits(symbol + 13);
 
-  char s[9];
-  s[8] = 0;
-  memcpy(s, symbol + 13, 8);
-  osi->strike = 1000000L * strtol(s, NULL, 10);
+  return true;
+}
+
+
+bool osi_format(
+  const osi_t *osi,
+  char *symbol)
+{
+  uint64_t strike = osi->strike / 1000000;
+  if (!osi->root[0]
+    || osi->exp_year > 99
+    || osi->exp_month < 1 || osi->exp_month > 12
+    || osi->exp_day < 1 || osi->exp_day > 31
+    || osi->strike % 1000000
+    || strike > 99999999) return false;
+
+  int len = 0;
+  while (len < 6 && osi->root[len])
+    len++;
+  if (len == 6 && osi->root[6]) return false;
+
+  for (int i = 0; i < 6; i++)
+    symbol[i] = i < len ? osi->root[i] : ' ';
+
+  symbol[6] = '0' + osi->exp_year / 10;
+  symbol[7] = '0' + osi->exp_year % 10;
+  symbol[8] = '0' + osi->exp_month / 10;
+  symbol[9] = '0' + osi->exp_month % 10;
+  symbol[10] = '0' + osi->exp_day / 10;
+  symbol[11] = '0' + osi->exp_day % 10;
+  symbol[12] = osi->is_call ? 'C' : 'P';
+
+  for (int i = 20; i >= 13; i--)
+  {
+    symbol[i] = '0' + strike % 10;
+    strike /= 10;
+  }
 
+  symbol[21] = 0;
   return true;
 }
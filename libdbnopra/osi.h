@@ -35,9 +35,33 @@ typedef struct __attribute__((packed))
 } osi_t;
 
 
+/**
+ * @brief Packed contract key bit layout, most significant first: root ID (20
+ * bits), expiration year (7), month (4), day (5), strike in thousandths of a
+ * dollar (27), and call (1). Keys sort by root ID, then expiration, then
+ * strike, then put before call.
+ */
+#define OSI_KEY_ROOT_SHIFT  44
+#define OSI_KEY_YEAR_SHIFT  37
+#define OSI_KEY_MONTH_SHIFT 33
+#define OSI_KEY_DAY_SHIFT   28
+#define OSI_KEY_STRIKE_SHIFT 1
+
+
+/**
+ * @brief Maximum root ID that fits in a packed contract key.
+ */
+#define OSI_KEY_MAX_ROOT_ID ((1u << 20) - 1)
+
+
 /**
  * @brief Parse an OCC (OSI) option contract symbol.
  *
+ * All 21 characters are validated in a single pass: the root must be 1 to 6
+ * printable characters, left-aligned and padded with spaces, the expiration
+ * and strike must be digits with a valid month and day, and the type must be
+ * 'C' or 'P'. No libc functions are called.
+ *
  * @param symbol Pointer to null-terminated OCC (OSI) option contract symbol. Must be exactly 21 ASCII characters plus null terminator.
  * @param osi Pointer where decoded symbol will be stored on success.
  *
@@ -46,3 +70,68 @@ typedef struct __attribute__((packed))
 extern bool osi_parse(
   const char *symbol,
   osi_t *osi);
+
+
+/**
+ * @brief Format an OCC (OSI) option contract symbol; the reverse of
+ * osi_parse().
+ *
+ * @param osi Pointer to decoded symbol.
+ * @param symbol Pointer to at least 22 bytes, where the null-terminated symbol will be stored on success.
+ *
+ * @return true on success, or false if the decoded symbol can't be represented
+ */
+extern bool osi_format(
+  const osi_t *osi,
+  char *symbol);
+
+
+/**
+ * @brief Pack a decoded symbol into a 64-bit contract key, for hashing and
+ * sorting contracts.
+ *
+ * @param osi Pointer to decoded symbol. Strikes are truncated to thousandths of a dollar.
+ * @param root_id Caller-assigned ID of the root (ex. its position in a sorted list of roots), at most OSI_KEY_MAX_ROOT_ID.
+ *
+ * @return Contract key.
+ */
+static inline uint64_t osi_key(
+  const osi_t *osi,
+  uint32_t root_id)
+{
+  return ((uint64_t)root_id << OSI_KEY_ROOT_SHIFT)
+    | ((uint64_t)(osi->exp_year & 0x7F) << OSI_KEY_YEAR_SHIFT)
+    | ((uint64_t)(osi->exp_month & 0xF) << OSI_KEY_MONTH_SHIFT)
+    | ((uint64_t)(osi->exp_day & 0x1F) << OSI_KEY_DAY_SHIFT)
+    | (((osi->strike / 1000000) & 0x7FFFFFF) << OSI_KEY_STRIKE_SHIFT)
+    | osi->is_call;
+}
+
+
+/**
+ * @brief Get the root ID of a contract key.
+ */
+static inline uint32_t osi_key_root_id(uint64_t key)
+{
+  return key >> OSI_KEY_ROOT_SHIFT;
+}
+
+
+/**
+ * @brief Unpack the expiration, strike, and type of a contract key. The root
+ * is set to an empty string; see osi_key_root_id().
+ *
+ * @param key Contract key.
+ * @param osi Pointer where decoded symbol will be stored.
+ */
+static inline void osi_key_unpack(
+  uint64_t key,
+  osi_t *osi)
+{
+  *osi = (osi_t){ 0 };
+  osi->exp_year = (key >> OSI_KEY_YEAR_SHIFT) & 0x7F;
+  osi->exp_month = (key >> OSI_KEY_MONTH_SHIFT) & 0xF;
+  osi->exp_day = (key >> OSI_KEY_DAY_SHIFT) & 0x1F;
+  osi->strike = 1000000 * ((key >> OSI_KEY_STRIKE_SHIFT) & 0x7FFFFFF);
+  osi->is_call = key & 1;
+}
@@ -0,0 +1,541 @@
+/**
+ * @file test_dbnopra.c
+ * @brief Tests for OSI symbols, snapshots and option chains
+ * @author Nathan Blythe
+ * @copyright Copyright 2025 Nathan Blythe
+ * @copyright Released under the Apache-2.0 license, see LICENSE
+ *
+ * Run with ctest. No connection to Databento is made: discovery results are
+ * filled in by hand.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "osi.h"
+#include "dbn_opra_discover.h"
+#include "dbn_opra_snapshot.h"
+#include "dbn_opra_chain.h"
+
+
+/**
+ * @brief Number of failed checks.
+ */
+static int num_failed = 0;
+
+
+/**
+ * @brief Check a condition, and print it with its location if it fails.
+ */
+#define CHECK(cond) \
+  do \
+  { \
+    if (!(cond)) \
+    { \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      num_failed++; \
+    } \
+  } while (0)
+
+
+/**
+ * @brief One dollar, in nanodollars.
+ */
+#define DOLLAR 1000000000ull
+
+
+/**
+ * @brief Parse a symbol, and check that it formats back unchanged.
+ */
+static void check_round_trip(const char *symbol, osi_t *osi)
+{
+  char formatted[22];
+  CHECK(osi_parse(symbol, osi));
+  CHECK(osi_format(osi, formatted));
+  CHECK(!strcmp(formatted, symbol));
+}
+
+
+static void test_osi_parse(void)
+{
+  osi_t osi;
+
+  check_round_trip("MSFT  250815C00100000", &osi);
+  CHECK(!strcmp(osi.root, "MSFT"));
+  CHECK(osi.exp_year == 25 && osi.exp_month == 8 && osi.exp_day == 15);
+  CHECK(osi.is_call);
+  CHECK(osi.strike == 100 * DOLLAR);
+
+  check_round_trip("SPY   261218P00450500", &osi);
+  CHECK(!strcmp(osi.root, "SPY"));
+  CHECK(!osi.is_call);
+  CHECK(osi.strike == 450500000000ull);
+
+  check_round_trip("F     270101C00000001", &osi);
+  CHECK(!strcmp(osi.root, "F"));
+  CHECK(osi.strike == 1000000);
+
+  check_round_trip("ABCDEF991231P99999999", &osi);
+  CHECK(!strcmp(osi.root, "ABCDEF"));
+  CHECK(osi.exp_year == 99 && osi.exp_month == 12 && osi.exp_day == 31);
+  CHECK(osi.strike == 99999999ull * 1000000);
+
+
+  /*
+   * Every digit position of the strike, so that a misplaced lane in the
+   * word-at-a-time conversion shows up.
+   */
+  check_round_trip("X     250101C12345678", &osi);
+  CHECK(osi.strike == 12345678ull * 1000000);
+  check_round_trip("X     250101C87654321", &osi);
+  CHECK(osi.strike == 87654321ull * 1000000);
+  check_round_trip("X     250101C90000009", &osi);
+  CHECK(osi.strike == 90000009ull * 1000000);
+  check_round_trip("X     250101C00000000", &osi);
+  CHECK(osi.strike == 0);
+}
+
+
+static void test_osi_reject(void)
+{
+  osi_t osi;
+  const char *bad[] =
+  {
+    "",
+    "TSLA250815C00100000",     // Root not padded
+    "MSFT  250815C0010000",    // Short
+    "MSFT  250815C001000000",  // Long
+    " MSFT 250815C00100000",   // Leading space
+    "MS FT 250815C00100000",   // Space inside root
+    "MSFT  250015C00100000",   // Month 0
+    "MSFT  251315C00100000",   // Month 13
+    "MSFT  250800C00100000",   // Day 0
+    "MSFT  250832C00100000",   // Day 32
+    "MSFT  250815X00100000",   // Type
+    "MSFT  250815c00100000",   // Lower case type
+    "MSFT  2508150C0100000",   // Type in the wrong place
+    "MSFT  25081AC00100000",   // Letter in expiration
+    "MSFT  250815C0010000A",   // Letter in strike
+    "MSFT  250815C0010000:",   // Just above '9'
+    "MSFT  250815C/0100000",   // Just below '0'
+    "MSFT  250815C 0100000",   // Space in strike
+    "MSF\x7F  250815C00100000", // Non-printable root
+  };
+
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+  {
+    if (osi_parse(bad[i], &osi))
+      fprintf(stderr, "accepted: \"%s\"\n", bad[i]);
+    CHECK(!osi_parse(bad[i], &osi));
+  }
+
+
+  /*
+   * Decoded symbols that no OSI symbol represents.
+   */
+  char symbol[22];
+  CHECK(osi_parse("MSFT  250815C00100000", &osi));
+
+  osi_t o = osi;
+  o.root[0] = 0;
+  CHECK(!osi_format(&o, symbol));
+
+  o = osi;
+  memcpy(o.root, "ABCDEFG", 7);
+  CHECK(!osi_format(&o, symbol));
+
+  o = osi;
+  o.strike += 1;
+  CHECK(!osi_format(&o, symbol));
+
+  o = osi;
+  o.strike = 100000000ull * 1000000;
+  CHECK(!osi_format(&o, symbol));
+
+  o = osi;
+  o.exp_month = 13;
+  CHECK(!osi_format(&o, symbol));
+
+  o = osi;
+  o.exp_day = 0;
+  CHECK(!osi_format(&o, symbol));
+}
+
+
+static void test_osi_key(void)
+{
+  /*
+   * Listed in the order their keys must sort: by root ID, then expiration,
+   * then strike, then put before call.
+   */
+  struct { const char *symbol; uint32_t root_id; } sorted[] =
+  {
+    { "ZZZ   250815P00100000", 0 },
+    { "ZZZ   250815C00100000", 0 },
+    { "ZZZ   250815P00100500", 0 },
+    { "ZZZ   250815P09999999", 0 },
+    { "ZZZ   250816P00000001", 0 },
+    { "ZZZ   250901C00000001", 0 },
+    { "ZZZ   260101P00000001", 0 },
+    { "AAA   250101P00000001", 1 },
+    { "AAA   250101P00000001", OSI_KEY_MAX_ROOT_ID },
+  };
+  size_t n = sizeof(sorted) / sizeof(sorted[0]);
+
+  uint64_t previous = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    osi_t osi;
+    CHECK(osi_parse(sorted[i].symbol, &osi));
+    uint64_t key = osi_key(&osi, sorted[i].root_id);
+    if (i) CHECK(key > previous);
+    previous = key;
+
+    CHECK(osi_key_root_id(key) == sorted[i].root_id);
+
+    osi_t unpacked;
+    osi_key_unpack(key, &unpacked);
+    CHECK(unpacked.root[0] == 0);
+    CHECK(unpacked.exp_year == osi.exp_year);
+    CHECK(unpacked.exp_month == osi.exp_month);
+    CHECK(unpacked.exp_day == osi.exp_day);
+    CHECK(unpacked.strike == osi.strike);
+    CHECK(unpacked.is_call == osi.is_call);
+  }
+}
+
+
+/**
+ * @brief Contracts of the hand-built discovery, grouped by root as discovery
+ * groups them, and deliberately out of key order within each root.
+ */
+static const struct
+{
+  int root;
+  const char *symbol;
+  uint32_t instrument_id;
+} contracts[] =
+{
+  { 0, "AAPL  250815C00110000", 1001 },
+  { 0, "AAPL  250815P00100000", 1002 },
+  { 0, "AAPL  250815C00090000", 1003 },
+  { 0, "AAPL  250815C00100000", 1004 },
+  { 0, "AAPL  250815P00090000", 1005 },
+  { 0, "AAPL  250815P00110000", 1006 },
+  { 0, "AAPL  250919C00100000", 1007 },
+  { 1, "MSFT  250815C00400000", 2001 },
+  { 1, "MSFT  250815P00400000", 2002 },
+};
+
+#define NUM_CONTRACTS (sizeof(contracts) / sizeof(contracts[0]))
+
+
+/**
+ * @brief Hand-built discovery results.
+ */
+typedef struct
+{
+  dbn_opra_discover_t discover;
+  dbn_opra_discover_root_t roots[2];
+  dbn_opra_discover_option_t options[NUM_CONTRACTS];
+  dbn_sdef_t sdef;
+} fixture_t;
+
+
+/**
+ * @brief Fill in discovery results as if discovery had completed. Only the
+ * first option has a security definition.
+ */
+static void build_fixture(fixture_t *f)
+{
+  memset(f, 0, sizeof(fixture_t));
+  f->roots[0].root = "AAPL";
+  f->roots[1].root = "MSFT";
+
+  for (size_t i = 0; i < NUM_CONTRACTS; i++)
+  {
+    CHECK(osi_parse(contracts[i].symbol, &f->options[i].symbol));
+    f->options[i].instrument_id = contracts[i].instrument_id;
+    dbn_opra_discover_root_t *root = &f->roots[contracts[i].root];
+    if (!root->num_options) root->options = &f->options[i];
+    root->num_options++;
+  }
+
+  f->sdef.hdr.publisher_id = 30;
+  f->sdef.expiration = 1755288000000000000ull;
+  f->sdef.activation = 1700000000000000000ull;
+  f->sdef.min_price_increment = 10000000;
+  f->sdef.strike_price = 110 * DOLLAR;
+  f->sdef.underlying_id = 77;
+  f->sdef.contract_multiplier = 100;
+  f->options[0].sdef = &f->sdef;
+
+  f->discover.state = DBN_OPRA_DISCOVER_STATE_DONE;
+  f->discover.num_roots = 2;
+  f->discover.roots = f->roots;
+  f->discover.options = f->options;
+  f->discover.num_options = NUM_CONTRACTS;
+}
+
+
+/**
+ * @brief Overwrite bytes of a file.
+ */
+static void patch_file(const char *path, off_t offset, const void *data, size_t n)
+{
+  int fd = open(path, O_WRONLY);
+  CHECK(fd >= 0);
+  CHECK(pwrite(fd, data, n, offset) == (ssize_t)n);
+  close(fd);
+}
+
+
+static void test_snapshot(const char *dir)
+{
+  static fixture_t f;
+  build_fixture(&f);
+
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/snapshot", dir);
+
+  dbn_opra_snapshot_t snapshot;
+
+
+  /*
+   * Save, open and find every option.
+   */
+  CHECK(!dbn_opra_snapshot_save(&f.discover, path, 20250815));
+  CHECK(!dbn_opra_snapshot_open(&snapshot, path, 20250815));
+  CHECK(snapshot.header->num_roots == 2);
+  CHECK(snapshot.header->num_options == NUM_CONTRACTS);
+  CHECK(!strcmp(snapshot.roots[0].root, "AAPL"));
+  CHECK(!strcmp(snapshot.roots[1].root, "MSFT"));
+  CHECK(snapshot.roots[1].first_option == 7 && snapshot.roots[1].num_options == 2);
+
+  for (size_t i = 0; i < NUM_CONTRACTS; i++)
+  {
+    const dbn_opra_snapshot_option_t *option = dbn_opra_snapshot_find(&snapshot, contracts[i].instrument_id);
+    CHECK(option);
+    if (!option) continue;
+    CHECK(option->instrument_id == contracts[i].instrument_id);
+    CHECK(option->root == (uint32_t)contracts[i].root);
+
+    char symbol[22];
+    CHECK(osi_format(&option->symbol, symbol));
+    CHECK(!strcmp(symbol, contracts[i].symbol));
+    CHECK(option->has_sdef == (i == 0));
+  }
+
+  const dbn_opra_snapshot_option_t *option = dbn_opra_snapshot_find(&snapshot, 1001);
+  CHECK(option->expiration == f.sdef.expiration);
+  CHECK(option->activation == f.sdef.activation);
+  CHECK(option->min_price_increment == f.sdef.min_price_increment);
+  CHECK(option->strike_price == f.sdef.strike_price);
+  CHECK(option->underlying_id == 77);
+  CHECK(option->contract_multiplier == 100);
+  CHECK(option->publisher_id == 30);
+
+  CHECK(!dbn_opra_snapshot_find(&snapshot, 1008));
+  CHECK(!dbn_opra_snapshot_find(&snapshot, DBN_OPRA_DISCOVER_NONE));
+  dbn_opra_snapshot_close(&snapshot);
+
+  CHECK(!dbn_opra_snapshot_open(&snapshot, path, 0));
+  dbn_opra_snapshot_close(&snapshot);
+
+
+  /*
+   * Validation.
+   */
+  errno = 0;
+  CHECK(dbn_opra_snapshot_open(&snapshot, path, 20250816) && errno == ESTALE);
+  CHECK(!snapshot.base);
+
+  char missing[4096];
+  snprintf(missing, sizeof(missing), "%s/missing", dir);
+  errno = 0;
+  CHECK(dbn_opra_snapshot_open(&snapshot, missing, 0) && errno == ENOENT);
+
+  f.discover.state = DBN_OPRA_DISCOVER_STATE_SUBSCRIBED;
+  errno = 0;
+  CHECK(dbn_opra_snapshot_save(&f.discover, path, 20250815) && errno == EINVAL);
+  f.discover.state = DBN_OPRA_DISCOVER_STATE_DONE;
+
+  CHECK(!dbn_opra_snapshot_open(&snapshot, path, 0));
+  uint64_t size = snapshot.header->size;
+  dbn_opra_snapshot_close(&snapshot);
+
+  CHECK(!truncate(path, size - 1));
+  errno = 0;
+  CHECK(dbn_opra_snapshot_open(&snapshot, path, 0) && errno == EINVAL);
+
+  CHECK(!truncate(path, sizeof(dbn_opra_snapshot_header_t) - 1));
+  errno = 0;
+  CHECK(dbn_opra_snapshot_open(&snapshot, path, 0) && errno == EINVAL);
+
+  CHECK(!dbn_opra_snapshot_save(&f.discover, path, 20250815));
+  patch_file(path, 0, "DBNOSNAQ", 8);
+  errno = 0;
+  CHECK(dbn_opra_snapshot_open(&snapshot, path, 0) && errno == EINVAL);
+
+  uint32_t version = DBN_OPRA_SNAPSHOT_VERSION + 1;
+  CHECK(!dbn_opra_snapshot_save(&f.discover, path, 20250815));
+  patch_file(path, offsetof(dbn_opra_snapshot_header_t, version), &version, sizeof(version));
+  errno = 0;
+  CHECK(dbn_opra_snapshot_open(&snapshot, path, 0) && errno == EINVAL);
+
+  uint32_t byte_order = 0x04030201;
+  CHECK(!dbn_opra_snapshot_save(&f.discover, path, 20250815));
+  patch_file(path, offsetof(dbn_opra_snapshot_header_t, byte_order), &byte_order, sizeof(byte_order));
+  errno = 0;
+  CHECK(dbn_opra_snapshot_open(&snapshot, path, 0) && errno == EINVAL);
+
+  uint64_t num_options = 1u << 20;
+  CHECK(!dbn_opra_snapshot_save(&f.discover, path, 20250815));
+  patch_file(path, offsetof(dbn_opra_snapshot_header_t, num_options), &num_options, sizeof(num_options));
+  errno = 0;
+  CHECK(dbn_opra_snapshot_open(&snapshot, path, 0) && errno == EINVAL);
+
+  unlink(path);
+}
+
+
+/**
+ * @brief Check the chain built from the hand-built discovery, however it was
+ * built.
+ */
+static void check_chain(const dbn_opra_chain_t *chain)
+{
+  CHECK(chain->num_roots == 2);
+  CHECK(chain->num_contracts == NUM_CONTRACTS);
+  CHECK(chain->num_expiries == 3);
+
+  for (size_t i = 1; i < chain->num_contracts; i++)
+    CHECK(chain->key[i - 1] < chain->key[i]);
+
+  const dbn_opra_chain_root_t *aapl = dbn_opra_chain_find_root(chain, "AAPL");
+  const dbn_opra_chain_root_t *msft = dbn_opra_chain_find_root(chain, "MSFT");
+  CHECK(aapl && msft);
+  CHECK(!dbn_opra_chain_find_root(chain, "AAP"));
+  CHECK(!dbn_opra_chain_find_root(chain, "ZZZZ"));
+  if (!aapl || !msft) return;
+  CHECK(aapl->num == 7 && aapl->num_expiries == 2);
+  CHECK(msft->num == 2 && msft->num_expiries == 1);
+
+
+  /*
+   * Find contracts.
+   */
+  uint16_t aug = dbn_opra_chain_expiry(25, 8, 15);
+  uint16_t sep = dbn_opra_chain_expiry(25, 9, 19);
+  size_t k = dbn_opra_chain_find(chain, aapl, aug, 100 * DOLLAR, true);
+  CHECK(k != DBN_OPRA_CHAIN_NONE && chain->instrument_id[k] == 1004);
+  k = dbn_opra_chain_find(chain, aapl, aug, 100 * DOLLAR, false);
+  CHECK(k != DBN_OPRA_CHAIN_NONE && chain->instrument_id[k] == 1002);
+  k = dbn_opra_chain_find(chain, aapl, sep, 100 * DOLLAR, true);
+  CHECK(k != DBN_OPRA_CHAIN_NONE && chain->instrument_id[k] == 1007);
+  k = dbn_opra_chain_find(chain, msft, aug, 400 * DOLLAR, false);
+  CHECK(k != DBN_OPRA_CHAIN_NONE && chain->instrument_id[k] == 2002);
+
+  CHECK(dbn_opra_chain_find(chain, aapl, sep, 100 * DOLLAR, false) == DBN_OPRA_CHAIN_NONE);
+  CHECK(dbn_opra_chain_find(chain, aapl, aug, 105 * DOLLAR, true) == DBN_OPRA_CHAIN_NONE);
+  CHECK(dbn_opra_chain_find(chain, aapl, aug, 100 * DOLLAR + 1, true) == DBN_OPRA_CHAIN_NONE);
+  CHECK(dbn_opra_chain_find(chain, msft, aug, 100 * DOLLAR, true) == DBN_OPRA_CHAIN_NONE);
+
+  const dbn_opra_chain_expiry_t *expiry = dbn_opra_chain_find_expiry(chain, aapl, aug);
+  CHECK(expiry && expiry->num == 6);
+  CHECK(!dbn_opra_chain_find_expiry(chain, aapl, dbn_opra_chain_expiry(25, 8, 16)));
+  CHECK(!dbn_opra_chain_find_expiry(chain, msft, sep));
+  if (!expiry) return;
+
+
+  /*
+   * Nearest strikes. At equal distance the higher strike comes first.
+   */
+  size_t positions[8];
+  size_t n = dbn_opra_chain_nearest(chain, expiry, 105 * DOLLAR, true, 3, positions);
+  CHECK(n == 3);
+  CHECK(chain->instrument_id[positions[0]] == 1001);
+  CHECK(chain->instrument_id[positions[1]] == 1004);
+  CHECK(chain->instrument_id[positions[2]] == 1003);
+
+  n = dbn_opra_chain_nearest(chain, expiry, 100 * DOLLAR, false, 8, positions);
+  CHECK(n == 3);
+  CHECK(chain->instrument_id[positions[0]] == 1002);
+  CHECK(chain->instrument_id[positions[1]] == 1006);
+  CHECK(chain->instrument_id[positions[2]] == 1005);
+
+  n = dbn_opra_chain_nearest(chain, expiry, 96 * DOLLAR, true, 2, positions);
+  CHECK(n == 2);
+  CHECK(chain->instrument_id[positions[0]] == 1004);
+  CHECK(chain->instrument_id[positions[1]] == 1003);
+
+  n = dbn_opra_chain_nearest(chain, expiry, 0, false, 1, positions);
+  CHECK(n == 1 && chain->instrument_id[positions[0]] == 1005);
+
+  n = dbn_opra_chain_nearest(chain, expiry, 1000 * DOLLAR, true, 1, positions);
+  CHECK(n == 1 && chain->instrument_id[positions[0]] == 1001);
+
+  CHECK(!dbn_opra_chain_nearest(chain, expiry, 100 * DOLLAR, true, 0, positions));
+}
+
+
+static void test_chain(const char *dir)
+{
+  static fixture_t f;
+  build_fixture(&f);
+
+  dbn_opra_chain_t chain;
+  CHECK(!dbn_opra_chain_build(&chain, &f.discover));
+  check_chain(&chain);
+  dbn_opra_chain_destroy(&chain);
+
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/chain", dir);
+  dbn_opra_snapshot_t snapshot;
+  CHECK(!dbn_opra_snapshot_save(&f.discover, path, 20250815));
+  CHECK(!dbn_opra_snapshot_open(&snapshot, path, 20250815));
+  CHECK(!dbn_opra_chain_build_snapshot(&chain, &snapshot));
+  check_chain(&chain);
+  dbn_opra_chain_destroy(&chain);
+  dbn_opra_snapshot_close(&snapshot);
+  unlink(path);
+
+  f.discover.state = DBN_OPRA_DISCOVER_STATE_ERROR;
+  errno = 0;
+  CHECK(dbn_opra_chain_build(&chain, &f.discover) && errno == EINVAL);
+}
+
+
+int main(int argc, char **argv)
+{
+  char dir[] = "/tmp/test_dbnopra.XXXXXX";
+  if (!mkdtemp(dir))
+  {
+    perror("mkdtemp");
+    return EXIT_FAILURE;
+  }
+
+  test_osi_parse();
+  test_osi_reject();
+  test_osi_key();
+  test_snapshot(dir);
+  test_chain(dir);
+
+  rmdir(dir);
+
+  if (num_failed)
+  {
+    fprintf(stderr, "%d check%s failed\n", num_failed, num_failed == 1 ? "" : "s");
+    return EXIT_FAILURE;
+  }
+
+  printf("All checks passed\n");
+  return EXIT_SUCCESS;
+}